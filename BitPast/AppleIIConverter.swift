@@ -2,6 +2,10 @@ import Cocoa
 
 class AppleIIConverter: RetroMachine {
     var name: String = "Apple II"
+
+    /// The temporary directory as a C string for b2d_options.directory,
+    /// made once and kept for every conversion
+    private static let nativeDirectory: UnsafeMutablePointer<CChar> = strdup(FileManager.default.temporaryDirectory.path)!
     
     var options: [ConversionOption] = [
         
@@ -92,18 +96,197 @@ class AppleIIConverter: RetroMachine {
     ]
     
     func convert(sourceImage: NSImage, withSettings settings: [ConversionOption]? = nil) async throws -> ConversionResult {
+        try await convert(sourceImage: sourceImage, withSettings: settings, draft: nil)
+    }
+
+    /// Converts as above in two steps. draft is called first with a quick
+    /// draft of the result - nearest colors only, no dithering - then full
+    /// with the full result, which is returned as well. Both are called on
+    /// the conversion thread. The draft is ready in a few milliseconds,
+    /// long before the full result is. Mono has no draft.
+    func convert(sourceImage: NSImage, withSettings settings: [ConversionOption]?,
+                 draft: ((NSImage) -> Void)?,
+                 full: ((ConversionResult) -> Void)? = nil) async throws -> ConversionResult {
+        guard let result = try await convert(sourceImage: sourceImage, settings: settings,
+                                             draft: draft, draftOnly: false) else { throw CancellationError() }
+        full?(result)
+        return result
+    }
+
+    /// Makes only the quick draft of the conversion and stops there, so it
+    /// can be made again on every change of a setting. nil for mono.
+    func draft(sourceImage: NSImage, withSettings settings: [ConversionOption]?) async throws -> NSImage? {
+        var image: NSImage?
+        _ = try await convert(sourceImage: sourceImage, settings: settings, draft: { image = $0 }, draftOnly: true)
+        return image
+    }
+
+    /// Converts, or stops after the draft if draftOnly is set and returns nil
+    private func convert(sourceImage: NSImage, settings: [ConversionOption]?,
+                         draft: ((NSImage) -> Void)?, draftOnly: Bool) async throws -> ConversionResult? {
         try validateSourceImage(sourceImage)
         // Use provided settings or fall back to instance options
-        let opts = settings ?? options
+        let input = try b2dInput(for: sourceImage, settings: settings ?? options)
+        let rgb = input.rgb
+        var b2dOptions = input.options
+        if draftOnly && b2dOptions.mode == B2D_MODE_MONO { return nil }
+        // Dither on every core - the output is the same as one thread
+        b2dOptions.threads = -1
+
+        let baseNameRaw = "bp_\(UUID().uuidString.prefix(8))"
+
+        // Call b2d conversion - everything stays in memory
+        var result = b2d_result()
+        defer { b2d_result_free(&result) }
+
+        // b2d draws the preview straight into this RGBA surface
+        let surfaceSize = Int(B2D_PREVIEW_MAXWIDTH) * Int(B2D_PREVIEW_MAXHEIGHT) * 4
+        let surface = UnsafeMutablePointer<UInt8>.allocate(capacity: surfaceSize)
+        defer { surface.deallocate() }
+        b2dOptions.previewrgba = surface
+        b2dOptions.previewsize = surfaceSize
+        b2dOptions.previewscale = 1
+
+        // Cancelling the task stops b2d at the next scanline, so a live
+        // preview that is no longer wanted does not keep a core busy
+        let cancelFlag = UnsafeMutablePointer<Int32>.allocate(capacity: 1)
+        cancelFlag.initialize(to: 0)
+        defer { cancelFlag.deallocate() }
+        b2dOptions.cancel = UnsafePointer(cancelFlag)
+
+        // the callback is a C function, so the closure goes in draftdata
+        let draftBox = draft.map { Unmanaged.passRetained(DraftPreview($0, last: draftOnly)) }
+        defer { draftBox?.release() }
+        if let draftBox = draftBox {
+            b2dOptions.draftdata = draftBox.toOpaque()
+            b2dOptions.draft = { userdata, rgba, width, height in
+                guard let userdata = userdata, let rgba = rgba else { return 0 }
+                let preview = Unmanaged<DraftPreview>.fromOpaque(userdata).takeUnretainedValue()
+                preview.show(rgba, Int(width), Int(height))
+                // non-zero stops b2d after the draft
+                return preview.last ? 1 : 0
+            }
+        }
+
+        let exitCode = await withTaskCancellationHandler {
+            baseNameRaw.withCString { namePtr -> Int32 in
+                b2dOptions.name = namePtr
+                return rgb.withUnsafeBufferPointer { rgbPtr in
+                    b2d_convert_rgb(rgbPtr.baseAddress, Int32(input.width), Int32(input.height), Int32(input.width * 3), &b2dOptions, &result)
+                }
+            }
+        } onCancel: {
+            b2d_cancel(cancelFlag)
+        }
+
+        if exitCode == B2D_CANCELLED {
+            if draftOnly && !Task.isCancelled { return nil }
+            throw CancellationError()
+        }
+        guard exitCode == 0 else { throw conversionError(exitCode) }
+        return try conversionResult(from: result)
+    }
+
+    /// Converts several images at once with b2d_convert_batch, which uses
+    /// every core. Each image uses its settings, or the instance options if
+    /// they are nil, as in convert(sourceImage:withSettings:). progress is
+    /// called on a conversion thread with the number of images done and
+    /// the total. The results are nil for images that could not be converted.
+    func convertBatch(_ images: [(image: NSImage, settings: [ConversionOption]?)],
+                      progress: @escaping (Int, Int) -> Void) async -> [ConversionResult?] {
+        var results = [ConversionResult?](repeating: nil, count: images.count)
+        guard let shared = try? b2dInput(for: nil, settings: options) else { return results }
+        var sharedOptions = shared.options
+
+        // b2d reads the pixels, settings and names while it converts, so
+        // each is copied somewhere that does not move
+        var jobs: [b2d_job] = []
+        var indices: [Int] = []
+        let jobOptions = UnsafeMutablePointer<b2d_options>.allocate(capacity: max(images.count, 1))
+        var buffers: [UnsafeMutablePointer<UInt8>] = []
+        var names: [UnsafeMutablePointer<CChar>] = []
+        defer {
+            jobOptions.deallocate()
+            buffers.forEach { $0.deallocate() }
+            names.forEach { free($0) }
+        }
+
+        for (index, item) in images.enumerated() {
+            guard (try? validateSourceImage(item.image)) != nil,
+                  let input = try? b2dInput(for: item.image, settings: item.settings ?? options) else { continue }
+            let buffer = UnsafeMutablePointer<UInt8>.allocate(capacity: input.rgb.count)
+            buffer.initialize(from: input.rgb, count: input.rgb.count)
+            buffers.append(buffer)
+            guard let name = strdup("bp_\(UUID().uuidString.prefix(8))") else { continue }
+            names.append(name)
+
+            var job = b2d_job()
+            job.rgb = UnsafePointer(buffer)
+            job.w = Int32(input.width)
+            job.h = Int32(input.height)
+            job.stride = Int32(input.width * 3)
+            job.name = UnsafePointer(name)
+            // images with their own settings override the shared ones
+            if item.settings != nil {
+                (jobOptions + jobs.count).initialize(to: input.options)
+                job.opts = UnsafePointer(jobOptions + jobs.count)
+            }
+            jobs.append(job)
+            indices.append(index)
+        }
 
-        let fileManager = FileManager.default
-        let tempDir = fileManager.temporaryDirectory
-        let uuid = UUID().uuidString.prefix(8)
+        // the callback is a C function, so the closure goes in userdata
+        let box = Unmanaged.passRetained(BatchProgress(progress))
+        defer { box.release() }
+        _ = b2d_convert_batch(&jobs, Int32(jobs.count), &sharedOptions, 0, { userdata, _, _, done, count in
+            guard let userdata = userdata else { return }
+            Unmanaged<BatchProgress>.fromOpaque(userdata).takeUnretainedValue().report(Int(done), Int(count))
+        }, box.toOpaque())
 
-        let baseNameRaw = "bp_\(uuid)"
-        let inputFilename = "\(baseNameRaw).bmp"
-        let inputUrl = tempDir.appendingPathComponent(inputFilename)
+        for (jobIndex, index) in indices.enumerated() {
+            if jobs[jobIndex].status == 0 {
+                results[index] = try? conversionResult(from: jobs[jobIndex].result)
+            }
+            b2d_result_free(&jobs[jobIndex].result)
+        }
+        return results
+    }
+
+    /// The progress closure for b2d_convert_batch
+    private final class BatchProgress {
+        let report: (Int, Int) -> Void
+        init(_ report: @escaping (Int, Int) -> Void) { self.report = report }
+    }
+
+    /// The draft closure for b2d_options.draft
+    private final class DraftPreview {
+        let show: (NSImage) -> Void
+        let last: Bool  // stop after the draft
+        init(_ show: @escaping (NSImage) -> Void, last: Bool) { self.show = show; self.last = last }
+
+        /// copies the draft b2d drew, the surface is drawn over next
+        func show(_ rgba: UnsafePointer<UInt8>, _ width: Int, _ height: Int) {
+            let colorSpace = CGColorSpace(name: CGColorSpace.sRGB)!
+            let bitmapInfo = CGImageAlphaInfo.premultipliedLast.rawValue | CGBitmapInfo.byteOrder32Big.rawValue
+            guard let ctx = CGContext(data: UnsafeMutableRawPointer(mutating: rgba), width: width, height: height,
+                                       bitsPerComponent: 8, bytesPerRow: width * 4,
+                                       space: colorSpace, bitmapInfo: bitmapInfo),
+                  let cgImage = ctx.makeImage() else { return }
+            show(NSImage(cgImage: cgImage, size: NSSize(width: width, height: height)))
+        }
+    }
 
+    /// The pixels and b2d settings for one image
+    private struct B2DInput {
+        let rgb: [UInt8]
+        let width: Int
+        let height: Int
+        let options: b2d_options
+    }
+
+    /// Maps the settings to b2d options and scales the image to the size
+    /// b2d expects. Without an image only the options are filled in.
+    private func b2dInput(for sourceImage: NSImage?, settings opts: [ConversionOption]) throws -> B2DInput {
         // --- CONFIG ---
         let mode = opts.first(where: {$0.key == "mode"})?.selectedValue ?? ""
         let resString = opts.first(where: {$0.key == "resolution"})?.selectedValue ?? ""
@@ -154,43 +337,63 @@ class AppleIIConverter: RetroMachine {
             else { targetW = 280; targetH = 192 }
         }
         
-        // --- SAVE BMP ---
-        let readyImage = sourceImage.fitToStandardSize(targetWidth: targetW, targetHeight: targetH)
-        try readyImage.saveAsStrict24BitBMP(to: inputUrl)
-        
-        // --- B2D ARGUMENTS ---
-        var args: [String] = [inputFilename]
-        
-        // Mode Flags - clear and explicit logic
+        // --- RGB PIXELS ---
+        var rgb: [UInt8] = []
+        var width = targetW
+        var height = targetH
+        if let sourceImage = sourceImage {
+            // b2d resamples the image to the target size itself, only
+            // images larger than it takes are scaled down here first
+            var readyImage = sourceImage
+            if let cgImage = sourceImage.cgImage(forProposedRect: nil, context: nil, hints: nil),
+               cgImage.width > 0x7fff || cgImage.height > 0x7fff {
+                readyImage = sourceImage.fitToStandardSize(targetWidth: targetW, targetHeight: targetH)
+            }
+            let pixels = try readyImage.packedRGBPixels()
+            rgb = pixels.rgb
+            width = pixels.width
+            height = pixels.height
+        }
+
+        // --- B2D OPTIONS ---
+        var b2dOptions = b2d_options()
+        b2d_options_init(&b2dOptions)
+        b2dOptions.fitwidth = Int32(targetW)
+        b2dOptions.fitheight = Int32(targetH)
+        // b2d writes the native files straight to the temporary directory
+        b2dOptions.sink = B2D_SINK_FILES
+        b2dOptions.directory = UnsafePointer(AppleIIConverter.nativeDirectory)
+
+        // Mode - clear and explicit logic
         if mode == "Mono" {
-            // Mono mode uses only MONO flag (HGR and MONO are mutually exclusive!)
-            args.append("MONO")
+            // Mono mode (HGR and MONO are mutually exclusive!)
+            b2dOptions.mode = B2D_MODE_MONO
         }
         else if mode.contains("HGR") && !mode.contains("DHGR") {
-            // HGR mode needs the HGR flag for color output (but not DHGR!)
-            args.append("HGR")
+            // HGR mode for color output (but not DHGR!)
+            b2dOptions.mode = B2D_MODE_HGR
         }
         else if mode.contains("DLGR") {
-            args.append("DL")
+            b2dOptions.mode = B2D_MODE_DLGR
         }
         else if mode.contains("LGR") && !mode.contains("DLGR") {
-            args.append("L")
+            b2dOptions.mode = B2D_MODE_LGR
         }
-        // DHGR mode (default) - no flags needed for color DHGR
-        
+        // DHGR mode (default)
+
         // --- DITHER MAPPING (matching b2d.c defines) ---
         let ditherName = opts.first(where: {$0.key == "dither"})?.selectedValue ?? ""
         switch ditherName {
-        case "None":           break  // No dither flag
-        case "Floyd-Steinberg": args.append("-D1")
-        case "Jarvis":          args.append("-D2")
-        case "Stucki":          args.append("-D3")
-        case "Atkinson":        args.append("-D4")
-        case "Burkes":          args.append("-D5")
-        case "Sierra":          args.append("-D6")
-        case "Sierra Two":      args.append("-D7")
-        case "Sierra Lite":     args.append("-D8")
-        case "Buckels":         args.append("-D9")
+        case "None":           break  // No dither
+        case "Floyd-Steinberg": b2dOptions.dither = 1
+        case "Jarvis":          b2dOptions.dither = 2
+        case "Stucki":          b2dOptions.dither = 3
+        case "Atkinson":        b2dOptions.dither = 4
+        case "Burkes":          b2dOptions.dither = 5
+        case "Sierra":          b2dOptions.dither = 6
+        case "Sierra Two":      b2dOptions.dither = 7
+        case "Sierra Lite":     b2dOptions.dither = 8
+        case "Buckels":         b2dOptions.dither = 9
         default: break
         }
 
@@ -200,142 +403,134 @@ class AppleIIConverter: RetroMachine {
             if let eStr = opts.first(where: {$0.key == "error_matrix"})?.selectedValue,
                let eVal = Double(eStr),
                eVal > 0 {
-                args.append("-E\(Int(eVal))")
+                // b2d has E2 and E4, any other value selects E2
+                b2dOptions.diffuse = Int(eVal) == 4 ? 4 : 2
             }
         }
 
         // --- PALETTE MAPPING (matching b2d.c palname[] indices) ---
         let palName = opts.first(where: {$0.key == "palette"})?.selectedValue ?? ""
 
-        // For Mono mode, DO NOT set any palette - palette flags can trigger HGR internally!
+        // Mono mode always uses a black and white palette
         if mode != "Mono" {
             switch palName {
-            case "Kegs32 RGB":           args.append("-P0")
-            case "CiderPress RGB":       args.append("-P1")
-            case "AppleWin Old NTSC":    args.append("-P2")
-            case "AppleWin New NTSC":    args.append("-P3")
-            case "Wikipedia NTSC":       args.append("-P4")
-            case "tohgr NTSC (Default)": args.append("-P5")
-            case "Super Convert RGB":    args.append("-P12")
-            case "Jace NTSC":            args.append("-P13")
-            case "Cybernesto NTSC":      args.append("-P14")
-            case "tohgr NTSC HGR":       args.append("-P16")
-            default:                     args.append("-P5")  // Fallback to tohgr
+            case "Kegs32 RGB":           b2dOptions.palette = 0
+            case "CiderPress RGB":       b2dOptions.palette = 1
+            case "AppleWin Old NTSC":    b2dOptions.palette = 2
+            case "AppleWin New NTSC":    b2dOptions.palette = 3
+            case "Wikipedia NTSC":       b2dOptions.palette = 4
+            case "tohgr NTSC (Default)": b2dOptions.palette = 5
+            case "Super Convert RGB":    b2dOptions.palette = 12
+            case "Jace NTSC":            b2dOptions.palette = 13
+            case "Cybernesto NTSC":      b2dOptions.palette = 14
+            case "tohgr NTSC HGR":       b2dOptions.palette = 16
+            default:                     b2dOptions.palette = 5  // Fallback to tohgr
             }
         }
 
         // --- SLIDERS (X, Z) ---
         if let valStr = opts.first(where: {$0.key == "crosshatch"})?.selectedValue, let val = Double(valStr), val > 0 {
-            args.append("-X\(Int(val))")
+            b2dOptions.xmatrix = Int32(val)
         }
         if let valStr = opts.first(where: {$0.key == "z_threshold"})?.selectedValue, let val = Double(valStr), val > 0 {
-            args.append("-Z\(Int(val))")
+            b2dOptions.threshold = Int32(val)
         }
-        
-        args.append("-V") // Preview
 
-        // Switch to temp directory (b2d expects this)
-        let originalDir = fileManager.currentDirectoryPath
-        fileManager.changeCurrentDirectoryPath(tempDir.path)
-        
-        // Build argv array for C
-        var cArgs: [UnsafeMutablePointer<CChar>?] = []
-        cArgs.append(strdup("b2d")) // argv[0] = program name
+        b2dOptions.preview = 1
+        // Keep closest colors between conversions - the same image is
+        // converted again every time a setting changes
+        b2dOptions.colortable = 1
+        // and the resampled image and its colors, so a new preview palette
+        // only draws the preview again
+        b2dOptions.cache = 1
+
+        return B2DInput(rgb: rgb, width: width, height: height, options: b2dOptions)
+    }
 
-        for arg in args {
-            cArgs.append(strdup(arg))
+    private func conversionError(_ exitCode: Int32) -> NSError {
+        let errorMsg: String
+        if exitCode == 1 {
+            errorMsg = "b2d rejected the image (wrong format). The image may have invalid dimensions or unsupported format."
+        } else {
+            errorMsg = "b2d conversion failed with code \(exitCode)"
         }
-        cArgs.append(nil) // argv must end with NULL
+        return NSError(domain: "BitPast", code: Int(exitCode),
+                       userInfo: [NSLocalizedDescriptionKey: errorMsg])
+    }
 
-        // Call b2d conversion
-        let exitCode = b2d_main_wrapper(Int32(cArgs.count - 1), &cArgs)
+    /// Copies RGBA pixels, top scanline first, into an image
+    private func previewCGImage(_ pixels: UnsafeMutablePointer<UInt8>, width: Int, height: Int) throws -> CGImage {
+        let colorSpace = CGColorSpace(name: CGColorSpace.sRGB)!
+        let bitmapInfo = CGImageAlphaInfo.premultipliedLast.rawValue | CGBitmapInfo.byteOrder32Big.rawValue
 
-        // Return to original directory
-        fileManager.changeCurrentDirectoryPath(originalDir)
-        
-        // Cleanup
-        for ptr in cArgs where ptr != nil {
-            free(ptr)
+        guard let ctx = CGContext(data: pixels, width: width, height: height,
+                                   bitsPerComponent: 8, bytesPerRow: width * 4,
+                                   space: colorSpace, bitmapInfo: bitmapInfo),
+              let cgImage = ctx.makeImage() else {
+            throw NSError(domain: "BitPast", code: 500, userInfo: [NSLocalizedDescriptionKey: "Failed to create preview image"])
         }
-        
-        guard exitCode == 0 else {
-            // Clean up the failed input file
-            try? fileManager.removeItem(at: inputUrl)
-            
-            let errorMsg: String
-            if exitCode == 1 {
-                errorMsg = "b2d rejected the BMP file (wrong format). The image may have invalid dimensions or unsupported format."
-            } else {
-                errorMsg = "b2d conversion failed with code \(exitCode)"
+        return cgImage
+    }
+
+    /// Makes the preview image and lists the native files b2d wrote to the temporary directory
+    private func conversionResult(from result: b2d_result) throws -> ConversionResult {
+        let previewWidth = Int(result.previewwidth)
+        let previewHeight = Int(result.previewheight)
+        let cgImage: CGImage
+
+        if let previewRGBA = result.previewrgba {
+            // already RGBA, drawn by b2d
+            cgImage = try previewCGImage(previewRGBA, width: previewWidth, height: previewHeight)
+        } else if let previewRGB = result.preview {
+            // packed RGB from a batch conversion
+            var previewBytes = [UInt8](repeating: 255, count: previewWidth * previewHeight * 4)
+            for i in 0..<(previewWidth * previewHeight) {
+                previewBytes[i * 4] = previewRGB[i * 3]
+                previewBytes[i * 4 + 1] = previewRGB[i * 3 + 1]
+                previewBytes[i * 4 + 2] = previewRGB[i * 3 + 2]
             }
-            
-            throw NSError(domain: "BitPast", code: Int(exitCode),
-                         userInfo: [NSLocalizedDescriptionKey: errorMsg])
-        }
-        
-        // Find output files
-        let allFiles = try fileManager.contentsOfDirectory(at: tempDir, includingPropertiesForKeys: nil)
-
-        let previewFile = allFiles.first { file in
-            let name = file.lastPathComponent
-            return name.localizedCaseInsensitiveContains(baseNameRaw) &&
-            name != inputFilename &&
-            name.lowercased().hasSuffix(".bmp")
+            cgImage = try previewBytes.withUnsafeMutableBufferPointer {
+                try previewCGImage($0.baseAddress!, width: previewWidth, height: previewHeight)
+            }
+        } else {
+            throw NSError(domain: "BitPast", code: 500, userInfo: [NSLocalizedDescriptionKey: "Conversion failed. No preview."])
         }
 
-        let assets = allFiles.filter { file in
-            let name = file.lastPathComponent
-            return name.localizedCaseInsensitiveContains(baseNameRaw) &&
-            file.pathExtension.lowercased() != "bmp"
-        }
-        
-        if let outputUrl = previewFile, let img = NSImage(contentsOf: outputUrl) {
-            try? fileManager.removeItem(at: inputUrl)
-            return ConversionResult(previewImage: img, fileAssets: assets)
+        let previewImage = NSImage(cgImage: cgImage, size: NSSize(width: previewWidth, height: previewHeight))
+
+        // Native files
+        let tempDir = FileManager.default.temporaryDirectory
+        var assets: [URL] = []
+        for i in 0..<Int(result.filecount) {
+            guard let file = result.files?[i], let name = file.name else { continue }
+            assets.append(tempDir.appendingPathComponent(String(cString: name)))
         }
-        
-        throw NSError(domain: "BitPast", code: 500, userInfo: [NSLocalizedDescriptionKey: "Conversion failed. No preview. Exit code: \(exitCode)"])
+
+        return ConversionResult(previewImage: previewImage, fileAssets: assets)
     }
 }
 
 extension NSImage {
-    func saveAsStrict24BitBMP(to url: URL) throws {
-        let width = Int(self.size.width)
-        let height = Int(self.size.height)
+    /// The pixels at the image's own pixel size, transparency on black
+    func packedRGBPixels() throws -> (rgb: [UInt8], width: Int, height: Int) {
         guard let cgImage = self.cgImage(forProposedRect: nil, context: nil, hints: nil) else {
             throw NSError(domain: "BMPError", code: 1, userInfo: [NSLocalizedDescriptionKey: "No CGImage"])
         }
+        let width = cgImage.width
+        let height = cgImage.height
         let colorSpace = CGColorSpace(name: CGColorSpace.sRGB)!
         let bytesPerRow = width * 4
         var rawData = [UInt8](repeating: 0, count: height * bytesPerRow)
         let context = CGContext(data: &rawData, width: width, height: height, bitsPerComponent: 8, bytesPerRow: bytesPerRow, space: colorSpace, bitmapInfo: CGImageAlphaInfo.premultipliedLast.rawValue | CGBitmapInfo.byteOrder32Big.rawValue)
         context?.draw(cgImage, in: CGRect(x: 0, y: 0, width: width, height: height))
-        
-        let rowSize = ((width * 3) + 3) & ~3
-        let fileSize = 54 + (rowSize * height)
-        var bmpData = Data(); bmpData.reserveCapacity(fileSize)
-        
-        bmpData.append(contentsOf: [0x42, 0x4D])
-        bmpData.append(contentsOf: uInt32ToBytes(UInt32(fileSize)))
-        bmpData.append(contentsOf: [0, 0, 0, 0])
-        bmpData.append(contentsOf: uInt32ToBytes(54))
-        bmpData.append(contentsOf: uInt32ToBytes(40))
-        bmpData.append(contentsOf: uInt32ToBytes(UInt32(width)))
-        bmpData.append(contentsOf: uInt32ToBytes(UInt32(height)))
-        bmpData.append(contentsOf: [1, 0, 24, 0, 0, 0, 0, 0])
-        bmpData.append(contentsOf: uInt32ToBytes(UInt32(rowSize * height)))
-        bmpData.append(contentsOf: [0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0])
-        
-        let paddingBytes = [UInt8](repeating: 0, count: rowSize - (width * 3))
-        for y in (0..<height).reversed() {
-            let rowStart = y * bytesPerRow
-            for x in 0..<width {
-                let i = rowStart + (x * 4)
-                bmpData.append(contentsOf: [rawData[i+2], rawData[i+1], rawData[i]])
-            }
-            bmpData.append(contentsOf: paddingBytes)
+
+        // top scanline first, as b2d_convert_rgb expects
+        var rgb = [UInt8](repeating: 0, count: width * height * 3)
+        for i in 0..<(width * height) {
+            rgb[i * 3] = rawData[i * 4]
+            rgb[i * 3 + 1] = rawData[i * 4 + 1]
+            rgb[i * 3 + 2] = rawData[i * 4 + 2]
         }
-        try bmpData.write(to: url)
+        return (rgb, width, height)
     }
-    private func uInt32ToBytes(_ val: UInt32) -> [UInt8] { var v = val; return withUnsafeBytes(of: &v) { Array($0) } }
 }
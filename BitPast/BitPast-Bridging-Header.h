@@ -8,7 +8,7 @@
 #ifndef BitPast_Bridging_Header_h
 #define BitPast_Bridging_Header_h
 
-// Declare the wrapper function that calls the b2d main function
-int b2d_main_wrapper(int argc, char** argv);
+// b2d conversion entry points: b2d_main_wrapper and the in-memory b2d_convert_rgb
+#include "b2d_api.h"
 
 #endif /* BitPast_Bridging_Header_h */
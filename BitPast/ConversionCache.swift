@@ -0,0 +1,320 @@
+//
+//  ConversionCache.swift
+//  BitPast
+//
+//  Converted images kept on disk between batch exports
+//
+
+import Cocoa
+import CryptoKit
+
+/// Keeps the native files and preview of every image a batch export
+/// converts, so exporting the same images again with the same settings -
+/// to another disk format, say - only hashes each image and copies its
+/// files.
+///
+/// An entry is found by a SHA-256 of the source pixels, the machine and
+/// every conversion option, and lives in its own directory under
+/// ~/Library/Caches/BitPast/Conversions. The index there is a flat file of
+/// fixed-size records (key, size on disk, last used) that is memory mapped
+/// when it is read. A hit updates its record in place, a new entry is
+/// appended, and once the entries take more than `maxBytes` the least
+/// recently used are removed and the index is written again. The index
+/// header has the app's version and build, and another build starts the
+/// cache again - an update can change what a conversion makes.
+///
+/// Results from the cache have no palettes or pixel indices - only the
+/// batch exports, which do not use them, go through it.
+final class ConversionCache {
+    static let shared = ConversionCache()
+
+    /// The cache is trimmed to this many bytes, least recently used first
+    var maxBytes: UInt64 = 512 * 1024 * 1024
+
+    private static let magic: UInt32 = 0x49435042   // "BPCI"
+    private static let version: UInt32 = 2
+    private static let headerSize = 16              // magic, version, build
+    private static let recordSize = 48              // key, bytes, last used
+
+    /// The app's version and build, hashed
+    private static let build: UInt64 = {
+        let info = Bundle.main.infoDictionary
+        let text = "\(info?["CFBundleShortVersionString"] ?? "") (\(info?["CFBundleVersion"] ?? ""))"
+        return Data(SHA256.hash(data: Data(text.utf8))).withUnsafeBytes { $0.loadUnaligned(as: UInt64.self) }
+    }()
+
+    private struct Record {
+        var key: Data
+        var bytes: UInt64
+        var lastUsed: Double
+    }
+
+    /// What an entry's directory holds besides the preview and native files
+    private struct Manifest: Codable {
+        let previewWidth: Double
+        let previewHeight: Double
+        let files: [String]
+    }
+
+    private let directory: URL
+    private let indexURL: URL
+    private let lock = NSLock()
+    private var records: [Record] = []
+    private var slots: [Data: Int] = [:]
+
+    private init() {
+        let caches = FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask)[0]
+        directory = caches.appendingPathComponent("BitPast/Conversions", isDirectory: true)
+        indexURL = directory.appendingPathComponent("index")
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        loadIndex()
+    }
+
+    // MARK: - Keys
+
+    /// The key for converting image with options on machine, nil if the
+    /// image has no pixels to hash
+    static func key(for image: NSImage, machine: String, options: [ConversionOption]) -> Data? {
+        guard let cgImage = image.cgImage(forProposedRect: nil, context: nil, hints: nil),
+              let pixels = cgImage.dataProvider?.data else { return nil }
+
+        var hasher = SHA256()
+        func add(_ text: String) { hasher.update(data: Data((text + "\u{0}").utf8)) }
+
+        add(machine)
+        for option in options.sorted(by: { $0.key < $1.key }) {
+            add("\(option.key)=\(option.selectedValue)")
+        }
+        // the pixels as they are stored, with what it takes to read them
+        add("\(cgImage.width)x\(cgImage.height) \(cgImage.bitsPerPixel) \(cgImage.bytesPerRow) \(cgImage.bitmapInfo.rawValue)")
+        if let bytes = CFDataGetBytePtr(pixels) {
+            hasher.update(bufferPointer: UnsafeRawBufferPointer(start: bytes, count: CFDataGetLength(pixels)))
+        }
+        return Data(hasher.finalize())
+    }
+
+    // MARK: - Lookup and Storage
+
+    /// The result stored for key. Its native files are copied to the
+    /// temporary directory, as a conversion leaves them. The lock is only
+    /// held to look the entry up and update it, not while it is copied.
+    func result(for key: Data) -> ConversionResult? {
+        lock.lock()
+        let found = slots[key] != nil
+        lock.unlock()
+        guard found else { return nil }
+
+        let entry = entryDirectory(key)
+        guard let manifestData = try? Data(contentsOf: entry.appendingPathComponent("manifest.json")),
+              let manifest = try? JSONDecoder().decode(Manifest.self, from: manifestData),
+              let previewImage = NSImage(contentsOf: entry.appendingPathComponent("preview.png")) else {
+            // the entry was removed from under the index
+            forget(key)
+            return nil
+        }
+        previewImage.size = NSSize(width: manifest.previewWidth, height: manifest.previewHeight)
+
+        let output = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString, isDirectory: true)
+        var assets: [URL] = []
+        do {
+            try FileManager.default.createDirectory(at: output, withIntermediateDirectories: true)
+            for name in manifest.files {
+                let asset = output.appendingPathComponent(name)
+                try FileManager.default.copyItem(at: entry.appendingPathComponent("files").appendingPathComponent(name), to: asset)
+                assets.append(asset)
+            }
+        } catch {
+            // the entry is not all there
+            try? FileManager.default.removeItem(at: output)
+            forget(key)
+            return nil
+        }
+
+        lock.lock()
+        defer { lock.unlock() }
+        if let slot = slots[key] {
+            records[slot].lastUsed = Date().timeIntervalSinceReferenceDate
+            writeRecord(slot)
+        }
+        return ConversionResult(previewImage: previewImage, fileAssets: assets)
+    }
+
+    /// Keeps the preview and native files of result under key. They are
+    /// copied to a new directory without the lock, which is then only
+    /// held to move it into place and add its record.
+    func store(_ result: ConversionResult, for key: Data) {
+        guard let tiffData = result.previewImage.tiffRepresentation,
+              let bitmap = NSBitmapImageRep(data: tiffData),
+              let pngData = bitmap.representation(using: .png, properties: [:]) else { return }
+
+        lock.lock()
+        let found = slots[key] != nil
+        lock.unlock()
+        if found { return }
+
+        let staging = directory.appendingPathComponent("new-\(UUID().uuidString)", isDirectory: true)
+        let files = staging.appendingPathComponent("files", isDirectory: true)
+        let manifest = Manifest(previewWidth: Double(result.previewImage.size.width),
+                                previewHeight: Double(result.previewImage.size.height),
+                                files: result.fileAssets.map { $0.lastPathComponent })
+        var bytes = UInt64(pngData.count)
+        do {
+            try FileManager.default.createDirectory(at: files, withIntermediateDirectories: true)
+            for asset in result.fileAssets {
+                try FileManager.default.copyItem(at: asset, to: files.appendingPathComponent(asset.lastPathComponent))
+                let size = (try? FileManager.default.attributesOfItem(atPath: asset.path)[.size] as? NSNumber)?.uint64Value
+                bytes += size ?? 0
+            }
+            try pngData.write(to: staging.appendingPathComponent("preview.png"))
+            try JSONEncoder().encode(manifest).write(to: staging.appendingPathComponent("manifest.json"))
+        } catch {
+            try? FileManager.default.removeItem(at: staging)
+            return
+        }
+
+        lock.lock()
+        defer { lock.unlock() }
+        // another thread stored the same key meanwhile
+        if slots[key] != nil {
+            try? FileManager.default.removeItem(at: staging)
+            return
+        }
+        let entry = entryDirectory(key)
+        do {
+            try? FileManager.default.removeItem(at: entry)
+            try FileManager.default.moveItem(at: staging, to: entry)
+        } catch {
+            try? FileManager.default.removeItem(at: staging)
+            return
+        }
+
+        records.append(Record(key: key, bytes: bytes, lastUsed: Date().timeIntervalSinceReferenceDate))
+        slots[key] = records.count - 1
+        if trim() {
+            writeIndex()
+        } else {
+            writeRecord(records.count - 1)
+        }
+    }
+
+    /// Removes every entry
+    func clear() {
+        lock.lock()
+        defer { lock.unlock() }
+        try? FileManager.default.removeItem(at: directory)
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        records = []
+        slots = [:]
+    }
+
+    // MARK: - Entries
+
+    private func entryDirectory(_ key: Data) -> URL {
+        let name = key.map { String(format: "%02x", $0) }.joined()
+        return directory.appendingPathComponent(name, isDirectory: true)
+    }
+
+    /// Removes the least recently used entries until the rest fit in
+    /// maxBytes, true if any were removed
+    private func trim() -> Bool {
+        var total = records.reduce(UInt64(0)) { $0 + $1.bytes }
+        guard total > maxBytes else { return false }
+
+        var victims = Set<Data>()
+        for record in records.sorted(by: { $0.lastUsed < $1.lastUsed }) where total > maxBytes {
+            total -= record.bytes
+            victims.insert(record.key)
+        }
+        remove(victims)
+        return true
+    }
+
+    /// Removes entries and their records - the index has to be written again
+    private func remove(_ keys: Set<Data>) {
+        for key in keys { try? FileManager.default.removeItem(at: entryDirectory(key)) }
+        records.removeAll { keys.contains($0.key) }
+        slots = Dictionary(uniqueKeysWithValues: records.enumerated().map { ($1.key, $0) })
+    }
+
+    /// Removes an entry that is missing or broken on disk, if it is still there
+    private func forget(_ key: Data) {
+        lock.lock()
+        defer { lock.unlock() }
+        guard slots[key] != nil else { return }
+        remove([key])
+        writeIndex()
+    }
+
+    // MARK: - Index
+
+    private func loadIndex() {
+        guard let index = try? Data(contentsOf: indexURL, options: .alwaysMapped) else { return }
+
+        let recordSize = ConversionCache.recordSize
+        let valid = index.count >= ConversionCache.headerSize && index.withUnsafeBytes { raw -> Bool in
+            raw.loadUnaligned(fromByteOffset: 0, as: UInt32.self).littleEndian == ConversionCache.magic &&
+            raw.loadUnaligned(fromByteOffset: 4, as: UInt32.self).littleEndian == ConversionCache.version &&
+            raw.loadUnaligned(fromByteOffset: 8, as: UInt64.self).littleEndian == ConversionCache.build
+        }
+        guard valid else {
+            // another version or build, start again
+            clear()
+            return
+        }
+
+        // the slots have to match the records in the file for writeRecord(),
+        // so the index is written again if any record is left out
+        let complete = index.withUnsafeBytes { raw -> Bool in
+            var complete = true
+            var offset = ConversionCache.headerSize
+            while offset + recordSize <= raw.count {
+                let key = Data(raw[offset..<offset + 32])
+                let bytes = raw.loadUnaligned(fromByteOffset: offset + 32, as: UInt64.self).littleEndian
+                let lastUsed = Double(bitPattern: raw.loadUnaligned(fromByteOffset: offset + 40, as: UInt64.self).littleEndian)
+                if slots[key] == nil {
+                    records.append(Record(key: key, bytes: bytes, lastUsed: lastUsed))
+                    slots[key] = records.count - 1
+                } else {
+                    complete = false
+                }
+                offset += recordSize
+            }
+            // a record cut short
+            return complete && offset == raw.count
+        }
+        if !complete { writeIndex() }
+    }
+
+    private func recordData(_ record: Record) -> Data {
+        var data = record.key
+        withUnsafeBytes(of: record.bytes.littleEndian) { data.append(contentsOf: $0) }
+        withUnsafeBytes(of: record.lastUsed.bitPattern.littleEndian) { data.append(contentsOf: $0) }
+        return data
+    }
+
+    private func writeIndex() {
+        var index = Data()
+        withUnsafeBytes(of: ConversionCache.magic.littleEndian) { index.append(contentsOf: $0) }
+        withUnsafeBytes(of: ConversionCache.version.littleEndian) { index.append(contentsOf: $0) }
+        withUnsafeBytes(of: ConversionCache.build.littleEndian) { index.append(contentsOf: $0) }
+        for record in records { index.append(recordData(record)) }
+        try? index.write(to: indexURL, options: .atomic)
+    }
+
+    /// Writes one record in place - a hit only changes its own, and a new
+    /// entry's goes on the end
+    private func writeRecord(_ slot: Int) {
+        guard let handle = try? FileHandle(forWritingTo: indexURL) else {
+            writeIndex()
+            return
+        }
+        defer { try? handle.close() }
+        let offset = UInt64(ConversionCache.headerSize + slot * ConversionCache.recordSize)
+        do {
+            try handle.seek(toOffset: offset)
+            try handle.write(contentsOf: recordData(records[slot]))
+        } catch {
+            writeIndex()
+        }
+    }
+}
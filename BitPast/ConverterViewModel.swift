@@ -97,9 +97,13 @@ class ConverterViewModel: ObservableObject {
         }
     
     private var previewTask: Task<Void, Never>?
+    private var draftTask: Task<Void, Never>?
     private var conversionGeneration: Int = 0
 
-    var convertedImage: NSImage? { currentResult?.previewImage }
+    /// A quick draft of the conversion that is under way, shown until its result is ready
+    @Published var draftImage: NSImage?
+
+    var convertedImage: NSImage? { draftImage ?? currentResult?.previewImage }
     var currentOriginalImage: NSImage? {
         guard let id = selectedImageId, let item = inputImages.first(where: { $0.id == id }) else { return nil }
         return item.image
@@ -172,6 +176,7 @@ class ConverterViewModel: ObservableObject {
         } else {
             selectedImageId = nil
             currentResult = nil
+            draftImage = nil
         }
     }
 
@@ -253,7 +258,7 @@ class ConverterViewModel: ObservableObject {
                     // Convert the image using per-image settings if locked, otherwise use global settings
                     let settingsToUse = (imageItem.lockedSettings != nil && imageItem.lockedMachineIndex == self.selectedMachineIndex)
                         ? imageItem.lockedSettings : nil
-                    let result = try await currentMachine.convert(sourceImage: imageItem.image, withSettings: settingsToUse)
+                    let result = try await batchConvert(imageItem, withSettings: settingsToUse)
 
                     // Copy native file to export folder
                     if let sourceURL = result.fileAssets.first {
@@ -319,7 +324,7 @@ class ConverterViewModel: ObservableObject {
                     // Convert the image using per-image settings if locked, otherwise use global settings
                     let settingsToUse = (imageItem.lockedSettings != nil && imageItem.lockedMachineIndex == self.selectedMachineIndex)
                         ? imageItem.lockedSettings : nil
-                    let result = try await currentMachine.convert(sourceImage: imageItem.image, withSettings: settingsToUse)
+                    let result = try await batchConvert(imageItem, withSettings: settingsToUse)
 
                     // Save as specified image format
                     let baseName = (imageItem.name as NSString).deletingPathExtension
@@ -392,7 +397,7 @@ class ConverterViewModel: ObservableObject {
                     // Convert the image using per-image settings if locked, otherwise use global settings
                     let settingsToUse = (imageItem.lockedSettings != nil && imageItem.lockedMachineIndex == self.selectedMachineIndex)
                         ? imageItem.lockedSettings : nil
-                    let result = try await currentMachine.convert(sourceImage: imageItem.image, withSettings: settingsToUse)
+                    let result = try await batchConvert(imageItem, withSettings: settingsToUse)
 
                     // Copy native file to export folder
                     if let sourceURL = result.fileAssets.first {
@@ -572,6 +577,7 @@ class ConverterViewModel: ObservableObject {
             } else {
                 selectedImageId = nil
                 currentResult = nil
+                draftImage = nil
             }
         }
     }
@@ -581,23 +587,45 @@ class ConverterViewModel: ObservableObject {
     func triggerLivePreview() {
         guard currentOriginalImage != nil else { return }
         previewTask?.cancel()
+        draftTask?.cancel()
         conversionGeneration += 1
         let expectedGeneration = conversionGeneration
+        // Apple II shows a draft of every change at once, the full
+        // conversion waits until the settings stop changing
+        if currentMachine is AppleIIConverter {
+            draftTask = Task { await performDraft(generation: expectedGeneration) }
+        }
         previewTask = Task {
             try? await Task.sleep(nanoseconds: 300 * 1_000_000)
             if Task.isCancelled || expectedGeneration != conversionGeneration { return }
-            await performConversion(generation: expectedGeneration)
+            await performConversion(generation: expectedGeneration, draft: false)
         }
     }
 
     func convertImmediately() {
         previewTask?.cancel()
+        draftTask?.cancel()
         conversionGeneration += 1
         let expectedGeneration = conversionGeneration
         Task { await performConversion(generation: expectedGeneration) }
     }
-    
-    private func performConversion(generation: Int? = nil) async {
+
+    /// Use locked settings if the selected image has them for the current machine
+    private var selectedImageSettings: [ConversionOption]? {
+        guard let selectedId = selectedImageId,
+              let image = inputImages.first(where: { $0.id == selectedId }),
+              image.lockedSettings != nil && image.lockedMachineIndex == selectedMachineIndex else { return nil }
+        return image.lockedSettings
+    }
+
+    /// Shows the quick Apple II draft of the current settings
+    private func performDraft(generation gen: Int) async {
+        guard let input = currentOriginalImage, let appleII = currentMachine as? AppleIIConverter else { return }
+        guard let draft = try? await appleII.draft(sourceImage: input, withSettings: selectedImageSettings) else { return }
+        if !Task.isCancelled && gen == conversionGeneration { self.draftImage = draft }
+    }
+
+    private func performConversion(generation: Int? = nil, draft: Bool = true) async {
         guard let input = currentOriginalImage else { return }
         let gen = generation ?? conversionGeneration
 
@@ -613,31 +641,39 @@ class ConverterViewModel: ObservableObject {
         isConverting = true
         errorMessage = nil
         let machine = currentMachine
-
-        // Use locked settings if the selected image has them for the current machine
-        let settingsToUse: [ConversionOption]?
-        if let selectedId = selectedImageId,
-           let image = inputImages.first(where: { $0.id == selectedId }),
-           image.lockedSettings != nil && image.lockedMachineIndex == selectedMachineIndex {
-            settingsToUse = image.lockedSettings
-        } else {
-            settingsToUse = nil
-        }
+        let settingsToUse = selectedImageSettings
 
         do {
-            let result = try await machine.convert(sourceImage: input, withSettings: settingsToUse)
-            if !Task.isCancelled && gen == conversionGeneration {
-                self.currentResult = result
+            if let appleII = machine as? AppleIIConverter {
+                // the draft and then the full result come through the callbacks
+                let showDraft: ((NSImage) -> Void)? = draft ? { image in
+                    Task { @MainActor in
+                        if gen == self.conversionGeneration && self.isConverting { self.draftImage = image }
+                    }
+                } : nil
+                _ = try await appleII.convert(sourceImage: input, withSettings: settingsToUse, draft: showDraft) { result in
+                    Task { @MainActor in self.showResult(result, generation: gen) }
+                }
+            } else {
+                let result = try await machine.convert(sourceImage: input, withSettings: settingsToUse)
+                if !Task.isCancelled { showResult(result, generation: gen) }
             }
         } catch {
             if !Task.isCancelled && gen == conversionGeneration {
                 self.errorMessage = "\(error.localizedDescription)"
+                self.draftImage = nil
             }
         }
         if !Task.isCancelled && gen == conversionGeneration {
             self.isConverting = false
         }
     }
+
+    private func showResult(_ result: ConversionResult, generation gen: Int) {
+        guard gen == conversionGeneration else { return }
+        self.currentResult = result
+        self.draftImage = nil
+    }
     
     // MARK: - Export Logic
     
@@ -803,7 +839,7 @@ class ConverterViewModel: ObservableObject {
                             // Convert the image using per-image settings if locked, otherwise use global settings
                             let settingsToUse = (imageItem.lockedSettings != nil && imageItem.lockedMachineIndex == self.selectedMachineIndex)
                                 ? imageItem.lockedSettings : nil
-                            let result = try await self.currentMachine.convert(sourceImage: imageItem.image, withSettings: settingsToUse)
+                            let result = try await self.batchConvert(imageItem, withSettings: settingsToUse)
 
                             for assetUrl in result.fileAssets {
                                 // Build target filename from original image name
@@ -895,6 +931,21 @@ class ConverterViewModel: ObservableObject {
 
     // MARK: - Batch Conversion Helper
 
+    /// Converts an image for a batch export. An image exported before with
+    /// the same settings comes from the conversion cache instead.
+    private func batchConvert(_ imageItem: InputImage, withSettings settings: [ConversionOption]?) async throws -> ConversionResult {
+        let machine = currentMachine
+        let key = ConversionCache.key(for: imageItem.image, machine: machine.name, options: settings ?? machine.options)
+        if let key = key, let cached = ConversionCache.shared.result(for: key) {
+            return cached
+        }
+        let result = try await machine.convert(sourceImage: imageItem.image, withSettings: settings)
+        if let key = key {
+            ConversionCache.shared.store(result, for: key)
+        }
+        return result
+    }
+
     /// Returns images to convert: selected ones, or all if none selected
     private func getImagesToConvert() -> [InputImage] {
         if !selectedImageIds.isEmpty {
@@ -916,28 +967,76 @@ class ConverterViewModel: ObservableObject {
             self.diskCreationProgress = 0
         }
 
-        for (index, imageItem) in imagesToConvert.enumerated() {
-            // Update progress
-            await MainActor.run {
-                self.diskCreationCurrent = index + 1
-                self.diskCreationProgress = Double(index + 1) / Double(imagesToConvert.count)
-                self.diskCreationStatus = "Converting \(imageItem.name)..."
+        // Convert the images using per-image settings if locked, otherwise use global settings
+        let settingsToUse = imagesToConvert.map { imageItem in
+            (imageItem.lockedSettings != nil && imageItem.lockedMachineIndex == self.selectedMachineIndex)
+                ? imageItem.lockedSettings : nil
+        }
+
+        func collectFiles(_ result: ConversionResult, for imageItem: InputImage) {
+            // Get base name without extension from original image
+            let baseName = (imageItem.name as NSString).deletingPathExtension
+            for (assetIndex, assetUrl) in result.fileAssets.enumerated() {
+                // If multiple assets per image, append index
+                let fileName = result.fileAssets.count > 1 ? "\(baseName)\(assetIndex)" : baseName
+                allFiles.append((url: assetUrl, name: fileName))
+            }
+        }
+
+        if let appleII = currentMachine as? AppleIIConverter {
+            // images exported before come from the conversion cache, b2d
+            // converts the rest at once on every core
+            let keys = zip(imagesToConvert, settingsToUse).map { imageItem, settings in
+                ConversionCache.key(for: imageItem.image, machine: appleII.name, options: settings ?? appleII.options)
+            }
+            var results = keys.map { key in key.flatMap { ConversionCache.shared.result(for: $0) } }
+            let missing = results.indices.filter { results[$0] == nil }
+            let batch = missing.map { (image: imagesToConvert[$0].image, settings: settingsToUse[$0]) }
+            // the cached images count as done
+            let cached = imagesToConvert.count - missing.count
+            let total = imagesToConvert.count
+            if cached > 0 {
+                await MainActor.run {
+                    self.diskCreationCurrent = cached
+                    self.diskCreationProgress = Double(cached) / Double(total)
+                    self.diskCreationStatus = "Converting \(cached) of \(total)..."
+                }
             }
+            let converted = await appleII.convertBatch(batch) { done, _ in
+                Task { @MainActor in
+                    self.diskCreationCurrent = cached + done
+                    self.diskCreationProgress = Double(cached + done) / Double(total)
+                    self.diskCreationStatus = "Converting \(cached + done) of \(total)..."
+                }
+            }
+            for (index, result) in zip(missing, converted) {
+                results[index] = result
+                if let result = result, let key = keys[index] {
+                    ConversionCache.shared.store(result, for: key)
+                }
+            }
+            for (imageItem, result) in zip(imagesToConvert, results) {
+                if let result = result {
+                    collectFiles(result, for: imageItem)
+                } else {
+                    print("Error converting \(imageItem.name)")
+                }
+            }
+        } else {
+            for (index, imageItem) in imagesToConvert.enumerated() {
+                // Update progress
+                await MainActor.run {
+                    self.diskCreationCurrent = index + 1
+                    self.diskCreationProgress = Double(index + 1) / Double(imagesToConvert.count)
+                    self.diskCreationStatus = "Converting \(imageItem.name)..."
+                }
 
-            do {
-                // Convert the image using per-image settings if locked, otherwise use global settings
-                let settingsToUse = (imageItem.lockedSettings != nil && imageItem.lockedMachineIndex == self.selectedMachineIndex)
-                    ? imageItem.lockedSettings : nil
-                let result = try await currentMachine.convert(sourceImage: imageItem.image, withSettings: settingsToUse)
-                // Get base name without extension from original image
-                let baseName = (imageItem.name as NSString).deletingPathExtension
-                for (assetIndex, assetUrl) in result.fileAssets.enumerated() {
-                    // If multiple assets per image, append index
-                    let fileName = result.fileAssets.count > 1 ? "\(baseName)\(assetIndex)" : baseName
-                    allFiles.append((url: assetUrl, name: fileName))
+                do {
+                    let result = try await batchConvert(imageItem, withSettings: settingsToUse[index])
+                    collectFiles(result, for: imageItem)
+                } catch {
+                    print("Error converting \(imageItem.name): \(error)")
                 }
-            } catch {
-                print("Error converting \(imageItem.name): \(error)")
             }
         }
 
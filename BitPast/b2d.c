@@ -116,6 +116,10 @@ specific range of input sizes and formats. The size and format of the input
 file depends on the type of desired primary output and the rendering options
 that have been selected.
 
+Color input of any other size is resampled to the full screen size of the
+output first (see b2d_resample.c). Option "fit" followed by a size, for
+example fit640x480, resamples to that size instead.
+
 Rendering options fall into several categories and where considered practically
 possible and where it makes sense given the constraints and scope of Bmp2DHR,
 all rendering options are available for all output.
@@ -348,17 +352,6 @@ char *palname[] = {
 	"Pseudo Palette",
 	"tohgr NTSC HGR"};
 
-/*
-* Reset all global variables to their default state
-* This must be called before each conversion to ensure clean state
-*/
-void b2d_reset_globals(void) {
-    // Reset ONLY the mode flags that cause conflicts
-   
-    
-    // DO NOT reset anything else!
-    // The palette data must stay initialized!
-}
 /* ***************************************************************** */
 /* ========================== code ================================= */
 /* ***************************************************************** */
@@ -438,14 +431,14 @@ ushort Motorola16(ushort val)
     return val;
 }
 
-void WriteDosHeader(FILE *fp, ushort fl, ushort fa)
+void WriteDosHeader(b2d_context *ctx, FILE *fp, ushort fl, ushort fa)
 {
 
     /* if CiderPress tags are turned-on I assume that the header is not required
        since presumably the tags will be used to place the file properly and ciderpress
        will create the DOS 3.3 header based on the file attribute preservation tag.
     */
-	if (dosheader == 1 && tags == 0) {
+	if (ctx->dosheader == 1 && ctx->tags == 0) {
 
     	fa = Motorola16(fa);/* file bload address - not including this header */
     	fl = Motorola16(fl);/* file length - not including this header */
@@ -469,37 +462,36 @@ Formula for the Luminosity Average:
 
 
 /* set luma to different values for closest color */
-int lumaREQ = 601, lumaRED = 299, lumaGREEN = 587, lumaBLUE = 114;
-double dlumaRED, dlumaGREEN, dlumaBLUE;
+/* lumaREQ defaults to 601 - see b2d_context_init() */
 
-void setluma(void)
+void setluma(b2d_context *ctx)
 {
-	switch(lumaREQ)
+	switch(ctx->lumaREQ)
 	{
         case 240: /* SMPTE 240M transitional coefficients */
-		          lumaRED = 212;	 lumaGREEN = 701;	 lumaBLUE = 87;
-		          dlumaRED = 0.212;  dlumaGREEN = 0.701; dlumaBLUE = 0.087;
+		          ctx->lumaRED = 212;	 ctx->lumaGREEN = 701;	 ctx->lumaBLUE = 87;
+		          ctx->dlumaRED = 0.212;  ctx->dlumaGREEN = 0.701; ctx->dlumaBLUE = 0.087;
 		          break;
 
         case 911: /* Sheldon Simms - tohgr */
-       		      lumaRED = 77;	   lumaGREEN = 151;	   lumaBLUE = 28;
-		          dlumaRED = 0.077;dlumaGREEN = 0.151; dlumaBLUE = 0.028;
+       		      ctx->lumaRED = 77;	   ctx->lumaGREEN = 151;	   ctx->lumaBLUE = 28;
+		          ctx->dlumaRED = 0.077;ctx->dlumaGREEN = 0.151; ctx->dlumaBLUE = 0.028;
 		          break;
 
 		case 411: /* The GIMP color managed */
-		          lumaRED = 223;	 lumaGREEN = 717;	   lumaBLUE = 61;
-		          dlumaRED = 0.2225; dlumaGREEN = 0.7169;  dlumaBLUE = 0.0606;
+		          ctx->lumaRED = 223;	 ctx->lumaGREEN = 717;	   ctx->lumaBLUE = 61;
+		          ctx->dlumaRED = 0.2225; ctx->dlumaGREEN = 0.7169;  ctx->dlumaBLUE = 0.0606;
 		          break;
 
 		case 709: /* CCIR 709 - modern */
 		          /* ImageMagick non-color managed */
-		          lumaRED = 213;	  lumaGREEN = 715;	     lumaBLUE = 72;
-		          dlumaRED = 0.212656;dlumaGREEN = 0.715158; dlumaBLUE = 0.072186;
+		          ctx->lumaRED = 213;	  ctx->lumaGREEN = 715;	     ctx->lumaBLUE = 72;
+		          ctx->dlumaRED = 0.212656;ctx->dlumaGREEN = 0.715158; ctx->dlumaBLUE = 0.072186;
 		          break;
 
 		case 601: /* CCIR 601 - most digital standard definition formats */
-		default:  lumaRED = 299;	 lumaGREEN = 587;	   lumaBLUE = 114;
-		          dlumaRED = 0.299;  dlumaGREEN = 0.587;   dlumaBLUE = 0.114;
+		default:  ctx->lumaRED = 299;	 ctx->lumaGREEN = 587;	   ctx->lumaBLUE = 114;
+		          ctx->dlumaRED = 0.299;  ctx->dlumaGREEN = 0.587;   ctx->dlumaBLUE = 0.114;
 		          break;
 
 
@@ -508,61 +500,71 @@ void setluma(void)
 
 
 /* intialize the values for the current palette */
-void InitDoubleArrays(void)
+void InitDoubleArrays(b2d_context *ctx)
 {
 	int i;
 	double dr, dg, db, dthreshold;
-	unsigned r, g, b;
+	uchar *rgb;
+	sshort brighten, darken;
+
+	/* color tables belong to the previous palette */
+	ColorTableRelease(ctx);
 
     /* array for matching closest color in palette */
 	for (i=0;i<16;i++) {
-		rgbDouble[i][0] = dr = (double) rgbArray[i][0];
-		rgbDouble[i][1] = dg = (double) rgbArray[i][1];
-		rgbDouble[i][2] = db = (double) rgbArray[i][2];
-		rgbLuma[i] = (dr*lumaRED + dg*lumaGREEN + db*lumaBLUE) / (255.0*1000);
+		rgb = &ctx->rgbArray[i][0];
+		ctx->rgbDouble[i][0] = dr = (double) rgb[0];
+		ctx->rgbDouble[i][1] = dg = (double) rgb[1];
+		ctx->rgbDouble[i][2] = db = (double) rgb[2];
+		ctx->rgbLuma[i] = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
 	}
 
     /* array for matching closest color in palette
        threshold reduced by 25% */
 
-    if (threshold == 0) {
+    if (ctx->threshold == 0) {
 		dthreshold = 0.75;
 	}
 	else {
-		dthreshold = (double) threshold;
-		if (xmatrix != 2) dthreshold *= 0.5;
+		dthreshold = (double) ctx->threshold;
+		if (ctx->xmatrix != 2) dthreshold *= 0.5;
 	    dthreshold = (double) (100.0 - dthreshold) / 100;
 
 	}
+	/* in 1/200ths for NearestFixed() - these are always whole numbers */
+	brighten = (sshort) (dthreshold * 200.0 + 0.5);
 
 	for (i=0;i<16;i++) {
-		dr = (double) rgbArray[i][0];
-		dg = (double) rgbArray[i][1];
-		db = (double) rgbArray[i][2];
+		rgb = &ctx->rgbArray[i][0];
+		dr = (double) rgb[0];
+		dg = (double) rgb[1];
+		db = (double) rgb[2];
 
 		dr *= dthreshold;
 		dg *= dthreshold;
 		db *= dthreshold;
 
-		rgbDoubleBrighten[i][0] = dr;
-		rgbDoubleBrighten[i][1] = dg;
-		rgbDoubleBrighten[i][2] = db;
-		rgbLumaBrighten[i] = (dr*lumaRED + dg*lumaGREEN + db*lumaBLUE) / (255.0*1000);
+		ctx->rgbDoubleBrighten[i][0] = dr;
+		ctx->rgbDoubleBrighten[i][1] = dg;
+		ctx->rgbDoubleBrighten[i][2] = db;
+		ctx->rgbLumaBrighten[i] = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
 	}
 
-    if (threshold == 0) {
+    if (ctx->threshold == 0) {
 		dthreshold = 1.25;
 	}
 	else {
-		dthreshold = (double) threshold;
-		if (xmatrix != 2) dthreshold *= 0.5;
+		dthreshold = (double) ctx->threshold;
+		if (ctx->xmatrix != 2) dthreshold *= 0.5;
 	    dthreshold = (double) (100.0 + dthreshold) / 100;
 	}
+	darken = (sshort) (dthreshold * 200.0 + 0.5);
 
 	for (i=0;i<16;i++) {
-		dr = (double) rgbArray[i][0];
-		dg = (double) rgbArray[i][1];
-		db = (double) rgbArray[i][2];
+		rgb = &ctx->rgbArray[i][0];
+		dr = (double) rgb[0];
+		dg = (double) rgb[1];
+		db = (double) rgb[2];
 
 		dr *= dthreshold;
 		if (dr > 255.0) dr = 255.0;
@@ -571,145 +573,146 @@ void InitDoubleArrays(void)
 		db *= dthreshold;
 		if (db > 255.0) db = 255.0;
 
-		rgbDoubleDarken[i][0] = dr;
-		rgbDoubleDarken[i][1] = dg;
-		rgbDoubleDarken[i][2] = db;
-		rgbLumaDarken[i] = (dr*lumaRED + dg*lumaGREEN + db*lumaBLUE) / (255.0*1000);
+		ctx->rgbDoubleDarken[i][0] = dr;
+		ctx->rgbDoubleDarken[i][1] = dg;
+		ctx->rgbDoubleDarken[i][2] = db;
+		ctx->rgbLumaDarken[i] = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
 	}
+
+	NearestInit(ctx, brighten, darken);
 }
 
 
 /* select current palette */
-void GetBuiltinPalette(sshort palidx, sshort previewidx, sshort pseudo)
+void GetBuiltinPalette(b2d_context *ctx, sshort palidx, sshort previewidx, sshort pseudo)
 {
-	sshort i,j;
-	uchar r,g,b;
+	sshort i;
 
     /* set conversion colors */
 	switch(palidx) {
 		case 16:/* optional NTSC palette from tohgr - used for HGR conversion */
 		        for (i=0;i<16;i++) {
-					rgbArray[i][0] = hgrpal[i][0];
-					rgbArray[i][1] = hgrpal[i][1];
-					rgbArray[i][2] = hgrpal[i][2];
+					ctx->rgbArray[i][0] = hgrpal[i][0];
+					ctx->rgbArray[i][1] = hgrpal[i][1];
+					ctx->rgbArray[i][2] = hgrpal[i][2];
 				}
 				break;
 		case 15:
 		        /* the infamous pseudo palette */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = PseudoPalette[i][0];
-					rgbArray[i][1] = PseudoPalette[i][1];
-					rgbArray[i][2] = PseudoPalette[i][2];
+					ctx->rgbArray[i][0] = ctx->PseudoPalette[i][0];
+					ctx->rgbArray[i][1] = ctx->PseudoPalette[i][1];
+					ctx->rgbArray[i][2] = ctx->PseudoPalette[i][2];
 				}
 				break;
 		case 14: /* Robert Munafo - http://mrob.com/pub/xapple2/colors.html */
 				 /* NTSC Palette used by Cybernesto in VBMP GIMP tutorial */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = Cybernesto[i][0];
-					rgbArray[i][1] = Cybernesto[i][1];
-					rgbArray[i][2] = Cybernesto[i][2];
+					ctx->rgbArray[i][0] = Cybernesto[i][0];
+					ctx->rgbArray[i][1] = Cybernesto[i][1];
+					ctx->rgbArray[i][2] = Cybernesto[i][2];
 				}
 				break;
 		case 13: /* Jace emulator NTSC palette */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = Jace[i][0];
-					rgbArray[i][1] = Jace[i][1];
-					rgbArray[i][2] = Jace[i][2];
+					ctx->rgbArray[i][0] = Jace[i][0];
+					ctx->rgbArray[i][1] = Jace[i][1];
+					ctx->rgbArray[i][2] = Jace[i][2];
 				}
 				break;
 		case 12: /* Super Convert HGR and DHGR conversion colors */
 				 /* same as kegs32 colors */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = SuperConvert[i][0];
-					rgbArray[i][1] = SuperConvert[i][1];
-					rgbArray[i][2] = SuperConvert[i][2];
+					ctx->rgbArray[i][0] = SuperConvert[i][0];
+					ctx->rgbArray[i][1] = SuperConvert[i][1];
+					ctx->rgbArray[i][2] = SuperConvert[i][2];
 				}
 				break;
 		/* 5 IBM-PC legacy palettes from BMPA2FC */
 		/* used for color substitution - not Apple II colors */
 		case 11: for (i=0;i<16;i++) {
 					/* default colors from some old ZSoft 16 color PCX */
-					rgbArray[i][0] = rgbPcxArray[i][0];
-					rgbArray[i][1] = rgbPcxArray[i][1];
-					rgbArray[i][2] = rgbPcxArray[i][2];
+					ctx->rgbArray[i][0] = rgbPcxArray[i][0];
+					ctx->rgbArray[i][1] = rgbPcxArray[i][1];
+					ctx->rgbArray[i][2] = rgbPcxArray[i][2];
 				}
 				break;
 		case 10: for (i=0;i<16;i++) {
 					/* colors from VGA bios */
-					rgbArray[i][0] = rgbVgaArray[i][0];
-					rgbArray[i][1] = rgbVgaArray[i][1];
-					rgbArray[i][2] = rgbVgaArray[i][2];
+					ctx->rgbArray[i][0] = rgbVgaArray[i][0];
+					ctx->rgbArray[i][1] = rgbVgaArray[i][1];
+					ctx->rgbArray[i][2] = rgbVgaArray[i][2];
 				}
 				break;
 		case 9: for (i=0;i<16;i++) {
 					/* colors from Windows Paint XP - 16 color BMP */
-					rgbArray[i][0] = rgbXmpArray[i][0];
-					rgbArray[i][1] = rgbXmpArray[i][1];
-					rgbArray[i][2] = rgbXmpArray[i][2];
+					ctx->rgbArray[i][0] = rgbXmpArray[i][0];
+					ctx->rgbArray[i][1] = rgbXmpArray[i][1];
+					ctx->rgbArray[i][2] = rgbXmpArray[i][2];
 				}
 				break;
 		case 8: for (i=0;i<16;i++) {
 					/* colors from MSPaint Windows 3.1 - 16 color BMP */
-					rgbArray[i][0] = rgbBmpArray[i][0];
-					rgbArray[i][1] = rgbBmpArray[i][1];
-					rgbArray[i][2] = rgbBmpArray[i][2];
+					ctx->rgbArray[i][0] = rgbBmpArray[i][0];
+					ctx->rgbArray[i][1] = rgbBmpArray[i][1];
+					ctx->rgbArray[i][2] = rgbBmpArray[i][2];
 				}
 				break;
 		case 7: for (i=0;i<16;i++) {
 					/* "canvas" colors from BmpA2FC */
-					rgbArray[i][0] = rgbCanvasArray[i][0];
-					rgbArray[i][1] = rgbCanvasArray[i][1];
-					rgbArray[i][2] = rgbCanvasArray[i][2];
+					ctx->rgbArray[i][0] = rgbCanvasArray[i][0];
+					ctx->rgbArray[i][1] = rgbCanvasArray[i][1];
+					ctx->rgbArray[i][2] = rgbCanvasArray[i][2];
 				}
 				break;
 		case 6: /* user definable imported palette file */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = rgbUser[i][0];
-					rgbArray[i][1] = rgbUser[i][1];
-					rgbArray[i][2] = rgbUser[i][2];
+					ctx->rgbArray[i][0] = ctx->rgbUser[i][0];
+					ctx->rgbArray[i][1] = ctx->rgbUser[i][1];
+					ctx->rgbArray[i][2] = ctx->rgbUser[i][2];
 				}
 				break;
 		case 4: /* wikipedia Apple II NTSC colors */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = wikipedia[i][0];
-					rgbArray[i][1] = wikipedia[i][1];
-					rgbArray[i][2] = wikipedia[i][2];
+					ctx->rgbArray[i][0] = ctx->wikipedia[i][0];
+					ctx->rgbArray[i][1] = ctx->wikipedia[i][1];
+					ctx->rgbArray[i][2] = ctx->wikipedia[i][2];
 				}
 				break;
 		case 3: /* Current AppleWin Version's sort-of NTSC colors */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = awinnewcolors[i][0];
-					rgbArray[i][1] = awinnewcolors[i][1];
-					rgbArray[i][2] = awinnewcolors[i][2];
+					ctx->rgbArray[i][0] = awinnewcolors[i][0];
+					ctx->rgbArray[i][1] = awinnewcolors[i][1];
+					ctx->rgbArray[i][2] = awinnewcolors[i][2];
 				}
 				break;
 		case 2: /* Previous AppleWin Version's sort-of NTSC colors */
 			 	for (i=0;i<16;i++) {
-					rgbArray[i][0] = awinoldcolors[i][0];
-					rgbArray[i][1] = awinoldcolors[i][1];
-					rgbArray[i][2] = awinoldcolors[i][2];
+					ctx->rgbArray[i][0] = awinoldcolors[i][0];
+					ctx->rgbArray[i][1] = awinoldcolors[i][1];
+					ctx->rgbArray[i][2] = awinoldcolors[i][2];
 				}
 				break;
 		case 1:	/* CiderPress RGB File Viewer colors */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = ciderpresscolors[i][0];
-					rgbArray[i][1] = ciderpresscolors[i][1];
-					rgbArray[i][2] = ciderpresscolors[i][2];
+					ctx->rgbArray[i][0] = ciderpresscolors[i][0];
+					ctx->rgbArray[i][1] = ciderpresscolors[i][1];
+					ctx->rgbArray[i][2] = ciderpresscolors[i][2];
 				}
 				break;
 		case 0: /* kegs32 RGB colors - same as Super Convert */
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = kegs32colors[i][0];
-					rgbArray[i][1] = kegs32colors[i][1];
-					rgbArray[i][2] = kegs32colors[i][2];
+					ctx->rgbArray[i][0] = kegs32colors[i][0];
+					ctx->rgbArray[i][1] = kegs32colors[i][1];
+					ctx->rgbArray[i][2] = kegs32colors[i][2];
 				}
 				break;
 	    case 5:  /* NTSC palette from tohgr - used for default HGR and DHGR conversion */
 		default:
 				for (i=0;i<16;i++) {
-					rgbArray[i][0] = grpal[i][0];
-					rgbArray[i][1] = grpal[i][1];
-					rgbArray[i][2] = grpal[i][2];
+					ctx->rgbArray[i][0] = ctx->grpal[i][0];
+					ctx->rgbArray[i][1] = ctx->grpal[i][1];
+					ctx->rgbArray[i][2] = ctx->grpal[i][2];
 				}
 				palidx = 5;
 				break;
@@ -719,126 +722,126 @@ void GetBuiltinPalette(sshort palidx, sshort previewidx, sshort pseudo)
 	switch(previewidx) {
 		case 16:/* HGR conversion - optional palette from tohgr */
 		        for (i=0;i<16;i++) {
-					rgbPreview[i][0] = hgrpal[i][0];
-					rgbPreview[i][1] = hgrpal[i][1];
-					rgbPreview[i][2] = hgrpal[i][2];
+					ctx->rgbPreview[i][0] = hgrpal[i][0];
+					ctx->rgbPreview[i][1] = hgrpal[i][1];
+					ctx->rgbPreview[i][2] = hgrpal[i][2];
 				}
 				break;
 		case 15: /* the infamous pseudo palette */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = PseudoPalette[i][0];
-					rgbPreview[i][1] = PseudoPalette[i][1];
-					rgbPreview[i][2] = PseudoPalette[i][2];
+					ctx->rgbPreview[i][0] = ctx->PseudoPalette[i][0];
+					ctx->rgbPreview[i][1] = ctx->PseudoPalette[i][1];
+					ctx->rgbPreview[i][2] = ctx->PseudoPalette[i][2];
 				}
 				break;
 		case 14: /* Robert Munafo - http://mrob.com/pub/xapple2/colors.html */
 				 /* NTSC Palette used by Cybernesto in VBMP GIMP tutorial */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = Cybernesto[i][0];
-					rgbPreview[i][1] = Cybernesto[i][1];
-					rgbPreview[i][2] = Cybernesto[i][2];
+					ctx->rgbPreview[i][0] = Cybernesto[i][0];
+					ctx->rgbPreview[i][1] = Cybernesto[i][1];
+					ctx->rgbPreview[i][2] = Cybernesto[i][2];
 				}
 				break;
 		case 13: /* Jace emulator NTSC palette */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = Jace[i][0];
-					rgbPreview[i][1] = Jace[i][1];
-					rgbPreview[i][2] = Jace[i][2];
+					ctx->rgbPreview[i][0] = Jace[i][0];
+					ctx->rgbPreview[i][1] = Jace[i][1];
+					ctx->rgbPreview[i][2] = Jace[i][2];
 				}
 				break;
 		case 12: /* Super Convert HGR and DHGR conversion colors */
 				 /* same as kegs32 colors */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = SuperConvert[i][0];
-					rgbPreview[i][1] = SuperConvert[i][1];
-					rgbPreview[i][2] = SuperConvert[i][2];
+					ctx->rgbPreview[i][0] = SuperConvert[i][0];
+					ctx->rgbPreview[i][1] = SuperConvert[i][1];
+					ctx->rgbPreview[i][2] = SuperConvert[i][2];
 				}
 				break;
 		/* 5 IBM-PC VGA legacy palettes from BMPA2FC */
 		/* used for color substitution - not Apple II colors */
 		case 11: for (i=0;i<16;i++) {
 					/* default colors from some old ZSoft 16 color PCX */
-					rgbPreview[i][0] = rgbPcxArray[i][0];
-					rgbPreview[i][1] = rgbPcxArray[i][1];
-					rgbPreview[i][2] = rgbPcxArray[i][2];
+					ctx->rgbPreview[i][0] = rgbPcxArray[i][0];
+					ctx->rgbPreview[i][1] = rgbPcxArray[i][1];
+					ctx->rgbPreview[i][2] = rgbPcxArray[i][2];
 				}
 				break;
 		case 10: for (i=0;i<16;i++) {
 					/* colors from VGA bios */
-					rgbPreview[i][0] = rgbVgaArray[i][0];
-					rgbPreview[i][1] = rgbVgaArray[i][1];
-					rgbPreview[i][2] = rgbVgaArray[i][2];
+					ctx->rgbPreview[i][0] = rgbVgaArray[i][0];
+					ctx->rgbPreview[i][1] = rgbVgaArray[i][1];
+					ctx->rgbPreview[i][2] = rgbVgaArray[i][2];
 				}
 				break;
 		case 9: for (i=0;i<16;i++) {
 					/* colors from Windows Paint XP - 16 color BMP */
-					rgbPreview[i][0] = rgbXmpArray[i][0];
-					rgbPreview[i][1] = rgbXmpArray[i][1];
-					rgbPreview[i][2] = rgbXmpArray[i][2];
+					ctx->rgbPreview[i][0] = rgbXmpArray[i][0];
+					ctx->rgbPreview[i][1] = rgbXmpArray[i][1];
+					ctx->rgbPreview[i][2] = rgbXmpArray[i][2];
 				}
 				break;
 		case 8: for (i=0;i<16;i++) {
 			        /* colors from MSPaint Windows 3.1 - 16 color BMP */
-					rgbPreview[i][0] = rgbBmpArray[i][0];
-					rgbPreview[i][1] = rgbBmpArray[i][1];
-					rgbPreview[i][2] = rgbBmpArray[i][2];
+					ctx->rgbPreview[i][0] = rgbBmpArray[i][0];
+					ctx->rgbPreview[i][1] = rgbBmpArray[i][1];
+					ctx->rgbPreview[i][2] = rgbBmpArray[i][2];
 				}
 				break;
 		case 7: for (i=0;i<16;i++) {
 					/* "canvas" colors from BmpA2FC */
-					rgbPreview[i][0] = rgbCanvasArray[i][0];
-					rgbPreview[i][1] = rgbCanvasArray[i][1];
-					rgbPreview[i][2] = rgbCanvasArray[i][2];
+					ctx->rgbPreview[i][0] = rgbCanvasArray[i][0];
+					ctx->rgbPreview[i][1] = rgbCanvasArray[i][1];
+					ctx->rgbPreview[i][2] = rgbCanvasArray[i][2];
 				}
 				break;
 		case 6: /* user definable imported palette file */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = rgbUser[i][0];
-					rgbPreview[i][1] = rgbUser[i][1];
-					rgbPreview[i][2] = rgbUser[i][2];
+					ctx->rgbPreview[i][0] = ctx->rgbUser[i][0];
+					ctx->rgbPreview[i][1] = ctx->rgbUser[i][1];
+					ctx->rgbPreview[i][2] = ctx->rgbUser[i][2];
 				}
 				break;
 		case 4: /* wikipedia Apple II NTSC colors */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = wikipedia[i][0];
-					rgbPreview[i][1] = wikipedia[i][1];
-					rgbPreview[i][2] = wikipedia[i][2];
+					ctx->rgbPreview[i][0] = ctx->wikipedia[i][0];
+					ctx->rgbPreview[i][1] = ctx->wikipedia[i][1];
+					ctx->rgbPreview[i][2] = ctx->wikipedia[i][2];
 				}
 				break;
 		case 3: /* Current AppleWin Version's sort-of NTSC colors */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = awinnewcolors[i][0];
-					rgbPreview[i][1] = awinnewcolors[i][1];
-					rgbPreview[i][2] = awinnewcolors[i][2];
+					ctx->rgbPreview[i][0] = awinnewcolors[i][0];
+					ctx->rgbPreview[i][1] = awinnewcolors[i][1];
+					ctx->rgbPreview[i][2] = awinnewcolors[i][2];
 				}
 				break;
 		case 2: /* Previous AppleWin Version's sort-of NTSC colors */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = awinoldcolors[i][0];
-					rgbPreview[i][1] = awinoldcolors[i][1];
-					rgbPreview[i][2] = awinoldcolors[i][2];
+					ctx->rgbPreview[i][0] = awinoldcolors[i][0];
+					ctx->rgbPreview[i][1] = awinoldcolors[i][1];
+					ctx->rgbPreview[i][2] = awinoldcolors[i][2];
 				}
 				break;
 		case 1:	/* CiderPress RGB File Viewer colors */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = ciderpresscolors[i][0];
-					rgbPreview[i][1] = ciderpresscolors[i][1];
-					rgbPreview[i][2] = ciderpresscolors[i][2];
+					ctx->rgbPreview[i][0] = ciderpresscolors[i][0];
+					ctx->rgbPreview[i][1] = ciderpresscolors[i][1];
+					ctx->rgbPreview[i][2] = ciderpresscolors[i][2];
 				}
 				break;
 		case 0: /* kegs32 RGB colors - same as Super Convert */
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = kegs32colors[i][0];
-					rgbPreview[i][1] = kegs32colors[i][1];
-					rgbPreview[i][2] = kegs32colors[i][2];
+					ctx->rgbPreview[i][0] = kegs32colors[i][0];
+					ctx->rgbPreview[i][1] = kegs32colors[i][1];
+					ctx->rgbPreview[i][2] = kegs32colors[i][2];
 				}
 				break;
 	    case 5:  /* NTSC palette from tohgr - used for default HGR and DHGR conversion */
 		default:
 				for (i=0;i<16;i++) {
-					rgbPreview[i][0] = grpal[i][0];
-					rgbPreview[i][1] = grpal[i][1];
-					rgbPreview[i][2] = grpal[i][2];
+					ctx->rgbPreview[i][0] = ctx->grpal[i][0];
+					ctx->rgbPreview[i][1] = ctx->grpal[i][1];
+					ctx->rgbPreview[i][2] = ctx->grpal[i][2];
 				}
 				previewidx = 5;
 				break;
@@ -846,29 +849,29 @@ void GetBuiltinPalette(sshort palidx, sshort previewidx, sshort pseudo)
 
         /* set-up the HGR conversion palette based-on the colors that were removed from palette 5 */
         /* 3 options are available - 6 colors, 4 color Orange-Blue, or 4 color Green-Violet */
-		if (hgroutput == 1) {
+		if (ctx->hgroutput == 1) {
 			for (i=0;i<16;i++) {
-				if (grpal[i][0] == 0 && grpal[i][1] == 0 && grpal[i][2] == 0) {
-					rgbPreview[i][0] = rgbArray[i][0] = 0;
-					rgbPreview[i][1] = rgbArray[i][1] =	0;
-					rgbPreview[i][2] = rgbArray[i][2] =	0;
+				if (ctx->grpal[i][0] == 0 && ctx->grpal[i][1] == 0 && ctx->grpal[i][2] == 0) {
+					ctx->rgbPreview[i][0] = ctx->rgbArray[i][0] = 0;
+					ctx->rgbPreview[i][1] = ctx->rgbArray[i][1] =	0;
+					ctx->rgbPreview[i][2] = ctx->rgbArray[i][2] =	0;
 				}
 			}
 		}
 
 		for (i=0;i<16;i++) {
 			/* verbatim match - 4-bits deep not 8 */
-			rgbAppleArray[i][0] = rgbArray[i][0] >> 4;
-			rgbAppleArray[i][1] = rgbArray[i][1] >> 4;
-			rgbAppleArray[i][2] = rgbArray[i][2] >> 4;
+			ctx->rgbAppleArray[i][0] = ctx->rgbArray[i][0] >> 4;
+			ctx->rgbAppleArray[i][1] = ctx->rgbArray[i][1] >> 4;
+			ctx->rgbAppleArray[i][2] = ctx->rgbArray[i][2] >> 4;
 			/* match VBMP color palette to the current conversion palette */
-			rgbVBMP[i][0] = rgbArray[i][0];
-			rgbVBMP[i][1] = rgbArray[i][1];
-			rgbVBMP[i][2] = rgbArray[i][2];
+			ctx->rgbVBMP[i][0] = ctx->rgbArray[i][0];
+			ctx->rgbVBMP[i][1] = ctx->rgbArray[i][1];
+			ctx->rgbVBMP[i][2] = ctx->rgbArray[i][2];
 		}
 
         /* no need to clip mono - the mono palette has only 2 colors */
-		if (paletteclip == 1 && mono == 0) {
+		if (ctx->paletteclip == 1 && ctx->mono == 0) {
 			/* command options "CV" or "CP" (clip view or clip palette) */
 			/* not implemented for preview or for verbatim match */
 			/* note that verbatim match is only 4-bits deep so already clips */
@@ -876,18 +879,18 @@ void GetBuiltinPalette(sshort palidx, sshort previewidx, sshort pseudo)
 			/* clipping filter for dirty blacks and whites */
 			/* borrowed from Sheldon Simms */
 			/* but this may have other adverse effects so it is optional */
-        	rgbArray[0][RED]   = 1;
-			rgbArray[0][GREEN] = 4;
-			rgbArray[0][BLUE]  = 8;
+        	ctx->rgbArray[0][RED]   = 1;
+			ctx->rgbArray[0][GREEN] = 4;
+			ctx->rgbArray[0][BLUE]  = 8;
 
-        	rgbArray[15][RED]   = 248;
-			rgbArray[15][GREEN] = 250;
-			rgbArray[15][BLUE]  = 244;
+        	ctx->rgbArray[15][RED]   = 248;
+			ctx->rgbArray[15][GREEN] = 250;
+			ctx->rgbArray[15][BLUE]  = 244;
 		}
 
     if(pseudo != 1) {
-    	if (quietmode == 1) {
-			if (mono == 1) puts("Black and White Monochrome Palette");
+    	if (ctx->quietmode == 1) {
+			if (ctx->mono == 1) puts("Black and White Monochrome Palette");
 			else printf("Palette %d: %s Colors\nPreview Palette %d: %s Colors\n",palidx,palname[palidx],previewidx,palname[previewidx]);
 
 		}
@@ -898,7 +901,7 @@ void GetBuiltinPalette(sshort palidx, sshort previewidx, sshort pseudo)
 /* build pseudo-palettes by using the average rgb values of two or more palettes into one */
 /* called from main() before setting the palettes
    and after an external user definable palette has been set (if any) */
-void BuildPseudoPalette(sshort palidx)
+void BuildPseudoPalette(b2d_context *ctx, sshort palidx)
 {
 
 	sshort i,j,k,idx;
@@ -911,52 +914,52 @@ void BuildPseudoPalette(sshort palidx)
 	/* get the initial values */
     /* call the palette routine before it is actually used to select the
        conversion and preview palette to avoid doing so much duplicate code */
-	GetBuiltinPalette(palidx,palidx,1);
+	GetBuiltinPalette(ctx, palidx,palidx,1);
 	for (i=0;i<16;i++) {
 		for (j=0;j<3;j++) {
-			pseudowork[i][j] = (ushort)rgbArray[i][j];
+			ctx->pseudowork[i][j] = (ushort)ctx->rgbArray[i][j];
 		}
 	}
 
     /* merge the values from the work buffers into the pseudo-palette */
     /* accumulate the additional values */
-	for (k = 0; k < pseudocount;k++) {
-		idx = pseudolist[k];
-		GetBuiltinPalette(idx,idx,1);
+	for (k = 0; k < ctx->pseudocount;k++) {
+		idx = ctx->pseudolist[k];
+		GetBuiltinPalette(ctx, idx,idx,1);
     	for (i=0;i<16;i++) {
 			for (j=0;j<3;j++) {
-				pseudowork[i][j] += rgbArray[i][j];
+				ctx->pseudowork[i][j] += ctx->rgbArray[i][j];
 			}
 		}
 	}
 
-	pseudocount++;
+	ctx->pseudocount++;
 	for (i=0;i<16;i++) {
 		for (j=0;j<3;j++) {
 			/* basic linear color distance */
 			/* use the average rgb values */
 			/* no attempt to avoid rounding */
-			gun = pseudowork[i][j]/pseudocount;
-			PseudoPalette[i][j] = (uchar)gun;
+			gun = ctx->pseudowork[i][j]/ctx->pseudocount;
+			ctx->PseudoPalette[i][j] = (uchar)gun;
 		}
 	}
-	pseudocount--;
+	ctx->pseudocount--;
 
 	/* if quiet mode is set print the final values */
-	if (outputtype != SPRITE_OUTPUT) {
-		if (quietmode == 0){
+	if (ctx->outputtype != SPRITE_OUTPUT) {
+		if (ctx->quietmode == 0){
 			/* rgb values can be redirected to a text file and used as an external palette
 			   for subsequnet conversions and/or whatever else this is useful for */
 			for (i=0;i<16;i++)
-				printf("%d,%d,%d\n",PseudoPalette[i][0],PseudoPalette[i][1],PseudoPalette[i][2]);
+				printf("%d,%d,%d\n",ctx->PseudoPalette[i][0],ctx->PseudoPalette[i][1],ctx->PseudoPalette[i][2]);
 		}
 	}
 
 	/* for normal output print the palette list */
-	if (quietmode == 1) {
+	if (ctx->quietmode == 1) {
 		printf("Pseudo Palette: %d (%s)",palidx,palname[palidx]);
-		for (k = 0; k < pseudocount;k++) {
-			idx = pseudolist[k];
+		for (k = 0; k < ctx->pseudocount;k++) {
+			idx = ctx->pseudolist[k];
 		    printf(" + %d (%s)",idx,palname[idx]);
 		}
 		printf("\n");
@@ -965,40 +968,45 @@ void BuildPseudoPalette(sshort palidx)
 
 /* use CCIR 601 luminosity to get closest color in current palette */
 /* based on palette that has been selected for conversion */
-uchar GetMedColor(uchar r, uchar g, uchar b, double *paldistance)
+uchar GetMedColor(b2d_context *ctx, uchar r, uchar g, uchar b, double *paldistance)
 {
+#ifdef B2D_SIMD
+	if (ctx->fixedpoint != 0) return NearestFixed(ctx, MEDCOLOR, r,g,b,paldistance);
+	return NearestColor(ctx, MEDCOLOR, r,g,b,paldistance);
+#else
 	uchar drawcolor;
 	double dr, dg, db, diffR, diffG, diffB, luma, lumadiff, distance, prevdistance;
 	int i;
 
+	if (ctx->fixedpoint != 0) return NearestFixed(ctx, MEDCOLOR, r,g,b,paldistance);
+
     dr = (double)r;
     dg = (double)g;
     db = (double)b;
-    luma = (dr*lumaRED + dg*lumaGREEN + db*lumaBLUE) / (255.0*1000);
-    lumadiff = rgbLuma[0]-luma;
+    luma = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
+    lumadiff = ctx->rgbLuma[0]-luma;
 
 	/* Compare the difference of RGB values, weigh by CCIR 601 luminosity */
     /* set palette index to color with shortest distance */
 
     /* get color distance to first palette color */
-	diffR = (rgbDouble[0][0]-dr)/255.0;
-	diffG = (rgbDouble[0][1]-dg)/255.0;
-	diffB = (rgbDouble[0][2]-db)/255.0;
+	diffR = (ctx->rgbDouble[0][0]-dr)/255.0;
+	diffG = (ctx->rgbDouble[0][1]-dg)/255.0;
+	diffB = (ctx->rgbDouble[0][2]-db)/255.0;
 
-    prevdistance = (diffR*diffR*dlumaRED + diffG*diffG*dlumaGREEN + diffB*diffB*dlumaGREEN)*0.75
+    prevdistance = (diffR*diffR*ctx->dlumaRED + diffG*diffG*ctx->dlumaGREEN + diffB*diffB*ctx->dlumaGREEN)*0.75
          + lumadiff*lumadiff;
     /* set palette index to first color */
     drawcolor = 0;
-    paldistance[0] = prevdistance;
 
     /* get color distance to rest of palette colors */
     for (i=1;i<16;i++) {
 
         /* error test for doing dithered HGR */
         /* test with a 4 color palette */
-        if (dither7 != (uchar) 0) {
+        if (ctx->dither7 != (uchar) 0) {
 			/* dither7 is set in FloydSteinberg() function */
-        	if (dither7 == 'O') {
+        	if (ctx->dither7 == 'O') {
 				/* 'O' - orange-blue palette */
 				if (i != LOMEDBLUE && i!= LOORANGE && i!= LOWHITE) continue;
 			}
@@ -1009,62 +1017,68 @@ uchar GetMedColor(uchar r, uchar g, uchar b, double *paldistance)
 		}
 
         /* get color distance of this index */
-		lumadiff = rgbLuma[i]-luma;
-		diffR = (rgbDouble[i][0]-dr)/255.0;
-		diffG = (rgbDouble[i][1]-dg)/255.0;
-		diffB = (rgbDouble[i][2]-db)/255.0;
-    	distance = (diffR*diffR*dlumaRED + diffG*diffG*dlumaGREEN + diffB*diffB*dlumaGREEN)*0.75
+		lumadiff = ctx->rgbLuma[i]-luma;
+		diffR = (ctx->rgbDouble[i][0]-dr)/255.0;
+		diffG = (ctx->rgbDouble[i][1]-dg)/255.0;
+		diffB = (ctx->rgbDouble[i][2]-db)/255.0;
+    	distance = (diffR*diffR*ctx->dlumaRED + diffG*diffG*ctx->dlumaGREEN + diffB*diffB*ctx->dlumaGREEN)*0.75
          	+ lumadiff*lumadiff;
 
         /* if distance is smaller use this index */
 	    if (distance < prevdistance) {
 		   prevdistance = distance;
-		   paldistance[0] = prevdistance;
 		   drawcolor = (uchar)i;
 		}
 
 	}
+	if (paldistance != NULL) paldistance[0] = prevdistance;
 	return drawcolor;
+#endif
 }
 
 
 /* use CCIR 601 luminosity to get closest color in current palette */
 /* match values have been decreased by user-defined threshold */
 /* brightens darker colors by promoting them */
-uchar GetHighColor(uchar r, uchar g, uchar b, double *paldistance)
+uchar GetHighColor(b2d_context *ctx, uchar r, uchar g, uchar b, double *paldistance)
 {
+#ifdef B2D_SIMD
+	if (ctx->fixedpoint != 0) return NearestFixed(ctx, HIGHCOLOR, r,g,b,paldistance);
+	return NearestColor(ctx, HIGHCOLOR, r,g,b,paldistance);
+#else
 	uchar drawcolor;
 	double dr, dg, db, diffR, diffG, diffB, luma, lumadiff, distance, prevdistance;
 	int i;
 
+	if (ctx->fixedpoint != 0) return NearestFixed(ctx, HIGHCOLOR, r,g,b,paldistance);
+
     dr = (double)r;
     dg = (double)g;
     db = (double)b;
-    luma = (dr*lumaRED + dg*lumaGREEN + db*lumaBLUE) / (255.0*1000);
-    lumadiff = rgbLumaBrighten[0]-luma;
+    luma = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
+    lumadiff = ctx->rgbLumaBrighten[0]-luma;
 
 	/* Compare the difference of RGB values, weigh by CCIR 601 luminosity */
     /* set palette index to color with shortest distance */
 
     /* get color distance to first palette color */
-	diffR = (rgbDoubleBrighten[0][0]-dr)/255.0;
-	diffG = (rgbDoubleBrighten[0][1]-dg)/255.0;
-	diffB = (rgbDoubleBrighten[0][2]-db)/255.0;
+	diffR = (ctx->rgbDoubleBrighten[0][0]-dr)/255.0;
+	diffG = (ctx->rgbDoubleBrighten[0][1]-dg)/255.0;
+	diffB = (ctx->rgbDoubleBrighten[0][2]-db)/255.0;
 
-    prevdistance = (diffR*diffR*dlumaRED + diffG*diffG*dlumaGREEN + diffB*diffB*dlumaGREEN)*0.75
+    prevdistance = (diffR*diffR*ctx->dlumaRED + diffG*diffG*ctx->dlumaGREEN + diffB*diffB*ctx->dlumaGREEN)*0.75
          + lumadiff*lumadiff;
     /* set palette index to first color */
     drawcolor = 0;
-    paldistance[0] = prevdistance;
 
     /* get color distance to rest of palette colors */
     for (i=1;i<16;i++) {
 
         /* error test for doing dithered HGR */
         /* test with a 4 color palette */
-        if (dither7 != (uchar) 0) {
+        if (ctx->dither7 != (uchar) 0) {
 			/* dither7 is set in FloydSteinberg() function */
-        	if (dither7 == 'O') {
+        	if (ctx->dither7 == 'O') {
 				/* 'O' - orange-blue palette */
 				if (i != LOMEDBLUE && i!= LOORANGE && i!= LOWHITE) continue;
 			}
@@ -1075,61 +1089,67 @@ uchar GetHighColor(uchar r, uchar g, uchar b, double *paldistance)
 		}
 
         /* get color distance of to this index */
-		lumadiff = rgbLumaBrighten[i]-luma;
-		diffR = (rgbDoubleBrighten[i][0]-dr)/255.0;
-		diffG = (rgbDoubleBrighten[i][1]-dg)/255.0;
-		diffB = (rgbDoubleBrighten[i][2]-db)/255.0;
-    	distance = (diffR*diffR*dlumaRED + diffG*diffG*dlumaGREEN + diffB*diffB*dlumaGREEN)*0.75
+		lumadiff = ctx->rgbLumaBrighten[i]-luma;
+		diffR = (ctx->rgbDoubleBrighten[i][0]-dr)/255.0;
+		diffG = (ctx->rgbDoubleBrighten[i][1]-dg)/255.0;
+		diffB = (ctx->rgbDoubleBrighten[i][2]-db)/255.0;
+    	distance = (diffR*diffR*ctx->dlumaRED + diffG*diffG*ctx->dlumaGREEN + diffB*diffB*ctx->dlumaGREEN)*0.75
          	+ lumadiff*lumadiff;
 
         /* if distance is smaller use this index */
 	    if (distance < prevdistance) {
 		   prevdistance = distance;
-		   paldistance[0] = prevdistance;
 		   drawcolor = (uchar)i;
 		}
 
 	}
+	if (paldistance != NULL) paldistance[0] = prevdistance;
 	return drawcolor;
+#endif
 }
 
 /* use CCIR 601 luminosity to get closest color in current palette */
 /* match values have been increased by user-defined threshold */
 /* darkens lighter colors by demoting them */
-uchar GetLowColor(uchar r, uchar g, uchar b, double *paldistance)
+uchar GetLowColor(b2d_context *ctx, uchar r, uchar g, uchar b, double *paldistance)
 {
+#ifdef B2D_SIMD
+	if (ctx->fixedpoint != 0) return NearestFixed(ctx, LOWCOLOR, r,g,b,paldistance);
+	return NearestColor(ctx, LOWCOLOR, r,g,b,paldistance);
+#else
 	uchar drawcolor;
 	double dr, dg, db, diffR, diffG, diffB, luma, lumadiff, distance, prevdistance;
 	int i;
 
+	if (ctx->fixedpoint != 0) return NearestFixed(ctx, LOWCOLOR, r,g,b,paldistance);
+
     dr = (double)r;
     dg = (double)g;
     db = (double)b;
-    luma = (dr*lumaRED + dg*lumaGREEN + db*lumaBLUE) / (255.0*1000);
-    lumadiff = rgbLumaDarken[0]-luma;
+    luma = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
+    lumadiff = ctx->rgbLumaDarken[0]-luma;
 
 	/* Compare the difference of RGB values, weigh by CCIR 601 luminosity */
     /* set palette index to color with shortest distance */
 
     /* get color distance to first palette color */
-	diffR = (rgbDoubleDarken[0][0]-dr)/255.0;
-	diffG = (rgbDoubleDarken[0][1]-dg)/255.0;
-	diffB = (rgbDoubleDarken[0][2]-db)/255.0;
+	diffR = (ctx->rgbDoubleDarken[0][0]-dr)/255.0;
+	diffG = (ctx->rgbDoubleDarken[0][1]-dg)/255.0;
+	diffB = (ctx->rgbDoubleDarken[0][2]-db)/255.0;
 
-    prevdistance = (diffR*diffR*dlumaRED + diffG*diffG*dlumaGREEN + diffB*diffB*dlumaGREEN)*0.75
+    prevdistance = (diffR*diffR*ctx->dlumaRED + diffG*diffG*ctx->dlumaGREEN + diffB*diffB*ctx->dlumaGREEN)*0.75
          + lumadiff*lumadiff;
     /* set palette index to first color */
     drawcolor = 0;
-    paldistance[0] = prevdistance;
 
     /* get color distance to rest of palette colors */
     for (i=1;i<16;i++) {
 
         /* error test for doing dithered HGR */
         /* test with a 4 color palette */
-        if (dither7 != (uchar) 0) {
+        if (ctx->dither7 != (uchar) 0) {
 			/* dither7 is set in FloydSteinberg() function */
-        	if (dither7 == 'O') {
+        	if (ctx->dither7 == 'O') {
 				/* 'O' - orange-blue palette */
 				if (i != LOMEDBLUE && i!= LOORANGE && i!= LOWHITE) continue;
 			}
@@ -1140,45 +1160,46 @@ uchar GetLowColor(uchar r, uchar g, uchar b, double *paldistance)
 		}
 
         /* get color distance of to this index */
-		lumadiff = rgbLumaDarken[i]-luma;
-		diffR = (rgbDoubleDarken[i][0]-dr)/255.0;
-		diffG = (rgbDoubleDarken[i][1]-dg)/255.0;
-		diffB = (rgbDoubleDarken[i][2]-db)/255.0;
-    	distance = (diffR*diffR*dlumaRED + diffG*diffG*dlumaGREEN + diffB*diffB*dlumaGREEN)*0.75
+		lumadiff = ctx->rgbLumaDarken[i]-luma;
+		diffR = (ctx->rgbDoubleDarken[i][0]-dr)/255.0;
+		diffG = (ctx->rgbDoubleDarken[i][1]-dg)/255.0;
+		diffB = (ctx->rgbDoubleDarken[i][2]-db)/255.0;
+    	distance = (diffR*diffR*ctx->dlumaRED + diffG*diffG*ctx->dlumaGREEN + diffB*diffB*ctx->dlumaGREEN)*0.75
          	+ lumadiff*lumadiff;
 
         /* if distance is smaller use this index */
 	    if (distance < prevdistance) {
 		   prevdistance = distance;
-		   paldistance[0] = prevdistance;
 		   drawcolor = (uchar)i;
 		}
 
 	}
+	if (paldistance != NULL) paldistance[0] = prevdistance;
 	return drawcolor;
+#endif
 }
 
-/* switchboard function to handle cross-hatched and non-cross-hatched output */
-/* keeps the conditionals out of the main loop */
-uchar GetDrawColor(uchar r, uchar g, uchar b, int x, int y)
+/* closest color for a GetDrawColor variant */
+/* the result depends only on the palette, dither7, and the rgb values */
+/* so it can be kept in a color table - see ColorTableLookup() */
+uchar GetPaletteColor(b2d_context *ctx, uchar r, uchar g, uchar b, sshort variant)
 {
-
-    /* additional vars for future */
-    double distance, lowdistance, highdistance;
-    uchar drawcolor, lowcolor, highcolor;
     uchar red 	= (uchar)(r >> 4),
 		  green = (uchar)(g >> 4),
 		  blue 	= (uchar)(b >> 4);
     int i;
 
+	/* NEARCOLOR is the closest color without a verbatim match */
+	if (variant == NEARCOLOR) return GetMedColor(ctx, r,g,b,NULL);
+
 	/* quick check for verbatim match */
 	for (i = 0; i < 16; i++) {
 
         /* error test for doing dithered HGR */
         /* test with a 4 color palette */
-        if (i!= 0 && dither7 != (uchar) 0) {
+        if (i!= 0 && ctx->dither7 != (uchar) 0) {
 			/* dither7 is set in FloydSteinberg() function */
-        	if (dither7 == 'O') {
+        	if (ctx->dither7 == 'O') {
 				/* 'O' - orange-blue palette */
 				if (i != LOMEDBLUE && i!= LOORANGE && i!= LOWHITE) continue;
 			}
@@ -1188,87 +1209,161 @@ uchar GetDrawColor(uchar r, uchar g, uchar b, int x, int y)
 			}
 		}
 
-		if (rgbAppleArray[i][0] == red &&
-			rgbAppleArray[i][1] == green &&
-			rgbAppleArray[i][2] == blue) return (uchar)i;
+		if (ctx->rgbAppleArray[i][0] == red &&
+			ctx->rgbAppleArray[i][1] == green &&
+			ctx->rgbAppleArray[i][2] == blue) {
+			if (ctx->stats != 0) atomic_fetch_add_explicit(&ctx->exactmatches, 1, memory_order_relaxed);
+			return (uchar)i;
+		}
 
 	}
 
-    /* non-cross-hatched output */
-    if (threshold == 0 && ymatrix == 0) return GetMedColor(r,g,b,&distance);
-
-    if (ymatrix != 0) {
-        switch(ymatrix) {
-        	case 1: return GetLowColor(r,g,b,&lowdistance);
-        	case 3: return GetHighColor(r,g,b,&highdistance);
-        	case 2:
-        	default:return GetMedColor(r,g,b,&distance);
-		}
+	switch(variant) {
+		case LOWCOLOR:  return GetLowColor(ctx, r,g,b,NULL);
+		case HIGHCOLOR: return GetHighColor(ctx, r,g,b,NULL);
 	}
+	return GetMedColor(ctx, r,g,b,NULL);
+}
 
-	/* patterned cross-hatching */
-	/* the thresholds are percentage based */
-	/* with a user definable threshold */
+/* spreads the 8 bits of n three bits apart - 0x249249 has every third bit set */
+ulong MortonBits(uchar n)
+{
+	ulong x = (ulong)n;
 
-    switch(xmatrix)
-    {
-		/* patterns 1, 2, 3 - 2 x 2 patterned cross-hatching */
-		case 1:
-			/* low, med
-			   med, low
-			*/
-			if (y % 2 == 0) {
-				if (x%2 == 1) return GetMedColor(r,g,b,&distance);
-				return GetLowColor(r,g,b,&lowdistance);
-			}
-			if (x%2 == 0) return GetMedColor(r,g,b,&distance);
-			return GetLowColor(r,g,b,&lowdistance);
+	x = (x | (x << 8)) & 0x00F00FUL;
+	x = (x | (x << 4)) & 0x0C30C3UL;
+	x = (x | (x << 2)) & 0x249249UL;
+	return x;
+}
 
-		case 3:
-			/* high, med
-			   med, high
-			*/
-			if (y % 2 == 0) {
-				if (x%2 == 1) return GetMedColor(r,g,b,&distance);
-				return GetHighColor(r,g,b,&highdistance);
-			}
-			if (x%2 == 0) return GetMedColor(r,g,b,&distance);
-			return GetHighColor(r,g,b,&highdistance);
+/* color table mode - option "lut" */
+/* each color is looked up once with GetPaletteColor() and kept in a 24-bit table */
+/* the tables are shared by all conversions that use the same palette settings */
+/* the color table for variant with the current dither7 subset */
+/* NULL if there is none - color table mode is turned off then */
+static b2d_colortable *ColorTableLoad(b2d_context *ctx, sshort variant)
+{
+	b2d_colortable *table;
+	sshort subset = 0;
 
-		case 2:
-		default:
-			/* high, low
-			   low, high
-			*/
-			if (y % 2 == 0) {
-				if (x%2 == 1) return GetLowColor(r,g,b,&lowdistance);
-				return GetHighColor(r,g,b,&highdistance);
-			}
-			if (x%2 == 0) return GetLowColor(r,g,b,&lowdistance);
-			return GetHighColor(r,g,b,&highdistance);
+	if (ctx->dither7 != (uchar) 0) subset = (ctx->dither7 == 'O' ? 1 : 2);
 
+	table = ctx->colortables[variant][subset];
+	if (NULL == table) {
+		table = ColorTableAcquire(ctx, variant, subset);
+		/* no table available - use the palette directly from now on */
+		if (NULL == table) ctx->colortable = 0;
+		else ctx->colortables[variant][subset] = table;
 	}
+	return table;
+}
 
-#ifndef TURBOC
-    /* never gets to here */
-	return GetMedColor(r,g,b,&distance);
-#endif
+uchar ColorTableLookup(b2d_context *ctx, uchar r, uchar g, uchar b, sshort variant)
+{
+	b2d_colortable *table;
+	ulong idx;
+	uchar drawcolor;
+
+	table = ColorTableLoad(ctx, variant);
+	if (NULL == table) return GetPaletteColor(ctx, r,g,b,variant);
+
+	/* the bits of r, g, and b are interleaved so similar colors are stored
+	   close together - a 4 x 4 x 4 block of colors shares a cache line */
+	idx = (MortonBits(r) << 2) | (MortonBits(g) << 1) | MortonBits(b);
+	drawcolor = atomic_load_explicit(&table->map[idx], memory_order_relaxed);
+	if (drawcolor != 0) return (uchar)(drawcolor - 1);
+
+	/* table entries are the palette index + 1 so that 0 is an empty entry */
+	drawcolor = GetPaletteColor(ctx, r,g,b,variant);
+	atomic_store_explicit(&table->map[idx], (uchar)(drawcolor + 1), memory_order_relaxed);
+	return drawcolor;
+}
+
+/* the closest color variant for pixel x, y of cross-hatched and non-cross-hatched output */
+static sshort DrawColorVariant(b2d_context *ctx, int x, int y)
+{
+    sshort variant = MEDCOLOR;
+
+    /* non-cross-hatched output */
+    if (ctx->ymatrix != 0) {
+        switch(ctx->ymatrix) {
+        	case 1: variant = LOWCOLOR; break;
+        	case 3: variant = HIGHCOLOR; break;
+		}
+	}
+	else if (ctx->threshold != 0) {
+
+		/* patterned cross-hatching */
+		/* the thresholds are percentage based */
+		/* with a user definable threshold */
+
+	    switch(ctx->xmatrix)
+	    {
+			/* patterns 1, 2, 3 - 2 x 2 patterned cross-hatching */
+			case 1:
+				/* low, med
+				   med, low
+				*/
+				if (y % 2 == 0) variant = (x%2 == 1 ? MEDCOLOR : LOWCOLOR);
+				else variant = (x%2 == 0 ? MEDCOLOR : LOWCOLOR);
+				break;
+
+			case 3:
+				/* high, med
+				   med, high
+				*/
+				if (y % 2 == 0) variant = (x%2 == 1 ? MEDCOLOR : HIGHCOLOR);
+				else variant = (x%2 == 0 ? MEDCOLOR : HIGHCOLOR);
+				break;
+
+			case 2:
+			default:
+				/* high, low
+				   low, high
+				*/
+				if (y % 2 == 0) variant = (x%2 == 1 ? LOWCOLOR : HIGHCOLOR);
+				else variant = (x%2 == 0 ? LOWCOLOR : HIGHCOLOR);
+				break;
+		}
+	}
+	return variant;
+}
+
+/* switchboard function to handle cross-hatched and non-cross-hatched output */
+/* keeps the conditionals out of the main loop */
+uchar GetDrawColor(b2d_context *ctx, uchar r, uchar g, uchar b, int x, int y)
+{
+    sshort variant = DrawColorVariant(ctx, x, y);
+
+	if (ctx->stats != 0) atomic_fetch_add_explicit(&ctx->drawcolors, 1, memory_order_relaxed);
+
+	if (ctx->colortable != 0) return ColorTableLookup(ctx, r,g,b,variant);
+	return GetPaletteColor(ctx, r,g,b,variant);
+}
+
+/* loads the color tables GetDrawColor() uses for the current dither7 subset */
+/* so that the dithering threads do not each look for them - nothing is counted */
+void ColorTablePreload(b2d_context *ctx)
+{
+	int i;
 
+	/* the cross-hatch patterns are 2 x 2 */
+	for (i = 0; i < 4 && ctx->colortable != 0; i++) ColorTableLoad(ctx, DrawColorVariant(ctx, i % 2, i / 2));
 }
 
 /* routines to save to Apple 2 Double Hires Format */
 /* a double hi-res pixel can occur at any one of 7 positions */
 /* in a 4 byte block which spans aux and main screen memory */
 /* the horizontal resolution is 140 pixels */
-void dhrplot(int x,int y,uchar drawcolor)
+void dhrplot(b2d_context *ctx, int x,int y,uchar drawcolor)
 {
     int xoff, pattern;
     uchar *ptraux, *ptrmain;
 
     pattern = (x%7);
 	xoff = HB[y] + ((x/7) * 2);
-    ptraux  = (uchar *) &dhrbuf[xoff-0x2000];
-    ptrmain = (uchar *) &dhrbuf[xoff];
+    ptraux  = (uchar *) &ctx->dhrbuf[xoff-0x2000];
+    ptrmain = (uchar *) &ctx->dhrbuf[xoff];
 
 
 	switch(pattern)
@@ -1316,12 +1411,56 @@ void dhrplot(int x,int y,uchar drawcolor)
 
 }
 
+/* plots the first width pixels of scanline y from a line of drawcolors */
+/* the 4 bits of each of the 7 pixels in a block are put together in one
+   28 bit run which is then split into the 4 bytes - aux, main, aux, main
+   (see dhrgetpixel) - the 4 bits of a drawcolor are the same in any of the
+   7 positions so they are taken from the first one in dhrbytes */
+/* a block that is only partly plotted keeps the bits of the pixels that
+   are not, as dhrplot would */
+void dhrputline(b2d_context *ctx, int y, uchar *line, int width)
+{
+    int x, i, n, stage;
+    uchar *ptraux, *ptrmain, *ptr, mask;
+    ulong bits, used;
+
+    if (width > 140) width = 140;
+    stage = StatsStage(ctx, B2D_STAGE_ENCODE);
+
+    ptraux  = (uchar *) &ctx->dhrbuf[HB[y]-0x2000];
+    ptrmain = (uchar *) &ctx->dhrbuf[HB[y]];
+
+	for (x = 0; x < width; x += 7, ptraux += 2, ptrmain += 2) {
+		n = width - x;
+		if (n > 7) n = 7;
+		for (i = n, bits = 0; i > 0; i--) bits = (bits << 4) | (dhrbytes[line[x+i-1]][0] & 0x0f);
+
+		if (n == 7) {
+			ptraux[0]  = (uchar)(bits & 0x7f);
+			ptrmain[0] = (uchar)((bits >> 7) & 0x7f);
+			ptraux[1]  = (uchar)((bits >> 14) & 0x7f);
+			ptrmain[1] = (uchar)((bits >> 21) & 0x7f);
+			continue;
+		}
+
+		used = (1UL << (n * 4)) - 1;
+		for (i = 0; i < 4; i++) {
+			mask = (uchar)((used >> (i * 7)) & 0x7f);
+			if (mask == 0) break;
+			if (i & 1) ptr = &ptrmain[i/2];
+			else ptr = &ptraux[i/2];
+			ptr[0] = (ptr[0] & 0x7f & ~mask) | (uchar)((bits >> (i * 7)) & mask);
+		}
+	}
+	StatsStage(ctx, stage);
+}
+
 
 /* monochrome DHGR - 560 x 192 */
 unsigned char dhbmono[] = {0x7e,0x7d,0x7b,0x77,0x6f,0x5f,0x3f};
 unsigned char dhwmono[] = {0x1,0x2,0x4,0x8,0x10,0x20,0x40};
 
-void dhrmonoplot(int x, int y, uchar drawcolor)
+void dhrmonoplot(b2d_context *ctx, int x, int y, uchar drawcolor)
 {
 
     int xoff, pixel;
@@ -1334,11 +1473,11 @@ void dhrmonoplot(int x, int y, uchar drawcolor)
     if (pixel > 6) {
 		/* main memory */
 		pixel -= 7;
-		ptr = (uchar *) &dhrbuf[xoff];
+		ptr = (uchar *) &ctx->dhrbuf[xoff];
 	}
 	else {
 		/* auxiliary memory */
-		ptr  = (uchar *) &dhrbuf[xoff-0x2000];
+		ptr  = (uchar *) &ctx->dhrbuf[xoff-0x2000];
 	}
 
 	if (drawcolor != 0) {
@@ -1353,7 +1492,7 @@ void dhrmonoplot(int x, int y, uchar drawcolor)
 }
 
 /* monochrome HGR 280 x 192 */
-void hrmonoplot(int x, int y, uchar drawcolor)
+void hrmonoplot(b2d_context *ctx, int x, int y, uchar drawcolor)
 {
 
     int xoff, pixel;
@@ -1364,7 +1503,7 @@ void hrmonoplot(int x, int y, uchar drawcolor)
     xoff = HB[y] + (x/7);
     pixel = (x%7);
 	/* main memory */
-	ptr  = (uchar *) &dhrbuf[xoff-0x2000];
+	ptr  = (uchar *) &ctx->dhrbuf[xoff-0x2000];
 
 	if (drawcolor != 0) {
 		/* white */
@@ -1377,22 +1516,12 @@ void hrmonoplot(int x, int y, uchar drawcolor)
 
 }
 
-void dhrfill(int y,uchar drawcolor)
+void dhrfill(b2d_context *ctx, int y,uchar drawcolor)
 {
-    int xoff, x;
-    uchar *ptraux, *ptrmain;
-
-	xoff = HB[y];
+    uchar line[140];
 
-    ptraux  = (uchar *) &dhrbuf[xoff-0x2000];
-    ptrmain = (uchar *) &dhrbuf[xoff];
-
-    for (x = 0,xoff=0; x < 20; x++) {
-		ptraux[xoff]  = dhrbytes[drawcolor][0];
-		ptrmain[xoff] = dhrbytes[drawcolor][1]; xoff++;
-		ptraux[xoff]  = dhrbytes[drawcolor][2];
-		ptrmain[xoff] = dhrbytes[drawcolor][3]; xoff++;
-	}
+	memset(line,drawcolor,140);
+	dhrputline(ctx, y,line,140);
 }
 
 
@@ -1402,14 +1531,14 @@ void dhrfill(int y,uchar drawcolor)
    this doesn't matter for a full-screen image
 
 */
-void dhrclear(void)
+void dhrclear(b2d_context *ctx)
 {
 	int y;
 	uchar drawcolor;
-	memset(dhrbuf,0,16384);
-	if (backgroundcolor == LOBLACK) return;
-	drawcolor = (uchar)backgroundcolor;
-	for (y=0;y<192;y++) dhrfill(y,drawcolor);
+	memset(ctx->dhrbuf,0,16384);
+	if (ctx->backgroundcolor == LOBLACK) return;
+	drawcolor = (uchar)ctx->backgroundcolor;
+	for (y=0;y<192;y++) dhrfill(ctx, y,drawcolor);
 }
 
 /* mono-spaced "tom thumb" 4 x 6 font */
@@ -1417,7 +1546,7 @@ void dhrclear(void)
 /* a bitmap could have been encoded into nibbles of 3 bytes per character
    rather than the 18 bytes per character that I am using
    but the trade-off in the speed in unmasking would have slowed this down */
-void plotthumbDHGR(unsigned char ch, unsigned x, unsigned y,
+void plotthumbDHGR(b2d_context *ctx, unsigned char ch, unsigned x, unsigned y,
                unsigned char fg, unsigned char bg)
 {
 	unsigned offset, x1, x2=x+3, y2=y+6, xmono;
@@ -1443,34 +1572,34 @@ void plotthumbDHGR(unsigned char ch, unsigned x, unsigned y,
 
 		   if (byte == 0) {
 			   if (bg > 15) continue;
-			   if (hgroutput == 1 && mono == 1) {
-			      hrmonoplot(xmono,y,bg);
-			      hrmonoplot(xmono+1,y,bg);
+			   if (ctx->hgroutput == 1 && ctx->mono == 1) {
+			      hrmonoplot(ctx, xmono,y,bg);
+			      hrmonoplot(ctx, xmono+1,y,bg);
 			   }
 			   else {
-			   	  dhrplot(x1,y,bg);
+			   	  dhrplot(ctx, x1,y,bg);
 			   }
 		   }
 		   else {
 			   if (fg > 15) continue;
-			   if (hgroutput == 1 && mono == 1) {
-			      hrmonoplot(xmono,y,fg);
-			      hrmonoplot(xmono+1,y,fg);
+			   if (ctx->hgroutput == 1 && ctx->mono == 1) {
+			      hrmonoplot(ctx, xmono,y,fg);
+			      hrmonoplot(ctx, xmono+1,y,fg);
 			   }
 			   else {
-			   	  dhrplot(x1,y,fg);
+			   	  dhrplot(ctx, x1,y,fg);
 			   }
 	   	   }
 		}
 		/* if background color is being used then a trailing pixel is required
 		   between characters */
 		if (bg < 16 && x2 < 140) {
-			if (hgroutput == 1 && mono == 1) {
-				hrmonoplot(xmono,y,bg);
-			    hrmonoplot(xmono+1,y,bg);
+			if (ctx->hgroutput == 1 && ctx->mono == 1) {
+				hrmonoplot(ctx, xmono,y,bg);
+			    hrmonoplot(ctx, xmono+1,y,bg);
 			}
 			else {
-				dhrplot(x2,y,bg);
+				dhrplot(ctx, x2,y,bg);
 			}
 		}
 
@@ -1481,7 +1610,7 @@ void plotthumbDHGR(unsigned char ch, unsigned x, unsigned y,
 
 /* normally spaced 4 x 6 font */
 /* using character plotting function plotthumb() (above) */
-void thumbDHGR(char *str,unsigned x, unsigned y,
+void thumbDHGR(b2d_context *ctx, char *str,unsigned x, unsigned y,
               unsigned char fg,unsigned char bg, unsigned char justify)
 {
   int target;
@@ -1493,7 +1622,7 @@ void thumbDHGR(char *str,unsigned x, unsigned y,
   }
 
   while ((ch = *str++) != 0) {
-	 plotthumbDHGR(ch,x,y,fg,bg);
+	 plotthumbDHGR(ctx, ch,x,y,fg,bg);
 	 x+=4;
   }
 }
@@ -1514,7 +1643,7 @@ void thumbDHGR(char *str,unsigned x, unsigned y,
 
 */
 
-ushort WriteVbmpHeader(FILE *fp)
+ushort WriteVbmpHeader(b2d_context *ctx, FILE *fp)
 {
     ushort outpacket;
     int c, i, j;
@@ -1522,8 +1651,8 @@ ushort WriteVbmpHeader(FILE *fp)
     /* BMP scanlines are padded to a multiple of 4 bytes (DWORD) */
     outpacket = (ushort)72;
 
-    if (mono != 0 || hgroutput == 1) {
-		if (hgroutput == 1) {
+    if (ctx->mono != 0 || ctx->hgroutput == 1) {
+		if (ctx->hgroutput == 1) {
 			outpacket = 36;
 			c = fwrite(mono280,1,sizeof(mono192),fp);
 		}
@@ -1534,27 +1663,27 @@ ushort WriteVbmpHeader(FILE *fp)
         return outpacket;
 	}
 
-    memset((char *)&mybmp.bfi.bfType[0],0,sizeof(BMPHEADER));
+    memset((char *)&ctx->mybmp.bfi.bfType[0],0,sizeof(BMPHEADER));
 
     /* create the info header */
-    mybmp.bmi.biSize = (ulong)40;
-    mybmp.bmi.biWidth  = (ulong)140;
-    mybmp.bmi.biHeight = (ulong)192;
-    mybmp.bmi.biPlanes = 1;
-    mybmp.bmi.biBitCount = 4;
-    mybmp.bmi.biCompression = (ulong) BI_RGB;
+    ctx->mybmp.bmi.biSize = (ulong)40;
+    ctx->mybmp.bmi.biWidth  = (ulong)140;
+    ctx->mybmp.bmi.biHeight = (ulong)192;
+    ctx->mybmp.bmi.biPlanes = 1;
+    ctx->mybmp.bmi.biBitCount = 4;
+    ctx->mybmp.bmi.biCompression = (ulong) BI_RGB;
 
-    mybmp.bmi.biSizeImage = (ulong)outpacket;
-	mybmp.bmi.biSizeImage *= mybmp.bmi.biHeight;
+    ctx->mybmp.bmi.biSizeImage = (ulong)outpacket;
+	ctx->mybmp.bmi.biSizeImage *= ctx->mybmp.bmi.biHeight;
 
     /* create the file header */
-    mybmp.bfi.bfType[0] = 'B';
-    mybmp.bfi.bfType[1] = 'M';
-    mybmp.bfi.bfOffBits = (ulong) sizeof(BMPHEADER) + sizeof(RGBQUAD) * 16;
-    mybmp.bfi.bfSize = mybmp.bmi.biSizeImage + mybmp.bfi.bfOffBits;
+    ctx->mybmp.bfi.bfType[0] = 'B';
+    ctx->mybmp.bfi.bfType[1] = 'M';
+    ctx->mybmp.bfi.bfOffBits = (ulong) sizeof(BMPHEADER) + sizeof(RGBQUAD) * 16;
+    ctx->mybmp.bfi.bfSize = ctx->mybmp.bmi.biSizeImage + ctx->mybmp.bfi.bfOffBits;
 
  	/* write the header for the output BMP */
-    c = fwrite((char *)&mybmp.bfi.bfType[0],sizeof(BMPHEADER),1,fp);
+    c = fwrite((char *)&ctx->mybmp.bfi.bfType[0],sizeof(BMPHEADER),1,fp);
 
     if (c!= 1)return 0;
 
@@ -1562,59 +1691,59 @@ ushort WriteVbmpHeader(FILE *fp)
     /* rather than the preview palette */
     for (i=0;i<16;i++) {
 		j = RemapLoToHi[i];
-		sbmp[i].rgbRed   = rgbVBMP[j][RED];
-		sbmp[i].rgbGreen = rgbVBMP[j][GREEN];
-    	sbmp[i].rgbBlue  = rgbVBMP[j][BLUE];
+		ctx->sbmp[i].rgbRed   = ctx->rgbVBMP[j][RED];
+		ctx->sbmp[i].rgbGreen = ctx->rgbVBMP[j][GREEN];
+    	ctx->sbmp[i].rgbBlue  = ctx->rgbVBMP[j][BLUE];
 
 	}
 
 	/* write the palette for the output bmp */
-	c = fwrite((char *)&sbmp[0].rgbBlue, sizeof(RGBQUAD)*16,1,fp);
+	c = fwrite((char *)&ctx->sbmp[0].rgbBlue, sizeof(RGBQUAD)*16,1,fp);
 	if (c!= 1)return 0;
 
 return outpacket;
 }
 
 /* decodes scanlines from hgr or dhgr monochrome buffer */
-void applemonobites(int y, int doubleres)
+void applemonobites(b2d_context *ctx, int y, int doubleres)
 {
 	    int xoff,idx;
 	    unsigned char *ptraux, *ptrmain, ch;
 
 	    xoff = HB[y];
-	    ptraux  = (unsigned char *) &dhrbuf[xoff-0x2000];
-	    ptrmain = (unsigned char *) &dhrbuf[xoff];
+	    ptraux  = (unsigned char *) &ctx->dhrbuf[xoff-0x2000];
+	    ptrmain = (unsigned char *) &ctx->dhrbuf[xoff];
 
         xoff = 0;
         for (idx = 0; idx < 40; idx++) {
 
             ch = ptraux[idx];
 
-            buf280[xoff] = ((ch) &1); xoff++;
-            buf280[xoff] = ((ch >> 1) &1); xoff++;
-            buf280[xoff] = ((ch >> 2) &1); xoff++;
-            buf280[xoff] = ((ch >> 3) &1); xoff++;
-            buf280[xoff] = ((ch >> 4) &1); xoff++;
-            buf280[xoff] = ((ch >> 5) &1); xoff++;
-            buf280[xoff] = ((ch >> 6) &1); xoff++;
+            ctx->buf280[xoff] = ((ch) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 1) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 2) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 3) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 4) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 5) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 6) &1); xoff++;
 
             if (doubleres == 0) continue;
 
             ch = ptrmain[idx];
 
-            buf280[xoff] = ((ch) &1); xoff++;
-            buf280[xoff] = ((ch >> 1) &1); xoff++;
-            buf280[xoff] = ((ch >> 2) &1); xoff++;
-            buf280[xoff] = ((ch >> 3) &1); xoff++;
-            buf280[xoff] = ((ch >> 4) &1); xoff++;
-            buf280[xoff] = ((ch >> 5) &1); xoff++;
-            buf280[xoff] = ((ch >> 6) &1); xoff++;
+            ctx->buf280[xoff] = ((ch) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 1) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 2) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 3) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 4) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 5) &1); xoff++;
+            ctx->buf280[xoff] = ((ch >> 6) &1); xoff++;
 
  		}
 }
 
 /* encodes monochrome bmp scanline */
-void ibmmonobites(void)
+void ibmmonobites(b2d_context *ctx)
 {
      int i,j,k;
      unsigned char bits[8];
@@ -1624,38 +1753,38 @@ void ibmmonobites(void)
      {
         for(k=0;k<8;k++)
         {
-		  bits[k] = buf280[j]; j++;
+		  bits[k] = ctx->buf280[j]; j++;
 		}
-		bmpscanline[i] = (bits[0]<<7|bits[1]<<6|bits[2]<<5|bits[3]<<4|
+		ctx->bmpscanline[i] = (bits[0]<<7|bits[1]<<6|bits[2]<<5|bits[3]<<4|
                           bits[4]<<3|bits[5]<<2|bits[6]<<1|bits[7]);
      }
 }
 
 
 /* writes VBMP compatible 140 x 192 x 16 color bmp or VBMP monochrome bmp in 2 sizes */
-int WriteVBMPFile(void)
+int WriteVBMPFile(b2d_context *ctx)
 {
 
     FILE *fp;
-    uchar ch;
+    uchar ch = 0, line[140];
 	int x,x1,y,y2,idx,j,packet=72;
 
-	if (hgroutput == 1) packet = 36;
+	if (ctx->hgroutput == 1) packet = 36;
 
-	fp = fopen(vbmpfile,"wb");
+	fp = b2d_fopen(ctx, ctx->vbmpfile,"wb");
 
 	if (fp == NULL) {
-		printf("Error opening %s for writing!\n",vbmpfile);
+		printf("Error opening %s for writing!\n",ctx->vbmpfile);
 		return INVALID;
 	}
 
-	if (WriteVbmpHeader(fp) == 0) {
+	if (WriteVbmpHeader(ctx, fp) == 0) {
 		fclose(fp);
-		remove(vbmpfile);
-		printf("Error writing header to %s!\n",vbmpfile);
+		b2d_remove(ctx, ctx->vbmpfile);
+		printf("Error writing header to %s!\n",ctx->vbmpfile);
 		return INVALID;
 	}
-	memset(&bmpscanline[0],0,packet);
+	memset(&ctx->bmpscanline[0],0,packet);
 
     /* write 4 bit packed scanlines */
     /* remap from LORES color order to DHGR color order */
@@ -1663,35 +1792,32 @@ int WriteVBMPFile(void)
 
     y2 = 191;
    	for (y = 0; y< 192; y++) {
-	   if (hgroutput == 1) {
-		   applemonobites(y2,0);
-		   ibmmonobites();
+	   if (ctx->hgroutput == 1) {
+		   applemonobites(ctx, y2,0);
+		   ibmmonobites(ctx);
 	   }
 	   else {
+		   dhrgetline(ctx, y2, line);
 		   for (x = 0, x1=0; x < 140; x++) {
 			  if (x%2 == 0) {
-				idx = dhrgetpixel(x,y2);
-				/* range check */
-				if (idx < 0 || idx > 15)idx = 0; /* default black */
+				idx = line[x];
 				j = RemapLoToHi[idx];
 				ch = (uchar)j << 4;
 			  }
 			  else {
-				idx = dhrgetpixel(x,y2);
-				/* range check */
-				if (idx < 0 || idx > 15)idx = 0; /* default black */
+				idx = line[x];
 				j = RemapLoToHi[idx];
-				bmpscanline[x1] = ch | (uchar)j; x1++;
+				ctx->bmpscanline[x1] = ch | (uchar)j; x1++;
 			  }
 		   }
    	   }
 
-	   fwrite((char *)&bmpscanline[0],1,packet,fp);
+	   fwrite((char *)&ctx->bmpscanline[0],1,packet,fp);
 	   y2 -= 1;
     }
 
     fclose(fp);
-    if (quietmode == 1)printf("%s created!\n",vbmpfile);
+    if (ctx->quietmode == 1)printf("%s created!\n",ctx->vbmpfile);
     return SUCCESS;
 
 }
@@ -1699,21 +1825,21 @@ int WriteVBMPFile(void)
 
 /* plain old HGR transformation routines for DHGR 6-color HGR pseudo-output */
 /* encodes apple II hgr scanline into buffer */
-void hgrbits(int y)
+void hgrbits(b2d_context *ctx, int y)
 {
 	    int xoff,idx,jdx;
 	    unsigned char *ptr, bits[7], x1, palettebit;
 
 	    xoff = HB[y]-0x2000;
-	    ptr  = (unsigned char *) &hgrbuf[xoff];
+	    ptr  = (unsigned char *) &ctx->hgrbuf[xoff];
 
         xoff = 0;
         for (idx = 0; idx < 40; idx++) {
 
             for (jdx = 0; jdx < 7; jdx++) {
-				bits[jdx] = buf280[xoff]; xoff++;
+				bits[jdx] = ctx->buf280[xoff]; xoff++;
 			}
-			palettebit = palettebits[idx];
+			palettebit = ctx->palettebits[idx];
 
 			x1 = (palettebit | bits[6]<<6|bits[5]<<5|bits[4]<<4|
                         bits[3]<<3|bits[2]<<2|bits[1]<<1|bits[0]);
@@ -1722,65 +1848,65 @@ void hgrbits(int y)
 		}
 }
 
-void buildhgr(void)
+void buildhgr(b2d_context *ctx)
 {
 	 int i, j;
 
      /* create bit pattern from pixelized values */
      /* i is even and j is odd */
 	 for (i= 0, j = 1; i < 280; i+=2, j+=2) {
-		buf280[i] = 0; /* assume everything is black */
-		buf280[j] = 0;
+		ctx->buf280[i] = 0; /* assume everything is black */
+		ctx->buf280[j] = 0;
 
         /* add the white bits - this also accounts for the half shift of
            the color pixels which applewin renders as white to represent
            aliasing of the color anomalies */
 
-        if (doublewhite == 1) {
+        if (ctx->doublewhite == 1) {
 			/* if double white is on, set the white pixels in pairs */
-			if (work280[i] == HWHITE || work280[j] == HWHITE) {
-				buf280[i] = buf280[j] = 1;
+			if (ctx->work280[i] == HWHITE || ctx->work280[j] == HWHITE) {
+				ctx->buf280[i] = ctx->buf280[j] = 1;
 			}
 		}
 		else {
 			/* otherwise set white pixels individually */
-			if (work280[i] == HWHITE) buf280[i] = 1;
-			if (work280[j] == HWHITE) buf280[j] = 1;
+			if (ctx->work280[i] == HWHITE) ctx->buf280[i] = 1;
+			if (ctx->work280[j] == HWHITE) ctx->buf280[j] = 1;
 		}
 
         /* if double colors is on, set the color pixels in pairs */
-        if (doublecolors == 1) {
+        if (ctx->doublecolors == 1) {
 			/* add the violet or blue bits - the 2-bit value will be 2 */
-			if (work280[i] == HBLUE || work280[i] == HVIOLET ||
-			    work280[j] == HBLUE || work280[j] == HVIOLET ) {
-					buf280[i] = 1;
-					buf280[j] = 0;
+			if (ctx->work280[i] == HBLUE || ctx->work280[i] == HVIOLET ||
+			    ctx->work280[j] == HBLUE || ctx->work280[j] == HVIOLET ) {
+					ctx->buf280[i] = 1;
+					ctx->buf280[j] = 0;
 			}
 
 			/* add the green or orange bits - the 2-bit value will be 1 */
-			if (work280[i] == HORANGE || work280[i] == HGREEN ||
-			    work280[j] == HORANGE || work280[j] == HGREEN ) {
-					buf280[i] = 0;
-					buf280[j] = 1;
+			if (ctx->work280[i] == HORANGE || ctx->work280[i] == HGREEN ||
+			    ctx->work280[j] == HORANGE || ctx->work280[j] == HGREEN ) {
+					ctx->buf280[i] = 0;
+					ctx->buf280[j] = 1;
 			}
 
 		}
 		else {
 			/* otherwise set the colors individually if double colors is off */
 			/* add the violet or blue bits - the 2-bit value will be 2 */
-			if (work280[i] == HBLUE || work280[i] == HVIOLET )buf280[i] = 1;
-			if (work280[j] == HBLUE || work280[j] == HVIOLET )buf280[j] = 0;
+			if (ctx->work280[i] == HBLUE || ctx->work280[i] == HVIOLET )ctx->buf280[i] = 1;
+			if (ctx->work280[j] == HBLUE || ctx->work280[j] == HVIOLET )ctx->buf280[j] = 0;
 
 			/* add the green or orange bits - the 2-bit value will be 1 */
-			if (work280[i] == HORANGE || work280[i] == HGREEN )buf280[i] = 0;
-			if (work280[j] == HORANGE || work280[j] == HGREEN )buf280[j] = 1;
+			if (ctx->work280[i] == HORANGE || ctx->work280[i] == HGREEN )ctx->buf280[i] = 0;
+			if (ctx->work280[j] == HORANGE || ctx->work280[j] == HGREEN )ctx->buf280[j] = 1;
 		}
 
-        if (doubleblack == 1) {
+        if (ctx->doubleblack == 1) {
 		  /* be careful here - this can foul the colors */
-		  if (work280[i] == HBLACK || work280[j]==HBLACK) {
-		  		buf280[i] = 0;
-		  		buf280[j] = 0;
+		  if (ctx->work280[i] == HBLACK || ctx->work280[j]==HBLACK) {
+		  		ctx->buf280[i] = 0;
+		  		ctx->buf280[j] = 0;
 		  }
 		}
 
@@ -1788,10 +1914,10 @@ void buildhgr(void)
 
 }
 
-void hgrline(int y)
+void hgrline(b2d_context *ctx, int y)
 {
-     int x,i,j,k,l, green, orange;
-     unsigned char c, p;
+     int x,i,j,k, green, orange, stage;
+     unsigned char p, line[140];
 
      /* read the 6-color DHGR buffer and translate to HGR */
      /* since DHGR is 140 pixels in width and HGR is 280, double each pixel */
@@ -1805,33 +1931,36 @@ void hgrline(int y)
         */
 
     /* double colors */
+	dhrgetline(ctx, y, line);
 	for (x=0,i=0,j=1;x<140;x++,i+=2,j+=2) {
 		/* get the DHGR color */
-		k = dhrgetpixel(x,y);
+		k = line[x];
 		/* remap to the HGR color indices */
-		work280[i] = work280[j] = dhgr2hgr[k];
+		ctx->work280[i] = ctx->work280[j] = dhgr2hgr[k];
 	}
 
     /* single colors - shift image right by one nominal pixel */
     /* otherwise this setting will have no effect */
- 	if (doublecolors == 0) {
+ 	if (ctx->doublecolors == 0) {
 	   for (x = 279;x > 0;x--) {
-		   work280[x] = work280[x-1];
+		   ctx->work280[x] = ctx->work280[x-1];
 	   }
     }
 
-	buildhgr();
+	buildhgr(ctx);
+
+	stage = StatsStage(ctx, B2D_STAGE_HGRPALETTE);
 
      /* set the HGR palette based on groups of seven HGR pixels */
-	if (hgrpaltype == 0 || hgrpaltype == 0x80) {
+	if (ctx->hgrpaltype == 0 || ctx->hgrpaltype == 0x80) {
 		/* single palette over-ride... 4 color output. all non-black and
 		   non-white pixels will be converted to either Green-Violet or
 		   Orange-Blue */
-		for (i = 0; i < 40; i++) palettebits[i] = hgrpaltype;
+		for (i = 0; i < 40; i++) ctx->palettebits[i] = ctx->hgrpaltype;
 	}
 	else {
 		 /* seed palette hi-bit with some value */
-		 if (hgrcolortype == 'G' || hgrcolortype == 'V') p = 0;
+		 if (ctx->hgrcolortype == 'G' || ctx->hgrcolortype == 'V') p = 0;
 		 else p = 0x80;
 
 		 /* go through the 280 pixel scanline and determine precedence of colors
@@ -1842,12 +1971,12 @@ void hgrline(int y)
 			 green = 0;
 			 for (j = 0; j < 7; j++) {
 				 /* count in groups of 7 pixels (really 3.5 color pixels) */
-				 if (work280[k] == HORANGE ||  work280[k] == HBLUE) orange++;
-				 if (work280[k] == HGREEN ||  work280[k] == HVIOLET) green++;
+				 if (ctx->work280[k] == HORANGE ||  ctx->work280[k] == HBLUE) orange++;
+				 if (ctx->work280[k] == HGREEN ||  ctx->work280[k] == HVIOLET) green++;
 				 k++;
 			 }
 
-			 if (hgrcolortype == 'O') {
+			 if (ctx->hgrcolortype == 'O') {
 				 /* big orange - one orange pixel sets the palette */
 				 /* orange blue */
 				 if (orange > 0) p = 0x80;
@@ -1855,7 +1984,7 @@ void hgrline(int y)
 					if (green > 0) p = 0;
 				 }
 			 }
-			 else if (hgrcolortype == 'G') {
+			 else if (ctx->hgrcolortype == 'G') {
 				 /* big green - one green pixel sets the palette */
 				 /* green violet */
 				 if (green > 0) p = 0;
@@ -1870,19 +1999,21 @@ void hgrline(int y)
 			 	else {
 					/* but if both groups are equal then 3 - options for behaviour */
 					/* little green - equal green and orange sets the palette to green */
-					if (hgrcolortype == 'V' && green == orange) p = 0;
+					if (ctx->hgrcolortype == 'V' && green == orange) p = 0;
 					/* little orange - equal green and orange sets the palette to orange */
-					else if (hgrcolortype == 'B' && orange == green) p = 0x80;
+					else if (ctx->hgrcolortype == 'B' && orange == green) p = 0x80;
 					else if (orange > 0) {
 						 /* it was either do this or carry the previous palette bit setting forward */
-						 if (hgrcolortype == 'G' || hgrcolortype == 'V') p = 0;
+						 if (ctx->hgrcolortype == 'G' || ctx->hgrcolortype == 'V') p = 0;
 		 				 else p = 0x80;
 					}
 				}
 			 }
-			 palettebits[i] = p;
+			 ctx->palettebits[i] = p;
 		 }
 	 }
+
+	StatsStage(ctx, stage);
 }
 
 
@@ -1909,7 +2040,7 @@ void hgrline(int y)
  routines to save to Apple 2 Lores Format */
 
 /* sets the pixels in the lores buffer (hgrbuf) */
-void setlopixel(unsigned char color,int x, int y,int ragflag)
+void setlopixel(b2d_context *ctx, unsigned char color,int x, int y,int ragflag)
 {
      unsigned char *crt, c1, c2;
      int y1, offset;
@@ -1935,7 +2066,7 @@ void setlopixel(unsigned char color,int x, int y,int ragflag)
      else
 		 offset = (textbase[y1]-1024)+x;
 
-	 crt = (unsigned char *)&hgrbuf[offset];
+	 crt = (unsigned char *)&ctx->hgrbuf[offset];
      crt[0] &= c1;
      crt[0] |= c2;
 }
@@ -1945,94 +2076,95 @@ void setlopixel(unsigned char color,int x, int y,int ragflag)
 /* only full-screen (48 line) or mixed-screen (40 line) files are supported for raster-oriented files */
 /* only full-sceen format is supported for BSAVE files */
 /* image fragments are not supported */
-int savelofragment(void)
+int savelofragment(b2d_context *ctx)
 {
 
 	FILE *fp;
-	unsigned char outfile[MAXF], temp, remap;
+	char outfile[MAXF+12]; /* the work name, an extension and a file type tag */
+	unsigned char temp, remap;
 	int x,y,x2,y2, offset;
 	ushort fl = 1016; /* default LGR or DLGR file size in bytes - BSAVE format */
 
    /* raster files - single file output */
-   if (applesoft == 0) {
+   if (ctx->applesoft == 0) {
 	   /* save single lo-res and double lo-res */
 	   /* save raster images of 48 or 40 scanlines
 		  (full graphics or mixed text and graphics) */
 
-		if (lores == 1) {
-			if (appletop == 1) {
+		if (ctx->lores == 1) {
+			if (ctx->appletop == 1) {
 				fl = 802;
-				sprintf(outfile,"%s.STO",hgrwork);
+				sprintf(outfile,"%s.STO",ctx->hgrwork);
 			}
 			else {
 				fl = 962;
-				sprintf(outfile,"%s.SLO",hgrwork);
+				sprintf(outfile,"%s.SLO",ctx->hgrwork);
 			}
 		}
 		else {
-			if (appletop == 1) {
+			if (ctx->appletop == 1) {
 				fl = 1602;
-				sprintf(outfile,"%s.DTO",hgrwork);
+				sprintf(outfile,"%s.DTO",ctx->hgrwork);
 			}
 			else {
 				fl = 1922;
-				sprintf(outfile,"%s.DLO",hgrwork);
+				sprintf(outfile,"%s.DLO",ctx->hgrwork);
 			}
 		}
-        if (tags == 1) {
+        if (ctx->tags == 1) {
 			strcat(outfile,"#060400");
 		}
-		fp = fopen(outfile,"wb");
+		fp = b2d_fopen(ctx, outfile,"wb");
 		if (NULL == fp)return INVALID;
-		WriteDosHeader(fp,fl,1024);
+		WriteDosHeader(ctx, fp,fl,1024);
 
 		/* On the double lo res display each byte in
 		high memory is interleaved with a byte in low memory
 		in the interests of efficiency I am saving and loading
 		the interleaf on a scanline by scanline basis.
 		*/
-		memset(hgrbuf,0,LORAGSIZE);
+		memset(ctx->hgrbuf,0,LORAGSIZE);
 		for (y = 0; y< 48; y++) {
-			if (appletop == 1 && y > 39)break;
+			if (ctx->appletop == 1 && y > 39)break;
 			y2 = y;
 			/* first 40 bytes goes to auxiliary memory (even pixels) */
 			for (x = 0; x < 40; x++) {
 				x2 = (x*2);
-				remap = dhrgetpixel(x2,y2);
+				remap = dhrgetpixel(ctx, x2,y2);
 				temp = dloauxcolor[remap];
-				setlopixel(temp,x,y,1);
+				setlopixel(ctx, temp,x,y,1);
 			}
 			/* followed by the interleaf (odd pixels)
 			   next 40 bytes goes to main memory */
 			for (x = 0; x < 40; x++) {
-				if (lores == 1)
+				if (ctx->lores == 1)
 					x2 = x;
 				else
 					x2 = (x*2) + 1;
-				temp = dhrgetpixel(x2,y2);
-				setlopixel(temp,x+40,y,1);
+				temp = dhrgetpixel(ctx, x2,y2);
+				setlopixel(ctx, temp,x+40,y,1);
 			}
 		}
-		if (lores == 1) {
+		if (ctx->lores == 1) {
 			fputc(40,fp); /* bytes */
-			if (appletop == 1) fputc(20,fp);
+			if (ctx->appletop == 1) fputc(20,fp);
 			else fputc(24,fp);
 
 			for (y = 0; y < 24; y++) {
-				if (appletop == 1 && y > 19)break;
+				if (ctx->appletop == 1 && y > 19)break;
 				offset = (y * 80)+40;
-				fwrite((unsigned char *)&hgrbuf[offset],1,40,fp);
+				fwrite((unsigned char *)&ctx->hgrbuf[offset],1,40,fp);
 			}
 		}
 		else {
 			fputc(80,fp); /* bytes */
-			if (appletop == 1) {
+			if (ctx->appletop == 1) {
 				fputc(20,fp); /* bytes (rasters / 2) */
-				fwrite(hgrbuf,1,LOTOPSIZE,fp);
+				fwrite(ctx->hgrbuf,1,LOTOPSIZE,fp);
 			}
 			else {
 				fputc(24,fp); /* bytes (rasters / 2) */
-				fwrite(hgrbuf,1,LORAGSIZE,fp);
+				fwrite(ctx->hgrbuf,1,LORAGSIZE,fp);
 			}
 		}
 		fclose(fp);
@@ -2052,26 +2184,26 @@ int savelofragment(void)
 		/* for double lo-res the bsaved images are split into two files
 		   the first file is loaded into aux mem
 		 */
-		if (lores == 0) {
-			sprintf(outfile,"%s.DL1",hgrwork);
-			if (tags == 1) {
+		if (ctx->lores == 0) {
+			sprintf(outfile,"%s.DL1",ctx->hgrwork);
+			if (ctx->tags == 1) {
 				strcat(outfile,"#060400");
 			}
-			fp = fopen(outfile,"wb");
+			fp = b2d_fopen(ctx, outfile,"wb");
 			if (NULL == fp)return INVALID;
-			WriteDosHeader(fp,fl,1024);
+			WriteDosHeader(ctx, fp,fl,1024);
 
-			memset(hgrbuf,0,LOBINSIZE);
+			memset(ctx->hgrbuf,0,LOBINSIZE);
 			for (y = 0; y< 48; y++) {
 				y2 = y;
 				for (x = 0; x < 40; x++) {
 					x2 = (x*2);
-					remap = dhrgetpixel(x2,y2);
+					remap = dhrgetpixel(ctx, x2,y2);
 					temp = dloauxcolor[remap];
-					setlopixel(temp,x,y,0);
+					setlopixel(ctx, temp,x,y,0);
 				}
 			}
-			fwrite(hgrbuf,1,LOBINSIZE,fp);
+			fwrite(ctx->hgrbuf,1,LOBINSIZE,fp);
 			fclose(fp);
 			printf("%s Saved!",outfile);
 		}
@@ -2080,29 +2212,29 @@ int savelofragment(void)
 		for single lo res only 1 file is needed
 		for double lo res the second file is loaded into main mem
 		*/
-		if (lores == 1)
-			sprintf(outfile,"%s.SL2",hgrwork);
+		if (ctx->lores == 1)
+			sprintf(outfile,"%s.SL2",ctx->hgrwork);
 		else
-			sprintf(outfile,"%s.DL2",hgrwork);
-		if (tags == 1) {
+			sprintf(outfile,"%s.DL2",ctx->hgrwork);
+		if (ctx->tags == 1) {
 			strcat(outfile,"#060400");
 		}
-		fp = fopen(outfile,"wb");
+		fp = b2d_fopen(ctx, outfile,"wb");
 		if (NULL == fp)return INVALID;
-		WriteDosHeader(fp,fl,1024);
-		memset(hgrbuf,0,LOBINSIZE);
+		WriteDosHeader(ctx, fp,fl,1024);
+		memset(ctx->hgrbuf,0,LOBINSIZE);
 		for (y = 0; y< 48; y++) {
 			y2 = y;
 			for (x = 0; x < 40; x++) {
-				if (lores == 1)
+				if (ctx->lores == 1)
 					x2 = x;
 				else
 					x2 = (x*2) + 1;
-				temp = dhrgetpixel(x2,y2);
-				setlopixel(temp,x,y,0);
+				temp = dhrgetpixel(ctx, x2,y2);
+				setlopixel(ctx, temp,x,y,0);
 			}
 		}
-		fwrite(hgrbuf,1,LOBINSIZE,fp);
+		fwrite(ctx->hgrbuf,1,LOBINSIZE,fp);
 		fclose(fp);
 		printf("%s Saved!",outfile);
 	}
@@ -2113,84 +2245,86 @@ int savelofragment(void)
 
 
 /* save both raw output file formats */
-int savedhr(void)
+int savedhr(b2d_context *ctx)
 {
 
 	FILE *fp;
-	int c,y;
+	int c,y,stage;
 
-    if (outputtype != BIN_OUTPUT) return SUCCESS;
+    if (ctx->outputtype != BIN_OUTPUT) return SUCCESS;
 
-    if (loresoutput == 1) {
-		savelofragment();
+    if (ctx->loresoutput == 1) {
+		savelofragment(ctx);
 		return SUCCESS;
 	}
 
     /* titling from text files if found */
-    GetUserTextFile();
+    GetUserTextFile(ctx);
 
 
-    if (hgroutput == 1) {
+    if (ctx->hgroutput == 1) {
 		/* just using the BIN file extension as always */
-		if (mono == 0) {
-			strcpy(mainfile,hgrcolor);
-        	memset(hgrbuf,0,8192);
+		if (ctx->mono == 0) {
+			strcpy(ctx->mainfile,ctx->hgrcolor);
+        	memset(ctx->hgrbuf,0,8192);
+			stage = StatsStage(ctx, B2D_STAGE_ENCODE);
 			for (y = 0; y < 192; y++) {
-     			hgrline(y); /* translate from DHGR and format the HGR line */
-				hgrbits(y); /* put the HGR line into the HGR file buffer */
+     			hgrline(ctx, y); /* translate from DHGR and format the HGR line */
+				hgrbits(ctx, y); /* put the HGR line into the HGR file buffer */
 			}
+			StatsStage(ctx, stage);
 		}
 		else {
-			strcpy(mainfile,hgrmono);
+			strcpy(ctx->mainfile,ctx->hgrmono);
 		}
-		fp = fopen(mainfile,"wb");
+		fp = b2d_fopen(ctx, ctx->mainfile,"wb");
 		if (NULL == fp) {
-			if (quietmode == 1)printf("Error Opening %s for writing!\n",mainfile);
+			if (ctx->quietmode == 1)printf("Error Opening %s for writing!\n",ctx->mainfile);
 			return INVALID;
 		}
 
-		WriteDosHeader(fp,8192,8192);
+		WriteDosHeader(ctx, fp,8192,8192);
 
-		if (mono == 1) c = fwrite(dhrbuf,1,8192,fp);
-		else c = fwrite(&hgrbuf[0],1,8192,fp);
+		if (ctx->mono == 1) c = fwrite(ctx->dhrbuf,1,8192,fp);
+		else c = fwrite(&ctx->hgrbuf[0],1,8192,fp);
 		fclose(fp);
 		if (c != 8192) {
-			remove(mainfile);
-			if (quietmode == 1)printf("Error Writing %s!\n",mainfile);
+			b2d_remove(ctx, ctx->mainfile);
+			if (ctx->quietmode == 1)printf("Error Writing %s!\n",ctx->mainfile);
 			return INVALID;
 		}
 
-		if (quietmode == 1) printf("%s created!\n",mainfile);
-		if (vbmp != 0) {
+		if (ctx->quietmode == 1) printf("%s created!\n",ctx->mainfile);
+		if (ctx->vbmp != 0) {
 			/* additional BMP file for Cybernesto's VBMP */
-			if (mono == 0) memcpy(&dhrbuf[0],&hgrbuf[0],8192);
-			WriteVBMPFile();
+			if (ctx->mono == 0) memcpy(&ctx->dhrbuf[0],&ctx->hgrbuf[0],8192);
+			WriteVBMPFile(ctx);
 		}
 		return SUCCESS;
 	}
 
-    if (applesoft == 0) {
+    if (ctx->applesoft == 0) {
 
-		fp = fopen(a2fcfile,"wb");
+		fp = b2d_fopen(ctx, ctx->a2fcfile,"wb");
 		if (NULL == fp) {
-	    	if (quietmode == 1)printf("Error Opening %s for writing!\n",a2fcfile);
+	    	if (ctx->quietmode == 1)printf("Error Opening %s for writing!\n",ctx->a2fcfile);
 			return INVALID;
 		}
 
-		WriteDosHeader(fp,16384,8192);
+		WriteDosHeader(ctx, fp,16384,8192);
 
-		c = fwrite(dhrbuf,1,16384,fp);
+		c = fwrite(ctx->dhrbuf,1,16384,fp);
 		fclose(fp);
 
 		if (c != 16384) {
-			remove(a2fcfile);
-			if (quietmode == 1)printf("Error Writing %s!\n",a2fcfile);
+			b2d_remove(ctx, ctx->a2fcfile);
+			if (ctx->quietmode == 1)printf("Error Writing %s!\n",ctx->a2fcfile);
 			return INVALID;
 		}
-		if (quietmode == 1)printf("%s created!\n",a2fcfile);
-		if (vbmp != 0) {
+		if (ctx->quietmode == 1)printf("%s created!\n",ctx->a2fcfile);
+		if (ctx->vbmp != 0) {
 			/* additional BMP file for Cybernesto's VBMP */
-			WriteVBMPFile();
+			WriteVBMPFile(ctx);
 		}
 		return SUCCESS;
 	}
@@ -2198,113 +2332,113 @@ int savedhr(void)
 
     /* the bsaved images are split into two files
        the first file is loaded into aux mem */
-   	fp = fopen(auxfile,"wb");
+   	fp = b2d_fopen(ctx, ctx->auxfile,"wb");
 	if (NULL == fp) {
-	    if (quietmode == 1)printf("Error Opening %s for writing!\n",auxfile);
+	    if (ctx->quietmode == 1)printf("Error Opening %s for writing!\n",ctx->auxfile);
 		return INVALID;
 	}
-	WriteDosHeader(fp,8192,8192);
-	c = fwrite(dhrbuf,1,8192,fp);
+	WriteDosHeader(ctx, fp,8192,8192);
+	c = fwrite(ctx->dhrbuf,1,8192,fp);
 	fclose(fp);
 	if (c != 8192) {
-		remove(auxfile);
-		if (quietmode == 1)printf("Error Writing %s!\n",auxfile);
+		b2d_remove(ctx, ctx->auxfile);
+		if (ctx->quietmode == 1)printf("Error Writing %s!\n",ctx->auxfile);
 		return INVALID;
 	}
 
     /* the second file is loaded into main mem */
-	fp = fopen(mainfile,"wb");
+	fp = b2d_fopen(ctx, ctx->mainfile,"wb");
 	if (NULL == fp) {
-		remove(auxfile);
-		if (quietmode == 1)printf("Error Opening %s for writing!\n",mainfile);
+		b2d_remove(ctx, ctx->auxfile);
+		if (ctx->quietmode == 1)printf("Error Opening %s for writing!\n",ctx->mainfile);
 		return INVALID;
 	}
-	WriteDosHeader(fp,8192,8192);
-	c = fwrite(&dhrbuf[8192],1,8192,fp);
+	WriteDosHeader(ctx, fp,8192,8192);
+	c = fwrite(&ctx->dhrbuf[8192],1,8192,fp);
 	fclose(fp);
 	if (c != 8192) {
 		/* remove both files */
-		remove(auxfile);
-		remove(mainfile);
-		if (quietmode == 1)printf("Error Writing %s!\n",mainfile);
+		b2d_remove(ctx, ctx->auxfile);
+		b2d_remove(ctx, ctx->mainfile);
+		if (ctx->quietmode == 1)printf("Error Writing %s!\n",ctx->mainfile);
 		return INVALID;
 	}
 
-	if (quietmode == 1) {
-		printf("%s created!\n",auxfile);
-		printf("%s created!\n",mainfile);
+	if (ctx->quietmode == 1) {
+		printf("%s created!\n",ctx->auxfile);
+		printf("%s created!\n",ctx->mainfile);
 	}
 
-	if (vbmp != 0) {
+	if (ctx->vbmp != 0) {
 		/* additional BMP file for Cybernesto's VBMP */
-		WriteVBMPFile();
+		WriteVBMPFile(ctx);
 	}
 
 	return SUCCESS;
 }
 
 
-int saverag(void)
+int saverag(b2d_context *ctx)
 {
 	FILE *fp;
 	/* make an Rasterized Apple II Graphic (RAG) */
     int c = 0, x, y, xoff, width;
     unsigned char *ptr;
 
-    if (scale == 1) spritewidth = bmpwidth;
-    else spritewidth = bmpwidth * 2;
+    if (ctx->scale == 1) ctx->spritewidth = ctx->bmpwidth;
+    else ctx->spritewidth = ctx->bmpwidth * 2;
 
-    if (spritewidth < 1) {
-	   printf("Width is too small for %s!\n",spritefile);
+    if (ctx->spritewidth < 1) {
+	   printf("Width is too small for %s!\n",ctx->spritefile);
 	   return INVALID;
     }
 
-    memset(hgrbuf,0,8192);
+    memset(ctx->hgrbuf,0,8192);
 	for (y = 0; y < 192; y++) {
-     	hgrline(y); /* translate from DHGR and format the HGR line */
-		hgrbits(y); /* put the HGR line into the HGR file buffer */
+     	hgrline(ctx, y); /* translate from DHGR and format the HGR line */
+		hgrbits(ctx, y); /* put the HGR line into the HGR file buffer */
 	}
 
-    width = spritewidth;
+    width = ctx->spritewidth;
     while (width%7 != 0)width++; /* multiples of 7 pixels */
     /* if we have an orphan pixel hanging at the edge of an even byte
        increase the width to the next 7 pixels */
-    if (width == spritewidth && (width % 14) != 0) width += 7;
+    if (width == ctx->spritewidth && (width % 14) != 0) width += 7;
 	width /= 7;
 	if (width > 40)width = 40; /* likely not necessary */
 
     /* over-ride for default .RAG file extension */
     /* use .BOT extension for full-screen */
     /* use .TOP extension for mixed-screen */
-    if (width == 40 && (bmpheight == 160 || bmpheight == 192)) {
+    if (width == 40 && (ctx->bmpheight == 160 || ctx->bmpheight == 192)) {
 		x = 999;
-		for (y=0;spritefile[y] != (char)0;y++) {
-			if (spritefile[y] == '.') x = y;
+		for (y=0;ctx->spritefile[y] != (char)0;y++) {
+			if (ctx->spritefile[y] == '.') x = y;
 		}
 		if (x != 999) {
-			spritefile[x+2] = 'O';
-			if (bmpheight == 160) {
-				spritefile[x+1] = 'T'; spritefile[x+3] = 'P';
+			ctx->spritefile[x+2] = 'O';
+			if (ctx->bmpheight == 160) {
+				ctx->spritefile[x+1] = 'T'; ctx->spritefile[x+3] = 'P';
 			}
 			else {
-			    spritefile[x+1] = 'B'; spritefile[x+3] = 'T';
+			    ctx->spritefile[x+1] = 'B'; ctx->spritefile[x+3] = 'T';
 			}
 		}
 	}
 
-	fp = fopen(spritefile,"wb");
+	fp = b2d_fopen(ctx, ctx->spritefile,"wb");
 	if (NULL == fp) {
-		printf("Error Opening %s for writing!\n",spritefile);
+		printf("Error Opening %s for writing!\n",ctx->spritefile);
 		return INVALID;
 	}
 
 	/* write 2 byte header */
 	fputc((uchar)width,fp);          /* width in bytes */
-	fputc((uchar)bmpheight,fp);      /* height in scanlines */
+	fputc((uchar)ctx->bmpheight,fp);      /* height in scanlines */
 
-    for (y = 0; y < bmpheight; y++) {
+    for (y = 0; y < ctx->bmpheight; y++) {
 	    xoff = HB[y] - 0x2000;
-    	ptr  = (unsigned char *) &hgrbuf[xoff];
+    	ptr  = (unsigned char *) &ctx->hgrbuf[xoff];
 		c = fwrite(ptr,1,width,fp);
 		if (c!=width) break;
 
@@ -2312,12 +2446,12 @@ int saverag(void)
 	fclose(fp);
 
 	if (c!=width) {
-		remove(spritefile);
-	    printf("Error Writing %s!\n",spritefile);
+		b2d_remove(ctx, ctx->spritefile);
+	    printf("Error Writing %s!\n",ctx->spritefile);
 	    return INVALID;
 	}
 
-	printf("%s created!\n",spritefile);
+	printf("%s created!\n",ctx->spritefile);
     return SUCCESS;
 }
 
@@ -2339,7 +2473,7 @@ int saverag(void)
    etc...
 
 */
-int savesprite(void)
+int savesprite(b2d_context *ctx)
 {
 
 	FILE *fp;
@@ -2347,51 +2481,51 @@ int savesprite(void)
 	ushort fl;
 	uchar *ptraux, *ptrmain, ch;
 
-    if (outputtype != SPRITE_OUTPUT) return SUCCESS;
+    if (ctx->outputtype != SPRITE_OUTPUT) return SUCCESS;
 
-	if (hgroutput == 1) return saverag();
+	if (ctx->hgroutput == 1) return saverag(ctx);
 
     /* if scaling is turned-on the sprite matrix is 280 x 192 so for every 2-pixels
        in the BMP only 1-pixel will be in the sprite. BMPs over 140 x 192 implictly
        and automatically turn-on scaling whether sprite mode is selected (option "F")
        or not.
        */
-    if (scale == 1) spritewidth = bmpwidth / 2;
-    else spritewidth = bmpwidth;
+    if (ctx->scale == 1) ctx->spritewidth = ctx->bmpwidth / 2;
+    else ctx->spritewidth = ctx->bmpwidth;
 
-    if (spritewidth < 1) {
-	   if (quietmode == 1)printf("Width is too small for %s!\n",spritefile);
+    if (ctx->spritewidth < 1) {
+	   if (ctx->quietmode == 1)printf("Width is too small for %s!\n",ctx->spritefile);
 	   return INVALID;
     }
-    while (spritewidth%7 != 0) spritewidth++;
+    while (ctx->spritewidth%7 != 0) ctx->spritewidth++;
 
-    width = (int)((spritewidth / 7) * 4); /* 4 bytes = 7 pixels */
+    width = (int)((ctx->spritewidth / 7) * 4); /* 4 bytes = 7 pixels */
     packet = (int)width / 2;
 
     /* prepare either an image fragment or a mask for the image fragment */
     /* the idea for a mask is to provide a background mixing map for the image fragment */
-    if (spritemask != 1) {
-		fp = fopen(spritefile,"wb");
+    if (ctx->spritemask != 1) {
+		fp = b2d_fopen(ctx, ctx->spritefile,"wb");
 		if (NULL == fp) {
-	    	if (quietmode == 1)printf("Error Opening %s for writing!\n",spritefile);
+	    	if (ctx->quietmode == 1)printf("Error Opening %s for writing!\n",ctx->spritefile);
 			return INVALID;
 		}
 	}
 	else {
-		fp = fopen(fmask,"wb");
+		fp = b2d_fopen(ctx, ctx->fmask,"wb");
 		if (NULL == fp) {
-			if (quietmode == 1)printf("Error Opening %s for writing!\n",fmask);
+			if (ctx->quietmode == 1)printf("Error Opening %s for writing!\n",ctx->fmask);
 			return INVALID;
 		}
 		/* transform the buffer to a black and white mask for the sprite */
 		/* the background is black and the foreground is white */
 		/* this allows a rendered sprite to be prepared independently of the mask */
 		/* and to contain the background color in any rendering or dithering that goes-on */
-		for (y = 0; y < bmpheight; y ++) {
-			for (x = 0; x < spritewidth; x++) {
-        		if (dhrgetpixel(x,y) == backgroundcolor) ch = 0;
+		for (y = 0; y < ctx->bmpheight; y ++) {
+			for (x = 0; x < ctx->spritewidth; x++) {
+        		if (dhrgetpixel(ctx, x,y) == ctx->backgroundcolor) ch = 0;
 		 		else ch = 15;
-		 		dhrplot(x,y,ch);
+		 		dhrplot(ctx, x,y,ch);
 			}
 		}
 		/* now that we have transformed the image into a mask for mixing the sprite
@@ -2399,46 +2533,46 @@ int savesprite(void)
 		   but as a DHM file rather than a DHR file */
 
 		/* append M for mask to the array basename */
-		if (quietmode == 0) strcat(fname,"M");
+		if (ctx->quietmode == 0) strcat(ctx->fname,"M");
 
 	}
 
-	if (dosheader == 1) {
+	if (ctx->dosheader == 1) {
 		fl = (ushort) width;
-		fl *=bmpheight;
+		fl *=ctx->bmpheight;
 		fl += 5;
-		WriteDosHeader(fp,fl,8192);
+		WriteDosHeader(ctx, fp,fl,8192);
 	}
 
 	/* 5 byte header */
 	/* some kind of identifier */
 	fputc('D',fp);
     fputc('H',fp);
-    if (spritemask != 1) fputc('R',fp);
+    if (ctx->spritemask != 1) fputc('R',fp);
     else fputc('M',fp);
 
 	fputc((uchar)width,fp);          /* width in bytes */
-	fputc((uchar)bmpheight,fp);      /* height in scanlines */
+	fputc((uchar)ctx->bmpheight,fp);      /* height in scanlines */
 
      /* write header values to stdout */
-	if (quietmode == 0) {
-		printf("#define %sWIDTH  %d\n",fname,width);
-		printf("#define %sHEIGHT %d\n",fname,bmpheight);
-		printf("#define %sSIZE   %d\n\n",fname,width * bmpheight);
+	if (ctx->quietmode == 0) {
+		printf("#define %sWIDTH  %d\n",ctx->fname,width);
+		printf("#define %sHEIGHT %d\n",ctx->fname,ctx->bmpheight);
+		printf("#define %sSIZE   %d\n\n",ctx->fname,width * ctx->bmpheight);
 
 		/* if we are writing a mask, background color is irrelevant */
 		/* the whole idea behind background color is the same as a mask */
 
-		if (spritemask != 1) printf("uchar %sBackgroundColor = %d;\n\n",fname,backgroundcolor);
+		if (ctx->spritemask != 1) printf("uchar %sBackgroundColor = %d;\n\n",ctx->fname,ctx->backgroundcolor);
 
-		printf("/* Embedded DHGR Image Fragment created from %s */\n\n",bmpfile);
-        printf("uchar %sPixelData[] = {\n",fname);
+		printf("/* Embedded DHGR Image Fragment created from %s */\n\n",ctx->bmpfile);
+        printf("uchar %sPixelData[] = {\n",ctx->fname);
 	}
 
-	for (y = 0, cnt = 0; y < bmpheight; y++) {
+	for (y = 0, cnt = 0; y < ctx->bmpheight; y++) {
 		xoff = HB[y];
-		ptraux  = (uchar *) &dhrbuf[xoff-0x2000];
-		ptrmain = (uchar *) &dhrbuf[xoff];
+		ptraux  = (uchar *) &ctx->dhrbuf[xoff-0x2000];
+		ptrmain = (uchar *) &ctx->dhrbuf[xoff];
 		/* aux raster */
 		c = fwrite((char *)&ptraux[0],1,packet,fp);
 		if (c!= packet) break;
@@ -2446,7 +2580,7 @@ int savesprite(void)
 		c = fwrite((char *)&ptrmain[0],1,packet,fp);
 		if (c!= packet) break;
 
-		if (quietmode == 0) {
+		if (ctx->quietmode == 0) {
 			for (i=0;i<width;i++) {
 				if (i <packet)ch = ptraux[i];
 				else ch = ptrmain[i-packet];
@@ -2462,24 +2596,24 @@ int savesprite(void)
 			}
 		}
 	}
-	if (quietmode == 0) printf("};\n\n");
+	if (ctx->quietmode == 0) printf("};\n\n");
 	fclose(fp);
 
 	if (c!=packet) {
-		if (spritemask != 1) {
-			remove(spritefile);
-	    	if (quietmode == 1)printf("Error Writing %s!\n",spritefile);
+		if (ctx->spritemask != 1) {
+			b2d_remove(ctx, ctx->spritefile);
+	    	if (ctx->quietmode == 1)printf("Error Writing %s!\n",ctx->spritefile);
 		}
 		else {
-			remove(fmask);
-	    	if (quietmode == 1)printf("Error Writing %s!\n",fmask);
+			b2d_remove(ctx, ctx->fmask);
+	    	if (ctx->quietmode == 1)printf("Error Writing %s!\n",ctx->fmask);
 		}
 	    return INVALID;
 	}
 
-	if (quietmode == 1) {
-		if (spritemask != 1) printf("%s created!\n",spritefile);
-		else printf("%s created!\n",fmask);
+	if (ctx->quietmode == 1) {
+		if (ctx->spritemask != 1) printf("%s created!\n",ctx->spritefile);
+		else printf("%s created!\n",ctx->fmask);
 	}
 
 	return SUCCESS;
@@ -2488,31 +2622,30 @@ int savesprite(void)
 
 /* read and remap a mask line from an open mask file */
 /* required by dithered and non-dithered routines when in use */
-sshort ReadMaskLine(ushort y)
+sshort ReadMaskLine(b2d_context *ctx, ushort y)
 {
 	ulong pos;
 	ushort x, packet;
 	uchar ch;
 
-	if (use_overlay == 0) return INVALID;
+	if (ctx->use_overlay == 0) return INVALID;
 
-	if (mono == 1) {
+	if (ctx->mono == 1) {
 		/* two sizes for mono use_overlays depending on output */
 		/* 560 x 192 DHGR use_overlay or 280 x 192 HGR use_overlay */
-		if (hgroutput == 1) packet = 280;
+		if (ctx->hgroutput == 1) packet = 280;
 		else packet = 560;
 	}
 	else packet = 140;
 
 	pos = (ulong) (191 - y);
     pos *= packet;
-    pos += maskbmp.bfi.bfOffBits;
+    pos += ctx->maskbmp.bfi.bfOffBits;
 
-    fseek(fpmask,pos,SEEK_SET);
-	fread((char *)&maskline[0],1,packet,fpmask);
+    b2d_fread_at(ctx, ctx->fpmask, (long)pos, &ctx->maskline[0], packet);
 	for (x = 0; x < packet; x++) {
-		ch = maskline[x];
-		maskline[x] = remap[ch];
+		ch = ctx->maskline[x];
+		ctx->maskline[x] = ctx->remap[ch];
 	}
 	return SUCCESS;
 }
@@ -2583,10 +2716,10 @@ is somewhat less clean and sharp.
 
 /* setting clip to 0 increases the potential amount of retained error */
 /* error is accumulated in a short integer and may be negative or positive */
-uchar AdjustShortPixel(int clip,sshort *buf,sshort value)
+uchar AdjustShortPixel(b2d_context *ctx, int clip,sshort *buf,sshort value)
 {
 
-    if (globalclip == 1) clip = 1;
+    if (ctx->globalclip == 1) clip = 1;
 
     value = (sshort)(buf[0] + value);
     if (clip != 0) {
@@ -2604,52 +2737,71 @@ uchar AdjustShortPixel(int clip,sshort *buf,sshort value)
 
 
 /* helper function for ReadCustomDither */
-int InitCustomLine(char *ptr, int lidx)
+int InitCustomLine(b2d_context *ctx, char *ptr, int lidx)
 {
+    sshort fields[DITHERTAPS];
     int cnt=0, i;
 
-    customdither[lidx][cnt] = (sshort) atoi(ptr);
+    fields[cnt] = (sshort) atoi(ptr);
 
-    /* enforce 11 fields */
+    /* enforce 11 or 15 fields */
     for (i=0;ptr[i]!=0;i++) {
         if (ptr[i]== ',') {
             cnt++;
-            if (cnt < 11) customdither[lidx][cnt] = (sshort) atoi((char*)&ptr[i+1]);
+            if (cnt < DITHERTAPS) fields[cnt] = (sshort) atoi((char*)&ptr[i+1]);
         }
     }
-    if (cnt != 10) return -1;
-    
-    return 0;  // SUCCESS - return 0 when cnt == 10
+    if (cnt != 10 && cnt != DITHERTAPS-1) return -1;
+
+    /* line up the current pixel of 11 field lines with 15 field lines */
+    memcpy(&ctx->customdither[lidx][DITHERCENTER-cnt/2],&fields[0],sizeof(sshort)*(cnt+1));
+
+    return 0;  // SUCCESS - return 0 when cnt == 10 or 14
 }
 
 
 /* read a custom dither pattern from a comma delimited text file
 
    line 1 is the custom divisor
-   the next 3 lines are 11 fields in the following format:
+   the next 3 to 5 lines are the pattern, each of 11 or 15 fields:
 
 	0,0,0,0,0,*,0,0,0,0,0
 	0,0,0,0,0,0,0,0,0,0,0
 	0,0,0,0,0,0,0,0,0,0,0
 
+	or
+
+	0,0,0,0,0,0,0,*,0,0,0,0,0,0,0
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+
+	the first line is the current scanline and the current pixel
+	(asterisk) is at subscript 5 of an 11 field line and at subscript 7
+	of a 15 field line. InitCustomLine() centers 11 field lines in 15
+	fields so both can be used in the same pattern.
+
 	unused fields must be padded with zeros
 
 	errata:
 
 	- no range checking
-    - current pixel (asterisk) at subscript 5 is not "protected"
+	- the current pixel (asterisk) is not "protected"
+	- the pattern is not mirrored on the reversed scanlines of the
+	  serpentine effect (option DX), see CustomKernel()
 
 */
-int ReadCustomDither(char *name)
+int ReadCustomDither(b2d_context *ctx, char *name)
 {
 	FILE *fp;
 	char ch, buf[128];
 	int i,j;
 
     /* clear 3-dimensional custom dither array */
-    memset(&customdither[0][0],0,sizeof(sshort)*33);
+    memset(&ctx->customdither[0][0],0,sizeof(ctx->customdither));
 
-	fp = fopen(name,"r");
+	fp = b2d_fopen(ctx, name,"r");
 	if (NULL == fp) return -1;
 
 	/* read divisor */
@@ -2664,15 +2816,16 @@ int ReadCustomDither(char *name)
 		if (ch < 48 || ch > 57) continue;
 		break;
 	}
-	customdivisor = (sshort) atoi(buf);
-	if (customdivisor < 1) {
+	ctx->customdivisor = (sshort) atoi(buf);
+	if (ctx->customdivisor < 1) {
 		fclose(fp);
 		return -1;
 	}
 
-    /* read up to 3 lines of dither pattern */
+    /* read 3 to 5 lines of dither pattern */
 	for (i=0;;) {
 		if (NULL == fgets(buf, 128, fp)) {
+			if (i >= 3) break;
 	    	fclose(fp);
 	    	return -1;
 		}
@@ -2691,43 +2844,30 @@ int ReadCustomDither(char *name)
 			break;
 		}
 
-        /* parse fields - there must be 11 fields */
-		if(InitCustomLine((char *)&buf[0],i)==-1) {
+        /* parse fields - there must be 11 or 15 fields */
+		if(InitCustomLine(ctx, (char *)&buf[0],i)==-1) {
 			fclose(fp);
 			return -1;
 		}
 		i++;
-		if (i == 3) break;
+		if (i == DITHERROWS) break;
 	}
 	fclose(fp);
 	if (i == 0) return -1;
 
-	if (quietmode == 1) {
+	if (ctx->quietmode == 1) {
 		printf("Imported Dither from %s\n",name);
 	}
 
-    dither = CUSTOM;
+    ctx->dither = CUSTOM;
     return SUCCESS;
 
 }
 
-/* http://en.wikipedia.org/wiki/Floyd%E2%80%93Steinberg_dithering */
-/* http://www.tannerhelland.com/4660/dithering-eleven-algorithms-source-code/ */
-/* http://www.efg2.com/Lab/Library/ImageProcessing/DHALF.TXT */
-int run0=0, run1=0, run2=0;
-
-void FloydSteinberg(int y, int width)
+/* called before the first scanline is dithered */
+void DitherStart(b2d_context *ctx)
 {
 
-	double paldistance; /* not used in this function */
-	sshort red, green, blue, red_error, green_error, blue_error;
-	sshort pos, mult;
-    int dx,i, x,x1, total_difference, total_error, total_used;
-    int testrun, runs, temperror, z;
-    uchar drawcolor, r,g,b;
-
-   if (ditherstart == 0) {
-
 	   /* for hgr color dithering cancel serpentine effect and go forward only
 	   otherwise groups of 7 pixels for choosing between Orange and Green hgr
 	   palettes becomes too complicated */
@@ -2735,38 +2875,56 @@ void FloydSteinberg(int y, int width)
 	   /* this solution may effect user definable dithering but it is up to the
 		  user to make their own pattern work within the program's limitations
 		  */
-	   if (hgrdither == 1) serpentine = 0;
+	   if (ctx->hgrdither == 1) ctx->serpentine = 0;
 
-	   if (quietmode == 1) {
-		  if (mono == 1) puts("Monochrome Dithered Output:");
+	   if (ctx->quietmode == 1) {
+		  if (ctx->mono == 1) puts("Monochrome Dithered Output:");
 		  else puts("Color Dithered Output:");
 
-		  if (colorbleed < 100)
-		   	printf("Dither = %d - %s, Color Bleed Increase: %d%%\n",dither,dithertext[dither-1],(colorbleed-100)*-1);
-		  else if (colorbleed > 100)
-		  	printf("Dither = %d - %s, Color Bleed Reduction: %d%%\n",dither,dithertext[dither-1],(colorbleed-100));
+		  if (ctx->colorbleed < 100)
+		   	printf("Dither = %d - %s, Color Bleed Increase: %d%%\n",ctx->dither,dithertext[ctx->dither-1],(ctx->colorbleed-100)*-1);
+		  else if (ctx->colorbleed > 100)
+		  	printf("Dither = %d - %s, Color Bleed Reduction: %d%%\n",ctx->dither,dithertext[ctx->dither-1],(ctx->colorbleed-100));
 		  else
-		    printf("Dither = %d - %s\n",dither,dithertext[dither-1]);
+		    printf("Dither = %d - %s\n",ctx->dither,dithertext[ctx->dither-1]);
 
-		  if (serpentine == 1) puts("Serpentine effect is on!");
+		  if (ctx->serpentine == 1) puts("Serpentine effect is on!");
 
 	   }
-	   ditherstart = 1;
+	   ctx->ditherstart = 1;
 	   /* reduce or increase color bleed */
-	   switch(dither) {
-			case  FLOYDSTEINBERG: 	bleed = (16 * colorbleed)/100; break;
-			case  JARVIS:			bleed = (48 * colorbleed)/100; break;
-			case  STUCKI:			bleed = (42 * colorbleed)/100; break;
-			case  ATKINSON:         bleed = (8  * colorbleed)/100; break;
+	   switch(ctx->dither) {
+			case  FLOYDSTEINBERG: 	ctx->bleed = (16 * ctx->colorbleed)/100; break;
+			case  JARVIS:			ctx->bleed = (48 * ctx->colorbleed)/100; break;
+			case  STUCKI:			ctx->bleed = (42 * ctx->colorbleed)/100; break;
+			case  ATKINSON:         ctx->bleed = (8  * ctx->colorbleed)/100; break;
 			case  BURKES:
-			case  SIERRA:           bleed = (32 * colorbleed)/100; break;
-			case  SIERRATWO:        bleed = (16 * colorbleed)/100; break;
-			case  SIERRALITE:       bleed = (4  * colorbleed)/100; break;
-			case  CUSTOM:           bleed = (customdivisor * colorbleed)/100; break;
-			default:				bleed = (8  * colorbleed)/100; break; /* same as atkinson */
+			case  SIERRA:           ctx->bleed = (32 * ctx->colorbleed)/100; break;
+			case  SIERRATWO:        ctx->bleed = (16 * ctx->colorbleed)/100; break;
+			case  SIERRALITE:       ctx->bleed = (4  * ctx->colorbleed)/100; break;
+			case  CUSTOM:           ctx->bleed = (ctx->customdivisor * ctx->colorbleed)/100; break;
+			default:				ctx->bleed = (8  * ctx->colorbleed)/100; break; /* same as atkinson */
 		}
-		if (bleed < 1) bleed = 1;
-   }
+		if (ctx->bleed < 1) ctx->bleed = 1;
+
+		/* choose the error diffusion kernel once - see b2d_dither.c */
+		ctx->ditherkernel = DitherKernel(ctx);
+}
+
+/* http://en.wikipedia.org/wiki/Floyd%E2%80%93Steinberg_dithering */
+/* http://www.tannerhelland.com/4660/dithering-eleven-algorithms-source-code/ */
+/* http://www.efg2.com/Lab/Library/ImageProcessing/DHALF.TXT */
+void FloydSteinberg(b2d_context *ctx, int y, int width)
+{
+
+	sshort red, green, blue, red_error, green_error, blue_error;
+    int x, z;
+    uchar drawcolor, r,g,b;
+
+   if (ctx->ditherstart == 0) DitherStart(ctx);
+
+   /* for serpentine effect alternating scanlines run the error in reverse */
+   ctx->ditherline.reverse = (ctx->serpentine == 1 && y%2 == 1);
 
    /* When converting to HGR do palette matching here between Green-Violet and
 	  Orange-Blue palettes in groups of 7 pixels */
@@ -2775,8 +2933,7 @@ void FloydSteinberg(int y, int width)
    /* if we are dithering HGR we need to decide if we are using the Orange-Blue palette or
       the Green-Violet palette based on groups of 7 pixels */
 
-   if (hgrdither == 1) {
-	   testrun = 0;
+   if (ctx->hgrdither == 1) {
 	   /* the idea here is to work on a copy while we make the first two passes
 	   to determine the palette */
 
@@ -2788,74 +2945,57 @@ void FloydSteinberg(int y, int width)
 		  by just looking at the code */
 
 	   /* Clear the buffers */
-	   memset(&OrangeBlueError[0],0,640);
-	   memset(&GreenVioletError[0],0,640);
-	   memset(&HgrPixelPalette[0],0,320);
+	   memset(&ctx->OrangeBlueError[0],0,640);
+	   memset(&ctx->GreenVioletError[0],0,640);
+	   memset(&ctx->HgrPixelPalette[0],0,320);
 
 	   /* save the original dither buffers */
 	   /* work on a copy for the first two passes */
-	   memcpy(&redSave[0],&redDither[0],640);
-	   memcpy(&greenSave[0],&greenDither[0],640);
-	   memcpy(&blueSave[0],&blueDither[0],640);
-   }
-   else {
-	   testrun = 2;
+	   memcpy(&ctx->redSave[0],&ctx->redDither[0],640);
+	   memcpy(&ctx->greenSave[0],&ctx->greenDither[0],640);
+	   memcpy(&ctx->blueSave[0],&ctx->blueDither[0],640);
+
+	   /* the first two test passes - Orange-Blue and Green-Violet
+	      we don't bother to diffuse the error beyond the current scanline */
+
+	   /* it is not necessary to do so because all we are concerned with is the
+	   color of the transformed pixels on the current line, but it is necessary to
+	   dither the line completely in either palette in order to tansform the pixels
+	   in the current line */
+	   HgrTrialPass(ctx, y, width);
+
+	   /* restore dither buffer after both test runs for the final run */
+	   memcpy(&ctx->redDither[0],&ctx->redSave[0],640);
+	   memcpy(&ctx->greenDither[0],&ctx->greenSave[0],640);
+	   memcpy(&ctx->blueSave[0],&ctx->blueDither[0],640);
+
+	   /* determine hgr palette for each pixel based on the first two
+		  runs here before beginning the 3rd and final run */
+	   for (x = 0; x < width; x+=7) {
+			red_error = green_error = 0;
+			for (z = 0; z < 7; z++) {
+				red_error += ctx->OrangeBlueError[x+z];
+				green_error += ctx->GreenVioletError[x+z];
+			}
+			/* if the Green-Violet palette has the closest colors for
+			   this group then use it. otherwise use the Orange-Blue
+			   palette */
+			if (green_error < red_error) ctx->dither7 = 'G';
+			else ctx->dither7 = 'O';
+			/* set the hgr palette for 7 pixels */
+			for (z = 0; z < 7; z++) {
+				ctx->HgrPixelPalette[x+z] = ctx->dither7;
+			}
+	   }
    }
 
-   /* if we are dithering color hgr, for the first two test passes, we don't
-   bother to diffuse the error beyond the current scanline */
-
-   /* it is not necessary to do so because all we are concerned with is the
-   color of the transformed pixels on the current line, but it is necessary to
-   dither the line completely in either palette in order to tansform the pixels
-   in the current line */
-   for (runs=testrun;runs<3;runs++) {
-
-       /* big hgr color rigamorole here */
-	   if (hgrdither == 1) {
-	       if (runs == 1 || runs == 2) {
-			    /* restore dither buffer after both test runs for the final run */
-	   			memcpy(&redDither[0],&redSave[0],640);
-	   			memcpy(&greenDither[0],&greenSave[0],640);
-	   			memcpy(&blueSave[0],&blueDither[0],640);
-		   }
-
-           /* for the first two runs, dither7 does not change */
-		   if (runs == 0) {
-			   dither7 = 'O';
-		   }
-		   else if (runs == 1) {
-			   dither7 = 'G';
-		   }
-		   else {
-			    /* after the first two runs */
-			    /* determine hgr palette for each pixel based on the first two
-				   runs here before beginning the 3rd and final run */
-		   		for (x = 0; x < width; x+=7) {
-					red_error = green_error = 0;
-					for (z = 0; z < 7; z++) {
-						red_error += OrangeBlueError[x+z];
-						green_error += GreenVioletError[x+z];
-					}
-					/* if the Green-Violet palette has the closest colors for
-					   this group then use it. otherwise use the Orange-Blue
-					   palette */
-					if (green_error < red_error) dither7 = 'G';
-					else dither7 = 'O';
-					/* set the hgr palette for 7 pixels */
-					for (z = 0; z < 7; z++) {
-						HgrPixelPalette[x+z] = dither7;
-					}
-		   		}
-		   }
-
-	   }
+   ctx->ditherline.oneline = (ctx->ditheroneline == 1);
 
-	   for (x=0;x<width;x++) {
+   for (x=0;x<width;x++) {
 
-      	  red   = redDither[x];
-          green = greenDither[x];
-          blue  = blueDither[x];
+      	  red   = ctx->redDither[x];
+          green = ctx->greenDither[x];
+          blue  = ctx->blueDither[x];
 
 		  r = (uchar)red;
 		  g = (uchar)green;
@@ -2868,17 +3008,17 @@ void FloydSteinberg(int y, int width)
 			 built based on the lowest 7 pixel cumulative error between the two
 			 palettes that were tested on the first and second passes
 			 respectively */
-          if (hgrdither == 1 && runs == 2) dither7 = HgrPixelPalette[x];
+          if (ctx->hgrdither == 1) ctx->dither7 = ctx->HgrPixelPalette[x];
 
-		  drawcolor = GetDrawColor(r,g,b,x,y);
+		  drawcolor = GetDrawColor(ctx, r,g,b,x,y);
 
-		  r = rgbArray[drawcolor][RED];
-		  g = rgbArray[drawcolor][GREEN];
-		  b = rgbArray[drawcolor][BLUE];
+		  r = ctx->rgbArray[drawcolor][RED];
+		  g = ctx->rgbArray[drawcolor][GREEN];
+		  b = ctx->rgbArray[drawcolor][BLUE];
 
-		  redDither[x]   = (int)r;
-		  greenDither[x] = (int)g;
-		  blueDither[x]  = (int)b;
+		  ctx->redDither[x]   = (int)r;
+		  ctx->greenDither[x] = (int)g;
+		  ctx->blueDither[x]  = (int)b;
 
 		  /* the error is linear in this implementation */
 		  /* - an integer is used so round-off of errors occurs
@@ -2891,443 +3031,24 @@ void FloydSteinberg(int y, int width)
 		  green_error = green - g;
 		  blue_error  = blue - b;
 
-		  if (runs == 0 || runs == 1) {
-			    /* for hgr color only accumulate total error per pixel for the first two passes */
-			    /* use absolute error */
-			    if (red_error < 0) temperror = red_error * -1;
-			    else temperror = red_error;
-			    if (green_error < 0) temperror += (green_error * -1);
-			    else temperror += green_error;
-			    if (blue_error < 0) temperror += (blue_error * -1);
-			    else temperror += blue_error;
-
-		  		if (runs == 0) OrangeBlueError[x] = temperror;
-		  		else GreenVioletError[x] = temperror;
-
-		  		/* before we do the third pass, these arrays will be processed in 7 pixel chunks
-		  		   and the lowest cumulative error in each chunk will determine if the
-		  		   Orange-Blue or Green-Violet hgr palette will be used for the 7 pixels in the chunk */
-
-		  }
-
-		for (i=0;i<3;i++) {
-
-			/* loop through all 3 RGB channels */
-			switch(i) {
-				case RED:   colorptr = (sshort *)&redDither[0];
-							seedptr   = (sshort *)&redSeed[0];
-							seed2ptr  = (sshort *)&redSeed2[0];
-							color_error = red_error;
-							break;
-				case GREEN: colorptr = (sshort *)&greenDither[0];
-							seedptr   = (sshort *)&greenSeed[0];
-							seed2ptr  = (sshort *)&greenSeed2[0];
-							color_error = green_error;
-							break;
-				case BLUE:  colorptr = (sshort *)&blueDither[0];
-							seedptr   = (sshort *)&blueSeed[0];
-							seed2ptr  = (sshort *)&blueSeed2[0];
-							color_error = blue_error;
-							break;
-			}
-
-			/* diffuse the error based on the dither */
-			switch(dither) {
-				/* F 1*/
-				case FLOYDSTEINBERG:
-					/*
-						*   7
-					3   5   1 	(1/16)
-
-					Serpentine
-
-					7   *
-					1   5   3
-
-					*/
-
-					/* if error summing is turned-on add the accumulated rounding error
-					   to the next pixel */
-					if (errorsum == 0) {
-						total_difference = 0;
-					}
-					else {
-						total_error = (color_error * 16) / bleed;
-						total_used =  (color_error * 3)/bleed;
-						total_used += (color_error * 5)/bleed;
-						total_used += (color_error * 1)/bleed;
-						total_used += (color_error * 7)/bleed;
-						total_difference = total_error - total_used;
-					}
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						/* for serpentine effect line 1 error is added behind */
-						if (x > 0) AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error * 7)/bleed)+total_difference);
-						/* seed next line forward */
-						/* for serpentine effect line 2 error is reversed */
-						if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error * 1)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error * 3)/bleed));
-
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error * 7)/bleed)+total_difference);
-
-						/* if making hgr passes 0 and 1 dither first line only */
-						if (runs < 2 || ditheroneline == 1) break;
-
-						/* seed next line forward */
-						if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error * 3)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error * 1)/bleed));
-					}
-
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error * 5)/bleed));
-					break;
-
-				/* J 2 */
-				case JARVIS:
-					/*
-						*   7   5
-					3   5   7   5   3
-					1   3   5   3   1	(1/48)
-					*/
-
-					/* finish this line */
-					AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error * 7)/bleed));
-					AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)((color_error * 5)/bleed));
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next lines forward */
-					if (x>0){
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error * 5)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seed2ptr[x-1],(sshort)((color_error * 3)/bleed));
-					}
-					if (x>1){
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x-2],(sshort)((color_error * 3)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seed2ptr[x-2],(sshort)(color_error/bleed));
-
-					}
-
-					/* seed next line forward */
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error * 7)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error * 5)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+2],(sshort)((color_error * 3)/bleed));
-
-					/* seed furthest line forward */
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x],(sshort)((color_error * 5)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x+1],(sshort)((color_error * 3)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x+2],(sshort)(color_error/bleed));
-					break;
-
-				/* S 3 */
-				case STUCKI:
-					/*
-							*   8   4
-					2   4   8   4   2
-					1   2   4   2   1	(1/42)
-					*/
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if(x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error * 8)/bleed));
-						if(x>1)AdjustShortPixel(1,(sshort *)&colorptr[x-2],(sshort)((color_error * 4)/bleed));
-
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error * 8)/bleed));
-						AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)((color_error * 4)/bleed));
-					}
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next lines forward */
-					if (x>0){
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error * 4)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seed2ptr[x-1],(sshort)((color_error * 2)/bleed));
-					}
-					if (x>1){
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x-2],(sshort)((color_error * 2)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seed2ptr[x-2],(sshort)(color_error/bleed));
-
-					}
-
-					/* seed next line forward */
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error * 8)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error * 4)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+2],(sshort)((color_error * 2)/bleed));
-
-					/* seed furthest line forward */
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x],(sshort)((color_error * 4)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x+1],(sshort)((color_error * 2)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x+2],(sshort)(color_error/bleed));
-					break;
-
-				/* A 4 */
-				case ATKINSON:
-					/*
-						*   1   1
-					1   1   1
-						1			(1/8)
-
-					*/
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if (x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)(color_error/bleed));
-						if (x>1)AdjustShortPixel(1,(sshort *)&colorptr[x-2],(sshort)(color_error/bleed));
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)(color_error/bleed));
-						AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)(color_error/bleed));
-					}
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next line forward */
-					if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)(color_error/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)(color_error/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)(color_error/bleed));
-
-					/* seed furthest line forward */
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x],(sshort)(color_error/bleed));
-					break;
-
-				/* B 5 */
-				case BURKES:
-					/*
-							*   8   4
-					2   4   8   4   2	(1/32)
-					*/
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if(x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error * 8) /bleed));
-						if(x>1)AdjustShortPixel(1,(sshort *)&colorptr[x-2],(sshort)((color_error * 4) /bleed));
-
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error * 8) /bleed));
-						AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)((color_error * 4) /bleed));
-
-					}
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next line forward */
-					if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error * 4) / bleed));
-					if (x>1)AdjustShortPixel(threshold,(sshort *)&seedptr[x-2],(sshort)((color_error * 2) / bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error * 8) /bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error * 4) /bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+2],(sshort)((color_error * 2) /bleed));
-					break;
-
-				/* SI 6 */
-				case SIERRA:
-					/*
-							*   5   3
-					2   4   5   4   2
-						2   3   2		(1/32)
-					*/
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if(x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error * 5)/bleed));
-						if(x>1)AdjustShortPixel(1,(sshort *)&colorptr[x-2],(sshort)((color_error * 3)/bleed));
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error * 5)/bleed));
-						AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)((color_error * 3)/bleed));
-					}
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next lines forward */
-					if (x>0){
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error * 4)/bleed));
-						AdjustShortPixel(threshold,(sshort *)&seed2ptr[x-1],(sshort)((color_error * 2)/bleed));
-					}
-					if (x>1){
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x-2],(sshort)((color_error * 2)/bleed));
-					}
-
-					/* seed next line forward */
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error * 5)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error * 4)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+2],(sshort)((color_error * 2)/bleed));
-
-					/* seed furthest line forward */
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x],(sshort)((color_error * 3)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x+1],(sshort)((color_error * 2)/bleed));
-					break;
-
-				/* S2 7 */
-				case SIERRATWO:
-					/*
-							*   4   3
-					1   2   3   2   1	(1/16)
-					*/
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if(x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error*4)/bleed));
-						if(x>1)AdjustShortPixel(1,(sshort *)&colorptr[x-2],(sshort)((color_error*3)/bleed));
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error*4)/bleed));
-						AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)((color_error*3)/bleed));
-					}
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next line forward */
-					if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)((color_error*2)/bleed));
-					if (x>1)AdjustShortPixel(threshold,(sshort *)&seedptr[x-2],(sshort)(color_error/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error*3)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)((color_error*2)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+2],(sshort)(color_error/bleed));
-					break;
-
-				/* SL 8 */
-				case SIERRALITE:
-					/*
-						*   2
-					1   1		(1/4)
-					*/
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if (x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error * 2) /bleed));
-
-						/* seed next line forward */
-						AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)(color_error/bleed));
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error * 2) /bleed));
-						/* if making hgr passes 0 and 1 dither first line only */
-						if (runs < 2 || ditheroneline == 1) break;
-
-						/* seed next line forward */
-						if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)(color_error/bleed));
-					}
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)(color_error/bleed));
-
-					break;
-
-
-			   case CUSTOM:
-
-					/* 0,0,0,0,0,*,0,0,0,0,0
-					   0,0,0,0,0,0,0,0,0,0,0
-					   0,0,0,0,0,0,0,0,0,0,0 */
-
-					for (dx = 0,pos=x-5;dx < 11; dx++,pos++) {
-					   /* finish this line */
-					   if (pos < 0) continue;
-
-					   mult = customdither[0][dx];
-					   if (mult > 0) {
-						   AdjustShortPixel(1,(sshort *)&colorptr[pos],(sshort)((color_error * mult) /bleed));
-					   }
-
-					   /* if making hgr passes 0 and 1 dither first line only */
-					   if (runs < 2 || ditheroneline == 1) continue;
-
-					   /* seed next line forward */
-					   mult = customdither[1][dx];
-					   if (mult > 0) {
-						   AdjustShortPixel(threshold,(sshort *)&seedptr[pos],(sshort)((color_error * mult) /bleed));
-					   }
-					   /* seed furthest line forward */
-					   mult = customdither[2][dx];
-					   if (mult > 0) {
-						   AdjustShortPixel(threshold,(sshort *)&seed2ptr[pos],(sshort)((color_error * mult) /bleed));
-					   }
-
-					}
-					break;
-
-				default: /* buckels dither - d9 */
-				   /*
-					  * 2 1
-					1 2 1
-					  1          (1/8)
-
-					Serpentine
-
-				  1 2 *
-					1 2 1
-					  1
-
-					*/
-
-					/* if error summing is turned-on add the accumulated rounding error
-					   to the next pixel */
-					if (errorsum == 0) {
-						total_difference = 0;
-					}
-					else {
-						total_error = (color_error * 8) / bleed;
-						total_used =  (color_error * 2)/bleed;
-						total_used += (color_error * 2)/bleed;
-						total_used += (color_error /bleed);
-						total_used += (color_error /bleed);
-						total_used += (color_error /bleed);
-						total_used += (color_error /bleed);
-						total_difference = total_error - total_used;
-					}
-
-					/* for serpentine effect alternating scanlines run the error in reverse */
-					if (serpentine == 1 && y%2 == 1) {
-						/* finish this line */
-						if (x>0)AdjustShortPixel(1,(sshort *)&colorptr[x-1],(sshort)((color_error*2)/bleed)+total_difference);
-						if (x>1)AdjustShortPixel(1,(sshort *)&colorptr[x-2],(sshort)(color_error/bleed));
-					}
-					else {
-						/* finish this line */
-						AdjustShortPixel(1,(sshort *)&colorptr[x+1],(sshort)((color_error*2)/bleed)+total_difference);
-						AdjustShortPixel(1,(sshort *)&colorptr[x+2],(sshort)(color_error/bleed));
-					}
-
-					/* if making hgr passes 0 and 1 dither first line only */
-					if (runs < 2 || ditheroneline == 1) break;
-
-					/* seed next line forward */
-					if (x>0)AdjustShortPixel(threshold,(sshort *)&seedptr[x-1],(sshort)(color_error/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x],(sshort)((color_error*2)/bleed));
-					AdjustShortPixel(threshold,(sshort *)&seedptr[x+1],(sshort)(color_error/bleed));
-
-					/* seed furthest line forward */
-					AdjustShortPixel(threshold,(sshort *)&seed2ptr[x],(sshort)(color_error/bleed));
+		/* diffuse the error in all 3 RGB channels based on the dither */
+		ctx->ditherkernel(&ctx->ditherline, ctx->ditherrow[RED], x, red_error);
+		ctx->ditherkernel(&ctx->ditherline, ctx->ditherrow[GREEN], x, green_error);
+		ctx->ditherkernel(&ctx->ditherline, ctx->ditherrow[BLUE], x, blue_error);
+   }
 
+    /* turn-off hgr color dither */
+	ctx->dither7 = 0;
 
+	FloydSteinbergPlot(ctx, y, width);
+}
 
-				}
-			}
-		}
-	}
+/* plot a dithered scanline - also called for each scanline after DitherImage() */
+void FloydSteinbergPlot(b2d_context *ctx, int y, int width)
+{
 
-    /* turn-off hgr color dither */
-	dither7 = 0;
+    int x,x1;
+    uchar drawcolor, r,g,b, drawline[140];
 
    /* get the mask line from the mask file if we are use_overlaying this image */
    /* the mask file is a 256 color BMP and is applied after rendering is complete and */
@@ -3335,8 +3056,8 @@ void FloydSteinberg(int y, int width)
    /* for monochrome masking the maskfile is either 280 x 192 or 560 x 192 */
    /* for color masking the maskfile is always 140 x 192 */
 
-   if (use_overlay == 1) {
-   		ReadMaskLine(y);
+   if (ctx->use_overlay == 1) {
+   		ReadMaskLine(ctx, y);
    }
 
    /* plot dithered scanline in DHGR buffer using selected conversion palette */
@@ -3344,95 +3065,109 @@ void FloydSteinberg(int y, int width)
    for (x=0,x1=0;x<width;x++) {
 
 
-        maskpixel = 0;
-        if (use_overlay == 1) {
-			overcolor = maskline[x];
-			if (mono == 1) {
+        ctx->maskpixel = 0;
+        if (ctx->use_overlay == 1) {
+			ctx->overcolor = ctx->maskline[x];
+			if (ctx->mono == 1) {
 				/* for monochrome masking if an area is black or white
 				   it use_overlays the image */
-				if (overcolor == 0 || overcolor == 15) maskpixel = 1;
+				if (ctx->overcolor == 0 || ctx->overcolor == 15) ctx->maskpixel = 1;
 			}
 			else {
 				/* for color masking clearcolor is the transparent color for the mask */
 				/* if the use_overlay color is some other color then the pixel is overlaid
 	     		   with the mask color */
-				if (overcolor != clearcolor) maskpixel = 1;
+				if (ctx->overcolor != ctx->clearcolor) ctx->maskpixel = 1;
 			}
 
 		}
 
-        if (maskpixel == 1) {
-			drawcolor = (uchar)overcolor;
+        if (ctx->maskpixel == 1) {
+			drawcolor = (uchar)ctx->overcolor;
 		}
 		else {
-			r = (uchar)redDither[x];
-			g = (uchar)greenDither[x];
-			b = (uchar)blueDither[x];
-			drawcolor = GetMedColor(r,g,b,&paldistance);
+			r = (uchar)ctx->redDither[x];
+			g = (uchar)ctx->greenDither[x];
+			b = (uchar)ctx->blueDither[x];
+			if (ctx->colortable != 0) drawcolor = ColorTableLookup(ctx, r,g,b,NEARCOLOR);
+			else drawcolor = GetMedColor(ctx, r,g,b,NULL);
 		}
 
-		if (mono == 1) {
-			if (width == 280) hrmonoplot(x,y,drawcolor);
-			else dhrmonoplot(x,y,drawcolor);
+		if (ctx->mono == 1) {
+			if (width == 280) hrmonoplot(ctx, x,y,drawcolor);
+			else dhrmonoplot(ctx, x,y,drawcolor);
 		}
-		else dhrplot(x,y,drawcolor);
+		else if (x < 140) drawline[x] = drawcolor;
 
 		/* if color preview option, plot double-wide pixels in pairs of 24-bit RGB triples */
 		/* unless plotting double lo-res */
-		if (preview == 1) {
-			if (mono == 1 || (loresoutput == 1 && lores == 0)) {
-				previewline[x1] = rgbPreview[drawcolor][BLUE]; x1++;
-				previewline[x1] = rgbPreview[drawcolor][GREEN];x1++;
-				previewline[x1] = rgbPreview[drawcolor][RED];  x1++;
+		if (ctx->preview == 1) {
+			if (ctx->mono == 1 || (ctx->loresoutput == 1 && ctx->lores == 0)) {
+				ctx->previewline[x1] = ctx->rgbPreview[drawcolor][BLUE]; x1++;
+				ctx->previewline[x1] = ctx->rgbPreview[drawcolor][GREEN];x1++;
+				ctx->previewline[x1] = ctx->rgbPreview[drawcolor][RED];  x1++;
 
 			}
 			else {
 				/* we are plotting a double pixel in a 6 byte chunk - b,g,r,b,g,r */
-				previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][BLUE]; x1++;
-				previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][GREEN];x1++;
-				previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][RED];  x1+=4;
+				ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][BLUE]; x1++;
+				ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][GREEN];x1++;
+				ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][RED];  x1+=4;
 			}
 		}
    }
 
+   /* plot the whole scanline in the DHGR buffer */
+   if (ctx->mono == 0) dhrputline(ctx, y,drawline,width);
+
 }
 
-ushort WriteDIBHeader(FILE *fp, ushort pixels, ushort rasters)
+/* creates the header for a 24-bit BMP in mybmp */
+ushort SetDIBHeader(b2d_context *ctx, ushort pixels, ushort rasters)
 {
-    ushort outpacket;
-    int c;
+    ulong outpacket;
 
-    memset((char *)&mybmp.bfi.bfType[0],0,sizeof(BMPHEADER));
+    memset((char *)&ctx->mybmp.bfi.bfType[0],0,sizeof(BMPHEADER));
 
     /* create the info header */
-    mybmp.bmi.biSize = (ulong)sizeof(BITMAPINFOHEADER);
-    mybmp.bmi.biWidth  = (ulong)pixels;
-    mybmp.bmi.biHeight = (ulong)rasters;
-    mybmp.bmi.biPlanes = 1;
-    mybmp.bmi.biBitCount = 24;
-    mybmp.bmi.biCompression = (ulong) BI_RGB;
+    ctx->mybmp.bmi.biSize = (ulong)sizeof(BITMAPINFOHEADER);
+    ctx->mybmp.bmi.biWidth  = (ulong)pixels;
+    ctx->mybmp.bmi.biHeight = (ulong)rasters;
+    ctx->mybmp.bmi.biPlanes = 1;
+    ctx->mybmp.bmi.biBitCount = 24;
+    ctx->mybmp.bmi.biCompression = (ulong) BI_RGB;
 
     /* BMP scanlines are padded to a multiple of 4 bytes (DWORD) */
-    outpacket = (ushort)mybmp.bmi.biWidth * 3;
+    outpacket = (ulong)pixels * 3;
     while (outpacket%4 != 0)outpacket++;
-    mybmp.bmi.biSizeImage = (ulong)outpacket;
-	mybmp.bmi.biSizeImage *= mybmp.bmi.biHeight;
+    ctx->mybmp.bmi.biSizeImage = outpacket;
+	ctx->mybmp.bmi.biSizeImage *= ctx->mybmp.bmi.biHeight;
 
     /* create the file header */
-    mybmp.bfi.bfType[0] = 'B';
-    mybmp.bfi.bfType[1] = 'M';
-    mybmp.bfi.bfOffBits = (ulong) sizeof(BMPHEADER);
-    mybmp.bfi.bfSize = mybmp.bmi.biSizeImage + mybmp.bfi.bfOffBits;
-
- 	/* write the header for the output BMP */
-    c = fwrite((char *)&mybmp.bfi.bfType[0],sizeof(BMPHEADER),1,fp);
-
-    if (c!= 1)outpacket = 0;
+    ctx->mybmp.bfi.bfType[0] = 'B';
+    ctx->mybmp.bfi.bfType[1] = 'M';
+    ctx->mybmp.bfi.bfOffBits = (ulong) sizeof(BMPHEADER);
+    ctx->mybmp.bfi.bfSize = ctx->mybmp.bmi.biSizeImage + ctx->mybmp.bfi.bfOffBits;
 
-return outpacket;
+return (ushort)outpacket;
 }
 
-void DiffuseError(ushort outpacket)
+ushort WriteDIBHeader(b2d_context *ctx, FILE *fp, ushort pixels, ushort rasters)
+{
+    ushort outpacket;
+    int c;
+
+    outpacket = SetDIBHeader(ctx, pixels, rasters);
+
+ 	/* write the header for the output BMP */
+    c = fwrite((char *)&ctx->mybmp.bfi.bfType[0],sizeof(BMPHEADER),1,fp);
+
+    if (c!= 1)outpacket = 0;
+
+return outpacket;
+}
+
+void DiffuseError(b2d_context *ctx, ushort outpacket)
 {
 	/*
 		http://en.wikipedia.org/wiki/Error_diffusion
@@ -3459,22 +3194,22 @@ void DiffuseError(ushort outpacket)
 
 	/* create previous pixels for current pixels */
 	/* previous pixel on same line */
-	b2 = dibscanline1[0];
-	g2 = dibscanline1[1];
-	r2 = dibscanline1[2];
+	b2 = ctx->dibscanline1[0];
+	g2 = ctx->dibscanline1[1];
+	r2 = ctx->dibscanline1[2];
 
 	/* previous pixel from previous line */
-	b4 = dibscanline2[0];
-	g4 = dibscanline2[1];
-	r4 = dibscanline2[2];
+	b4 = ctx->dibscanline2[0];
+	g4 = ctx->dibscanline2[1];
+	r4 = ctx->dibscanline2[2];
 
 
 	for (i=0; i < outpacket; i+=3) {
 
         /* RGB Triples */
-	    b = (ushort) dibscanline1[i];
-	    g = (ushort) dibscanline1[i+1];
-	    r = (ushort) dibscanline1[i+2];
+	    b = (ushort) ctx->dibscanline1[i];
+	    g = (ushort) ctx->dibscanline1[i+1];
+	    r = (ushort) ctx->dibscanline1[i+2];
 
         /* add pixels to create 7/8 ratio of required value */
         /* 4 - current pixels
@@ -3487,394 +3222,118 @@ void DiffuseError(ushort outpacket)
         /* add 1 current pixel below - 1/8 ratio of required value */
         /* carry forward b4,g4 and r4 to next pixel */
         /* current pixel below becomes previous pixel below */
-        b4 = dibscanline2[i];   b += b4; while (b % 8 != 0) b++; b /=8;
-		g4 = dibscanline2[i+1]; g += g4; while (g % 8 != 0) g++; g /=8;
-		r4 = dibscanline2[i+2]; r += r4; while (r % 8 != 0) r++; r /=8;
+        b4 = ctx->dibscanline2[i];   b += b4; while (b % 8 != 0) b++; b /=8;
+		g4 = ctx->dibscanline2[i+1]; g += g4; while (g % 8 != 0) g++; g /=8;
+		r4 = ctx->dibscanline2[i+2]; r += r4; while (r % 8 != 0) r++; r /=8;
 
      	/* assign new color to current pixel */
         /* and carry forward b2,g2 and r2 to next pixel */
         /* current pixel becomes previous pixel */
 
-		dibscanline1[i]   = b2 = (uchar)b;
-		dibscanline1[i+1] = g2 = (uchar)g;
-        dibscanline1[i+2] = r2 = (uchar)r;
+		ctx->dibscanline1[i]   = b2 = (uchar)b;
+		ctx->dibscanline1[i+1] = g2 = (uchar)g;
+        ctx->dibscanline1[i+2] = r2 = (uchar)r;
 	}
 }
 
 
 /* create an error-diffused copy of the input file
-   and use that instead */
-FILE *ReadDIBFile(FILE *fp, ushort packet)
+   and use that instead - the copy is kept in memory (see b2d_stage.c) */
+FILE *ReadDIBFile(b2d_context *ctx, FILE *fp, ushort packet)
 {
-	FILE *fpdib;
 	ushort y,outpacket;
 
 
-    if((fpdib=fopen(dibfile,"wb"))==NULL) {
-		printf("Error Opening %s for writing!\n",dibfile);
-		return fp;
-	}
-
-    outpacket = WriteDIBHeader(fpdib,bmpwidth,bmpheight);
-    if (outpacket != packet) {
-		fclose(fpdib);
-		remove(dibfile);
-		printf("Error writing header to %s!\n",dibfile);
+    outpacket = SetDIBHeader(ctx, ctx->bmpwidth,ctx->bmpheight);
+    if (outpacket != packet || StageCreate(ctx) == 0) {
+		printf("Error creating %s!\n",ctx->dibfile);
 		return fp;
 	}
 
     /* seek past extraneous info in header if any */
-	fseek(fp,bfi.bfOffBits,SEEK_SET);
-	for (y=0;y<bmpheight;y++) {
-		fread((char *)&bmpscanline[0],1,packet,fp);
-		memcpy(&dibscanline1[0],&bmpscanline[0],packet);
-		if (y==0) memcpy(&dibscanline2[0],&bmpscanline[0],packet);
-        DiffuseError(packet);
+	StageSeek(ctx, ctx->bfi.bfOffBits);
+	for (y=0;y<ctx->bmpheight;y++) {
+		StageRead(ctx, &ctx->bmpscanline[0], packet);
+		memcpy(&ctx->dibscanline1[0],&ctx->bmpscanline[0],packet);
+		if (y==0) memcpy(&ctx->dibscanline2[0],&ctx->bmpscanline[0],packet);
+        DiffuseError(ctx, packet);
 		/* save a copy of the previous line */
-		if (diffuse == 2) {
+		if (ctx->diffuse == 2) {
 			/* if diffusion is by original value use pure line */
-			memcpy(&dibscanline2[0],&bmpscanline[0],packet);
+			memcpy(&ctx->dibscanline2[0],&ctx->bmpscanline[0],packet);
 		}
 		else {
 			/* otherwise use diffused line */
-			memcpy(&dibscanline2[0],&dibscanline1[0],packet);
+			memcpy(&ctx->dibscanline2[0],&ctx->dibscanline1[0],packet);
 		}
-        fwrite((char *)&dibscanline1[0],1,packet,fpdib);
-
-	}
-    fclose(fpdib);
-    fclose(fp);
+        StageWrite(ctx, &ctx->dibscanline1[0], packet);
 
-    if((fp=fopen(dibfile,"rb"))==NULL) {
-		printf("Error Opening %s for reading!\n",dibfile);
-   		if((fp=fopen(bmpfile,"rb"))==NULL) {
-			printf("Error Opening %s for reading!\n",bmpfile);
-			return fp;
-		}
 	}
-    /* read the header stuff into the appropriate structures */
-    fread((char *)&bfi.bfType[0],
-	             sizeof(BITMAPFILEHEADER),1,fp);
-    fread((char *)&bmi.biSize,
-                 sizeof(BITMAPINFOHEADER),1,fp);
+    StageFinish(ctx, ctx->dibfile);
     return fp;
 }
 
 
-/* helper functions for horizontal resizing */
-int ExpandBMPLine(uchar *src, uchar *dest, ushort srcwidth, ushort scale)
-{
-	int i,j,k;
-	unsigned char r,g,b;
-
-	srcwidth *=3;
-	for (i=0,j=0,k=0;i<srcwidth;) {
-		b = src[i++];
-		g = src[i++];
-		r = src[i++];
-
-		for (j=0;j<scale;j++) {
-			dest[k] = b; k++;
-			dest[k] = g; k++;
-			dest[k] = r; k++;
-		}
-	}
-	return k;
-}
-
-int ShrinkBMPLine(uchar *src, uchar *dest, int srcwidth)
-{
-	int i,j,k;
-	ushort r,g,b;
-
-
-    scale = srcwidth / 140;
-
-	srcwidth *=3;
-	for (i=0,j=0,k=0;k<srcwidth;) {
-        b = g = r = 0;
-		for (j=0;j<scale;j++) {
-			b += src[k++];
-			g += src[k++];
-			r += src[k++];
-		}
-
-		dest[i] = (b/scale);i++;
-		dest[i] = (g/scale);i++;
-		dest[i] = (r/scale);i++;
-
-	}
-	return i;
-}
-
-
-/* shrink 640 or 320 to 140 */
-/* uses dhrbuf as a work buffer and output buffer */
-void ShrinkPixels(FILE *fp)
-{
-
-	int packet = (bmpwidth * 3);
-
-	while (packet%4 != 0)packet++;
-
-	fread((char *)&bmpscanline[0],1,packet,fp);
-  	ExpandBMPLine((uchar *)&bmpscanline[0],(uchar *)&dhrbuf[0],bmpwidth,7);
-	ShrinkBMPLine((uchar *)&dhrbuf[0],(uchar *)&dhrbuf[0],(ushort)(bmpwidth * 7));
-}
-
-/* table-driven scaling from 25 to 24 lines */
-void ShrinkLines25to24(FILE *fp, FILE *fp2)
-{
-	ushort pixel,x,i;
-	ushort x1,x2;
-
-	ShrinkPixels(fp);
-	memcpy(&dibscanline1[0],&dhrbuf[0],420);
-	if (bmpheight == 400) {
-		ShrinkPixels(fp);
-		for (x=0;x<420;x++) {
-			pixel = (ushort) dhrbuf[x];
-			pixel += dibscanline1[x];
-			dibscanline1[x] = (uchar) (pixel/2);
-		}
-	}
-	for (i=0;i<24;i++) {
-		ShrinkPixels(fp);
-		memcpy(&dibscanline2[0],&dhrbuf[0],420);
-		if (bmpheight == 400) {
-			ShrinkPixels(fp);
-			for (x=0;x<420;x++) {
-				pixel = (ushort) dhrbuf[x];
-				pixel += dibscanline2[x];
-				dibscanline2[x] = (uchar) (pixel/2);
-			}
-		}
-
-        for (x=0;x<420;x++) {
-			x1 = (ushort)dibscanline1[x];
-			x2 = (ushort)dibscanline2[x];
-			pixel = (ushort) (x1 * mix25to24[i][0]) + (x2 * mix25to24[i][1]);
-			bmpscanline[x] = (uchar)(pixel/25);
-		}
-	   fwrite((char *)&bmpscanline[0],1,420,fp2);
-	   if (i<23)memcpy(&dibscanline1[0],&dibscanline2[0],420);
-	}
-}
-
-
-/* 640 x 480 scaled to 140 x 192 */
-void ShrinkLines640x480(FILE *fp, FILE *fp2)
-{
-	ushort pixel1,pixel2,x,i;
-
-	ShrinkPixels(fp);
-	memcpy(&dibscanline1[0],&dhrbuf[0],420);
-	ShrinkPixels(fp);
-	memcpy(&dibscanline2[0],&dhrbuf[0],420);
-	ShrinkPixels(fp);
-	memcpy(&dibscanline3[0],&dhrbuf[0],420);
-	ShrinkPixels(fp);
-	memcpy(&dibscanline4[0],&dhrbuf[0],420);
-	ShrinkPixels(fp);
-
- 	for (x=0;x<420;x++) {
-		pixel1 = (ushort) dibscanline1[x];
-		pixel1 += dibscanline2[x];
-		pixel1 *= 2;
-		pixel1 += dibscanline3[x];
-		dibscanline1[x] = (uchar) (pixel1/5);
-
-		pixel2 = (ushort) dhrbuf[x];
-		pixel2 += dibscanline4[x];
-		pixel2 *= 2;
-		pixel2 += dibscanline3[x];
-		dibscanline2[x] = (uchar) (pixel2/5);
-	}
-
-	fwrite((char *)&dibscanline1[0],1,420,fp2);
-	fwrite((char *)&dibscanline2[0],1,420,fp2);
-}
-
-/* merges the RGB values of 2 lines into one */
-void ShrinkLines560x384(FILE *fp, FILE *fp2)
-{
-
-	ushort x, pixel, packet = (bmpwidth * 3);
-
-	while (packet%4 != 0)packet++;
-
-	fread((char *)&bmpscanline[0],1,packet,fp);
-	ShrinkBMPLine((uchar *)&bmpscanline[0],(uchar *)&dibscanline1[0],bmpwidth);
-	fread((char *)&bmpscanline[0],1,packet,fp);
-	ShrinkBMPLine((uchar *)&bmpscanline[0],(uchar *)&dibscanline2[0],bmpwidth);
-	for (x=0;x<420;x++) {
-		pixel = (ushort)dibscanline1[x];
-		pixel+= dibscanline2[x];
-		bmpscanline[x] = (uchar)(pixel/2);
-	}
-	fwrite((char *)&bmpscanline[0],1,420,fp2);
-}
-
-/* lo-res and double lo-res input files are in multiples of 80 pixels */
-int ShrinkLoResLine(uchar *src, uchar *dest, int srcwidth)
-{
-	int i,j,k;
-	ushort r,g,b;
-
-    scale = srcwidth / 80;
-
-	srcwidth *=3;
-	for (i=0,j=0,k=0;k<srcwidth;) {
-        b = g = r = 0;
-		for (j=0;j<scale;j++) {
-			b += src[k++];
-			g += src[k++];
-			r += src[k++];
-		}
-
-		dest[i] = (b/scale);i++;
-		dest[i] = (g/scale);i++;
-		dest[i] = (r/scale);i++;
-
-	}
-	return i;
-}
-
-
-void ShrinkLoResData(FILE *fp, FILE *fp2)
-{
-
-    ushort x, x1, x2, y, lines = 0, srcwidth, packet = (bmpwidth * 3), pixel;
-
-	while (packet%4 != 0)packet++;
-
-
-    switch(bmpwidth) {
-		case 40:
-		case 80:
-		case 88:  lines = 1; srcwidth = 80; break;
-		case 160:
-		case 176: lines = 2; srcwidth = 160; break;
-		case 320: lines = 4; srcwidth = 320; break;
-		case 560: lines = 8; srcwidth = 560; break;
-		case 640: lines = 10;srcwidth = 640; break;
-	}
-
-    /* clear accumulators */
-	memset(&redDither[0],0,480);
-	memset(&greenDither[0],0,480);
-	memset(&blueDither[0],0,480);
-
-    /* scale up */
-	for (y = 0; y < lines; y++) {
-
-		if (bmpwidth == 40) {
-			fread((char *)&dibscanline1[0],1,packet,fp);
-			/* double the width */
-			for (x = 0, x1 = 0, x2 = 0; x < 40; x++) {
-				bmpscanline[x2] = bmpscanline[x2+3] = dibscanline1[x1]; x1++; x2++;
-				bmpscanline[x2] = bmpscanline[x2+3] = dibscanline1[x1]; x1++; x2++;
-				bmpscanline[x2] = bmpscanline[x2+3] = dibscanline1[x1]; x1++; x2+=4;
-			}
-		}
-		else {
-			fread((char *)&bmpscanline[0],1,packet,fp);
-		}
-		ShrinkLoResLine((uchar *)&bmpscanline[0],(uchar *)&dibscanline1[0],srcwidth);
-
-		for (x = 0, x1=0; x < 80; x++) {
-			blueDither[x] += dibscanline1[x1]; x1++;
-			greenDither[x] += dibscanline1[x1]; x1++;
-			redDither[x] += dibscanline1[x1]; x1++;
-
-		}
-	}
-
-	/* scale down */
-	for (x = 0, x1=0; x < 80; x++) {
-		pixel = blueDither[x] / lines;
-		bmpscanline[x1] = (uchar) pixel; x1++;
-		pixel = greenDither[x] / lines;
-		bmpscanline[x1] = (uchar) pixel; x1++;
-		pixel = redDither[x] / lines;
-		bmpscanline[x1] = (uchar) pixel; x1++;
-
-	}
-	fwrite((char *)&bmpscanline[0],1,240,fp2);
-}
-
-
 /* create a resized copy of the input file
-   and use that instead */
-FILE *ResizeBMP(FILE *fp, sshort resize)
+   and use that instead - the copy is kept in memory (see b2d_stage.c) */
+FILE *ResizeBMP(b2d_context *ctx, FILE *fp, sshort resize)
 {
-	FILE *fp2;
 	ushort x,y,packet,outpacket,chunks;
-    ushort i,j,r,g,b;
+    ushort i,j,r,g,b,lines=1,srcwidth;
     ulong offset=0L;
+    int status;
 
 #ifdef TURBOC
 	if (resize == 0)return NULL;
+#else
+	(void)resize;
 #endif
 
-    if((fp2=fopen(scaledfile,"wb"))==NULL) {
-		printf("Error Opening %s for writing!\n",scaledfile);
-		return fp;
-	}
-
-	if (loresoutput == 1) {
+	if (ctx->loresoutput == 1) {
 		/* Lo-Res and Double Lo-Res */
-		if (appletop == 0) outpacket = WriteDIBHeader(fp2,80,48);
-		else outpacket = WriteDIBHeader(fp2,80,40);
-		if (outpacket != 240) {
-			fclose(fp2);
-			remove(scaledfile);
-			printf("Error writing header to %s!\n",scaledfile);
-			return fp;
-		}
+		if (ctx->appletop == 0) outpacket = SetDIBHeader(ctx, 80,48);
+		else outpacket = SetDIBHeader(ctx, 80,40);
 	}
 	else {
         /* HGR and DHGR */
-		if (justify == 1) outpacket = WriteDIBHeader(fp2,280,192);
-		else outpacket = WriteDIBHeader(fp2,140,192);
-		if (outpacket != 420 && outpacket != 840) {
-			fclose(fp2);
-			remove(scaledfile);
-			printf("Error writing header to %s!\n",scaledfile);
-			return fp;
-		}
+		if (ctx->justify == 1) outpacket = SetDIBHeader(ctx, 280,192);
+		else outpacket = SetDIBHeader(ctx, 140,192);
+	}
+	if (StageCreate(ctx) == 0) {
+		printf("Error creating %s!\n",ctx->scaledfile);
+		return fp;
 	}
 
-    packet = bmpwidth * 3;
+    packet = ctx->bmpwidth * 3;
 	while (packet%4 != 0)packet++;
 
-    if (justify == 1) {
-		if (loresoutput == 0) {
+    if (ctx->justify == 1) {
+		if (ctx->loresoutput == 0) {
 		   /* HGR and DHGR */
-		   switch (bmpwidth) {
+		   switch (ctx->bmpwidth) {
 			   case 640:
-						 if (jxoffset > -1) {
-							if (jxoffset > 80) jxoffset = 80;
-							offset+= jxoffset * 3;
+						 if (ctx->jxoffset > -1) {
+							if (ctx->jxoffset > 80) ctx->jxoffset = 80;
+							offset+= ctx->jxoffset * 3;
 						 }
 						 else {
 							offset += 120;
 						 }
-						 if (bmpheight == 480) {
-							 if (jyoffset > -1) {
-								if (jyoffset > 96)jyoffset = 0;
-								else jyoffset = 96 - jyoffset;
-								offset += (1920L * jyoffset);
+						 if (ctx->bmpheight == 480) {
+							 if (ctx->jyoffset > -1) {
+								if (ctx->jyoffset > 96)ctx->jyoffset = 0;
+								else ctx->jyoffset = 96 - ctx->jyoffset;
+								offset += (1920L * ctx->jyoffset);
 							 }
 							 else {
 								offset += (1920L * 48);
 							}
 						 }
-						 if (bmpheight == 400) {
-							 if (jyoffset > -1) {
-								if (jyoffset > 16)jyoffset = 0;
-								else jyoffset = 16 - jyoffset;
-								offset += (1920L * jyoffset);
+						 if (ctx->bmpheight == 400) {
+							 if (ctx->jyoffset > -1) {
+								if (ctx->jyoffset > 16)ctx->jyoffset = 0;
+								else ctx->jyoffset = 16 - ctx->jyoffset;
+								offset += (1920L * ctx->jyoffset);
 							 }
 							 else {
 								offset += (1920L * 8);
@@ -3883,17 +3342,17 @@ FILE *ResizeBMP(FILE *fp, sshort resize)
 						 break;
 
 			   case 320:
-						 if (jxoffset > -1) {
-							if (jxoffset > 40) jxoffset = 40;
-							offset+= jxoffset * 3;
+						 if (ctx->jxoffset > -1) {
+							if (ctx->jxoffset > 40) ctx->jxoffset = 40;
+							offset+= ctx->jxoffset * 3;
 						 }
 						 else {
 							offset += 60;
 						 }
-						 if (jyoffset > -1) {
-							if (jyoffset > 8)jyoffset = 0;
-							else jyoffset = 8 - jyoffset;
-							offset += (960L * jyoffset);
+						 if (ctx->jyoffset > -1) {
+							if (ctx->jyoffset > 8)ctx->jyoffset = 0;
+							else ctx->jyoffset = 8 - ctx->jyoffset;
+							offset += (960L * ctx->jyoffset);
 						 }
 						 else {
 							offset += (960L * 4);
@@ -3904,103 +3363,94 @@ FILE *ResizeBMP(FILE *fp, sshort resize)
 	   }
 	   else {
 		   /* LGR and DLGR */
-		   offset += (jyoffset * packet);
-		   offset += (jxoffset * 3);
+		   offset += (ctx->jyoffset * packet);
+		   offset += (ctx->jxoffset * 3);
 	   }
 
 	}
 
     /* seek past extraneous info in header if any */
-	fseek(fp,bfi.bfOffBits+offset,SEEK_SET);
+	StageSeek(ctx, (long)(ctx->bfi.bfOffBits+offset));
 
-    if (justify == 1 && loresoutput == 0) {
+    if (ctx->justify == 1 && ctx->loresoutput == 0) {
 		for (y = 0;y< 192;y++) {
-		    fread((char *)&dibscanline1[0],1,packet,fp);
-		    if (bmpheight == 200) {
+		    StageRead(ctx, &ctx->dibscanline1[0], packet);
+		    if (ctx->bmpheight == 200) {
 				/* no merging at all on 320 x 200 */
-				fwrite((char *)&dibscanline1[0],1,outpacket,fp2);
+				StageWrite(ctx, &ctx->dibscanline1[0], outpacket);
 				continue;
 			}
-			fread((char *)&dibscanline2[0],1,packet,fp);
+			StageRead(ctx, &ctx->dibscanline2[0], packet);
 			for (x = 0,i=0,j=0;x<280;x++) {
-				b = (ushort)dibscanline1[i]; b+= dibscanline2[i]; i++;
-				g = (ushort)dibscanline1[i]; g+= dibscanline2[i]; i++;
-				r = (ushort)dibscanline1[i]; r+= dibscanline2[i]; i++;
+				b = (ushort)ctx->dibscanline1[i]; b+= ctx->dibscanline2[i]; i++;
+				g = (ushort)ctx->dibscanline1[i]; g+= ctx->dibscanline2[i]; i++;
+				r = (ushort)ctx->dibscanline1[i]; r+= ctx->dibscanline2[i]; i++;
 				/* half merge (merge vertically) unless merge is turned-on */
-				if (merge == 0) {
+				if (ctx->merge == 0) {
 					i+=3;b*=2;g*=2;r*=2;
 				}
 				else {
-					b += dibscanline1[i]; b+= dibscanline2[i]; i++;
-					g += dibscanline1[i]; g+= dibscanline2[i]; i++;
-					r += dibscanline1[i]; r+= dibscanline2[i]; i++;
+					b += ctx->dibscanline1[i]; b+= ctx->dibscanline2[i]; i++;
+					g += ctx->dibscanline1[i]; g+= ctx->dibscanline2[i]; i++;
+					r += ctx->dibscanline1[i]; r+= ctx->dibscanline2[i]; i++;
 				}
-			    bmpscanline[j] = (uchar) (ushort)(b/4);j++;
-			    bmpscanline[j] = (uchar) (ushort)(g/4);j++;
-			    bmpscanline[j] = (uchar) (ushort)(r/4);j++;
+			    ctx->bmpscanline[j] = (uchar) (ushort)(b/4);j++;
+			    ctx->bmpscanline[j] = (uchar) (ushort)(g/4);j++;
+			    ctx->bmpscanline[j] = (uchar) (ushort)(r/4);j++;
 			}
-			fwrite((char *)&bmpscanline[0],1,outpacket,fp2);
+			StageWrite(ctx, &ctx->bmpscanline[0], outpacket);
 		}
 	}
     else {
-		if (loresoutput == 1) {
-			/* LGR and DLGR input file */
-			if (appletop == 1) chunks = 40;
+		/* the pixels are merged down by the area each new one covers -
+		   see ResampleRows() in b2d_resample.c */
+		if (ctx->loresoutput == 1) {
+			/* LGR and DLGR input file - blocks of lines rasters are merged
+			   into one, and 40 pixels wide is doubled */
+			if (ctx->appletop == 1) chunks = 40;
 			else chunks = 48;
 
-            for (y=0;y<chunks;y++) ShrinkLoResData(fp,fp2);
+			switch(ctx->bmpwidth) {
+				case 40:  srcwidth = 40; break;
+				case 160:
+				case 176: lines = 2; srcwidth = 160; break;
+				case 320: lines = 4; srcwidth = 320; break;
+				case 560: lines = 8; srcwidth = 560; break;
+				case 640: lines = 10;srcwidth = 640; break;
+				default:  srcwidth = 80; break;
+			}
+			status = ResampleRows(ctx, offset, srcwidth, (ulong)chunks * lines, 80, 0, chunks, 0);
 		}
 		else {
-			/* HGR and DHGR input file */
-			switch(bmpheight)
-			{
-				case 200:
-				case 400: chunks = 8;   break;
-				case 384: chunks = 192; break;
-				case 480: chunks = 96;  break;
-			}
-
-			for (y=0;y<chunks;y++) {
-				switch(bmpheight) {
-					case 200:
-					case 400: ShrinkLines25to24(fp,fp2);break;
-					case 480: ShrinkLines640x480(fp,fp2);break;
-					case 384: ShrinkLines560x384(fp,fp2);break;
-				}
-			}
+			/* HGR and DHGR input file - 640 x 400 is merged to 200
+			   rasters before 25 rasters are merged to 24 */
+			status = ResampleRows(ctx, 0L, ctx->bmpwidth, ctx->bmpheight, 140,
+				(ushort)(ctx->bmpheight == 400 ? 200 : 0), 192, 0);
 		}
-	}
-    fclose(fp2);
-    fclose(fp);
-
-    if((fp=fopen(scaledfile,"rb"))==NULL) {
-		printf("Error Opening %s for reading!\n",scaledfile);
-   		if((fp=fopen(bmpfile,"rb"))==NULL) {
-			printf("Error Opening %s for reading!\n",bmpfile);
-			return fp;
+		if (status == 0) {
+			StageClose(ctx);
+			printf("Error creating %s!\n",ctx->scaledfile);
+			return NULL;
 		}
+		/* the merged output is single scaled whatever option S asked for -
+		   LGR and DLGR set it again in Convert() */
+		ctx->scale = 0;
 	}
-    /* read the header stuff into the appropriate structures */
-    fread((char *)&bfi.bfType[0],
-	             sizeof(BITMAPFILEHEADER),1,fp);
-    fread((char *)&bmi.biSize,
-                 sizeof(BITMAPINFOHEADER),1,fp);
+    StageFinish(ctx, ctx->scaledfile);
     return fp;
 }
 
 
 /* expand monochrome bmp lines to 24-bit bmp lines */
-void ReformatMonoLine(void)
+void ReformatMonoLine(b2d_context *ctx, uchar *src, uchar *dest, ushort width)
 {
      int i,j,k,packet;
      uchar b = 0, w = 255;
 
-     if (bmpwidth == 280) packet = 35;
+     if (width == 280) packet = 35;
      else packet = 70;
 
-     memcpy(&dibscanline1[0],&bmpscanline[0],packet);
-
-     if (reverse == 1) {
+     if (ctx->reverse == 1) {
 		 b = 255;
 		 w = 0;
 	 }
@@ -4010,11 +3460,11 @@ void ReformatMonoLine(void)
 
         for(k=0;k<8;k++)
         {
-            if (dibscanline1[i]&msk[k]) {
-				bmpscanline[j] = bmpscanline[j+1] = bmpscanline[j+2] = w;
+            if (src[i]&msk[k]) {
+				dest[j] = dest[j+1] = dest[j+2] = w;
 			}
             else {
-				bmpscanline[j] = bmpscanline[j+1] = bmpscanline[j+2] = b;
+				dest[j] = dest[j+1] = dest[j+2] = b;
 			}
             j+=3;
         }
@@ -4022,141 +3472,83 @@ void ReformatMonoLine(void)
 }
 
 /* expand 16 color and 256 color bmp lines to 24-bit bmp lines */
-void ReformatVGALine(void)
+void ReformatVGALine(b2d_context *ctx, uchar *src, uchar *dest, ushort width, ushort bitcount)
 {
-	sshort i, j, packet;
+	sshort i, j;
 	uchar ch;
 
-    memset(dibscanline1,0,1920);
-	if (bmi.biBitCount == 8) {
-       memcpy(&dibscanline1[0],&bmpscanline[0],bmpwidth);
-    }
-    else {
-		packet = bmpwidth /2;
-		if (bmpwidth%2 != 0) packet++;
-		for (i=0,j=0;i<packet;i++) {
-			ch = bmpscanline[i] >> 4;
-			dibscanline1[j] = ch; j++;
-			ch = bmpscanline[i] & 0xf;
-			dibscanline1[j] = ch; j++;
-		}
-	}
-	memset(&bmpscanline[0],0,1920);
-	for (i=0,j=0;i<bmpwidth;i++) {
-		  ch = dibscanline1[i];
-	      bmpscanline[j] = sbmp[ch].rgbBlue; j++;
-	      bmpscanline[j] = sbmp[ch].rgbGreen; j++;
-	      bmpscanline[j] = sbmp[ch].rgbRed; j++;
+	for (i=0,j=0;i<width;i++) {
+		  if (bitcount == 8) ch = src[i];
+		  else if (i%2 == 0) ch = src[i/2] >> 4;
+		  else ch = src[i/2] & 0xf;
+	      dest[j] = ctx->sbmp[ch].rgbBlue; j++;
+	      dest[j] = ctx->sbmp[ch].rgbGreen; j++;
+	      dest[j] = ctx->sbmp[ch].rgbRed; j++;
 	 }
 }
 
 /* convert 16 color and 256 color bmps to 24 bit bmps */
 /* convert Monochrome bmps to 24 bit bmps */
-FILE *ReformatBMP(FILE *fp)
+/* scanlines are converted as they are read (see b2d_stage.c) */
+FILE *ReformatBMP(b2d_context *ctx, FILE *fp)
 {
 
-    FILE *fp2;
 	sshort status = SUCCESS;
-	ushort packet, outpacket,y;
+	ushort packet;
 
-	if (bmi.biBitCount == 1) {
+	if (ctx->bmi.biBitCount == 1) {
 		/* Mono HGR = 280 and Mono DHGR = 560 */
-		if (bmpwidth != 280 && bmpwidth != 560) status = INVALID;
-		if (bmpheight != 192) status = INVALID;
-	}
-	else {
-		/* HGR and DHGR size check */
-		/* LGR and DLGR sizes were checked previously in Convert() */
-		if (loresoutput == 0) {
-			if (bmpwidth > 280) {
-				status = INVALID;
-				switch(bmpwidth) {
-					case 640: if (bmpheight == 400 || bmpheight == 480) status = SUCCESS; break;
-					case 320: if (bmpheight == 200) status = SUCCESS; break;
-					case 560: if (bmpheight == 384) status = SUCCESS; break;
-				}
-			}
-			else {
-				if (bmpheight > 192) status = INVALID;
-			}
-		}
+		if (ctx->bmpwidth != 280 && ctx->bmpwidth != 560) status = INVALID;
+		if (ctx->bmpheight != 192) status = INVALID;
 	}
+	/* 4 and 8 bit input of any other size is resampled after it is
+	   reformatted (see b2d_resample.c) */
 
 	if (status == INVALID) {
-		fclose(fp);
+		StageClose(ctx);
 		fp = NULL;
-		printf("%s is not a supported size!\n",bmpfile);
+		printf("%s is not a supported size!\n",ctx->bmpfile);
 		return fp;
 	}
 
-	if (bmi.biBitCount == 8)
-		fread((char *)&sbmp[0].rgbBlue, sizeof(RGBQUAD)*256,1,fp);
-	else if (bmi.biBitCount == 4)
-		fread((char *)&sbmp[0].rgbBlue, sizeof(RGBQUAD)*16,1,fp);
-	else if (bmi.biBitCount == 1)
-	    fread((char *)&sbmp[0].rgbBlue, sizeof(RGBQUAD)*2,1,fp);
-
-    /* seek past extraneous info in header if any */
-	fseek(fp,bfi.bfOffBits,SEEK_SET);
+	if (ctx->bmi.biBitCount == 8)
+		fread((char *)&ctx->sbmp[0].rgbBlue, sizeof(RGBQUAD)*256,1,fp);
+	else if (ctx->bmi.biBitCount == 4)
+		fread((char *)&ctx->sbmp[0].rgbBlue, sizeof(RGBQUAD)*16,1,fp);
+	else if (ctx->bmi.biBitCount == 1)
+	    fread((char *)&ctx->sbmp[0].rgbBlue, sizeof(RGBQUAD)*2,1,fp);
 
     /* align on 4 byte boundaries */
-    if (bmi.biBitCount == 1) {
-		if (bmpwidth == 280) packet = 36;
+    if (ctx->bmi.biBitCount == 1) {
+		if (ctx->bmpwidth == 280) packet = 36;
 		else packet = 72;
 	}
-    else if (bmi.biBitCount == 8) {
-		packet = bmpwidth;
+    else if (ctx->bmi.biBitCount == 8) {
+		packet = ctx->bmpwidth;
 	}
 	else {
-		packet = bmpwidth / 2;
-		if (bmpwidth%2 != 0)packet++;
+		packet = ctx->bmpwidth / 2;
+		if (ctx->bmpwidth%2 != 0)packet++;
 	}
     while ((packet % 4)!=0)packet++;
 
-    if((fp2=fopen(reformatfile,"wb"))==NULL) {
-		printf("Error Opening %s for writing!\n",reformatfile);
-		return fp;
-	}
-    if (bmi.biBitCount == 1) {
-		if (bmpwidth == 280) outpacket = WriteDIBHeader(fp2,bmpwidth,bmpheight);
-		else outpacket = WriteDIBHeader(fp2,bmpwidth,bmpheight*2);
+    /* double lines for DHGR monochrome conversion */
+    /* single lines for HGR monochrome conversion */
+    if (ctx->bmi.biBitCount == 1 && ctx->bmpwidth == 560) {
+		SetDIBHeader(ctx, ctx->bmpwidth,ctx->bmpheight*2);
 	}
 	else {
-    	outpacket = WriteDIBHeader(fp2,bmpwidth,bmpheight);
-	}
-    if (outpacket < 1) {
-		fclose(fp2);
-		remove(reformatfile);
-		printf("Error writing header to %s!\n",reformatfile);
-		return fp;
-	}
-
-  	for (y=0;y<bmpheight;y++) {
-		fread((char *)&bmpscanline[0],1,packet,fp);
-		if (bmi.biBitCount == 1) ReformatMonoLine();
-		else ReformatVGALine();
-        fwrite((char *)&bmpscanline[0],1,outpacket,fp2);
-        /* double lines for DHGR monochrome conversion */
-        /* single lines for HGR monochrome conversion */
-        if (bmi.biBitCount == 1 && bmpwidth == 560) fwrite((char *)&bmpscanline[0],1,outpacket,fp2);
+    	SetDIBHeader(ctx, ctx->bmpwidth,ctx->bmpheight);
 	}
-    fclose(fp2);
-    fclose(fp);
 
-    reformat = 1;
+    ctx->reformat = 1;
 
-    if((fp=fopen(reformatfile,"rb"))==NULL) {
-		printf("Error Opening %s for reading!\n",reformatfile);
-   		if((fp=fopen(bmpfile,"rb"))==NULL) {
-			printf("Error Opening %s for reading!\n",bmpfile);
-			return fp;
-		}
+    /* the 24 bit header replaces the header that was read */
+    if (StageReformat(ctx, packet, (ushort)ctx->mybmp.bmi.biHeight) == 0) {
+		StageClose(ctx);
+		printf("Error creating %s!\n",ctx->reformatfile);
+		return NULL;
 	}
-    /* read the header stuff into the appropriate structures */
-    fread((char *)&bfi.bfType[0],
-	             sizeof(BITMAPFILEHEADER),1,fp);
-    fread((char *)&bmi.biSize,
-                 sizeof(BITMAPINFOHEADER),1,fp);
     return fp;
 }
 
@@ -4164,7 +3556,7 @@ FILE *ReformatBMP(FILE *fp)
 /* use_overlay using a 256 color BMP file in verbatim output resolution */
 /* HGR and DHGR color use_overlay files are 140 x 192 */
 /* HGR and DHGR monochrome are 280 x 192 and 560 x 192 respectively */
-sshort OpenMaskFile(void)
+sshort OpenMaskFile(b2d_context *ctx)
 {
 
 	sshort status = INVALID;
@@ -4172,35 +3564,35 @@ sshort OpenMaskFile(void)
 	double dummy;
 	int c;
 
-    if (use_overlay == 0) return status;
+    if (ctx->use_overlay == 0) return status;
 
-    use_overlay = 0;
-    fpmask = fopen(maskfile,"rb");
-    if (NULL == fpmask) {
-		printf("Error opening maskfile %s\n",maskfile);
+    ctx->use_overlay = 0;
+    ctx->fpmask = b2d_fopen(ctx, ctx->maskfile,"rb");
+    if (NULL == ctx->fpmask) {
+		printf("Error opening maskfile %s\n",ctx->maskfile);
 		return status;
 	}
 
     for (;;) {
 
-		c = fread((char *)&maskbmp.bfi.bfType[0],sizeof(BMPHEADER),1,fpmask);
+		c = fread((char *)&ctx->maskbmp.bfi.bfType[0],sizeof(BMPHEADER),1,ctx->fpmask);
 
 		if (c!= 1) {
 			/* printf("header read returned %d\n",c); */
 			break;
 		}
 
-    	if (maskbmp.bmi.biCompression==BI_RGB &&
-     		maskbmp.bfi.bfType[0] == 'B' && maskbmp.bfi.bfType[1] == 'M' &&
-     		maskbmp.bmi.biPlanes==1 && maskbmp.bmi.biBitCount == 8) {
-				width = (ushort) maskbmp.bmi.biWidth;
-				height = (ushort) maskbmp.bmi.biHeight;
+    	if (ctx->maskbmp.bmi.biCompression==BI_RGB &&
+     		ctx->maskbmp.bfi.bfType[0] == 'B' && ctx->maskbmp.bfi.bfType[1] == 'M' &&
+     		ctx->maskbmp.bmi.biPlanes==1 && ctx->maskbmp.bmi.biBitCount == 8) {
+				width = (ushort) ctx->maskbmp.bmi.biWidth;
+				height = (ushort) ctx->maskbmp.bmi.biHeight;
 		}
 
         /* this ensures that only full-screen output is masked */
         /* it doesn't make sense to mix image fragment routines into here */
-        if (mono == 1) {
-			if (hgroutput == 0) {
+        if (ctx->mono == 1) {
+			if (ctx->hgroutput == 0) {
 				if (width != 560 || height != 192) {
 					/* printf("width = %d, height = %d\n",width,height); */
 					puts("Mask file width must be 560 x 192");
@@ -4224,59 +3616,59 @@ sshort OpenMaskFile(void)
 			}
 		}
 
-        fread((char *)&maskpalette[0].rgbBlue, sizeof(RGBQUAD)*256,1,fpmask);
+        fread((char *)&ctx->maskpalette[0].rgbBlue, sizeof(RGBQUAD)*256,1,ctx->fpmask);
 
 
 		for (i=0;i<256;i++) {
-			if (mono == 1) {
+			if (ctx->mono == 1) {
 				/* build a remap array for monochrome output */
-				if (maskpalette[i].rgbRed == 255 && maskpalette[i].rgbGreen == 255 &&
-				    maskpalette[i].rgbBlue == 255) {
-						remap[i] = 15;
+				if (ctx->maskpalette[i].rgbRed == 255 && ctx->maskpalette[i].rgbGreen == 255 &&
+				    ctx->maskpalette[i].rgbBlue == 255) {
+						ctx->remap[i] = 15;
 				}
-				else if (maskpalette[i].rgbRed == 0 && maskpalette[i].rgbGreen == 0 &&
-				    maskpalette[i].rgbBlue == 0) {
-						remap[i] = 0;
+				else if (ctx->maskpalette[i].rgbRed == 0 && ctx->maskpalette[i].rgbGreen == 0 &&
+				    ctx->maskpalette[i].rgbBlue == 0) {
+						ctx->remap[i] = 0;
 				}
 				else {
 					/* anything else maps to color 1 for mono */
-					remap[i] = 1;
+					ctx->remap[i] = 1;
 				}
 
 			}
 			else {
 				/* build a remap array for color output */
-				remap[i] = GetMedColor(maskpalette[i].rgbRed,
-			                           maskpalette[i].rgbGreen,
-			                       	   maskpalette[i].rgbBlue,&dummy);
+				ctx->remap[i] = GetMedColor(ctx, ctx->maskpalette[i].rgbRed,
+			                           ctx->maskpalette[i].rgbGreen,
+			                       	   ctx->maskpalette[i].rgbBlue,&dummy);
 			}
 		}
-		fseek(fpmask,bfi.bfOffBits,SEEK_SET);
+		fseek(ctx->fpmask,ctx->bfi.bfOffBits,SEEK_SET);
 		status = SUCCESS;
-		use_overlay = 1;
+		ctx->use_overlay = 1;
 		break;
 	}
 
     if (status == INVALID){
 		/* puts("Failed!"); */
-		fclose(fpmask);
-		fpmask = NULL;
-		if (quietmode == 1)printf("Error loading %s\n",maskfile);
+		fclose(ctx->fpmask);
+		ctx->fpmask = NULL;
+		if (ctx->quietmode == 1)printf("Error loading %s\n",ctx->maskfile);
 	}
 	else {
-		if (quietmode == 1)printf("Loaded mask %s\n",maskfile);
+		if (ctx->quietmode == 1)printf("Loaded mask %s\n",ctx->maskfile);
 	}
 
     return status;
 }
 
 /* LGR and DLGR only */
-sshort ValidLoResSizeRange(void)
+sshort ValidLoResSizeRange(b2d_context *ctx)
 {
 	sshort status = INVALID;
 
 	/* monochrome input files are not accepted for LGR or DLGR conversion */
-	if (bmi.biBitCount != 1) {
+	if (ctx->bmi.biBitCount != 1) {
 
 	   /* http://en.wikipedia.org/wiki/Windowbox_(film) - cropped (clipped) images */
 	   /* restricted to a reasonable number of sizes that make sense to me */
@@ -4309,38 +3701,39 @@ sshort ValidLoResSizeRange(void)
 
 		  */
 
-		switch(bmpwidth) {
+		switch(ctx->bmpwidth) {
 
-		case 40:  lores = 1; /* verbatim 1:1 lgr only - nominal size 40 x 48 */
+		case 40:  ctx->lores = 1; /* verbatim 1:1 lgr only - nominal size 40 x 48 */
+				  /* fall through */
 		case 80:
 				  /* verbatim 1:1 for dlgr - nominal size 80 x 48 */
 				  /* 2:1 scaled for lgr */
-				  if (bmpheight == 40 || bmpheight == 48) status = SUCCESS;
+				  if (ctx->bmpheight == 40 || ctx->bmpheight == 48) status = SUCCESS;
 				  else break;
-				  jxoffset = 0; /* windowbox in vertical axis only */
-				  if (bmpheight == 40) {
+				  ctx->jxoffset = 0; /* windowbox in vertical axis only */
+				  if (ctx->bmpheight == 40) {
 					  /* mixed text and graphics */
 					  /* 40 x 40 and 80 x 40 - windowbox not required */
-					  appletop = 1;
-					  justify = jyoffset = 0;
+					  ctx->appletop = 1;
+					  ctx->justify = ctx->jyoffset = 0;
 					  break;
 				  }
-				  if (appletop == 1) {
+				  if (ctx->appletop == 1) {
 					  /* mixed text and graphics */
 					  /* 40 x 48 and 80 x 48 - windowbox required */
 					  /* top justified if not otherwise specified */
-					  if (justify == 1 && (jyoffset > -1 || jyoffset < 9)) {
-						  jyoffset = 8 - jyoffset;
+					  if (ctx->justify == 1 && (ctx->jyoffset > -1 || ctx->jyoffset < 9)) {
+						  ctx->jyoffset = 8 - ctx->jyoffset;
 						  break;
 					  }
-					  jyoffset = 8;
-					  justify = 1;
+					  ctx->jyoffset = 8;
+					  ctx->justify = 1;
 
 				  }
 				  else {
 					  /* fullscreen */
 					  /* 40 x 48 and 80 x 48 */
-					  justify = jyoffset = 0;
+					  ctx->justify = ctx->jyoffset = 0;
 
 				  }
 				  break;
@@ -4350,147 +3743,147 @@ sshort ValidLoResSizeRange(void)
 				  /* saved in Windows Paint as "old" and "new" printshop "pastes" from ClipShop in
 					 small-copy (single-scaled) or regular copy (double-scaled) format. */
 
-				  if (bmpheight != 52) break;
+				  if (ctx->bmpheight != 52) break;
 				  status = SUCCESS;  /* verbatim for dlgr - nominal size 80 x 48 */
-				  if (jxoffset < 0 || jxoffset > 8) {
-					  jxoffset = 4; /* centre */
+				  if (ctx->jxoffset < 0 || ctx->jxoffset > 8) {
+					  ctx->jxoffset = 4; /* centre */
 				  }
-				  if (appletop == 1) { /* mixed text and graphics - dlgr windowbox 80 x 40 */
-					  if (justify == 1 && (jyoffset > -1 && jyoffset < 13)) jyoffset = 12 - jyoffset;
-					  else jyoffset = 10;
-					  justify = 1;
+				  if (ctx->appletop == 1) { /* mixed text and graphics - dlgr windowbox 80 x 40 */
+					  if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 13)) ctx->jyoffset = 12 - ctx->jyoffset;
+					  else ctx->jyoffset = 10;
+					  ctx->justify = 1;
 					  break;
 				  }
-				  justify = 1;
-				  if (jyoffset < 0 || jyoffset > 4) {
-					  jyoffset = 2; /* centre */
+				  ctx->justify = 1;
+				  if (ctx->jyoffset < 0 || ctx->jyoffset > 4) {
+					  ctx->jyoffset = 2; /* centre */
 				  }
 				  break;
-		case 176: if (bmpheight != 104) break;
+		case 176: if (ctx->bmpheight != 104) break;
 				  status = SUCCESS; /* dlgr double-scaled - nominal size 160 x 96 */
-				  if (jxoffset < 0 || jxoffset > 16) {
-					  jxoffset = 8; /* centre */
+				  if (ctx->jxoffset < 0 || ctx->jxoffset > 16) {
+					  ctx->jxoffset = 8; /* centre */
 				  }
-				  if (appletop == 1) { /* mixed text and graphics - dlgr windowbox 160 x 80 */
-					  if (justify == 1 && (jyoffset > -1 && jyoffset < 25)) jyoffset = 24 - jyoffset;
-					  else jyoffset = 20;
-					  justify = 1;
+				  if (ctx->appletop == 1) { /* mixed text and graphics - dlgr windowbox 160 x 80 */
+					  if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 25)) ctx->jyoffset = 24 - ctx->jyoffset;
+					  else ctx->jyoffset = 20;
+					  ctx->justify = 1;
 					  break;
 				  }
-				  justify = 1;
-				  if (jyoffset < 0 || jyoffset > 8) {
-					  jyoffset = 4; /* centre */
+				  ctx->justify = 1;
+				  if (ctx->jyoffset < 0 || ctx->jyoffset > 8) {
+					  ctx->jyoffset = 4; /* centre */
 				  }
 				  break;
 		case 160: /* nominal size 160 x 96 */
 				  /* 2:2 scaled for dlgr, 4:2 scaled for lgr */
-				  if (bmpheight == 80 || bmpheight == 96) status = SUCCESS;
+				  if (ctx->bmpheight == 80 || ctx->bmpheight == 96) status = SUCCESS;
 				  else break;
-				  jxoffset = 0;
-				  if (bmpheight == 80) {
+				  ctx->jxoffset = 0;
+				  if (ctx->bmpheight == 80) {
 					  /* 160 x 80 - mixed text and graphics */
-					  appletop = 1;
-					  justify = jyoffset = 0;
+					  ctx->appletop = 1;
+					  ctx->justify = ctx->jyoffset = 0;
 					  break;
 				  }
-				  if (appletop == 1) {
+				  if (ctx->appletop == 1) {
 					  /* mixed text and graphics */
 					  /* 160 x 96 - windowbox required */
 					  /* top justified if not otherwise specified */
-					  if (justify == 1 && (jyoffset > -1 || jyoffset < 17)) {
-						  jyoffset = 16 - jyoffset;
+					  if (ctx->justify == 1 && (ctx->jyoffset > -1 || ctx->jyoffset < 17)) {
+						  ctx->jyoffset = 16 - ctx->jyoffset;
 						  break;
 					  }
-					  jyoffset = 16;
-					  justify = 1;
+					  ctx->jyoffset = 16;
+					  ctx->justify = 1;
 
 				  }
 				  else {
 					  /* fullscreen */
 					  /* 160 x 96 */
-					  justify = jyoffset = 0;
+					  ctx->justify = ctx->jyoffset = 0;
 
 				  }
 				  break;
 		case 320: /* nominal size 320 x 192 */
 				  /* 4:4 scaled for dlgr, 8:4 scaled for lgr */
-				  if (bmpheight == 160 || bmpheight == 192 || bmpheight == 200) {
+				  if (ctx->bmpheight == 160 || ctx->bmpheight == 192 || ctx->bmpheight == 200) {
 					  status = SUCCESS;
-					  jxoffset = 0; /* vertical scaling of mixed text and graphics only */
-					  if (bmpheight == 160) {
-						  appletop = 1;
-						  justify = jyoffset = 0;
+					  ctx->jxoffset = 0; /* vertical scaling of mixed text and graphics only */
+					  if (ctx->bmpheight == 160) {
+						  ctx->appletop = 1;
+						  ctx->justify = ctx->jyoffset = 0;
 						  break;
 					  }
-					  if (bmpheight == 192) {
-						  if (appletop == 1) {
-							  if (justify == 1 && (jyoffset > -1 && jyoffset < 33)) jyoffset = 32 - jyoffset;
-							  else jyoffset = 32;
-							  justify = 1;
+					  if (ctx->bmpheight == 192) {
+						  if (ctx->appletop == 1) {
+							  if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 33)) ctx->jyoffset = 32 - ctx->jyoffset;
+							  else ctx->jyoffset = 32;
+							  ctx->justify = 1;
 							  break;
 						  }
-						  justify = jyoffset = 0;
+						  ctx->justify = ctx->jyoffset = 0;
 						  break;
 					  }
 					  /* 320 x 200 */
 					  /* centre in frame by default */
-					  if (appletop == 1) {
-						  if (justify == 1 && (jyoffset > -1 && jyoffset < 41)) jyoffset = 40 - jyoffset;
-						  else jyoffset = 36;
-						  justify = 1;
+					  if (ctx->appletop == 1) {
+						  if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 41)) ctx->jyoffset = 40 - ctx->jyoffset;
+						  else ctx->jyoffset = 36;
+						  ctx->justify = 1;
 						  break;
 					  }
-					  if (justify == 1 && (jyoffset > -1 && jyoffset < 9)) jyoffset = 8 - jyoffset;
-					  else jyoffset = 4;
-					  justify = 1;
+					  if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 9)) ctx->jyoffset = 8 - ctx->jyoffset;
+					  else ctx->jyoffset = 4;
+					  ctx->justify = 1;
 				  }
 				  break;
 		case 560: /* "Classic" full-screen conversion of pre-scaled 560 x 384 input */
 				  /* "Classic" mixed text and graphics screen conversion of pre-scaled
 					 560 x 384 full-screen or 560 x 320 cropped input */
 				  /* 7:8 scaled for dlgr, 14:8 scaled for lgr */
-				  if (bmpheight == 320 || bmpheight == 384) status = SUCCESS;
+				  if (ctx->bmpheight == 320 || ctx->bmpheight == 384) status = SUCCESS;
 				  else break;
-				  jxoffset = 0;
-				  if (bmpheight == 320) {
+				  ctx->jxoffset = 0;
+				  if (ctx->bmpheight == 320) {
 					  /* mixed text and graphics */
-					  appletop = 1;
-					  justify = jyoffset = 0;
+					  ctx->appletop = 1;
+					  ctx->justify = ctx->jyoffset = 0;
 					  break;
 				  }
-				  if (appletop == 1) {
+				  if (ctx->appletop == 1) {
 						/* mixed text and graphics */
-						if (justify == 1 && (jyoffset > -1 && jyoffset < 65)) jyoffset = 64 - jyoffset;
-						else jyoffset = 64;
-						justify = 1;
+						if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 65)) ctx->jyoffset = 64 - ctx->jyoffset;
+						else ctx->jyoffset = 64;
+						ctx->justify = 1;
 				  }
 				  else {
 						/* fullscreen */
-						justify = jyoffset = 0;
+						ctx->justify = ctx->jyoffset = 0;
 				  }
 				  break;
 		case 640: /* "Classic" full-screen conversion of 640 x 480 square pixeled input */
 				  /* "Classic" mixed text and graphics screen conversion of square pixeled
 					  640 x 480 full-screen or 640 x 400 cropped input */
 				  /* 8:10 scaled for dlgr, 16:10 scaled for dlgr */
-				  if (bmpheight == 480 || bmpheight == 400) status = SUCCESS;
+				  if (ctx->bmpheight == 480 || ctx->bmpheight == 400) status = SUCCESS;
 				  else break;
-				  jxoffset = 0;
-				  if (bmpheight == 400) {
+				  ctx->jxoffset = 0;
+				  if (ctx->bmpheight == 400) {
 					  /* mixed text and graphics */
-					  appletop = 1;
-					  justify = jyoffset = 0;
+					  ctx->appletop = 1;
+					  ctx->justify = ctx->jyoffset = 0;
 					  break;
 				  }
-				  if (appletop == 1) {
+				  if (ctx->appletop == 1) {
 						/* mixed text and graphics */
-						if (justify == 1 && (jyoffset > -1 && jyoffset < 81)) jyoffset = 80 - jyoffset;
-						else jyoffset = 64;
-						justify = 1;
+						if (ctx->justify == 1 && (ctx->jyoffset > -1 && ctx->jyoffset < 81)) ctx->jyoffset = 80 - ctx->jyoffset;
+						else ctx->jyoffset = 64;
+						ctx->justify = 1;
 				  }
 				  else {
 						/* fullscreen */
-						justify = jyoffset = 0;
+						ctx->justify = ctx->jyoffset = 0;
 				  }
 				  break;
 		}
@@ -4506,70 +3899,94 @@ sshort ValidLoResSizeRange(void)
    		when preview is on... also leaves an optional error-diffused dib file
    		in place if error diffusion is also turned-on */
 /* Etcetera */
-sshort Convert(void)
+sshort Convert(b2d_context *ctx)
 {
 
-    FILE *fp, *fpdib, *fpreview;
-    sshort status = INVALID, resize = 0;
-	ushort x,x1,x2,y,yoff,i,packet, outpacket, width, dwidth, red, green, blue;
-	uchar r,g,b,drawcolor;
-	ulong pos, prepos;
+    FILE *fp;
+    sshort status = INVALID, resize = 0, resample = 0;
+	ushort x,x1,x2,y,i,packet, width = 0, dwidth = 0, red, green, blue, fitwidth, fitheight;
+	uchar r,g,b,drawcolor,drawline[140];
+	ulong pos;
 
     /* if using a mask file, open it now */
     /* leave it open throughout the conversion session */
     /* it will be closed in main before exiting */
-	if (use_overlay == 1)OpenMaskFile();
+	if (ctx->use_overlay == 1)OpenMaskFile(ctx);
 
-    if((fp=fopen(bmpfile,"rb"))==NULL) {
-		printf("Error Opening %s for reading!\n",bmpfile);
+    if((fp=b2d_fopen(ctx, ctx->bmpfile,"rb"))==NULL) {
+		printf("Error Opening %s for reading!\n",ctx->bmpfile);
 		return status;
 	}
     /* read the header stuff into the appropriate structures */
-    fread((char *)&bfi.bfType[0],
+    fread((char *)&ctx->bfi.bfType[0],
 	             sizeof(BITMAPFILEHEADER),1,fp);
-    fread((char *)&bmi.biSize,
+    fread((char *)&ctx->bmi.biSize,
                  sizeof(BITMAPINFOHEADER),1,fp);
+    StageOpen(ctx, fp);
 
     /* reformat to 24 bit */
-    if (bmi.biCompression==BI_RGB &&
-        bfi.bfType[0] == 'B' && bfi.bfType[1] == 'M' && bmi.biPlanes==1) {
+    if (ctx->bmi.biCompression==BI_RGB &&
+        ctx->bfi.bfType[0] == 'B' && ctx->bfi.bfType[1] == 'M' && ctx->bmi.biPlanes==1) {
 
-		bmpwidth = (ushort) bmi.biWidth;
-		bmpheight = (ushort) bmi.biHeight;
+		ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+		ctx->bmpheight = (ushort) ctx->bmi.biHeight;
 
-		if (loresoutput == 1) {
+		/* input of other sizes is resampled once it is 24-bit */
+		resample = ResampleSize(ctx, &fitwidth, &fitheight);
+
+		if (ctx->loresoutput == 1 && resample == 0) {
 			/* LGR and DLGR */
-			status = ValidLoResSizeRange();
+			status = ValidLoResSizeRange(ctx);
 			if (status == INVALID) {
-				fclose(fp);
-				printf("%s is in the wrong format!\n",bmpfile);
+				StageClose(ctx);
+				printf("%s is in the wrong format!\n",ctx->bmpfile);
 				return status;
 			}
 		}
 
-       if (bmi.biBitCount == 8 || bmi.biBitCount == 4) {
-	    	fp = ReformatBMP(fp);
+       if (ctx->bmi.biBitCount == 8 || ctx->bmi.biBitCount == 4) {
+			StatsStage(ctx, B2D_STAGE_REFORMAT);
+	    	fp = ReformatBMP(ctx, fp);
 	    	if (fp == NULL) return INVALID;
+			StatsStage(ctx, B2D_STAGE_HEADER);
 		}
 	}
 
-    if (bmi.biCompression==BI_RGB &&
-        bfi.bfType[0] == 'B' && bfi.bfType[1] == 'M' &&
-        bmi.biPlanes==1 && bmi.biBitCount == 24) {
+    if (ctx->bmi.biCompression==BI_RGB &&
+        ctx->bfi.bfType[0] == 'B' && ctx->bfi.bfType[1] == 'M' &&
+        ctx->bmi.biPlanes==1 && ctx->bmi.biBitCount == 24) {
+
+		ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+		ctx->bmpheight = (ushort) ctx->bmi.biHeight;
 
-		bmpwidth = (ushort) bmi.biWidth;
-		bmpheight = (ushort) bmi.biHeight;
+		if (resample != 0) {
+			StatsStage(ctx, B2D_STAGE_RESIZE);
+			fp = ResampleBMP(ctx, fp, fitwidth, fitheight);
+			if (fp == NULL) return INVALID;
+			StatsStage(ctx, B2D_STAGE_HEADER);
+			ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+			ctx->bmpheight = (ushort) ctx->bmi.biHeight;
+			if (ctx->loresoutput == 1) {
+				/* LGR and DLGR */
+				status = ValidLoResSizeRange(ctx);
+				if (status == INVALID) {
+					StageClose(ctx);
+					printf("%s is in the wrong format!\n",ctx->bmpfile);
+					return status;
+				}
+			}
+		}
 
-		if (loresoutput == 0) {
+		if (ctx->loresoutput == 0) {
 			/* color HGR and DHGR */
 			/* resize some classic screen sizes */
-			if (bmpwidth == 320 && bmpheight == 200)
+			if (ctx->bmpwidth == 320 && ctx->bmpheight == 200)
 			   resize = 1;
-			else  if (bmpwidth == 640 && bmpheight == 400)
+			else  if (ctx->bmpwidth == 640 && ctx->bmpheight == 400)
 			   resize = 2;
-			else if (bmpwidth == 640 && bmpheight == 480)
+			else if (ctx->bmpwidth == 640 && ctx->bmpheight == 480)
 			   resize = 3;
-			else if (bmpwidth == 560 && bmpheight == 384)
+			else if (ctx->bmpwidth == 560 && ctx->bmpheight == 384)
 			   resize = 4;
 		}
 		else {
@@ -4592,156 +4009,155 @@ sshort Convert(void)
 		}
 
         if (resize != 0) {
-    		memset(&bmpscanline[0],0,1920);
-    		memset(&dibscanline1[0],0,1920);
-    		memset(&dibscanline2[0],0,1920);
-    		memset(&dibscanline3[0],0,1920);
-    		memset(&dibscanline4[0],0,1920);
-			fp = ResizeBMP(fp,resize);
+    		memset(&ctx->bmpscanline[0],0,1920);
+    		memset(&ctx->dibscanline1[0],0,1920);
+    		memset(&ctx->dibscanline2[0],0,1920);
+    		memset(&ctx->dibscanline3[0],0,1920);
+    		memset(&ctx->dibscanline4[0],0,1920);
+			StatsStage(ctx, B2D_STAGE_RESIZE);
+			fp = ResizeBMP(ctx, fp,resize);
 			if (fp == NULL) return INVALID;
-			bmpwidth = (ushort) bmi.biWidth;
-			bmpheight = (ushort) bmi.biHeight;
+			StatsStage(ctx, B2D_STAGE_HEADER);
+			ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+			ctx->bmpheight = (ushort) ctx->bmi.biHeight;
 		}
 
-        if (loresoutput == 0) {
+        if (ctx->loresoutput == 0) {
 			/* HGR and DHGR output */
-			if (scale == 0) {
-				if (bmpwidth > 140) scale = 1;
+			if (ctx->scale == 0) {
+				if (ctx->bmpwidth > 140) ctx->scale = 1;
 			}
 
-			if (scale == 1) {
-				width = bmpwidth;
-				dwidth = (bmpwidth+1)/2;
-				if (bmpwidth  > 0 && bmpwidth < 281 &&
-					bmpheight > 0 && bmpheight < 193) status = SUCCESS;
+			if (ctx->scale == 1) {
+				width = ctx->bmpwidth;
+				dwidth = (ctx->bmpwidth+1)/2;
+				if (ctx->bmpwidth  > 0 && ctx->bmpwidth < 281 &&
+					ctx->bmpheight > 0 && ctx->bmpheight < 193) status = SUCCESS;
 			}
 			else {
-				width = bmpwidth * 2;
-				dwidth = bmpwidth;
-				if (bmpwidth  > 0 && bmpwidth < 141 &&
-					bmpheight > 0 && bmpheight < 193) status = SUCCESS;
+				width = ctx->bmpwidth * 2;
+				dwidth = ctx->bmpwidth;
+				if (ctx->bmpwidth  > 0 && ctx->bmpwidth < 141 &&
+					ctx->bmpheight > 0 && ctx->bmpheight < 193) status = SUCCESS;
 
 			}
 		}
 		else {
 			/* LGR and DLGR */
-			width = bmpwidth;
-			if (lores == 1) {
-				scale = 1;
+			width = ctx->bmpwidth;
+			if (ctx->lores == 1) {
+				ctx->scale = 1;
 				dwidth = 40;
 			}
 			else {
-				scale = 0;
+				ctx->scale = 0;
 				dwidth = 80;
 			}
 		}
 	}
 
     if (status == INVALID) {
-		fclose(fp);
-		printf("%s is in the wrong format!\n",bmpfile);
+		StageClose(ctx);
+		printf("%s is in the wrong format!\n",ctx->bmpfile);
 		return status;
 	}
 
 
-	packet = bmpwidth * 3;
+	packet = ctx->bmpwidth * 3;
     /* BMP scanlines are padded to a multiple of 4 bytes (DWORD) */
 	while ((packet % 4) != 0) packet++;
 
+	/* the same input and settings were matched and dithered before -
+	   only the preview palette can differ (see b2d_cache.c) */
+	if (ctx->draft == 0 && CacheScreen(ctx) != 0) {
+		StageClose(ctx);
+		if (ctx->preview != 0) {
+			PreviewScreen(ctx, width, dwidth);
+			if (ctx->preview != 0 && ctx->previewrgba == NULL &&
+			    ctx->quietmode != 0) printf("Preview file %s created!\n",ctx->previewfile);
+		}
+		StatsStage(ctx, B2D_STAGE_SAVE);
+		if (savedhr(ctx) != SUCCESS) return INVALID;
+		if (savesprite(ctx) != SUCCESS) return INVALID;
+		return SUCCESS;
+	}
+
     /* error diffusion option */
-    if (diffuse != 0) {
+    if (ctx->diffuse != 0) {
 		/* clear buffers */
-    	memset(&bmpscanline[0],0,960);
-    	memset(&dibscanline1[0],0,960);
-    	memset(&dibscanline2[0],0,960);
-		fp = ReadDIBFile(fp, packet);
+    	memset(&ctx->bmpscanline[0],0,960);
+    	memset(&ctx->dibscanline1[0],0,960);
+    	memset(&ctx->dibscanline2[0],0,960);
+		StatsStage(ctx, B2D_STAGE_DIFFUSE);
+		fp = ReadDIBFile(ctx, fp, packet);
 		if (fp == NULL) return INVALID;
 	}
 
-	if (preview!=0) {
-		fpreview = fopen(previewfile,"wb+");
-
-		if (fpreview != NULL) {
-			outpacket = WriteDIBHeader(fpreview,width,bmpheight);
-			if (outpacket == 0) {
-				fclose(fpreview);
-				remove(previewfile);
-				printf("Error writing header to %s!\n",previewfile);
-				preview = 0;
-			}
-			else {
-				/* pad the preview file */
-				memset(&dibscanline1[0],0,960);
-    			for (y=0;y<bmpheight;y++) fwrite((char *)&dibscanline1[0],1,outpacket,fpreview);
-    			/* set the seek distance to scanline 0 in the preview file */
-    			prepos = (ulong) (bmpheight - 1);
-    			prepos *= outpacket;
-    			prepos += mybmp.bfi.bfOffBits;
-			}
+	StatsStage(ctx, B2D_STAGE_DITHER);
 
-		}
-		else {
-			printf("Error opening %s for writing!\n",previewfile);
-			preview = 0;
-		}
-	}
+	/* the preview is written top scanline first (see b2d_preview.c) */
+	if (ctx->preview!=0) PreviewOpen(ctx, width,ctx->bmpheight);
 
 
 	/* read BMP from top scanline to bottom scanline */
-    pos = (ulong) (bmpheight - 1);
+    pos = (ulong) (ctx->bmpheight - 1);
     pos *= packet;
-    pos += bfi.bfOffBits;
+    pos += ctx->bfi.bfOffBits;
 
     /* clear buffers */
-    dhrclear();
-	memset(&bmpscanline[0],0,960);
-	memset(&previewline[0],0,960);
+    dhrclear(ctx);
+	memset(&ctx->bmpscanline[0],0,960);
+	memset(&ctx->previewline[0],0,960);
 
-	if (dither != 0) {
+	if (ctx->dither != 0) {
 		/* sizeof(sshort) * 320 */
-		memset(&redDither[0],0,640);
-		memset(&greenDither[0],0,640);
-		memset(&blueDither[0],0,640);
-		memset(&redSeed[0],0,640);
-		memset(&greenSeed[0],0,640);
-		memset(&blueSeed[0],0,640);
- 		memset(&redSeed2[0],0,640);
-		memset(&greenSeed2[0],0,640);
-		memset(&blueSeed2[0],0,640);
+		DitherRowsInit(ctx, 320);
+		DitherImageInit(ctx, ctx->bmpheight);
 	}
+	if (ctx->dither != 0 && ctx->ditherimage != NULL) ProgressBegin(ctx, ctx->bmpheight * 2);
+	else ProgressBegin(ctx, ctx->bmpheight);
+
+	for (y=0;y<ctx->bmpheight;y++,pos-=packet) {
+		/* a draft at half vertical resolution repeats the scanline above
+		   on odd scanlines (see b2d_wrapper.c) */
+		if (ctx->draft == 2 && (y & 1) != 0 && ctx->dither == 0) {
+			if (ctx->scale == 1) dhrputline(ctx, y,drawline,(ctx->bmpwidth+1)/2);
+			else dhrputline(ctx, y,drawline,ctx->bmpwidth);
+			if (ctx->preview != 0) PreviewLine(ctx);
+			if (ProgressLine(ctx) != 0) break;
+			continue;
+		}
 
-	for (y=0;y<bmpheight;y++,pos-=packet) {
-		fseek(fp,pos,SEEK_SET);
-		fread((char *)&bmpscanline[0],1,packet,fp);
+		StageReadAt(ctx, (long)pos, &ctx->bmpscanline[0], packet);
 
-        if (use_overlay == 1)ReadMaskLine(y);
+        if (ctx->use_overlay == 1)ReadMaskLine(ctx, y);
 
-		if (scale == 1) {
-			for (x = 0,i = 0, x1=0; x < bmpwidth; x++) {
+		if (ctx->scale == 1) {
+			for (x = 0,i = 0, x1=0; x < ctx->bmpwidth; x++) {
 				/* get even pixel values */
-				b = bmpscanline[i]; i++;
-				g = bmpscanline[i]; i++;
-				r = bmpscanline[i]; i++;
+				b = ctx->bmpscanline[i]; i++;
+				g = ctx->bmpscanline[i]; i++;
+				r = ctx->bmpscanline[i]; i++;
 				x++;
 
                 /* get odd pixel values */
-               	if (x < bmpwidth) {
-					if (merge == 0) {
+               	if (x < ctx->bmpwidth) {
+					if (ctx->merge == 0) {
 					  blue  = (ushort)b;
 					  green = (ushort)g;
 					  red   = (ushort)r;
 					  i+=3;
 					}
 					else {
-					  blue  = (ushort)bmpscanline[i]; i++;
-					  green = (ushort)bmpscanline[i]; i++;
-					  red   = (ushort)bmpscanline[i]; i++;
+					  blue  = (ushort)ctx->bmpscanline[i]; i++;
+					  green = (ushort)ctx->bmpscanline[i]; i++;
+					  red   = (ushort)ctx->bmpscanline[i]; i++;
 					}
 
 				}
 				else {
 					/* if no odd pixel double-plot the last pixel */
-                	if (merge == 0) {
+                	if (ctx->merge == 0) {
 						blue  = (ushort)b;
 						green = (ushort)g;
 						red   = (ushort)r;
@@ -4750,9 +4166,9 @@ sshort Convert(void)
  						/* merge with background color
                    	   	   on some fragments the background color might already be padded-out
                 		*/
-						blue  = (ushort)rgbArray[backgroundcolor][2];
-						green = (ushort)rgbArray[backgroundcolor][1];
-						red   = (ushort)rgbArray[backgroundcolor][0];
+						blue  = (ushort)ctx->rgbArray[ctx->backgroundcolor][2];
+						green = (ushort)ctx->rgbArray[ctx->backgroundcolor][1];
+						red   = (ushort)ctx->rgbArray[ctx->backgroundcolor][0];
 					}
 			  	}
 
@@ -4764,31 +4180,31 @@ sshort Convert(void)
 				g = (uchar) (green/2);
 				r = (uchar) (red/2);
 
-                if (dither == 0) {
+                if (ctx->dither == 0) {
 
-					maskpixel = 0;
-					if (use_overlay == 1) {
-						overcolor = maskline[x/2];
+					ctx->maskpixel = 0;
+					if (ctx->use_overlay == 1) {
+						ctx->overcolor = ctx->maskline[x/2];
 						/* clearcolor is the transparent color for the mask */
 						/* if the use_overlay color is some other color then the pixel is overlaid
 						   with the mask color */
-						if (overcolor != clearcolor) maskpixel = 1;
+						if (ctx->overcolor != ctx->clearcolor) ctx->maskpixel = 1;
 					}
-					if (maskpixel == 1) {
-						drawcolor = (uchar)overcolor;
+					if (ctx->maskpixel == 1) {
+						drawcolor = (uchar)ctx->overcolor;
 					}
 					else {
 						/* get nearest color index from currently selected conversion palette */
-						drawcolor = GetDrawColor(r,g,b,x/2,y);
+						drawcolor = GetDrawColor(ctx, r,g,b,x/2,y);
 					}
 
-					/* plot to DHGR buffer */
-					dhrplot(x/2,y,drawcolor);
-					if (preview == 1) {
+					/* plotted to DHGR buffer after the scanline */
+					drawline[x/2] = drawcolor;
+					if (ctx->preview == 1) {
 						/* plot preview using currently selected preview palette */
-						previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][BLUE]; x1++;
-						previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][GREEN]; x1++;
-						previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][RED]; x1+=4;
+						ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][BLUE]; x1++;
+						ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][GREEN]; x1++;
+						ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][RED]; x1+=4;
 					}
 				}
 				else {
@@ -4796,318 +4212,322 @@ sshort Convert(void)
 					/* values are already seeded from previous line(s) */
 					x2 = x/2;
 
-					AdjustShortPixel(1,(sshort *)&redDither[x2],(sshort)r);
-					AdjustShortPixel(1,(sshort *)&greenDither[x2],(sshort)g);
-					AdjustShortPixel(1,(sshort *)&blueDither[x2],(sshort)b);
+					AdjustShortPixel(ctx, 1,(sshort *)&ctx->redDither[x2],(sshort)r);
+					AdjustShortPixel(ctx, 1,(sshort *)&ctx->greenDither[x2],(sshort)g);
+					AdjustShortPixel(ctx, 1,(sshort *)&ctx->blueDither[x2],(sshort)b);
 				}
 			}
 		}
 		else {
 			/* merge has no meaning unless we are scaling */
-			for (x = 0,i = 0,x1=0; x < bmpwidth; x++) {
-				b = bmpscanline[i]; i++;
-				g = bmpscanline[i]; i++;
-				r = bmpscanline[i]; i++;
+			for (x = 0,i = 0,x1=0; x < ctx->bmpwidth; x++) {
+				b = ctx->bmpscanline[i]; i++;
+				g = ctx->bmpscanline[i]; i++;
+				r = ctx->bmpscanline[i]; i++;
 
-				if (dither != 0) {
+				if (ctx->dither != 0) {
 					/* Floyd-Steinberg Etc. dithering */
 					/* values are already seeded from previous line(s) */
-					AdjustShortPixel(1,(sshort *)&redDither[x],(sshort)r);
-					AdjustShortPixel(1,(sshort *)&greenDither[x],(sshort)g);
-					AdjustShortPixel(1,(sshort *)&blueDither[x],(sshort)b);
+					AdjustShortPixel(ctx, 1,(sshort *)&ctx->redDither[x],(sshort)r);
+					AdjustShortPixel(ctx, 1,(sshort *)&ctx->greenDither[x],(sshort)g);
+					AdjustShortPixel(ctx, 1,(sshort *)&ctx->blueDither[x],(sshort)b);
 				}
 				else {
-					maskpixel = 0;
-					if (use_overlay == 1) {
-						overcolor = maskline[x];
+					ctx->maskpixel = 0;
+					if (ctx->use_overlay == 1) {
+						ctx->overcolor = ctx->maskline[x];
 						/* clearcolor is the transparent color for the mask */
 						/* if the use_overlay color is some other color then the pixel is overlaid
 						   with the mask color */
-						if (overcolor != clearcolor) maskpixel = 1;
+						if (ctx->overcolor != ctx->clearcolor) ctx->maskpixel = 1;
 					}
-					if (maskpixel == 1) {
-						drawcolor = (uchar)overcolor;
+					if (ctx->maskpixel == 1) {
+						drawcolor = (uchar)ctx->overcolor;
 					}
 					else {
 						/* get nearest color index from currently selected conversion palette */
-                		drawcolor = GetDrawColor(r,g,b,x,y);
+                		drawcolor = GetDrawColor(ctx, r,g,b,x,y);
 					}
-					/* plot to DHGR buffer */
-					dhrplot(x,y,drawcolor);
-					if (preview == 1) {
+					/* plotted to DHGR buffer after the scanline */
+					drawline[x] = drawcolor;
+					if (ctx->preview == 1) {
 						/* plot preview using currently selected preview palette */
-						previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][BLUE]; x1++;
-						previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][GREEN]; x1++;
-						previewline[x1] = previewline[x1+3] = rgbPreview[drawcolor][RED];
-						if (loresoutput == 1 && lores == 0) x1++;
+						ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][BLUE]; x1++;
+						ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][GREEN]; x1++;
+						ctx->previewline[x1] = ctx->previewline[x1+3] = ctx->rgbPreview[drawcolor][RED];
+						if (ctx->loresoutput == 1 && ctx->lores == 0) x1++;
 						else x1+=4;
 					}
 				}
 			}
 		}
 
-        if (dither != 0) {
-		   /* Floyd-Steinberg dithering */
-		   FloydSteinberg(y,dwidth);
-		   /* seed next line - promote nearest forward array to
-		      current line */
-		   memcpy(&redDither[0],&redSeed[0],640);
-		   memcpy(&greenDither[0],&greenSeed[0],640);
-		   memcpy(&blueDither[0],&blueSeed[0],640);
-
-           /* seed first seed - promote furthest forward array
-              to nearest forward array */
-		   memcpy(&redSeed[0],&redSeed2[0],640);
-		   memcpy(&greenSeed[0],&greenSeed2[0],640);
-		   memcpy(&blueSeed[0],&blueSeed2[0],640);
-
-		   /* clear last seed - furthest forward array */
- 		   /* this is not used in all the error diffusion dithers */
- 		   /* - but dithers like atkinson use 2 foward arrays */
- 		   /* - in dithers that use only one forward array this does no harm */
- 		   /* somewhat brute force but simple code */
- 		   memset(&redSeed2[0],0,640);
-		   memset(&greenSeed2[0],0,640);
-		   memset(&blueSeed2[0],0,640);
+		if (ctx->dither == 0) {
+			/* plot the whole scanline in the DHGR buffer */
+			if (ctx->scale == 1) dhrputline(ctx, y,drawline,(ctx->bmpwidth+1)/2);
+			else dhrputline(ctx, y,drawline,ctx->bmpwidth);
 		}
 
-		if (preview != 0) {
-			/* write the preview line to the preview file */
-			fseek(fpreview,prepos,SEEK_SET);
-			fwrite((char *)&previewline[0],1,outpacket,fpreview);
-			prepos -= outpacket;
+        if (ctx->dither != 0) {
+		   if (ctx->ditherimage != NULL) {
+			   /* dithered on several threads after every scanline is read */
+			   DitherImageNext(ctx);
+			   if (ProgressLine(ctx) != 0) break;
+			   continue;
+		   }
+		   /* Floyd-Steinberg dithering */
+		   FloydSteinberg(ctx, y,dwidth);
+		   /* seed next line - promote the forward arrays by
+		      rotating the error rows */
+		   DitherRowsNext(ctx);
 		}
 
+		/* write the preview line to the preview file */
+		if (ctx->preview != 0) PreviewLine(ctx);
+
+		if (ProgressLine(ctx) != 0) break;
 	}
 
-	fclose(fp);
+	if (ctx->dither != 0 && ctx->ditherimage != NULL && ctx->cancelled == 0) {
+		DitherImage(ctx, dwidth);
+		for (y=0;y<ctx->bmpheight;y++) {
+			DitherImageRow(ctx, y);
+			FloydSteinbergPlot(ctx, y,dwidth);
+
+			if (ctx->preview != 0) PreviewLine(ctx);
 
-	if (preview != 0) {
-		fclose(fpreview);
-		if (quietmode != 0) printf("Preview file %s created!\n",previewfile);
+			if (ProgressLine(ctx) != 0) break;
+		}
+	}
+
+	/* stopped by b2d_options.cancel - see b2d_progress.c */
+	if (ctx->cancelled != 0) {
+		ProgressAbort(ctx);
+		return INVALID;
 	}
 
-    if (debug == 0) {
-		if (diffuse  != 0) remove(dibfile);
-		if (resize != 0) remove(scaledfile);
-		if (reformat != 0) remove(reformatfile);
+	StageClose(ctx);
+
+	if (ctx->preview != 0) {
+		PreviewClose(ctx);
+		if (ctx->preview != 0 && ctx->previewrgba == NULL &&
+		    ctx->quietmode != 0) printf("Preview file %s created!\n",ctx->previewfile);
 	}
 
-    if (savedhr() != SUCCESS) return INVALID;
-    if (savesprite() != SUCCESS) return INVALID;
+	/* a draft is only the preview */
+	if (ctx->draft != 0) return SUCCESS;
+	CacheScreenStore(ctx);
+
+	StatsStage(ctx, B2D_STAGE_SAVE);
+    if (savedhr(ctx) != SUCCESS) return INVALID;
+    if (savesprite(ctx) != SUCCESS) return INVALID;
 
 	return SUCCESS;
 
 }
 
-sshort ConvertMono()
+sshort ConvertMono(b2d_context *ctx)
 {
 
-    FILE *fp, *fpreview;
-    sshort status = INVALID;
-	ushort x,y,i,packet, outpacket, red, green, blue, verbatim;
-	ulong pos, prepos;
+    FILE *fp;
+    sshort status = INVALID, resample;
+	ushort x,y,i,packet, red, green, blue, verbatim, fitwidth, fitheight;
+	ulong pos;
 
-    if((fp=fopen(bmpfile,"rb"))==NULL) {
-		printf("Error Opening %s for reading!\n",bmpfile);
+    if((fp=b2d_fopen(ctx, ctx->bmpfile,"rb"))==NULL) {
+		printf("Error Opening %s for reading!\n",ctx->bmpfile);
 		return status;
 	}
     /* read the header stuff into the appropriate structures */
-    fread((char *)&bfi.bfType[0],
+    fread((char *)&ctx->bfi.bfType[0],
 	             sizeof(BITMAPFILEHEADER),1,fp);
-    fread((char *)&bmi.biSize,
+    fread((char *)&ctx->bmi.biSize,
                  sizeof(BITMAPINFOHEADER),1,fp);
+    StageOpen(ctx, fp);
 
-	bmpwidth = (ushort) bmi.biWidth;
-	bmpheight = (ushort) bmi.biHeight;
+	ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+	ctx->bmpheight = (ushort) ctx->bmi.biHeight;
+
+	/* color input of other sizes is resampled once it is 24-bit
+	   and checked here as the size it will be */
+	resample = ResampleSize(ctx, &fitwidth, &fitheight);
+	if (resample != 0) {
+		ctx->bmpwidth = fitwidth;
+		ctx->bmpheight = fitheight;
+	}
 
     /* monochrome verbatim DHGR conversion */
-	if (bmpwidth == 560 && bmpheight == 192 && bmi.biBitCount == 1) {
+	if (ctx->bmpwidth == 560 && ctx->bmpheight == 192 && ctx->bmi.biBitCount == 1) {
 		verbatim = 1;
-		hgroutput = 0;
+		ctx->hgroutput = 0;
 	}
 	/* color to dithered DHGR monochrome conversion */
-	else if (bmpwidth == 560 && bmpheight == 384 && bmi.biBitCount != 1) {
+	else if (ctx->bmpwidth == 560 && ctx->bmpheight == 384 && ctx->bmi.biBitCount != 1) {
 		verbatim = 2;
-		hgroutput = 0;
+		ctx->hgroutput = 0;
 	}
 	/* monochrome verbatim HGR conversion */
-	else if (bmpwidth == 280 && bmpheight == 192 && bmi.biBitCount == 1) {
-		verbatim = hgroutput = 1;
+	else if (ctx->bmpwidth == 280 && ctx->bmpheight == 192 && ctx->bmi.biBitCount == 1) {
+		verbatim = ctx->hgroutput = 1;
 
 	}
 	/* color to dithered HGR monochrome conversion */
-	else if (bmpwidth == 280 && bmpheight == 192 && bmi.biBitCount != 1) {
-		verbatim = hgroutput = 1;
+	else if (ctx->bmpwidth == 280 && ctx->bmpheight == 192 && ctx->bmi.biBitCount != 1) {
+		verbatim = ctx->hgroutput = 1;
 	}
 	else {
-		fclose(fp);
+		StageClose(ctx);
 		puts("Invalid size for Monochrome conversion!");
 		return status;
 	}
+	ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+	ctx->bmpheight = (ushort) ctx->bmi.biHeight;
 
 
     /* reformat to 24 bit */
-    if (bmi.biCompression==BI_RGB &&
-        bfi.bfType[0] == 'B' && bfi.bfType[1] == 'M' && bmi.biPlanes==1 &&
-       ((bmi.biBitCount == 8) || (bmi.biBitCount == 4) || (bmi.biBitCount == 1))) {
-	    fp = ReformatBMP(fp);
+    if (ctx->bmi.biCompression==BI_RGB &&
+        ctx->bfi.bfType[0] == 'B' && ctx->bfi.bfType[1] == 'M' && ctx->bmi.biPlanes==1 &&
+       ((ctx->bmi.biBitCount == 8) || (ctx->bmi.biBitCount == 4) || (ctx->bmi.biBitCount == 1))) {
+		StatsStage(ctx, B2D_STAGE_REFORMAT);
+	    fp = ReformatBMP(ctx, fp);
 	    if (fp == NULL) return INVALID;
+		StatsStage(ctx, B2D_STAGE_HEADER);
 	}
 
-    if (bmi.biCompression==BI_RGB &&
-        bfi.bfType[0] == 'B' && bfi.bfType[1] == 'M' &&
-        bmi.biPlanes==1 && bmi.biBitCount == 24) {
+    if (ctx->bmi.biCompression==BI_RGB &&
+        ctx->bfi.bfType[0] == 'B' && ctx->bfi.bfType[1] == 'M' &&
+        ctx->bmi.biPlanes==1 && ctx->bmi.biBitCount == 24) {
+
+		if (resample != 0) {
+			StatsStage(ctx, B2D_STAGE_RESIZE);
+			fp = ResampleBMP(ctx, fp, fitwidth, fitheight);
+			if (fp == NULL) return INVALID;
+			StatsStage(ctx, B2D_STAGE_HEADER);
+		}
 
-		bmpwidth = (ushort) bmi.biWidth;
-		bmpheight = (ushort) bmi.biHeight;
+		ctx->bmpwidth = (ushort) ctx->bmi.biWidth;
+		ctx->bmpheight = (ushort) ctx->bmi.biHeight;
 
 		status = SUCCESS;
 	}
 
     if (status == INVALID) {
-		fclose(fp);
-		printf("%s is in the wrong format!\n",bmpfile);
+		StageClose(ctx);
+		printf("%s is in the wrong format!\n",ctx->bmpfile);
 		return status;
 	}
 
     /* if using a mask file, open it now */
     /* leave it open throughout the conversion session */
     /* it will be closed in main before exiting */
-	if (use_overlay == 1)OpenMaskFile();
+	if (ctx->use_overlay == 1)OpenMaskFile(ctx);
 
-	packet = bmpwidth * 3;
+	packet = ctx->bmpwidth * 3;
     /* BMP scanlines are padded to a multiple of 4 bytes (DWORD) */
 	while ((packet % 4) != 0) packet++;
 
-	if (preview!=0) {
-		fpreview = fopen(previewfile,"wb+");
-
-		if (fpreview != NULL) {
-			outpacket = WriteDIBHeader(fpreview,bmpwidth,bmpheight);
-			if (outpacket == 0) {
-				fclose(fpreview);
-				remove(previewfile);
-				printf("Error writing header to %s!\n",previewfile);
-				preview = 0;
-			}
-			else {
-				/* pad the preview file */
-				memset(&dibscanline1[0],0,960);
-    			for (y=0;y<bmpheight;y++) fwrite((char *)&dibscanline1[0],1,outpacket,fpreview);
-    			/* set the seek distance to scanline 0 in the preview file */
-    			prepos = (ulong) (bmpheight - 1);
-    			prepos *= outpacket;
-    			prepos += mybmp.bfi.bfOffBits;
-			}
+	StatsStage(ctx, B2D_STAGE_DITHER);
 
-		}
-		else {
-			printf("Error opening %s for writing!\n",previewfile);
-			preview = 0;
-		}
-	}
+	/* the preview is written top scanline first (see b2d_preview.c) */
+	if (ctx->preview!=0) PreviewOpen(ctx, ctx->bmpwidth,ctx->bmpheight);
 
 
 	/* read BMP from top scanline to bottom scanline */
-    pos = (ulong) (bmpheight - 1);
+    pos = (ulong) (ctx->bmpheight - 1);
     pos *= packet;
-    pos += bfi.bfOffBits;
+    pos += ctx->bfi.bfOffBits;
 
     /* clear buffers */
-    memset(dhrbuf,0,16384);
-	memset(&bmpscanline[0],0,1920);
-	memset(&previewline[0],0,1920);
+    memset(ctx->dhrbuf,0,16384);
+	memset(&ctx->bmpscanline[0],0,1920);
+	memset(&ctx->previewline[0],0,1920);
 
 	/* sizeof(sshort) * 640 */
-	memset(&redDither[0],0,1280);
-	memset(&greenDither[0],0,1280);
-	memset(&blueDither[0],0,1280);
-	memset(&redSeed[0],0,1280);
-	memset(&greenSeed[0],0,1280);
-	memset(&blueSeed[0],0,1280);
-	memset(&redSeed2[0],0,1280);
-	memset(&greenSeed2[0],0,1280);
-	memset(&blueSeed2[0],0,1280);
+	DitherRowsInit(ctx, 640);
+	DitherImageInit(ctx, 192);
+	ProgressBegin(ctx, ctx->ditherimage != NULL ? 192 * 2 : 192);
 
 
 	for (y=0;y<192;y++,pos-=packet) {
-		fseek(fp,pos,SEEK_SET);
-		fread((char *)&bmpscanline[0],1,packet,fp);
-		if (hgroutput != 1) {
+		StageReadAt(ctx, (long)pos, &ctx->bmpscanline[0], packet);
+		if (ctx->hgroutput != 1) {
+			/* the scanline after it in the file */
+			StageReadAt(ctx, (long)(pos+packet), &ctx->bmpscanline2[0], packet);
 			pos-=packet;
-			fread((char *)&bmpscanline2[0],1,packet,fp);
 		}
 
-		for (x = 0,i = 0; x < bmpwidth; x++, i+=3) {
+		for (x = 0,i = 0; x < ctx->bmpwidth; x++, i+=3) {
 
-			blue = (ushort)bmpscanline[i];
-			green = (ushort)bmpscanline[i+1];
-			red = (ushort)bmpscanline[i+2];
+			blue = (ushort)ctx->bmpscanline[i];
+			green = (ushort)ctx->bmpscanline[i+1];
+			red = (ushort)ctx->bmpscanline[i+2];
 
 			if (verbatim == 2) {
-				blue  +=  bmpscanline2[i];
-				green += bmpscanline2[i+1];
-				red   += bmpscanline2[i+2];
+				blue  +=  ctx->bmpscanline2[i];
+				green += ctx->bmpscanline2[i+1];
+				red   += ctx->bmpscanline2[i+2];
 			}
 			/* Floyd-Steinberg Etc. dithering */
 			/* values are already seeded from previous line(s) */
-			AdjustShortPixel(1,(sshort *)&redDither[x],(sshort)red/verbatim);
-			AdjustShortPixel(1,(sshort *)&greenDither[x],(sshort)green/verbatim);
-			AdjustShortPixel(1,(sshort *)&blueDither[x],(sshort)blue/verbatim);
+			AdjustShortPixel(ctx, 1,(sshort *)&ctx->redDither[x],(sshort)red/verbatim);
+			AdjustShortPixel(ctx, 1,(sshort *)&ctx->greenDither[x],(sshort)green/verbatim);
+			AdjustShortPixel(ctx, 1,(sshort *)&ctx->blueDither[x],(sshort)blue/verbatim);
 		}
 
+	   if (ctx->ditherimage != NULL) {
+		   /* dithered on several threads after every scanline is read */
+		   DitherImageNext(ctx);
+		   if (ProgressLine(ctx) != 0) break;
+		   continue;
+	   }
+
 	   /* Floyd-Steinberg dithering */
-	   FloydSteinberg(y,bmpwidth);
-	   /* seed next line - promote nearest forward array to
-		  current line */
-	   memcpy(&redDither[0],&redSeed[0],1280);
-	   memcpy(&greenDither[0],&greenSeed[0],1280);
-	   memcpy(&blueDither[0],&blueSeed[0],1280);
-
-	   /* seed first seed - promote furthest forward array
-		  to nearest forward array */
-	   memcpy(&redSeed[0],&redSeed2[0],1280);
-	   memcpy(&greenSeed[0],&greenSeed2[0],1280);
-	   memcpy(&blueSeed[0],&blueSeed2[0],1280);
-
-	   /* clear last seed - furthest forward array */
-	   /* this is not used in all the error diffusion dithers */
-	   /* - but dithers like atkinson use 2 forward arrays */
-	   /* - in dithers that use only one forward array this does no harm */
-	   /* somewhat brute force but simple code */
-	   memset(&redSeed2[0],0,1280);
-	   memset(&greenSeed2[0],0,1280);
-	   memset(&blueSeed2[0],0,1280);
-
-
-		if (preview != 0) {
+	   FloydSteinberg(ctx, y,ctx->bmpwidth);
+	   /* seed next line - promote the forward arrays by
+		  rotating the error rows */
+	   DitherRowsNext(ctx);
+
+
+		if (ctx->preview != 0) {
 			/* write the preview line to the preview file */
-			fseek(fpreview,prepos,SEEK_SET);
-			fwrite((char *)&previewline[0],1,outpacket,fpreview);
-			prepos -= outpacket;
-
-			if (hgroutput != 1) {
-				fseek(fpreview,prepos,SEEK_SET);
-				fwrite((char *)&previewline[0],1,outpacket,fpreview);
-				prepos -= outpacket;
-			}
+			PreviewLine(ctx);
+			if (ctx->hgroutput != 1) PreviewLine(ctx);
 		}
 
+		if (ProgressLine(ctx) != 0) break;
 	}
 
-	fclose(fp);
+	if (ctx->ditherimage != NULL && ctx->cancelled == 0) {
+		DitherImage(ctx, ctx->bmpwidth);
+		for (y=0;y<192;y++) {
+			DitherImageRow(ctx, y);
+			FloydSteinbergPlot(ctx, y,ctx->bmpwidth);
+
+			if (ctx->preview != 0) {
+				PreviewLine(ctx);
+				if (ctx->hgroutput != 1) PreviewLine(ctx);
+			}
+
+			if (ProgressLine(ctx) != 0) break;
+		}
+	}
 
-	if (preview != 0) {
-		fclose(fpreview);
-		if (quietmode != 0) printf("Preview file %s created!\n",previewfile);
+	/* stopped by b2d_options.cancel - see b2d_progress.c */
+	if (ctx->cancelled != 0) {
+		ProgressAbort(ctx);
+		return INVALID;
 	}
 
-    if (debug == 0) {
-		if (reformat != 0) remove(reformatfile);
+	StageClose(ctx);
+
+	if (ctx->preview != 0) {
+		PreviewClose(ctx);
+		if (ctx->preview != 0 && ctx->previewrgba == NULL &&
+		    ctx->quietmode != 0) printf("Preview file %s created!\n",ctx->previewfile);
 	}
 
-    if (savedhr() != SUCCESS) return INVALID;
+	StatsStage(ctx, B2D_STAGE_SAVE);
+    if (savedhr(ctx) != SUCCESS) return INVALID;
 	return SUCCESS;
 
 }
@@ -5186,9 +4606,9 @@ void SqueezeLine(char *ptr)
    ascii palette file. */
 int ReadPaletteLine(unsigned char *ptr, unsigned char *palptr, unsigned int colordepth)
 {
-  int red, green, blue, idx, spaces = 0;
+  int red, green = 0, blue = 0, idx, spaces = 0;
 
-  red = atoi(ptr);
+  red = atoi((char *)ptr);
   if (red < 0 || red > 255) return INVALID;
 
   /* there must be at least 3 fields */
@@ -5197,11 +4617,11 @@ int ReadPaletteLine(unsigned char *ptr, unsigned char *palptr, unsigned int colo
        spaces++;
        switch(spaces) {
          case 1:
-           green = atoi(&ptr[idx+1]);
+           green = atoi((char *)&ptr[idx+1]);
            if (green < 0 || green > 255) return INVALID;
            break;
          case 2:
-           blue = atoi(&ptr[idx+1]);
+           blue = atoi((char *)&ptr[idx+1]);
            if (blue < 0 || blue > 255) return INVALID;
            break;
        }
@@ -5252,7 +4672,7 @@ char *AldusVersion = "100";
 #define NEO 4
 #define ALDUS 5
 
-sshort GetUserPalette(char *name)
+sshort GetUserPalette(b2d_context *ctx, char *name)
 {
 	FILE *fp;
 	char buf[128];
@@ -5260,14 +4680,11 @@ sshort GetUserPalette(char *name)
 	sshort status = INVALID;
 	unsigned colordepth=8,userpaltype=GENERIC;
 
-	fp = fopen(name,"r");
+	fp = b2d_fopen(ctx, name,"r");
 	if (fp == NULL) return status;
 
 	for (;;) {
-  		if (NULL == fgets(buf, 128, fp)) {
-    		fclose(fp);
-    		break;
-		}
+  		if (NULL == fgets(buf, 128, fp)) break;
   		nocr(buf);
   		SqueezeLine(buf);
 
@@ -5305,14 +4722,14 @@ sshort GetUserPalette(char *name)
 		}
 		if (status == INVALID) break;
 
-        memset(&rgbUser[0][0],0,48);
+        memset(&ctx->rgbUser[0][0],0,48);
         cnt = 0;
 		while (fgets(buf,128,fp) != NULL) {
 			if (buf[0] == '#') continue;
 			if (strlen(buf) < 5) continue;
   			nocr(buf);
   			SqueezeLine(buf);
-    		if (INVALID == ReadPaletteLine(buf,(uchar *)&rgbUser[cnt][0],colordepth)) continue;
+    		if (INVALID == ReadPaletteLine((uchar *)buf,(uchar *)&ctx->rgbUser[cnt][0],colordepth)) continue;
     		cnt++;
     		if (cnt > 15)break;
 		}
@@ -5333,164 +4750,108 @@ sshort GetUserPalette(char *name)
 /* a double hi-res pixel can occur at any one of 7 positions */
 /* in a 4 byte block which spans aux and main screen memory */
 /* the horizontal resolution is 140 pixels */
-int dhrgetpixel(int x,int y)
+
+/* the low 7 bits of the 4 bytes - aux, main, aux, main - make one
+   28 bit run with 4 bits for each pixel, so the pixel at position n
+   is bits n*4 to n*4+3 and dhrnibble gives its drawcolor */
+#define DHRBLOCK(a,m) ((ulong)((a)[0]&0x7f) | ((ulong)((m)[0]&0x7f) << 7) | \
+					   ((ulong)((a)[1]&0x7f) << 14) | ((ulong)((m)[1]&0x7f) << 21))
+
+int dhrgetpixel(b2d_context *ctx, int x,int y)
 {
-    int xoff, pattern, idx;
-    unsigned char *ptraux, *ptrmain,c1, c2, d1, d2;
+    int xoff, pattern;
+    unsigned char *ptraux, *ptrmain;
+    ulong bits;
 
     pattern = (x%7);
 	xoff = HB[y] + ((x/7) * 2);
-    ptraux  = (unsigned char *) &dhrbuf[xoff-0x2000];
-    ptrmain = (unsigned char *) &dhrbuf[xoff];
+    ptraux  = (unsigned char *) &ctx->dhrbuf[xoff-0x2000];
+    ptrmain = (unsigned char *) &ctx->dhrbuf[xoff];
 
+	bits = DHRBLOCK(ptraux,ptrmain);
+	return dhrnibble[(bits >> (pattern * 4)) & 0x0f];
+}
 
-	switch(pattern)
-	{
-		/* left this here for reference
+/* the drawcolors of all 140 pixels on scanline y */
+/* a 4 byte block is read once for its 7 pixels */
+void dhrgetline(b2d_context *ctx, int y, uchar *dest)
+{
+    int x, i;
+    unsigned char *ptraux, *ptrmain;
+    ulong bits;
 
-		unsigned char dhrpattern[7][4] = {
-		0,0,0,0,
-		0,0,0,1,
-		1,1,1,1,
-		1,1,2,2,
-		2,2,2,2,
-		2,3,3,3,
-        3,3,3,3};
-        */
+    ptraux  = (unsigned char *) &ctx->dhrbuf[HB[y]-0x2000];
+    ptrmain = (unsigned char *) &ctx->dhrbuf[HB[y]];
 
-        /* compare colors in the input file to color patterns and return drawcolor */
-        /* somewhat inelegant but lazy to read and debug if a problem */
-		case 0: c1 = ptraux[0] &0x0f;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][0] & 0x0f;
-				  if (d1 == c1) return idx;
-				}
-		        break;
-		case 1: c1 = ptraux[0] & 0x70;
-		        c2 = ptrmain[0] & 0x01;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][0] & 0x70;
-				  d2 = dhrbytes[idx][1] & 0x01;
-				  if (d1 == c1 && d2 == c2) return idx;
-				}
-		        break;
-		case 2: c1 = ptrmain[0] & 0x1e;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][1] & 0x1e;
-				  if (d1 == c1) return idx;
-				}
-		        break;
-		case 3: c1 = ptrmain[0] & 0x60;
-		        c2 = ptraux[1] & 0x03;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][1] & 0x60;
-				  d2 = dhrbytes[idx][2] & 0x03;
-				  if (d1 == c1 && d2 == c2) return idx;
-				}
-                break;
-		case 4: c1 = ptraux[1] & 0x3c;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][2] & 0x3c;
-				  if (d1 == c1) return idx;
-				}
-		        break;
-		case 5: c1 = ptraux[1] & 0x40;
- 		        c2 = ptrmain[1] & 0x07;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][2] & 0x40;
-				  d2 = dhrbytes[idx][3] & 0x07;
-				  if (d1 == c1 && d2 == c2) return idx;
-				}
-                break;
-		case 6: c1 = ptrmain[1] & 0x78;
-		        for (idx = 0; idx < 16; idx++) {
-				  d1 = dhrbytes[idx][3] & 0x78;
-				  if (d1 == c1) return idx;
-				}
- 		        break;
+	for (x = 0; x < 40; x += 2) {
+		bits = DHRBLOCK(&ptraux[x],&ptrmain[x]);
+		for (i = 0; i < 7; i++) {
+			*dest++ = dhrnibble[bits & 0x0f];
+			bits >>= 4;
+		}
 	}
-
-    return INVALID;
-
 }
 
 
-int save_to_bmp24(void)
+int save_to_bmp24(b2d_context *ctx)
 {
 
-    FILE *fp;
-    uchar tempr, tempg, tempb;
-	int i,x,y, y2 = 191,idx = 1;
-	ushort width = 280, height = 192, outpacket;
-
-	fp = fopen(previewfile,"wb");
-	if (NULL == fp) {
-		printf("Error opening %s for writing!\n",previewfile);
-		preview = 0;
-		return INVALID;
-	}
+    uchar tempr, tempg, tempb, line[140];
+	int i,x,x1,y,idx = 1,stage;
+	ushort width = 280, height = 192;
 
-	if (mono == 1 && hgroutput == 0) {
+	if (ctx->mono == 1 && ctx->hgroutput == 0) {
 		width = 560;
 		height = 384;
 		idx = 2;
 	}
 
-	/* write header for 24 bit bmp */
-    outpacket = WriteDIBHeader(fp,width,height);
-	if (outpacket == 0) {
-		fclose(fp);
-		remove(previewfile);
-		printf("Error writing header to %s!\n",previewfile);
-		preview = 0;
+	stage = StatsStage(ctx, B2D_STAGE_PREVIEW);
+
+	/* the preview is written top scanline first (see b2d_preview.c) */
+	if (PreviewOpen(ctx, width,height) == INVALID) {
+		StatsStage(ctx, stage);
 		return INVALID;
 	}
 
-	if (mono == 0) {
+	if (ctx->mono == 0) {
 		/* write rgb triples and double each pixel to preserve the aspect ratio */
    		for (y = 0; y< 192; y++) {
 
-		   for (x = 0; x < 140; x++) {
-			  idx = dhrgetpixel(x,y2);
+		   dhrgetline(ctx, y, line);
+		   for (x = 0, x1 = 0; x < 140; x++) {
+			  idx = line[x];
 
-			  /* range check */
-			  if (idx < 0 || idx > 15)idx = 0; /* default black */
+			  tempr = ctx->rgbPreview[idx][0];
+			  tempg = ctx->rgbPreview[idx][1];
+			  tempb = ctx->rgbPreview[idx][2];
 
-			  tempr = rgbPreview[idx][0];
-			  tempg = rgbPreview[idx][1];
-			  tempb = rgbPreview[idx][2];
-
-			  /* reverse order */
-			  fputc(tempb, fp);
-			  fputc(tempg, fp);
-			  fputc(tempr, fp);
-
-			  /* double-up */
-			  fputc(tempb, fp);
-			  fputc(tempg, fp);
-			  fputc(tempr, fp);
+			  /* reverse order and double-up */
+			  ctx->previewline[x1] = ctx->previewline[x1+3] = tempb; x1++;
+			  ctx->previewline[x1] = ctx->previewline[x1+3] = tempg; x1++;
+			  ctx->previewline[x1] = ctx->previewline[x1+3] = tempr; x1+=4;
 		   }
-		   y2 -= 1;
+		   PreviewLine(ctx);
 		}
 	}
 	else {
-		for (y = 0;y< 192;y++,y2--) {
-			if (width == 560) applemonobites(y2,1);
-			else applemonobites(y2,0);
-			for (i=0;i < idx;i++) {
-				for (x = 0; x < width; x++) {
-					if (buf280[x] == 0) tempb = 0;
-					else tempb = 255;
-					/* any order - black and white */
-					fputc(tempb, fp);
-					fputc(tempb, fp);
-					fputc(tempb, fp);
-				}
+		for (y = 0;y< 192;y++) {
+			if (width == 560) applemonobites(ctx, y,1);
+			else applemonobites(ctx, y,0);
+			for (x = 0, x1 = 0; x < width; x++) {
+				if (ctx->buf280[x] == 0) tempb = 0;
+				else tempb = 255;
+				/* any order - black and white */
+				ctx->previewline[x1] = ctx->previewline[x1+1] = ctx->previewline[x1+2] = tempb;
+				x1 += 3;
 			}
+			for (i=0;i < idx;i++) PreviewLine(ctx);
 		}
 	}
 
-	fclose(fp);
+	PreviewClose(ctx);
+	StatsStage(ctx, stage);
+	if (ctx->preview == 0) return INVALID;
 	return SUCCESS;
 
 }
@@ -5502,16 +4863,16 @@ int save_to_bmp24(void)
 /* based on a 140 x 192 matrix */
 /* 140 / 4 = 35 characters across */
 /* 192 / 6 = 32 lines down */
-sshort GetUserTextFile()
+sshort GetUserTextFile(b2d_context *ctx)
 {
 	FILE *fp;
 	char buf[128];
 	int x,y,i,cnt=0;
 
-	fp = fopen(usertextfile,"r");
+	fp = b2d_fopen(ctx, ctx->usertextfile,"r");
 	if (NULL == fp) {
 		/* for batch operations */
-		fp = fopen("b2d.txt","r");
+		fp = b2d_fopen(ctx, "b2d.txt","r");
 		if (NULL == fp) return INVALID;
 	}
 
@@ -5525,20 +4886,20 @@ sshort GetUserTextFile()
   	    buf[35] = 0;
   	    for (x=0;x<3;x++) {
 			/* creating a black outline */
-			thumbDHGR(buf,x,y,0,255,'L');
+			thumbDHGR(ctx, buf,x,y,0,255,'L');
 			/* skip the middle pixels, and fill-in color */
-			if (x!=1)thumbDHGR(buf,x,y+1,0,255,'L');
-			thumbDHGR(buf,x,y+2,0,255,'L');
+			if (x!=1)thumbDHGR(ctx, buf,x,y+1,0,255,'L');
+			thumbDHGR(ctx, buf,x,y+2,0,255,'L');
 		}
 		/* now do the middle pixels */
-		if (mono == 1) {
+		if (ctx->mono == 1) {
 			/* for monochrome the letters are always white */
-			thumbDHGR(buf,1,y+1,15,255,'L');
+			thumbDHGR(ctx, buf,1,y+1,15,255,'L');
 		}
 		else {
 			/* for color the letters can be any color at all except for black */
-  			if (backgroundcolor == 0)thumbDHGR(buf,1,y+1,15,255,'L');
-  			else thumbDHGR(buf,1,y+1,(unsigned char)backgroundcolor,255,'L');
+  			if (ctx->backgroundcolor == 0)thumbDHGR(ctx, buf,1,y+1,15,255,'L');
+  			else thumbDHGR(ctx, buf,1,y+1,(unsigned char)ctx->backgroundcolor,255,'L');
 		}
   		cnt++;
 	}
@@ -5546,7 +4907,7 @@ sshort GetUserTextFile()
 
     /* if we have created titled output, and we have already written a preview image
        we need to over-write it with a titled version */
-	if (cnt!= 0 && preview != 0) save_to_bmp24();
+	if (cnt!= 0 && ctx->preview != 0) save_to_bmp24(ctx);
 
     /* at this point we just return */
 	return SUCCESS;
@@ -5555,32 +4916,292 @@ sshort GetUserTextFile()
 
 
 
-int b2d_actual_main(int argc, char **argv)
+/* allocate our output buffers to support MS-DOS compilers
+   but does no harm for 32-bit compilers
+*/
+int AllocScreenBuffers(b2d_context *ctx)
+{
+	ctx->dhrbuf = ctx->hgrbuf = (uchar *)malloc(8192);
+	if (NULL != ctx->hgrbuf) {
+		ctx->dhrbuf = (uchar *)malloc(16384);
+	}
+	if (ctx->dhrbuf == NULL) {
+		puts("No memory...");
+		return INVALID;
+	}
+	return SUCCESS;
+}
+
+/* HGR output */
+void SetHgrPalette(b2d_context *ctx)
+{
+	/* Low-resolution colors
+	   0 (black),
+	   3 (purple),
+	   6 (medium blue),
+	   9 (orange),
+	   12 (light green) and
+	   15 (white) are also available in high-resolution mode */
+	/*
+
+	 disable the unused colors in the default palette */
+	/* these will be propagated to any alternate palettes that are selected */
+	ctx->grpal[1][0] = ctx->grpal[1][1] = ctx->grpal[1][2] = 0;
+	ctx->grpal[2][0] = ctx->grpal[2][1] = ctx->grpal[2][2] = 0;
+	ctx->grpal[4][0] = ctx->grpal[4][1] = ctx->grpal[4][2] = 0;
+	ctx->grpal[5][0] = ctx->grpal[5][1] = ctx->grpal[5][2] = 0;
+	ctx->grpal[7][0] = ctx->grpal[7][1] = ctx->grpal[7][2] = 0;
+	ctx->grpal[8][0] = ctx->grpal[8][1] = ctx->grpal[8][2] = 0;
+	ctx->grpal[10][0] = ctx->grpal[10][1] = ctx->grpal[10][2] = 0;
+	ctx->grpal[11][0] = ctx->grpal[11][1] = ctx->grpal[11][2] = 0;
+	ctx->grpal[13][0] = ctx->grpal[13][1] = ctx->grpal[13][2] = 0;
+	ctx->grpal[14][0] = ctx->grpal[14][1] = ctx->grpal[14][2] = 0;
+}
+
+void CheckOptions(b2d_context *ctx, sshort pseudopal)
+{
+	/* mutually exclusive commands are handled here */
+	if (ctx->hgroutput == 1) {
+		if (ctx->loresoutput == 1) {
+			ctx->loresoutput = 0;
+			puts("HGR output and Lo-Res output are mutually exclusive.\nLo-Res output cancelled!");
+		}
+		/*
+		if (outputtype == SPRITE_OUTPUT) {
+			outputtype = BIN_OUTPUT;
+			puts("HGR output and Image Fragment output are mutually exclusive.\nImage Fragment output cancelled!");
+		}
+		*/
+		if (ctx->mono == 1) {
+			ctx->mono = 0;
+			puts("HGR output and Monochrome output are mutually exclusive.\nMonochrome output cancelled!");
+		}
+	}
+	else {
+		ctx->hgrdither = 0;
+	}
+
+	if (ctx->mono == 1) {
+		if (ctx->loresoutput == 1) {
+			ctx->loresoutput = 0;
+			puts("Monochrome output and Lo-Res output are mutually exclusive.\nLo-Res output cancelled!");
+		}
+		if (ctx->outputtype == SPRITE_OUTPUT) {
+			ctx->mono = 0;
+			puts("Image Fragment output and Monochrome output are mutually exclusive.\nMonochrome output cancelled!");
+		}
+	}
+
+	if (ctx->loresoutput == 1) {
+		ctx->use_overlay = 0;
+		if (ctx->outputtype == SPRITE_OUTPUT) {
+			ctx->outputtype = BIN_OUTPUT;
+			puts("Lo-Res output and Image Fragment output are mutually exclusive.\nImage Fragment output cancelled!");
+		}
+	}
+
+    /* embedding of image fragments or palette output only */
+    if (ctx->outputtype != SPRITE_OUTPUT) {
+		if (pseudopal == 0) ctx->quietmode = 1;
+	}
+}
+
+/* output file names are based on the input file name */
+void SetFileNames(b2d_context *ctx, char *name, sshort basename, sshort plainname, char *hgroptions)
+{
+	sshort idx,jdx;
+	uchar ch;
+
+    jdx = 999;
+	strcpy(ctx->fname, name);
+	for (idx = 0; ctx->fname[idx] != (uchar)0; idx++) {
+		if (ctx->fname[idx] == '.') {
+			jdx = idx;
+		}
+	}
+    if (jdx != 999) ctx->fname[jdx] = (uchar)0;
+
+    sprintf(ctx->bmpfile,"%s.bmp",ctx->fname);
+    sprintf(ctx->dibfile,"%s.dib",ctx->fname);
+#ifdef MSDOS
+	ctx->tags = 0;
+    sprintf(ctx->previewfile,"%s.pmp",ctx->fname);
+    sprintf(ctx->scaledfile,"%s.smp",ctx->fname);
+    sprintf(ctx->reformatfile,"%s.rmp",ctx->fname);
+    sprintf(ctx->vbmpfile,"%s.vmp",ctx->fname);
+#else
+    sprintf(ctx->previewfile,"%s_Preview.bmp",ctx->fname);
+    sprintf(ctx->scaledfile,"%s_Scaled.bmp",ctx->fname);
+    sprintf(ctx->reformatfile,"%s_Reformat.bmp",ctx->fname);
+    sprintf(ctx->vbmpfile,"%s_VBMP.bmp",ctx->fname);
+#endif
+    /* user titling file */
+    sprintf(ctx->usertextfile,"%s.txt",ctx->fname);
+
+    /* upper case basename for Apple II Output */
+    for (idx = 0; ctx->fname[idx] != (uchar)0; idx++) {
+		ch = toupper(ctx->fname[idx]);
+		ctx->fname[idx] = ch;
+	}
+	strcpy(ctx->hgrwork,ctx->fname);
+
+	if (basename == 1) {
+		/* if they are using the same naming convention that I am */
+	    /* optionally strip the resolution nomenclature from the input file's base name */
+		idx = strlen(ctx->hgrwork);
+		if (idx > 3) {
+			/* in order below: 384 - 560 x 384
+			                   280 - 280 x 192
+			                   640 - 640 x 480
+			                   400 - 640 x 400
+			                   320 - 320 x 200
+			                   140 - 140 x 192
+			                   560 - 560 x 192
+
+			                   LGR and DLGR only
+
+			                   176 - 176 x 104
+			                   160 - 160 x 80 and 160 x 96
+			                   88  - 88 x 52
+                               80  - 80 x 40 and 80 x 48
+			                   48  - 80 x 48 and 40 x 48
+			                   40  - 80 x 40 and 40 x 40
+			*/
+			if (ctx->hgrwork[idx-3] == '3' && ctx->hgrwork[idx-2] == '8' && ctx->hgrwork[idx-1] == '4') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '2' && ctx->hgrwork[idx-2] == '8' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '6' && ctx->hgrwork[idx-2] == '4' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '4' && ctx->hgrwork[idx-2] == '0' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '3' && ctx->hgrwork[idx-2] == '2' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '1' && ctx->hgrwork[idx-2] == '4' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '5' && ctx->hgrwork[idx-2] == '6' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '1' && ctx->hgrwork[idx-2] == '7' && ctx->hgrwork[idx-1] == '6') ctx->hgrwork[idx - 3] = 0;
+			else if (ctx->hgrwork[idx-3] == '1' && ctx->hgrwork[idx-2] == '6' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 3] = 0;
+
+			if (ctx->hgrwork[idx - 3] != (char)0) {
+				/* LGR and DLGR only */
+				if (ctx->hgrwork[idx-2] == '8' && ctx->hgrwork[idx-1] == '8') ctx->hgrwork[idx - 2] = 0;
+				else if (ctx->hgrwork[idx-2] == '8' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 2] = 0;
+				else if (ctx->hgrwork[idx-2] == '4' && ctx->hgrwork[idx-1] == '8') ctx->hgrwork[idx - 2] = 0;
+				else if (ctx->hgrwork[idx-2] == '4' && ctx->hgrwork[idx-1] == '0') ctx->hgrwork[idx - 2] = 0;
+			}
+		}
+	}
+
+    /* CiderPress File Attribute Preservation Tags */
+    if (ctx->tags == 1) {
+		if (ctx->hgroutput == 0)
+			sprintf(ctx->spritefile,"%s.DHR#062000",ctx->hgrwork);
+		else
+			sprintf(ctx->spritefile,"%s.RAG#062000",ctx->hgrwork);
+
+		sprintf(ctx->fmask,"%s.DHM#062000",ctx->hgrwork);
+		sprintf(ctx->mainfile,"%s.BIN#062000",ctx->hgrwork);
+		sprintf(ctx->auxfile,"%s.AUX#062000",ctx->hgrwork);
+		sprintf(ctx->a2fcfile,"%s.A2FC#062000",ctx->hgrwork);
+		if (plainname == 0) {
+		    sprintf(ctx->hgrcolor,"%s%s.BIN#062000",ctx->hgrwork,hgroptions);
+			sprintf(ctx->hgrmono,"%sM.BIN#062000",ctx->hgrwork);
+			if (ctx->mono == 1) {
+				sprintf(ctx->a2fcfile,"%s.A2FM#062000",ctx->hgrwork);
+				sprintf(ctx->mainfile,"%sM.BIN#062000",ctx->hgrwork);
+				sprintf(ctx->auxfile,"%sM.AUX#062000",ctx->hgrwork);
+			}
+		}
+		else {
+			sprintf(ctx->hgrcolor,"%s.BIN#062000",ctx->hgrwork);
+			sprintf(ctx->hgrmono,"%s.BIN#062000",ctx->hgrwork);
+		}
+	}
+    else {
+		/* tags are off by default */
+		/* unadorned file names */
+		if (ctx->hgroutput == 0)
+			sprintf(ctx->spritefile,"%s.DHR",ctx->hgrwork);
+		else
+			sprintf(ctx->spritefile,"%s.RAG",ctx->hgrwork);
+
+		sprintf(ctx->fmask,"%s.DHM",ctx->hgrwork);
+		sprintf(ctx->mainfile,"%s.BIN",ctx->hgrwork);
+		sprintf(ctx->auxfile,"%s.AUX",ctx->hgrwork);
+#ifdef MSDOS
+		if (plainname == 0 && ctx->mono == 1)
+			sprintf(ctx->a2fcfile,"%s.2FM",ctx->hgrwork);
+		else
+		  	sprintf(ctx->a2fcfile,"%s.2FC",ctx->hgrwork);
+		strcpy(ctx->hgrcolor,ctx->hgrwork);
+		strcpy(ctx->hgrmono,ctx->hgrwork);
+#else
+		sprintf(ctx->a2fcfile,"%s.A2FC",ctx->hgrwork);
+
+		if (plainname == 0) {
+		    sprintf(ctx->hgrcolor,"%s%s.BIN",ctx->hgrwork,hgroptions);
+			sprintf(ctx->hgrmono,"%sM.BIN",ctx->hgrwork);
+			if (ctx->mono == 1) {
+				sprintf(ctx->a2fcfile,"%s.A2FM",ctx->hgrwork);
+				sprintf(ctx->mainfile,"%sM.BIN#062000",ctx->hgrwork);
+				sprintf(ctx->auxfile,"%sM.AUX#062000",ctx->hgrwork);
+			}
+		}
+		else {
+			sprintf(ctx->hgrcolor,"%s.BIN",ctx->hgrwork);
+			sprintf(ctx->hgrmono,"%s.BIN",ctx->hgrwork);
+		}
+#endif
+	}
+}
+
+sshort ConvertImage(b2d_context *ctx, sshort palidx, sshort previewidx, sshort pseudopal)
+{
+	sshort status;
+
+	/* option "stats" - see b2d_stats.c */
+	StatsBegin(ctx);
+
+	if (ctx->mono == 1) {
+		palidx = previewidx = 4;
+		/* create a black and white palette */
+		memset(&ctx->wikipedia[0][0],0,45);
+	}
+	else {
+		/* create pseudo-palette for conversion */
+		/* preview using pseudopalette is optional - v15 */
+		if (pseudopal != 0) {
+			BuildPseudoPalette(ctx, palidx);
+			palidx = 15;
+		}
+	}
+
+  	GetBuiltinPalette(ctx, palidx,previewidx,0);
+    InitDoubleArrays(ctx);
+
+    if (ctx->mono == 1) status = ConvertMono(ctx);
+    else status = Convert(ctx);
+
+    /* close mask file if any before exiting */
+    if (NULL != ctx->fpmask) fclose(ctx->fpmask);
+    ctx->fpmask = NULL;
+
+	StatsEnd(ctx);
+	return status;
+}
+
+
+int b2d_actual_main(b2d_context *ctx, int argc, char **argv)
 {
 	sshort idx,jdx,kdx,palidx=5,previewidx=5,hgrpalidx=5,pseudopal=0,
 	       status,basename=0,plainname=0;
 	uchar c, ch, *wordptr, *ptr;
-	char hgroptions[20];
+	char hgroptions[20], statsline[512];
 
     if (argc < 2) {
 		pusage();
 		return (1);
 	}
 
-	/* allocate our output buffers to support MS-DOS compilers
-	   but does no harm for 32-bit compilers
-	*/
-	dhrbuf = hgrbuf = (uchar *)malloc(8192);
-	if (NULL != hgrbuf) {
-		dhrbuf = (uchar *)malloc(16384);
-	}
-	if (dhrbuf == NULL) {
-		puts("No memory...");
-		return (1);
-	}
+	if (AllocScreenBuffers(ctx) == INVALID) return (1);
 
     /* initialize color space for color distance */
-	setluma();
+	setluma(ctx);
 
     /* automatic naming is used for a number of reasons */
     /* I make no attempt to test for a legal ProDOS file name length - that's up to the user */
@@ -5592,7 +5213,7 @@ int b2d_actual_main(int argc, char **argv)
     /* for HGR output the preview file is an approximation so far */
     hgroptions[0] = 0;
 
-    usertextfile[0] = 0;
+    ctx->usertextfile[0] = 0;
 
     /* getopts */
     if (argc > 2) {
@@ -5605,64 +5226,98 @@ int b2d_actual_main(int argc, char **argv)
                 ch = toupper(wordptr[0]);
 			}
 
-			if (cmpstr(wordptr,"debug") == SUCCESS) {
-				debug = 1;
+			if (cmpstr((char *)wordptr,"debug") == SUCCESS) {
+				ctx->debug = 1;
 				continue;
 			}
 
             /* set different Luma for color distance */
             jdx = 0;
-			if (cmpstr(wordptr,"GIMP") == SUCCESS) jdx = 411;
-			else if (cmpstr(wordptr,"MAGICK") == SUCCESS) jdx = 709;
-			else if (cmpstr(wordptr,"HDMI") == SUCCESS) jdx = 240;
+			if (cmpstr((char *)wordptr,"GIMP") == SUCCESS) jdx = 411;
+			else if (cmpstr((char *)wordptr,"MAGICK") == SUCCESS) jdx = 709;
+			else if (cmpstr((char *)wordptr,"HDMI") == SUCCESS) jdx = 240;
 			if (jdx != 0) {
-			   lumaREQ = jdx;
-			   printf("Using LumaREQ %d\n", lumaREQ);
-			   setluma();
+			   ctx->lumaREQ = jdx;
+			   printf("Using LumaREQ %d\n", ctx->lumaREQ);
+			   setluma(ctx);
 			   continue;
 		    }
 
 			/* so-called "quick" commands */
-			if (cmpstr(wordptr,"photo") == SUCCESS) {
-				dither = FLOYDSTEINBERG;
+			if (cmpstr((char *)wordptr,"photo") == SUCCESS) {
+				ctx->dither = FLOYDSTEINBERG;
 				continue;
 			}
-			if (cmpstr(wordptr,"art") == SUCCESS) {
-				threshold = 25;
-				xmatrix = 2;
+			if (cmpstr((char *)wordptr,"art") == SUCCESS) {
+				ctx->threshold = 25;
+				ctx->xmatrix = 2;
 				continue;
 			}
-			if (cmpstr(wordptr,"both") == SUCCESS) {
-				dither = FLOYDSTEINBERG;
-				threshold = 15;
-				xmatrix = 2;
+			if (cmpstr((char *)wordptr,"both") == SUCCESS) {
+				ctx->dither = FLOYDSTEINBERG;
+				ctx->threshold = 15;
+				ctx->xmatrix = 2;
 				continue;
 			}
-			if (cmpstr(wordptr,"sprite") == SUCCESS) {
-				outputtype = SPRITE_OUTPUT;
+			if (cmpstr((char *)wordptr,"sprite") == SUCCESS) {
+				ctx->outputtype = SPRITE_OUTPUT;
 				continue;
 			}
 
-			if (cmpstr(wordptr,"BIN") == SUCCESS) {
-				applesoft = 1;
+			if (cmpstr((char *)wordptr,"BIN") == SUCCESS) {
+				ctx->applesoft = 1;
 				continue;
 			}
 
-			if (cmpstr(wordptr,"sum") == SUCCESS) {
-				errorsum = 1;
+			if (cmpstr((char *)wordptr,"sum") == SUCCESS) {
+				ctx->errorsum = 1;
 				continue;
 			}
 
-			if (cmpstr(wordptr,"mono") == SUCCESS || cmpstr(wordptr,"reverse") == SUCCESS) {
-				mono = 1;
-				if (dither == 0) dither = FLOYDSTEINBERG;
-				if (cmpstr(wordptr,"reverse") == SUCCESS) reverse = 1;
+			/* color table mode */
+			if (cmpstr((char *)wordptr,"lut") == SUCCESS) {
+				ctx->colortable = 1;
+				continue;
+			}
+
+			/* integer color distances */
+			if (cmpstr((char *)wordptr,"fixed") == SUCCESS) {
+				ctx->fixedpoint = 1;
+				continue;
+			}
+
+			/* time each stage and print the stats as JSON */
+			if (cmpstr((char *)wordptr,"stats") == SUCCESS) {
+				ctx->stats = 1;
+				continue;
+			}
+
+			/* dither on more than one thread - mt for one per processor or mt2 to mt16 */
+			if (toupper(wordptr[0]) == 'M' && toupper(wordptr[1]) == 'T' &&
+				(wordptr[2] == 0 || (wordptr[2] > 47 && wordptr[2] < 58))) {
+				ctx->ditherthreads = (wordptr[2] == 0 ? -1 : atoi((char *)&wordptr[2]));
+				continue;
+			}
+
+			/* resample input of any other size to this size - fit640x480 */
+			if (toupper(wordptr[0]) == 'F' && toupper(wordptr[1]) == 'I' && toupper(wordptr[2]) == 'T' &&
+				wordptr[3] > 47 && wordptr[3] < 58) {
+				ptr = (uchar *)strchr((char *)&wordptr[3],'x');
+				if (ptr == NULL) ptr = (uchar *)strchr((char *)&wordptr[3],'X');
+				ResampleFit(ctx, atoi((char *)&wordptr[3]), ptr == NULL ? 0 : atoi((char *)&ptr[1]));
+				continue;
+			}
+
+			if (cmpstr((char *)wordptr,"mono") == SUCCESS || cmpstr((char *)wordptr,"reverse") == SUCCESS) {
+				ctx->mono = 1;
+				if (ctx->dither == 0) ctx->dither = FLOYDSTEINBERG;
+				if (cmpstr((char *)wordptr,"reverse") == SUCCESS) ctx->reverse = 1;
 				continue;
 			}
 
             /* DOS 3.3 header will be appended to Apple II Output */
-			if (cmpstr(wordptr,"dos") == SUCCESS) {
-				dosheader = 1;
+			if (cmpstr((char *)wordptr,"dos") == SUCCESS) {
+				ctx->dosheader = 1;
 				continue;
 			}
 
@@ -5683,7 +5338,7 @@ int b2d_actual_main(int argc, char **argv)
 
 		    switch(ch) {
 				case 'A': /* output AUX,BIN - default is A2FC */
-				          applesoft = 1;
+				          ctx->applesoft = 1;
 				          break;
 				case 'B':
  				          c = wordptr[1];
@@ -5697,52 +5352,52 @@ int b2d_actual_main(int argc, char **argv)
 
 						  /* background color 1-15 (0 by default) */
  				          c = PaintByNumbers((char *)&wordptr[1]);
- 				          if (c!= (uchar)255) backgroundcolor = c;
+ 				          if (c!= (uchar)255) ctx->backgroundcolor = c;
 				          break;
 
 				case 'C': ch = toupper(wordptr[1]);
 				          if (ch == 'P' || ch == 'V') {
-							  paletteclip = 1;
+							  ctx->paletteclip = 1;
 							  break;
 						  }
-				          globalclip = 1;
+				          ctx->globalclip = 1;
 				          break;
 
                 case 'D': if (cmpstr("DL", (char *)&wordptr[0]) == SUCCESS) {
 					          /* DLGR output */
-					  		  loresoutput = 1;
+					  		  ctx->loresoutput = 1;
 					  		  break;
 					  	  }
 
-                          dither = FLOYDSTEINBERG;
+                          ctx->dither = FLOYDSTEINBERG;
 
-                          if (ReadCustomDither((char *)&wordptr[1]) == SUCCESS) {
+                          if (ReadCustomDither(ctx, (char *)&wordptr[1]) == SUCCESS) {
 							  break;
 						  }
 
 						  ch = toupper(wordptr[1]);
 						  if (ch == 'X') {
 							  wordptr++;
-							  serpentine = 1;
+							  ctx->serpentine = 1;
 						  }
 
                 		  jdx = atoi((char *)&wordptr[1]);
-                		  if (jdx > 0 && jdx < 10) dither = jdx;
+                		  if (jdx > 0 && jdx < 10) ctx->dither = jdx;
                 		  else {
 							  ch = toupper(wordptr[1]);
 							  switch(ch) {
-								  case 'F': dither = FLOYDSTEINBERG;break;
-								  case 'J': dither = JARVIS;break;
-								  case 'S': dither = STUCKI;
+								  case 'F': ctx->dither = FLOYDSTEINBERG;break;
+								  case 'J': ctx->dither = JARVIS;break;
+								  case 'S': ctx->dither = STUCKI;
 								            ch = toupper(wordptr[2]);
-								            if (ch == 'I') dither = SIERRA;
-								            else if (ch == '2') dither = SIERRATWO;
-								            else if (ch == 'L') dither = SIERRALITE;
+								            if (ch == 'I') ctx->dither = SIERRA;
+								            else if (ch == '2') ctx->dither = SIERRATWO;
+								            else if (ch == 'L') ctx->dither = SIERRALITE;
 								            break;
-								  case 'A': dither = ATKINSON;break;
-								  case 'B': dither = BURKES;
+								  case 'A': ctx->dither = ATKINSON;break;
+								  case 'B': ctx->dither = BURKES;
 								            ch = toupper(wordptr[2]);
-								            if (ch == 'B') dither = 9;
+								            if (ch == 'B') ctx->dither = 9;
 								            break;
 							  }
 						  }
@@ -5751,27 +5406,27 @@ int b2d_actual_main(int argc, char **argv)
 
 				case 'E':
                           /* error diffusion default = E2 */
-                          diffuse = 2;
+                          ctx->diffuse = 2;
                           jdx = atoi((char *)&wordptr[1]);
                           /* E4 */
-                          if (jdx == 4) diffuse = 4;
+                          if (jdx == 4) ctx->diffuse = 4;
                           break;
 
 				case 'F': /* image fragment - off by default */
-				          outputtype = SPRITE_OUTPUT;
+				          ctx->outputtype = SPRITE_OUTPUT;
 				          ch = toupper(wordptr[1]);
-				          if (ch == 'M') spritemask = 1;
+				          if (ch == 'M') ctx->spritemask = 1;
 				          break;
 
 				case 'J':
 						   /* scaling of larger sizes is pixel by pixel
 						      when justification is selected */
-						   justify = 1;
+						   ctx->justify = 1;
 				           ch = toupper(wordptr[1]); /* justify */
 						   switch(ch) {
-							   case 'L': jxoffset = atoi((char *)&wordptr[2]);
+							   case 'L': ctx->jxoffset = atoi((char *)&wordptr[2]);
 							             break;
-							   case 'T': jyoffset = atoi((char *)&wordptr[2]);
+							   case 'T': ctx->jyoffset = atoi((char *)&wordptr[2]);
 							             break;
 
 						   }
@@ -5779,13 +5434,13 @@ int b2d_actual_main(int argc, char **argv)
 
 				case 'H':  /* HGR output - command option 'H' */
 				           /* some options follow */
-				           hgroutput = 1;
+				           ctx->hgroutput = 1;
 				           if (hgroptions[0] == (char)0){
 							   /* if we are using Sheldon's HGR palette we use the TC suffix */
 							   /* if we are using Sheldon's DHGR palette modified for HGR we use the C suffix */
 							   if (hgrpalidx == 16)strcat(hgroptions,"TC");
 							   else strcat(hgroptions,"C");
-							   clearcolor = 3; /* set use_overlay color to violet */
+							   ctx->clearcolor = 3; /* set use_overlay color to violet */
 						   }
 				           /* default long file name for HGR color */
 				           /* HGR long commands - can be followed by separate HGR short commands to over-ride fixed settings */
@@ -5796,11 +5451,11 @@ int b2d_actual_main(int argc, char **argv)
 							   jdx = strlen((char *)&wordptr[0]);
 							   if (jdx < 6 || jdx > 9) break;
 							   if (jdx == 8 || jdx == 9) {
-								   if (jdx == 8) ptr = (char *)&wordptr[3];
-								   else ptr = (char *)&wordptr[4];
+								   if (jdx == 8) ptr = &wordptr[3];
+								   else ptr = &wordptr[4];
 								   if (cmpstr("clean", (char *)&ptr[0]) == SUCCESS) {
 									    printf("HGR Option X: %s\n",(char *)&ptr[0]);
-										globalclip = errorsum = 1;
+										ctx->globalclip = ctx->errorsum = 1;
 										ptr[0] = 0;
 										strcat(hgroptions,"X");
 										jdx = 0;
@@ -5809,11 +5464,11 @@ int b2d_actual_main(int argc, char **argv)
 							   if (jdx < 6 || jdx > 8) break;
 							   jdx = strlen((char *)&wordptr[0]);
 							   if (jdx == 7 || jdx == 8) {
-								   if (jdx == 7) ptr = (char *)&wordptr[3];
-								   else ptr = (char *)&wordptr[4];
+								   if (jdx == 7) ptr = &wordptr[3];
+								   else ptr = &wordptr[4];
 								   if (cmpstr("clip", (char *)&ptr[0]) == SUCCESS) {
 									    printf("HGR Option Y: %s\n",(char *)&ptr[0]);
-										globalclip = 1;
+										ctx->globalclip = 1;
 										ptr[0] = 0;
 										strcat(hgroptions,"Y");
 										jdx = 0;
@@ -5822,11 +5477,11 @@ int b2d_actual_main(int argc, char **argv)
 							   if (jdx < 6 || jdx > 8) break;
 							   jdx = strlen((char *)&wordptr[0]);
 							   if (jdx == 6 || jdx == 7) {
-								   if (jdx == 6) ptr = (char *)&wordptr[3];
-								   else ptr = (char *)&wordptr[4];
+								   if (jdx == 6) ptr = &wordptr[3];
+								   else ptr = &wordptr[4];
 								   if (cmpstr("sum", (char *)&ptr[0]) == SUCCESS) {
 									    printf("HGR Option Z: %s\n",(char *)&ptr[0]);
-										errorsum = 1;
+										ctx->errorsum = 1;
 										ptr[0] = 0;
 										strcat(hgroptions,"Z");
 								   }
@@ -5839,31 +5494,31 @@ int b2d_actual_main(int argc, char **argv)
 							   /* long commands */
 							   case 3:
 								   if (cmpstr("hgr", (char *)&wordptr[0]) == SUCCESS) {
-									   if (hgrcolortype == (char)0) hgrcolortype = 'B';
+									   if (ctx->hgrcolortype == (char)0) ctx->hgrcolortype = 'B';
 								   }
 								   break;
 							   case 4:
 								   if (cmpstr("hgrs", (char *)&wordptr[0]) == SUCCESS) {
 									   /* optionally single colored pixels are set */
-									   if (hgrcolortype == (char)0) hgrcolortype = 'B';
-									   doublecolors = 0;
+									   if (ctx->hgrcolortype == (char)0) ctx->hgrcolortype = 'B';
+									   ctx->doublecolors = 0;
 									   puts("HGR Option S: single color pixels");
 									   strcat(hgroptions,"S");
 								   }
 								   else if (cmpstr("hgrw", (char *)&wordptr[0]) == SUCCESS) {
 									   /* optionally double colors are set with a double white use_overlay */
-									   if (hgrcolortype == (char)0) hgrcolortype = 'B';
+									   if (ctx->hgrcolortype == (char)0) ctx->hgrcolortype = 'B';
 									   puts("HGR Option W: double color and white pixels");
-									   doublecolors = 1;
-									   doublewhite = 1;
+									   ctx->doublecolors = 1;
+									   ctx->doublewhite = 1;
 									   strcat(hgroptions,"W");
 								   }
 								   else if (cmpstr("hgrb", (char *)&wordptr[0]) == SUCCESS) {
 									   /* optionally double colors are set with a double black use_overlay */
-									   if (hgrcolortype == (char)0) hgrcolortype = 'B';
+									   if (ctx->hgrcolortype == (char)0) ctx->hgrcolortype = 'B';
 									   puts("HGR Option B: double color and black pixels");
-									   doublecolors = 1;
-									   doubleblack = 1;
+									   ctx->doublecolors = 1;
+									   ctx->doubleblack = 1;
 									   strcat(hgroptions,"B");
 								   }
 								   else if (cmpstr("hgro", (char *)&wordptr[0]) == SUCCESS) {
@@ -5871,31 +5526,31 @@ int b2d_actual_main(int argc, char **argv)
 										/* color type is not needed */
 										/* no pixel options - individual pixels only */
 										puts("HGR Option O: Orange and Blue Palette Only");
-										grpal[3][0]   = grpal[3][1]   = grpal[3][2]   = 0;
-										grpal[12][0]  = grpal[12][1]  = grpal[12][2]  = 0;
-										hgrpaltype = 0x80;
+										ctx->grpal[3][0]   = ctx->grpal[3][1]   = ctx->grpal[3][2]   = 0;
+										ctx->grpal[12][0]  = ctx->grpal[12][1]  = ctx->grpal[12][2]  = 0;
+										ctx->hgrpaltype = 0x80;
 										strcat(hgroptions,"O");
-										hgrdither = 0;
+										ctx->hgrdither = 0;
 
 									}
 									else if (cmpstr("hgrg", (char *)&wordptr[0]) == SUCCESS) {
 										/* set HGR output for green and violet only */
 										/* color type is not needed */
 										/* no pixel options - individual pixels only */
-										clearcolor = 6; /* set use_overlay color to blue */
+										ctx->clearcolor = 6; /* set use_overlay color to blue */
 										puts("HGR Option G: Green and Violet Palette Only");
-										grpal[6][0]  = grpal[6][1]  = grpal[6][2]  = 0;
-										grpal[9][0]  = grpal[9][1]  = grpal[9][2]  = 0;
-										hgrpaltype = 0;
+										ctx->grpal[6][0]  = ctx->grpal[6][1]  = ctx->grpal[6][2]  = 0;
+										ctx->grpal[9][0]  = ctx->grpal[9][1]  = ctx->grpal[9][2]  = 0;
+										ctx->hgrpaltype = 0;
 										strcat(hgroptions,"G");
-										hgrdither = 0;
+										ctx->hgrdither = 0;
 									}
 									else if (cmpstr("hgr2",(char *)&wordptr[0]) == SUCCESS) {
 										puts("HGR alternate nearest color option");
 										strcat(hgroptions,"A");
-										hgrdither = 1;
+										ctx->hgrdither = 1;
 									}
-									break;
+								   break;
 							   case 1:
 							   case 2:
 									/* short commands */
@@ -5921,55 +5576,36 @@ int b2d_actual_main(int argc, char **argv)
 										else {
 											printf("HGR Precedence Over-ride: Strong %c\n",ch);
 										}
-										wordptr[1] = hgrcolortype = ch;
+										wordptr[1] = ctx->hgrcolortype = ch;
 										wordptr[0] = toupper(wordptr[0]);
 										strcat(hgroptions,(char *)&wordptr[0]);
 								   }
 							   }
 
 
-							/* Low-resolution colors
-							   0 (black),
-							   3 (purple),
-							   6 (medium blue),
-							   9 (orange),
-							   12 (light green) and
-							   15 (white) are also available in high-resolution mode */
-							/*
-
-							 disable the unused colors in the default palette */
-							/* these will be propagated to any alternate palettes that are selected */
-							grpal[1][0] = grpal[1][1] = grpal[1][2] = 0;
-							grpal[2][0] = grpal[2][1] = grpal[2][2] = 0;
-							grpal[4][0] = grpal[4][1] = grpal[4][2] = 0;
-							grpal[5][0] = grpal[5][1] = grpal[5][2] = 0;
-							grpal[7][0] = grpal[7][1] = grpal[7][2] = 0;
-							grpal[8][0] = grpal[8][1] = grpal[8][2] = 0;
-							grpal[10][0] = grpal[10][1] = grpal[10][2] = 0;
-							grpal[11][0] = grpal[11][1] = grpal[11][2] = 0;
-							grpal[13][0] = grpal[13][1] = grpal[13][2] = 0;
-							grpal[14][0] = grpal[14][1] = grpal[14][2] = 0;
+							/* disable the colors that HGR does not have */
+							SetHgrPalette(ctx);
  				          	break;
                 case 'L':
-                          if (wordptr[1] == (char) 0 || cmpstr(wordptr,"lgr") == SUCCESS) {
+                          if (wordptr[1] == (char) 0 || cmpstr((char *)wordptr,"lgr") == SUCCESS) {
 	                          /* LGR output */
- 	                         lores = loresoutput = 1;
+ 	                         ctx->lores = ctx->loresoutput = 1;
  	                         break;
 	 					  }
 
                           /* Luma */
                           jdx = atoi((char *)&wordptr[1]);
                           if (jdx == 601 || jdx == 709 || jdx == 240 || jdx == 911 || jdx == 411) {
-							  lumaREQ = jdx;
-							  printf("Using LumaREQ %d\n", lumaREQ);
-							  setluma();
+							  ctx->lumaREQ = jdx;
+							  printf("Using LumaREQ %d\n", ctx->lumaREQ);
+							  setluma(ctx);
 							  break;
 						  }
 						  break;
 
                 case 'M': /* M2 - horizontal merge - S2 mode only */
                           /* by default every second pixel is skipped */
-                          merge = 1;
+                          ctx->merge = 1;
                           break;
 
                 case 'O': /* use an 8 bit use_overlay file - must be 140 x 192 */
@@ -5978,27 +5614,28 @@ int b2d_actual_main(int argc, char **argv)
  				          if (c == (uchar)0) break;
  						  c = PaintByNumbers((char *)&wordptr[1]);
  				          if (c!= (uchar)255) {
- 				        	clearcolor = c; break;
+ 				        	ctx->clearcolor = c; break;
 						  }
-                          use_overlay = 1;
-                		  strcpy(maskfile,(char *)&wordptr[1]);
+                          ctx->use_overlay = 1;
+                		  strcpy(ctx->maskfile,(char *)&wordptr[1]);
                 		  /* maskfile must have an extension or .bmp is assumed */
                 		  /* this avoids typing extensions which I dislike doing */
                 		  /* so I provide expected extensions. any questions? */
                 	      kdx = 999;
-                	      for (jdx=0;maskfile[jdx]!=0;jdx++) {
-							  if (maskfile[jdx] == '.')kdx = jdx;
+                	      for (jdx=0;ctx->maskfile[jdx]!=0;jdx++) {
+							  if (ctx->maskfile[jdx] == '.')kdx = jdx;
 						  }
-						  if (kdx == 999)strcat(maskfile,".bmp");
+						  if (kdx == 999)strcat(ctx->maskfile,".bmp");
                 		  break;
 
 				case 'V': /* create preview file */
-				          preview = 1;
+				          ctx->preview = 1;
 				          if (wordptr[1] == 0) break;
-				          if (cmpstr(wordptr,"vbmp") == SUCCESS) {
-						      vbmp = 1;
+				          if (cmpstr((char *)wordptr,"vbmp") == SUCCESS) {
+						      ctx->vbmp = 1;
 							  break;
 						  }
+						  /* fall through - V followed by a palette */
 
 				case 'P':
 				          if (cmpstr("plainname", (char *)&wordptr[0]) == SUCCESS ||
@@ -6048,7 +5685,7 @@ int b2d_actual_main(int argc, char **argv)
 							}
 						  }
 
-				          jdx = GetUserPalette((char *)&wordptr[1]);
+				          jdx = GetUserPalette(ctx, (char *)&wordptr[1]);
 				          if (jdx == SUCCESS) {
 							 if (ch == 'P') palidx = 6;
 							 else previewidx = 6;
@@ -6063,9 +5700,9 @@ int b2d_actual_main(int argc, char **argv)
 								if (wordptr[2] > (char)47 && wordptr[2] < (char)58) {
 									jdx = atoi((char *)&wordptr[2]);
 									if ((jdx < 0 || jdx > 16) || jdx == 15) break;
-									if (pseudocount < PSEUDOMAX) {
-									     pseudolist[pseudocount] = jdx;
-									     pseudocount++;
+									if (ctx->pseudocount < PSEUDOMAX) {
+									     ctx->pseudolist[ctx->pseudocount] = jdx;
+									     ctx->pseudocount++;
 										 pseudopal = 1;
 										 break;
 									}
@@ -6082,11 +5719,11 @@ int b2d_actual_main(int argc, char **argv)
 								  case 'J': jdx = 13; break; /* Jace NTSC Palette */
 								  case 'V': jdx = 14; break; /* VBMP NTSC Palette */
 								  case 'E':       /* Apple II "E" (IIe)  - composite display */
-								  case 'S': jdx++;/* Sheldon Simms NTSC Palette */
-								  case 'W': jdx++;/* Wikipedia NTSC */
-								  case 'N': jdx++;/* New AppleWin */
-								  case 'O': jdx++;/* Old AppleWin */
-								  case 'C': jdx++;/* CiderPress */
+								  case 'S': jdx = 5; break; /* Sheldon Simms NTSC Palette */
+								  case 'W': jdx = 4; break; /* Wikipedia NTSC */
+								  case 'N': jdx = 3; break; /* New AppleWin */
+								  case 'O': jdx = 2; break; /* Old AppleWin */
+								  case 'C': jdx = 1; break; /* CiderPress */
 							  }
 
 						  	}
@@ -6109,267 +5746,74 @@ int b2d_actual_main(int argc, char **argv)
 						  	}
 						  }
 				          break;
-				case 'Q': quietmode = 0;
+				case 'Q': ctx->quietmode = 0;
 				          break;
 
 				case 'R': /* reduced or increased color bleed
 				             by percentage (for dithering only) */
 
 						  jdx = atoi((char *)&wordptr[1]);
-						  if ((jdx > 0 && jdx < 101) || (jdx < 0 && jdx > -101)) colorbleed = 100 + jdx;
+						  if ((jdx > 0 && jdx < 101) || (jdx < 0 && jdx > -101)) ctx->colorbleed = 100 + jdx;
 						  break;
 
 				case 'S': /* by default scaling is set to S1 - full scale (verbatim) */
 				          /* so choosing option S without the S1 numeric modifier sets scaling to half-scale */
 				          jdx = atoi((char *)&wordptr[1]);
 
-				          if (jdx == 1) scale = 0; /* S1 full scale (verbatim) */
-				          else scale = 1; /* S2 - double scaled */
+				          if (jdx == 1) ctx->scale = 0; /* S1 full scale (verbatim) */
+				          else ctx->scale = 1; /* S2 - double scaled */
 				          break;
 				case 'T': if (cmpstr("op", (char *)&wordptr[1]) == SUCCESS) {
 					  		  /* LGR and DLGR mixed text and graphics */
-					  		  loresoutput = appletop = 1;
+					  		  ctx->loresoutput = ctx->appletop = 1;
 					  		  break;
 					  	  }
 				          /* use ciderpress tags - off by default */
-				          tags = 1;
+				          ctx->tags = 1;
 				          break;
                 case 'X': /* pattern setting for general purpose 2 x 2 cross-hatching */
-                          xmatrix = 2;
-                          if (threshold == 0) threshold = 25;
+                          ctx->xmatrix = 2;
+                          if (ctx->threshold == 0) ctx->threshold = 25;
                           /* optional pattern setting for general purpose 2 x 2 cross-hatching */
                           jdx = atoi((char *)&wordptr[1]);
-                          if (jdx == 1 || jdx == 3) xmatrix = jdx;
+                          if (jdx == 1 || jdx == 3) ctx->xmatrix = jdx;
                           break;
                 case 'Y': /* increase or decrease color - non-cross-hatched ouput */
                           /* this can eventually be replaced by a saturation adjustment or
                              a hue correction or something else */
-                          ymatrix = 1;
+                          ctx->ymatrix = 1;
                           jdx = atoi((char *)&wordptr[1]);
-                          if (jdx == 2 || jdx == 3) ymatrix = jdx;
+                          if (jdx == 2 || jdx == 3) ctx->ymatrix = jdx;
                           break;
 
 				case 'Z': /* threshold setting for general purpose 2 x 2 cross-hatching */
 				          /* and for brightening and darkening of colors */
-				          threshold = 25;
-				          if (xmatrix == 0)xmatrix = 2;
+				          ctx->threshold = 25;
+				          if (ctx->xmatrix == 0)ctx->xmatrix = 2;
 				          jdx = atoi((char *)&wordptr[1]);
 				          /* allow up to 50% adjustment on RGB values */
 				          /* surely that's enough */
-				          if (jdx > 0 && jdx < 51) threshold = jdx;
+				          if (jdx > 0 && jdx < 51) ctx->threshold = jdx;
 				          break;
 
 			}
 		}
 	}
 
-	/* mutually exclusive commands are handled here */
-	if (hgroutput == 1) {
-		if (loresoutput == 1) {
-			loresoutput = 0;
-			puts("HGR output and Lo-Res output are mutually exclusive.\nLo-Res output cancelled!");
-		}
-		/*
-		if (outputtype == SPRITE_OUTPUT) {
-			outputtype = BIN_OUTPUT;
-			puts("HGR output and Image Fragment output are mutually exclusive.\nImage Fragment output cancelled!");
-		}
-		*/
-		if (mono == 1) {
-			mono = 0;
-			puts("HGR output and Monochrome output are mutually exclusive.\nMonochrome output cancelled!");
-		}
-	}
-	else {
-		hgrdither = 0;
-	}
-
-	if (mono == 1) {
-		if (loresoutput == 1) {
-			loresoutput = 0;
-			puts("Monochrome output and Lo-Res output are mutually exclusive.\nLo-Res output cancelled!");
-		}
-		if (outputtype == SPRITE_OUTPUT) {
-			mono = 0;
-			puts("Image Fragment output and Monochrome output are mutually exclusive.\nMonochrome output cancelled!");
-		}
-	}
+	CheckOptions(ctx, pseudopal);
 
-	if (loresoutput == 1) {
-		use_overlay = 0;
-		if (outputtype == SPRITE_OUTPUT) {
-			outputtype = BIN_OUTPUT;
-			puts("Lo-Res output and Image Fragment output are mutually exclusive.\nImage Fragment output cancelled!");
-		}
-	}
-
-    /* embedding of image fragments or palette output only */
-    if (outputtype != SPRITE_OUTPUT) {
-		if (pseudopal == 0) quietmode = 1;
-	}
-
-    jdx = 999;
-	strcpy(fname, argv[1]);
-	for (idx = 0; fname[idx] != (uchar)0; idx++) {
-		if (fname[idx] == '.') {
-			jdx = idx;
-		}
-	}
-    if (jdx != 999) fname[jdx] = (uchar)0;
+	SetFileNames(ctx, argv[1], basename, plainname, hgroptions);
 
-    sprintf(bmpfile,"%s.bmp",fname);
-    sprintf(dibfile,"%s.dib",fname);
-#ifdef MSDOS
-	tags = 0;
-    sprintf(previewfile,"%s.pmp",fname);
-    sprintf(scaledfile,"%s.smp",fname);
-    sprintf(reformatfile,"%s.rmp",fname);
-    sprintf(vbmpfile,"%s.vmp",fname);
-#else
-    sprintf(previewfile,"%s_Preview.bmp",fname);
-    sprintf(scaledfile,"%s_Scaled.bmp",fname);
-    sprintf(reformatfile,"%s_Reformat.bmp",fname);
-    sprintf(vbmpfile,"%s_VBMP.bmp",fname);
-#endif
-    /* user titling file */
-    sprintf(usertextfile,"%s.txt",fname);
+    status = ConvertImage(ctx, palidx, previewidx, pseudopal);
 
-    /* upper case basename for Apple II Output */
-    for (idx = 0; fname[idx] != (uchar)0; idx++) {
-		ch = toupper(fname[idx]);
-		fname[idx] = ch;
+    if (ctx->stats != 0 && status != INVALID) {
+		b2d_stats_json(&ctx->statsdata, statsline, sizeof(statsline));
+		printf("%s\n", statsline);
 	}
-	strcpy(hgrwork,fname);
-
-	if (basename == 1) {
-		/* if they are using the same naming convention that I am */
-	    /* optionally strip the resolution nomenclature from the input file's base name */
-		idx = strlen(hgrwork);
-		if (idx > 3) {
-			/* in order below: 384 - 560 x 384
-			                   280 - 280 x 192
-			                   640 - 640 x 480
-			                   400 - 640 x 400
-			                   320 - 320 x 200
-			                   140 - 140 x 192
-			                   560 - 560 x 192
-
-			                   LGR and DLGR only
-
-			                   176 - 176 x 104
-			                   160 - 160 x 80 and 160 x 96
-			                   88  - 88 x 52
-                               80  - 80 x 40 and 80 x 48
-			                   48  - 80 x 48 and 40 x 48
-			                   40  - 80 x 40 and 40 x 40
-			*/
-			if (hgrwork[idx-3] == '3' && hgrwork[idx-2] == '8' && hgrwork[idx-1] == '4') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '2' && hgrwork[idx-2] == '8' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '6' && hgrwork[idx-2] == '4' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '4' && hgrwork[idx-2] == '0' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '3' && hgrwork[idx-2] == '2' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '1' && hgrwork[idx-2] == '4' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '5' && hgrwork[idx-2] == '6' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '1' && hgrwork[idx-2] == '7' && hgrwork[idx-1] == '6') hgrwork[idx - 3] = 0;
-			else if (hgrwork[idx-3] == '1' && hgrwork[idx-2] == '6' && hgrwork[idx-1] == '0') hgrwork[idx - 3] = 0;
-
-			if (hgrwork[idx - 3] != (char)0) {
-				/* LGR and DLGR only */
-				if (hgrwork[idx-2] == '8' && hgrwork[idx-1] == '8') hgrwork[idx - 2] = 0;
-				else if (hgrwork[idx-2] == '8' && hgrwork[idx-1] == '0') hgrwork[idx - 2] = 0;
-				else if (hgrwork[idx-2] == '4' && hgrwork[idx-1] == '8') hgrwork[idx - 2] = 0;
-				else if (hgrwork[idx-2] == '4' && hgrwork[idx-1] == '0') hgrwork[idx - 2] = 0;
-			}
-		}
-	}
-
-    /* CiderPress File Attribute Preservation Tags */
-    if (tags == 1) {
-		if (hgroutput == 0)
-			sprintf(spritefile,"%s.DHR#062000",hgrwork);
-		else
-			sprintf(spritefile,"%s.RAG#062000",hgrwork);
-
-		sprintf(fmask,"%s.DHM#062000",hgrwork);
-		sprintf(mainfile,"%s.BIN#062000",hgrwork);
-		sprintf(auxfile,"%s.AUX#062000",hgrwork);
-		sprintf(a2fcfile,"%s.A2FC#062000",hgrwork);
-		if (plainname == 0) {
-		    sprintf(hgrcolor,"%s%s.BIN#062000",hgrwork,hgroptions);
-			sprintf(hgrmono,"%sM.BIN#062000",hgrwork);
-			if (mono == 1) {
-				sprintf(a2fcfile,"%s.A2FM#062000",hgrwork);
-				sprintf(mainfile,"%sM.BIN#062000",hgrwork);
-				sprintf(auxfile,"%sM.AUX#062000",hgrwork);
-			}
-		}
-		else {
-			sprintf(hgrcolor,"%s.BIN#062000",hgrwork);
-			sprintf(hgrmono,"%s.BIN#062000",hgrwork);
-		}
-	}
-    else {
-		/* tags are off by default */
-		/* unadorned file names */
-		if (hgroutput == 0)
-			sprintf(spritefile,"%s.DHR",hgrwork);
-		else
-			sprintf(spritefile,"%s.RAG",hgrwork);
-
-		sprintf(fmask,"%s.DHM",hgrwork);
-		sprintf(mainfile,"%s.BIN",hgrwork);
-		sprintf(auxfile,"%s.AUX",hgrwork);
-#ifdef MSDOS
-		if (plainname == 0 && mono == 1)
-			sprintf(a2fcfile,"%s.2FM",hgrwork);
-		else
-		  	sprintf(a2fcfile,"%s.2FC",hgrwork);
-		strcpy(hgrcolor,hgrwork);
-		strcpy(hgrmono,hgrwork);
-#else
-		sprintf(a2fcfile,"%s.A2FC",hgrwork);
-
-		if (plainname == 0) {
-		    sprintf(hgrcolor,"%s%s.BIN",hgrwork,hgroptions);
-			sprintf(hgrmono,"%sM.BIN",hgrwork);
-			if (mono == 1) {
-				sprintf(a2fcfile,"%s.A2FM",hgrwork);
-				sprintf(mainfile,"%sM.BIN#062000",hgrwork);
-				sprintf(auxfile,"%sM.AUX#062000",hgrwork);
-			}
-		}
-		else {
-			sprintf(hgrcolor,"%s.BIN",hgrwork);
-			sprintf(hgrmono,"%s.BIN",hgrwork);
-		}
-#endif
-	}
-
-	if (mono == 1) {
-		palidx = previewidx = 4;
-		/* create a black and white palette */
-		memset(&wikipedia[0][0],0,45);
-	}
-	else {
-		/* create pseudo-palette for conversion */
-		/* preview using pseudopalette is optional - v15 */
-		if (pseudopal != 0) {
-			BuildPseudoPalette(palidx);
-			palidx = 15;
-		}
-	}
-
-  	GetBuiltinPalette(palidx,previewidx,0);
-    InitDoubleArrays();
-
-    if (mono == 1) status = ConvertMono();
-    else status = Convert();
-
-    /* close mask file if any before exiting */
-    if (NULL != fpmask) fclose(fpmask);
 
-    free(dhrbuf);
-    free(hgrbuf);
+    free(ctx->dhrbuf);
+    free(ctx->hgrbuf);
+    ctx->dhrbuf = ctx->hgrbuf = NULL;
 
     if (status == INVALID) return (1);
 
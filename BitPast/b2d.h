@@ -21,6 +21,9 @@ Version 1.0 - Modified for Swift Integration
 #include <stdlib.h>     /* For NULL, malloc, free */
 #include <string.h>     /* For string functions */
 #include <stddef.h>     /* For size_t, NULL */
+#include <stdatomic.h>  /* For color table entries shared between threads */
+
+#include "b2d_api.h"    /* b2d_options, b2d_result */
 
 /* ***************************************************************** */
 /* ========================== defines ============================== */
@@ -85,12 +88,40 @@ Version 1.0 - Modified for Swift Integration
 #define BUCKELS 9
 #define CUSTOM 10
 
+/* error diffusion rows - see b2d_dither.c */
+#define DITHERROWS   5   /* the current scanline and up to 4 below it */
+#define DITHERTAPS   15  /* custom dither fields per row */
+#define DITHERCENTER 7   /* the current pixel in a custom dither row */
+#define DITHERWIDTH  640
+
+/* GetDrawColor() variants */
+#define MEDCOLOR  0
+#define HIGHCOLOR 1
+#define LOWCOLOR  2
+#define NEARCOLOR 3 /* GetMedColor() without the verbatim check */
+
+/* vectorized closest color search - see b2d_nearest.c
+   define B2D_NO_SIMD to use only the scalar loops in b2d.c */
+#if !defined(B2D_NO_SIMD) && (defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__)))
+#define B2D_SIMD 1
+#endif
+
+/* define B2D_VERIFY_FIXED to run the "fixed" integer distances alongside
+   the double precision search for every conversion and report each
+   closest color that differs on stderr - see NearestFixed() */
+
 #define ASCIIZ	0
 #define CRETURN 13
 #define LFEED	10
 
 #define PSEUDOMAX 100
 
+/* named in-memory files per conversion */
+#define MAXMEMFILES 16
+
+/* input files open at once that b2d_fread_at() reads from memory */
+#define MAXINPUTS 8
+
 /* ***************************************************************** */
 /* ========================== typedefs ============================= */
 /* ***************************************************************** */
@@ -147,91 +178,414 @@ typedef struct tagRGBQUAD
     unsigned char    rgbReserved;
 } RGBQUAD;
 
+/* A file kept in memory instead of the current directory.
+   See b2d_fopen() in b2d_memio.c */
+typedef struct b2d_memfile
+{
+    char name[MAXF];
+    uchar *data;
+    size_t size, capacity;
+} b2d_memfile;
+
+/* A file opened for reading by b2d_fopen(). The whole file is read
+   once so scanlines can be copied from memory. See b2d_fread_at() */
+typedef struct b2d_input
+{
+    FILE *fp;
+    const uchar *data;
+    size_t size;
+} b2d_input;
+
+/* The BMP that Convert() and ConvertMono() read scanlines from, after
+   reformatting, resizing and error diffusion. See b2d_stage.c */
+typedef struct b2d_stage
+{
+    FILE *fp;               /* the input BMP */
+    ulong offbits;          /* its pixels */
+
+    /* 1, 4 and 8 bit input expanded to 24-bit as it is read */
+    int reformat;
+    ushort width, bitcount;
+    ulong packet, outpacket, rows;
+    long row;               /* the scanline in line, -1 for none */
+    uchar *in, *line;       /* packet and outpacket bytes */
+
+    /* a resized or error diffused copy kept as a BMP file in memory */
+    uchar *image, *next;
+    size_t size, nextsize;
+
+    long pos;               /* StageRead() */
+} b2d_stage;
+
+/* Palette settings that decide the closest color for a GetDrawColor()
+   variant. Conversions with the same key share a color table. */
+typedef struct b2d_colorkey
+{
+    uchar apple[16][3];
+    double rgb[16][3], luma[16];
+    int lumaRED, lumaGREEN, lumaBLUE;
+    double dlumaRED, dlumaGREEN, dlumaBLUE;
+    int variant, subset, fixedpoint;
+} b2d_colorkey;
+
+/* What a cached stage result depends on - the input pixels and the
+   settings that stage reads. See b2d_cache.c */
+typedef struct b2d_cachekey
+{
+    uint64_t pixels[2];     /* CacheHash() of the input scanlines */
+    int width, height;
+    int settings[16];
+} b2d_cachekey;
+
+/* Closest color for every 24-bit rgb value, filled in as colors are used.
+   See ColorTableLookup() in b2d.c and b2d_colortable.c */
+typedef struct b2d_colortable
+{
+    b2d_colorkey key;
+    int refcount;
+    unsigned long lastused;
+    atomic_uchar *map;      /* palette index + 1, 0 = not looked up yet */
+} b2d_colortable;
+
+/* A GetDrawColor() variant's palette with one array per channel so the
+   closest color search can score several entries at once.
+   See NearestColor() and NearestFixed() in b2d_nearest.c */
+typedef struct b2d_nearest
+{
+    double red[16], green[16], blue[16], luma[16];
+
+    /* fixed point - channels are in 1/200ths so the cross-hatch
+       threshold palettes are whole numbers */
+    long long fixbase[16], fixred[16], fixgreen[16], fixblue[16];
+} b2d_nearest;
+
+/* Error diffusion settings for the kernels in b2d_dither.c */
+typedef struct b2d_ditherline
+{
+    int bleed;              /* error divisor - the dither's own unless color bleed changes it */
+    int errorsum;           /* add the rounding error to the next pixel */
+    int seedclip;           /* clip the next scanlines to 0-255 */
+    int reverse;            /* serpentine effect on this scanline */
+    int oneline;            /* diffuse into this scanline only */
+
+    /* the ReadCustomDither() pattern without the unused fields */
+    int customcount;
+    sshort customline[DITHERROWS*DITHERTAPS];
+    sshort customoffset[DITHERROWS*DITHERTAPS];
+    sshort custommult[DITHERROWS*DITHERTAPS];
+} b2d_ditherline;
+
+/* spreads one color channel's error - see DitherKernel()
+   rows[0] is the current scanline and rows[1] the one below it */
+typedef void (*b2d_ditherkernel)(const b2d_ditherline *dl, sshort *const *rows, int x, int error);
+
+/* ***************************************************************** */
+/* ====================== conversion context ======================= */
+/* ***************************************************************** */
+
+/* Everything a single conversion reads and writes lives in a b2d_context.
+   Each conversion owns its own context so conversions do not share state
+   and more than one can run at the same time on different threads.
+   The palette tables that are modified in place during a conversion
+   (grpal, wikipedia, PseudoPalette) are copied into the context from the
+   read-only defaults in b2d_globals.c by b2d_context_init(). */
+typedef struct b2d_context
+{
+    uchar *dhrbuf;
+    uchar *hgrbuf;
+
+    BITMAPFILEHEADER bfi;
+    BITMAPINFOHEADER bmi;
+    BMPHEADER mybmp, maskbmp;
+    RGBQUAD sbmp[256], maskpalette[256];
+
+    /* overlay file for screen titling and framing */
+    FILE *fpmask;
+    unsigned char remap[256];
+
+    /* file names */
+    char bmpfile[MAXF], dibfile[MAXF], scaledfile[MAXF], previewfile[MAXF];
+    char reformatfile[MAXF], maskfile[MAXF], fmask[MAXF];
+    char spritefile[MAXF], mainfile[MAXF], auxfile[MAXF], a2fcfile[MAXF];
+    char usertextfile[MAXF], vbmpfile[MAXF], fname[MAXF];
+    char hgrcolor[MAXF], hgrmono[MAXF], hgrwork[MAXF];
+
+    /* flags and settings */
+    int mono, dosheader, spritemask, tags;
+    int backgroundcolor, quietmode, diffuse, merge, scale, applesoft, outputtype;
+    int reformat, debug;
+    int preview, vbmp, hgroutput;
+    int use_overlay, maskpixel, overcolor, clearcolor;
+    int xmatrix, ymatrix, threshold;
+
+    ushort bmpwidth, bmpheight, spritewidth;
+
+    sshort justify, jxoffset, jyoffset;
+
+    int doubleblack, doublewhite, doublecolors, ditheroneline;
+
+    int globalclip;
+    int ditherstart;
+    int bleed;
+    int paletteclip;
+
+    sshort customdivisor;
+    sshort customdither[DITHERROWS][DITHERTAPS];
+
+    int reverse;
+
+    /* luma for color distance */
+    int lumaREQ, lumaRED, lumaGREEN, lumaBLUE;
+    double dlumaRED, dlumaGREEN, dlumaBLUE;
+
+    /* line buffers */
+    uchar bmpscanline[1920];
+    uchar bmpscanline2[1920];
+    uchar dibscanline1[1920];
+    uchar dibscanline2[1920];
+    uchar dibscanline3[1920];
+    uchar dibscanline4[1920];
+    uchar previewline[1920];
+    uchar maskline[560];
+
+    /* error diffusion dithering */
+    uchar dither, errorsum, serpentine;
+
+    /* error rows for each channel used as a ring - see DitherRowsNext()
+       ditherrow[RED][0] is the current scanline, the same as redDither */
+    sshort ditherbuf[3][DITHERROWS][DITHERWIDTH];
+    sshort *ditherrow[3][DITHERROWS];
+    int ditherrows, ditherclear;
+    sshort *redDither, *greenDither, *blueDither;
+    b2d_ditherkernel ditherkernel;
+    b2d_ditherline ditherline;
+
+    /* dithering on more than one thread - option "mt"
+       0 or 1 for one thread, -1 for one per processor */
+    int ditherthreads;
+    sshort *ditherimage;    /* every scanline - see DitherImage() */
+    int ditherheight, dithery;
+
+    int colorbleed;
+
+    /* color HGR dither routines */
+    sshort redSave[320], greenSave[320], blueSave[320];
+    sshort redTrial[320], greenTrial[320], blueTrial[320];  /* see HgrTrialPass() */
+    sshort OrangeBlueError[320], GreenVioletError[320];
+    uchar HgrPixelPalette[320];
+    uchar dither7, hgrdither;
+
+    /* HGR output routines */
+    unsigned char palettebits[40], hgrpaltype;
+    unsigned char hgrcolortype;
+    unsigned char work280[280], buf280[560];
+
+    /* palettes that are modified in place */
+    uchar wikipedia[16][3];
+    uchar grpal[16][3];
+
+    sshort pseudocount;
+    sshort pseudolist[PSEUDOMAX];
+    ushort pseudowork[16][3];
+
+    uchar PseudoPalette[16][3];
+
+    /* current conversion and preview palettes */
+    uchar rgbArray[16][3], rgbAppleArray[16][3], rgbPreview[16][3], rgbUser[16][3];
+    double rgbLuma[16], rgbDouble[16][3];
+    double rgbOrangeDouble[3][3], rgbGreenDouble[3][3];
+    double rgbOrangeLuma[3], rgbGreenLuma[3];
+
+    double rgbLumaBrighten[16], rgbDoubleBrighten[16][3];
+    double rgbLumaDarken[16], rgbDoubleDarken[16][3];
+
+    sshort lores, loresoutput, appletop;
+
+    uchar rgbVBMP[16][3];
+
+    /* color table mode - [variant][dither7 subset: none, 'O', 'G'] */
+    int colortable;
+    b2d_colortable *colortables[4][3];
+
+    /* palettes for NearestColor() - [MEDCOLOR, HIGHCOLOR, LOWCOLOR] */
+    b2d_nearest nearest[3];
+
+    /* the same for the dither7 subsets 'O' and 'G' - 4 entries each */
+    b2d_nearest nearestsubset[3][2];
+
+    /* closest colors with integer distances - option "fixed" */
+    int fixedpoint;
+    long fixedmismatches;   /* B2D_VERIFY_FIXED builds only */
+
+    /* when memio is set every file is opened in memfiles and the
+       file system is not used - see b2d_convert_rgb() */
+    int memio;
+    int memfilecount;
+    b2d_memfile memfiles[MAXMEMFILES];
+
+    /* files open for reading "rb" */
+    b2d_input inputs[MAXINPUTS];
+
+    /* the input scanlines for the converters */
+    b2d_stage stage;
+
+    /* the preview - see b2d_preview.c
+       previewrgba is a caller's RGBA8 surface, NULL for the preview file */
+    uchar *previewrgba;
+    size_t previewsize;
+    int previewscale;
+    uchar *previewbmp;
+    ushort previewwidth, previewheight, previewpacket;
+    int previewrow;
+
+    /* timing and counters - option "stats", see b2d_stats.c */
+    int stats;
+    int statsstage;
+    double statsstart, statsmark;
+    b2d_stats statsdata;
+    atomic_ulong drawcolors, exactmatches;
+
+    /* input of other sizes is resampled to this - option "fit", see
+       b2d_resample.c */
+    ushort fitwidth, fitheight;
+
+    /* cancellation and progress, once per scanline - see b2d_progress.c */
+    const volatile int *cancel;
+    b2d_scanlines scanline;
+    void *scanlinedata;
+    int scanlinesdone, scanlines;
+    int cancelled;
+
+    /* b2d_options.draft - 1 for a quick preview without the native files,
+       2 to also match only every other scanline (see b2d_wrapper.c) */
+    int draft;
+
+    /* b2d_options.cache - the resampled input and the DHGR buffer are
+       kept for the next conversion with the same key (see b2d_cache.c) */
+    int cache;
+    b2d_cachekey inputkey, screenkey;
+    uchar *cachedinput;     /* CacheInput() - the resampled BMP */
+    size_t cachedinputsize;
+
+} b2d_context;
+
 /* ***************************************************************** */
 /* =================== prototypes as required  ===================== */
 /* ***************************************************************** */
 
-sshort GetUserTextFile(void);
-int dhrgetpixel(int x,int y);
+sshort GetUserTextFile(b2d_context *ctx);
+int dhrgetpixel(b2d_context *ctx, int x,int y);
+void dhrgetline(b2d_context *ctx, int y, uchar *dest);
+void dhrputline(b2d_context *ctx, int y, uchar *line, int width);
+uchar GetDrawColor(b2d_context *ctx, uchar r, uchar g, uchar b, int x, int y);
+void ColorTablePreload(b2d_context *ctx);
+void DitherStart(b2d_context *ctx);
+void FloydSteinbergPlot(b2d_context *ctx, int y, int width);
+
+/* conversion context - b2d_globals.c */
+b2d_context *b2d_context_new(void);
+void b2d_context_init(b2d_context *ctx);
+void b2d_context_free(b2d_context *ctx);
+
+/* in-memory files - b2d_memio.c */
+FILE *b2d_fopen(b2d_context *ctx, const char *name, const char *mode);
+int b2d_remove(b2d_context *ctx, const char *name);
+size_t b2d_fread_at(b2d_context *ctx, FILE *fp, long pos, void *buf, size_t len);
+b2d_memfile *b2d_memfile_find(b2d_context *ctx, const char *name);
+b2d_memfile *b2d_memfile_create(b2d_context *ctx, const char *name, size_t capacity);
+void b2d_memfile_clear(b2d_context *ctx);
+
+/* the stages before the converters - b2d_stage.c */
+void StageOpen(b2d_context *ctx, FILE *fp);
+int StageReformat(b2d_context *ctx, ushort packet, ushort rows);
+size_t StageReadAt(b2d_context *ctx, long pos, void *buf, size_t len);
+void StageSeek(b2d_context *ctx, long pos);
+size_t StageRead(b2d_context *ctx, void *buf, size_t len);
+int StageCreate(b2d_context *ctx);
+void StageWrite(b2d_context *ctx, const void *buf, size_t len);
+void StageFinish(b2d_context *ctx, const char *name);
+void StageClose(b2d_context *ctx);
+
+/* input of any size, and resizing - b2d_resample.c */
+void ResampleFit(b2d_context *ctx, int width, int height);
+int ResampleSize(b2d_context *ctx, ushort *width, ushort *height);
+FILE *ResampleBMP(b2d_context *ctx, FILE *fp, ushort width, ushort height);
+int ResampleRows(b2d_context *ctx, ulong offset, ulong width, ulong rows,
+                 ushort outwidth, ushort midheight, ushort outheight, int rounded);
+
+/* the preview - b2d_preview.c */
+sshort PreviewOpen(b2d_context *ctx, ushort width, ushort height);
+void PreviewLine(b2d_context *ctx);
+void PreviewClose(b2d_context *ctx);
+void PreviewScreen(b2d_context *ctx, ushort width, ushort dwidth);
+
+/* stage results kept between conversions - b2d_cache.c */
+void CacheHash(uint64_t *hash, const void *data, size_t len);
+int CacheInput(b2d_context *ctx);
+int CacheInputStage(b2d_context *ctx);
+void CacheInputStore(b2d_context *ctx);
+int CacheScreen(b2d_context *ctx);
+void CacheScreenStore(b2d_context *ctx);
+
+/* cancellation and progress - b2d_progress.c */
+void ProgressBegin(b2d_context *ctx, int scanlines);
+int ProgressLine(b2d_context *ctx);
+int ProgressCancelled(b2d_context *ctx);
+void ProgressAbort(b2d_context *ctx);
+
+/* stage timing - b2d_stats.c */
+void StatsBegin(b2d_context *ctx);
+int StatsStage(b2d_context *ctx, int stage);
+void StatsEnd(b2d_context *ctx);
+
+/* 24-bit BMP scanlines - b2d.c */
+ushort SetDIBHeader(b2d_context *ctx, ushort pixels, ushort rasters);
+sshort ValidLoResSizeRange(b2d_context *ctx);
+void ReformatMonoLine(b2d_context *ctx, uchar *src, uchar *dest, ushort width);
+void ReformatVGALine(b2d_context *ctx, uchar *src, uchar *dest, ushort width, ushort bitcount);
+
+/* shared color tables - b2d_colortable.c */
+b2d_colortable *ColorTableAcquire(b2d_context *ctx, sshort variant, sshort subset);
+void ColorTableRelease(b2d_context *ctx);
+
+/* error diffusion kernels - b2d_dither.c */
+b2d_ditherkernel DitherKernel(b2d_context *ctx);
+void DitherRowsInit(b2d_context *ctx, int width);
+void DitherRowsNext(b2d_context *ctx);
+void HgrTrialPass(b2d_context *ctx, int y, int width);
+void DitherImageInit(b2d_context *ctx, int height);
+void DitherImageNext(b2d_context *ctx);
+void DitherImage(b2d_context *ctx, int width);
+void DitherImageRow(b2d_context *ctx, int y);
+
+/* closest color search - b2d_nearest.c
+   paldistance can be NULL if the distance is not needed */
+void NearestInit(b2d_context *ctx, sshort brighten, sshort darken);
+uchar NearestColor(b2d_context *ctx, sshort variant, uchar r, uchar g, uchar b, double *paldistance);
+uchar NearestFixed(b2d_context *ctx, sshort variant, uchar r, uchar g, uchar b, double *paldistance);
+uchar GetMedColor(b2d_context *ctx, uchar r, uchar g, uchar b, double *paldistance);
+uchar GetHighColor(b2d_context *ctx, uchar r, uchar g, uchar b, double *paldistance);
+uchar GetLowColor(b2d_context *ctx, uchar r, uchar g, uchar b, double *paldistance);
+
+/* conversion steps shared by the command line and b2d_convert_rgb() */
+int AllocScreenBuffers(b2d_context *ctx);
+void SetHgrPalette(b2d_context *ctx);
+void CheckOptions(b2d_context *ctx, sshort pseudopal);
+void SetFileNames(b2d_context *ctx, char *name, sshort basename, sshort plainname, char *hgroptions);
+sshort ConvertImage(b2d_context *ctx, sshort palidx, sshort previewidx, sshort pseudopal);
 
 /* Wrapper functions for Swift integration */
-int b2d_main_wrapper(int argc, char** argv);
-int b2d_actual_main(int argc, char** argv);
+int b2d_actual_main(b2d_context *ctx, int argc, char** argv);
 
 /* ***************************************************************** */
 /* ========================== globals ============================== */
 /* ***************************************************************** */
 
 /* NOTE: These are extern declarations - actual definitions should be in a .c file */
+/* Only read-only tables are global. Per-conversion state is in b2d_context. */
 #ifndef B2D_IMPLEMENTATION
 
-extern uchar *dhrbuf;
-extern uchar *hgrbuf;
-
-extern BITMAPFILEHEADER bfi;
-extern BITMAPINFOHEADER bmi;
-extern BMPHEADER mybmp, maskbmp;
-extern RGBQUAD sbmp[256], maskpalette[256];
-
-extern FILE *fpmask;
-extern unsigned char remap[256];
-
-extern char bmpfile[MAXF], dibfile[MAXF], scaledfile[MAXF], previewfile[MAXF];
-extern char reformatfile[MAXF], maskfile[MAXF], fmask[MAXF];
-extern char spritefile[MAXF], mainfile[MAXF], auxfile[MAXF], a2fcfile[MAXF];
-extern char usertextfile[MAXF], vbmpfile[MAXF], fname[MAXF];
-extern char hgrcolor[MAXF], hgrmono[MAXF], hgrwork[MAXF];
-
-extern int mono, dosheader, spritemask, tags;
-extern int backgroundcolor, quietmode, diffuse, merge, scale, applesoft, outputtype;
-extern int reformat, debug;
-extern int preview, vbmp, hgroutput;
-extern int use_overlay, maskpixel, overcolor, clearcolor;
-extern int xmatrix, ymatrix, threshold;
-
-extern ushort bmpwidth, bmpheight, spritewidth;
-
-extern sshort justify, jxoffset, jyoffset;
-
-extern int doubleblack, doublewhite, doublecolors, ditheroneline;
-
-extern int globalclip;
-extern int ditherstart;
-extern int bleed;
-extern int paletteclip;
-
-extern sshort customdivisor;
-extern sshort customdither[3][11];
-
 extern unsigned char msk[8];
-extern int reverse;
-
-extern uchar bmpscanline[1920];
-extern uchar bmpscanline2[1920];
-extern uchar dibscanline1[1920];
-extern uchar dibscanline2[1920];
-extern uchar dibscanline3[1920];
-extern uchar dibscanline4[1920];
-extern uchar previewline[1920];
-extern uchar maskline[560];
-
-extern uchar dither, errorsum, serpentine;
-
-extern sshort redDither[640], greenDither[640], blueDither[640];
-extern sshort redSeed[640], greenSeed[640], blueSeed[640];
-extern sshort redSeed2[640], greenSeed2[640], blueSeed2[640];
-extern sshort *colorptr, *seedptr, *seed2ptr, color_error;
-
-extern int colorbleed;
-
-extern sshort redSave[320], greenSave[320], blueSave[320];
-extern sshort OrangeBlueError[320], GreenVioletError[320];
-extern uchar HgrPixelPalette[320];
-extern uchar dither7, hgrdither;
-
-extern unsigned char palettebits[40], hgrpaltype;
-extern unsigned char hgrcolortype;
-extern unsigned char work280[280], buf280[560];
 
 extern uchar kegs32colors[16][3];
 extern uchar ciderpresscolors[16][3];
@@ -244,39 +598,22 @@ extern uchar SuperConvert[16][3];
 extern uchar Jace[16][3];
 extern uchar Cybernesto[16][3];
 
-extern sshort pseudocount;
-extern sshort pseudolist[PSEUDOMAX];
-extern ushort pseudowork[16][3];
-
 extern uchar PseudoPalette[16][3];
 
 extern uchar rgbCanvasArray[16][3], rgbBmpArray[16][3], rgbXmpArray[16][3];
 extern uchar rgbVgaArray[16][3], rgbPcxArray[16][3];
 
-extern uchar rgbArray[16][3], rgbAppleArray[16][3], rgbPreview[16][3], rgbUser[16][3];
-extern double rgbLuma[16], rgbDouble[16][3];
-extern double rgbOrangeDouble[3][3], rgbGreenDouble[3][3];
-extern double rgbOrangeLuma[3], rgbGreenLuma[3];
-
-extern double rgbLumaBrighten[16], rgbDoubleBrighten[16][3];
-extern double rgbLumaDarken[16], rgbDoubleDarken[16][3];
-
 extern unsigned HB[192];
 
 extern uchar dhrbytes[16][4];
-
-extern sshort lores, loresoutput, appletop;
+extern uchar dhrnibble[16];
 
 extern unsigned textbase[24];
 
 extern unsigned char dloauxcolor[16];
 
-extern uchar mix25to24[24][2];
-
 extern uchar pixel320to280[7][4];
 
-extern uchar rgbVBMP[16][3];
-
 extern unsigned char RemapLoToHi[16];
 
 extern unsigned char mono192[62];
@@ -284,11 +621,7 @@ extern unsigned char mono280[62];
 
 extern uchar dhgr2hgr[16];
 
-extern unsigned char tomthumb[256];
-extern unsigned char hgrpaltype;
-extern unsigned char hgrcolortype;
-
-
+extern unsigned char tomthumb[96 * 18];
 
 #endif /* B2D_IMPLEMENTATION */
 
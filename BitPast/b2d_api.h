@@ -0,0 +1,225 @@
+/*
+ * b2d_api.h
+ * Public interface to the b2d conversion engine
+ * Included by b2d.h and by the Swift bridging header
+ *
+ * Only plain C types are used here so Swift can import this header
+ * without the engine's internal defines and tables.
+ */
+
+#ifndef B2D_API_H
+#define B2D_API_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* b2d_options.mode */
+#define B2D_MODE_DHGR 0
+#define B2D_MODE_HGR  1
+#define B2D_MODE_MONO 2
+#define B2D_MODE_LGR  3
+#define B2D_MODE_DLGR 4
+
+/* b2d_stats.seconds - where a conversion spends its time */
+#define B2D_STAGE_HEADER     0  /* palette setup, reading and checking the BMP header */
+#define B2D_STAGE_REFORMAT   1  /* 1, 4 and 8 bit input to 24-bit (ReformatBMP) */
+#define B2D_STAGE_RESIZE     2  /* scaling to an Apple II size (ResizeBMP) */
+#define B2D_STAGE_DIFFUSE    3  /* error diffusion prefilter E2, E4 (ReadDIBFile) */
+#define B2D_STAGE_DITHER     4  /* reading scanlines, matching colors and dithering */
+#define B2D_STAGE_HGRPALETTE 5  /* choosing the HGR palette bit of each byte (hgrline) */
+#define B2D_STAGE_ENCODE     6  /* packing pixels into DHGR and HGR screen bytes */
+#define B2D_STAGE_SAVE       7  /* the output files, lores blocks are packed as they are saved */
+#define B2D_STAGE_PREVIEW    8  /* the preview file or surface */
+#define B2D_STAGES           9
+
+/* b2d_options.sink - where b2d_convert_rgb() puts the native files */
+#define B2D_SINK_MEMORY 0   /* in b2d_result.files (the default) */
+#define B2D_SINK_FILES  1   /* written to b2d_options.directory */
+#define B2D_SINK_WRITE  2   /* handed to b2d_options.write one at a time */
+
+/* Takes one native file for B2D_SINK_WRITE and returns 0, or anything
+   else if it could not. data is only valid during the call. In a batch
+   it is called on the converting threads, and can be on several at once. */
+typedef int (*b2d_write)(void *userdata, const char *name, const uint8_t *data, size_t size);
+
+/* b2d_convert_rgb() returns this when b2d_options.cancel is set */
+#define B2D_CANCELLED 2
+
+/* Called after each scanline is matched to the palette, with how many of
+   total scanlines are done. See b2d_options.scanline. */
+typedef void (*b2d_scanlines)(void *userdata, int done, int total);
+
+/* Gets the quick draft of the preview, see b2d_options.draft. The pixels
+   are RGBA8 as b2d_options.previewrgba and only valid during the call.
+   Returns 0 to go on to the full conversion, or anything else to stop
+   after the draft, when b2d_convert_rgb() returns B2D_CANCELLED. */
+typedef int (*b2d_draft)(void *userdata, const uint8_t *rgba, int width, int height);
+
+/* No preview is larger than this at b2d_options.previewscale 1 */
+#define B2D_PREVIEW_MAXWIDTH  560
+#define B2D_PREVIEW_MAXHEIGHT 384
+
+/* Conversion settings for b2d_convert_rgb().
+   Each field has the same effect as the command line option noted beside it.
+   Call b2d_options_init() first to get the command line defaults. */
+typedef struct b2d_options
+{
+    int mode;           /* B2D_MODE_DHGR, HGR (H), MONO (mono), LGR (L) or DLGR (DL) */
+    int dither;         /* 0 = off, 1-9 = Floyd-Steinberg to Buckels (D1-D9) */
+    int serpentine;     /* serpentine dithering (DX) */
+    int errorsum;       /* error summing (sum) */
+    int diffuse;        /* error diffusion prefilter 0, 2 or 4 (E2, E4) */
+    int palette;        /* conversion palette 0-16 except 6 and 15 (P) */
+    int previewpalette; /* preview palette 0-16 except 6 and 15 (V) */
+    int xmatrix;        /* cross-hatch pattern 1-3 (X) */
+    int threshold;      /* cross-hatch threshold 1-50 (Z) */
+    int ymatrix;        /* color increase 1-3 (Y) */
+    int colorbleed;     /* color bleed adjustment -100 to 100 percent (R) */
+    int preview;        /* non-zero to return preview pixels (V) */
+    int colortable;     /* keep closest colors in shared tables (lut) */
+    int cache;          /* keep the resampled input and matched colors for the
+                           next conversion of the same image, see b2d_free_caches() */
+    int fixedpoint;     /* integer color distances (fixed) */
+    int threads;        /* dithering threads, 0 or 1 for one, -1 for one per processor (mt) */
+    int stats;          /* non-zero to fill b2d_result.stats (stats) */
+    int fitwidth;       /* resample input of any other size to fitwidth x */
+    int fitheight;      /* fitheight, up to 640 x 480 (fitWxH) */
+    const char *name;   /* base name for output files, "B2D" if NULL */
+
+    /* The native files are made in memory whatever the sink, and the
+       engine never uses the current directory. With B2D_SINK_FILES or
+       B2D_SINK_WRITE they go to the sink once the conversion is done and
+       b2d_result.files only has their names and sizes. */
+    int sink;               /* B2D_SINK_MEMORY, FILES or WRITE */
+    const char *directory;  /* B2D_SINK_FILES - an existing directory */
+    b2d_write write;        /* B2D_SINK_WRITE */
+    void *writedata;        /* passed to write */
+
+    /* Checked once per scanline while the image is matched to the palette
+       and dithered. As soon as *cancel is not 0 the conversion stops and
+       returns B2D_CANCELLED without any native files or preview, so a
+       conversion that is no longer wanted can be dropped from another
+       thread with b2d_cancel(). scanline is called on the converting
+       thread. */
+    const volatile int *cancel; /* NULL if it cannot be cancelled */
+    b2d_scanlines scanline;     /* progress, NULL for none */
+    void *scanlinedata;         /* passed to scanline */
+
+    /* With a draft callback b2d_convert_rgb() first makes a quick preview
+       and hands it to draft, then makes the full conversion as usual and
+       returns it in b2d_result. The draft is the input point sampled to
+       the size it is resampled to, matched to the nearest colors through
+       the color tables (lut) without dithering or cross-hatching, and no
+       native files are made. drafthalf matches only every other scanline.
+       The draft is drawn in previewrgba if it is set. Mono is always
+       dithered and has no draft. */
+    b2d_draft draft;
+    void *draftdata;            /* passed to draft */
+    int drafthalf;              /* non-zero for half vertical resolution */
+
+    /* The preview can be drawn straight into the caller's RGBA8 buffer,
+       top scanline first, 4 bytes per pixel and no padding. Then
+       b2d_result.preview is NULL and b2d_result.previewrgba is set.
+       B2D_PREVIEW_MAXWIDTH * B2D_PREVIEW_MAXHEIGHT * 4 bytes, times
+       previewscale squared, is always enough. */
+    uint8_t *previewrgba;
+    size_t previewsize;     /* bytes at previewrgba */
+    int previewscale;       /* previewrgba only - 2 to draw each pixel 2 x 2 */
+} b2d_options;
+
+/* one native output file */
+typedef struct b2d_file
+{
+    char *name;         /* the name the command line version would write */
+    uint8_t *data;      /* NULL unless b2d_options.sink is B2D_SINK_MEMORY */
+    size_t size;
+} b2d_file;
+
+/* Timing and counters of one conversion, see b2d_options.stats.
+   A stage's time does not include the stages inside it - the preview
+   scanlines written while dithering count as preview, not dither - so
+   the stages add up to a little less than total. */
+typedef struct b2d_stats
+{
+    double seconds[B2D_STAGES]; /* wall time in each B2D_STAGE */
+    double total;               /* the whole conversion */
+    uint64_t drawcolors;        /* colors matched to the palette (GetDrawColor) */
+    uint64_t exactmatches;      /* colors found verbatim in the palette - in color
+                                   table mode only the colors not in the table yet
+                                   are looked for */
+} b2d_stats;
+
+/* Output of b2d_convert_rgb(). Release with b2d_result_free(). */
+typedef struct b2d_result
+{
+    b2d_file *files;    /* native files in the order they were written */
+    int filecount;
+    uint8_t *preview;   /* packed RGB, top scanline first, NULL if no preview */
+    uint8_t *previewrgba;   /* b2d_options.previewrgba if the preview is there */
+    int previewwidth, previewheight;
+    b2d_stats stats;    /* zero unless b2d_options.stats is set */
+} b2d_result;
+
+void b2d_options_init(b2d_options *opts);
+
+/* Converts w x h packed RGB pixels (stride bytes per row) without using
+   the file system, except to write the native files to a B2D_SINK_FILES
+   directory. Returns 0 on success, 1 if the image could not be converted
+   (wrong size), B2D_CANCELLED if it was cancelled and -1 for bad
+   arguments, no memory or a native file the sink did not take. */
+int b2d_convert_rgb(const uint8_t *rgb, int w, int h, int stride,
+                    const b2d_options *opts, b2d_result *result);
+void b2d_result_free(b2d_result *result);
+
+/* Sets a b2d_options.cancel flag from any thread, with the atomic store
+   the engine's atomic load pairs with */
+void b2d_cancel(volatile int *cancel);
+
+/* "dither" and so on for a B2D_STAGE, NULL if there is no such stage */
+const char *b2d_stage_name(int stage);
+
+/* Writes stats as one line of JSON, times in milliseconds. Returns the
+   length of the whole line as snprintf() does, even if it did not fit. */
+int b2d_stats_json(const b2d_stats *stats, char *buf, size_t size);
+
+/* one image for b2d_convert_batch() */
+typedef struct b2d_job
+{
+    const uint8_t *rgb; /* w x h packed RGB, stride bytes per row */
+    int w, h, stride;
+    const b2d_options *opts;    /* this image's settings, NULL for the batch settings */
+    const char *name;   /* base name for output files, NULL for the settings' name */
+    b2d_result result;  /* release with b2d_result_free() */
+    int status;         /* what b2d_convert_rgb() returned */
+} b2d_job;
+
+/* Called after each image with its index and status, and how many of
+   count images are done. It is called on the converting threads, but
+   never on two at once. */
+typedef void (*b2d_progress)(void *userdata, int job, int status, int done, int count);
+
+/* Converts count images as b2d_convert_rgb() would on a pool of threads,
+   one per processor if threads is 0 or less. Every image is converted in
+   color table mode and dithered on one thread, whatever its settings.
+   The batch settings' previewrgba is ignored - one buffer cannot hold
+   every image's preview - so those images get b2d_result.preview.
+   Returns the number of images that could not be converted, or -1 for
+   bad arguments. progress and userdata can be NULL. */
+int b2d_convert_batch(b2d_job *jobs, int count, const b2d_options *opts, int threads,
+                      b2d_progress progress, void *userdata);
+
+/* Color table mode keeps up to four 16MB tables between conversions so
+   that converting with the same palette again is faster. This frees the
+   tables that no conversion is using. */
+void b2d_free_colortables(void);
+
+/* With b2d_options.cache the input resampled to an Apple II size and the
+   colors it was matched and dithered to are kept, so that converting the
+   same image with other settings starts from the last stage they change.
+   A new preview palette only draws the preview again. This frees them. */
+void b2d_free_caches(void);
+
+/* command line style conversion in the current directory */
+int b2d_main_wrapper(int argc, char** argv);
+
+#endif /* B2D_API_H */
@@ -0,0 +1,216 @@
+/*
+ * b2d_batch.c
+ * Converting many images at once
+ *
+ * b2d_convert_batch() runs b2d_convert_rgb() for a list of images on a
+ * pool of threads, one per processor by default. Each image is converted
+ * on one thread - dithering a single image on several threads as well
+ * would only make the threads wait for each other.
+ *
+ * Each thread starts with an even share of the images and converts them
+ * in order. A thread that runs out takes half of the images another
+ * thread has not started yet, from the end of its share, so a few slow
+ * images do not leave the other threads idle.
+ *
+ * Every image is converted in color table mode. The tables are shared
+ * between threads and conversions (see b2d_colortable.c), so the closest
+ * colors for each palette are searched for once for the whole batch
+ * rather than once per image.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAXBATCHTHREADS 64
+
+/* the images a thread has not started - jobs head to tail - 1 */
+typedef struct b2d_batchqueue
+{
+    pthread_mutex_t lock;
+    int head, tail;
+} b2d_batchqueue;
+
+typedef struct b2d_batch
+{
+    b2d_job *jobs;
+    int count, threads;
+    const b2d_options *opts;
+    b2d_progress progress;
+    void *userdata;
+
+    /* progress is reported one job at a time */
+    pthread_mutex_t lock;
+    int done, failed;
+
+    b2d_batchqueue queues[MAXBATCHTHREADS];
+} b2d_batch;
+
+typedef struct b2d_batchworker
+{
+    b2d_batch *batch;
+    int index;
+} b2d_batchworker;
+
+static int BatchThreads(int threads, int count)
+{
+    long processors;
+
+    if (threads < 1) {
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (processors < 1 ? 1 : (int)processors);
+    }
+    if (threads > MAXBATCHTHREADS) threads = MAXBATCHTHREADS;
+    if (threads > count) threads = count;
+    return threads;
+}
+
+/* the next image from the front of a thread's own share
+   returns -1 when there are none left */
+static int BatchTake(b2d_batchqueue *queue)
+{
+    int idx = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) idx = queue->head++;
+    pthread_mutex_unlock(&queue->lock);
+    return idx;
+}
+
+/* moves half of the largest share left to this thread's empty queue
+   returns 0 when every share is empty */
+static int BatchSteal(b2d_batch *batch, int index)
+{
+    b2d_batchqueue *queue, *own = &batch->queues[index];
+    int i, victim, left, most, head = 0, tail = 0;
+
+    for (;;) {
+        victim = -1;
+        most = 0;
+        for (i = 1; i < batch->threads; i++) {
+            queue = &batch->queues[(index + i) % batch->threads];
+            pthread_mutex_lock(&queue->lock);
+            left = queue->tail - queue->head;
+            pthread_mutex_unlock(&queue->lock);
+            if (left > most) {
+                most = left;
+                victim = (index + i) % batch->threads;
+            }
+        }
+        if (victim == -1) return 0;
+
+        /* the victim may have taken its last images since */
+        queue = &batch->queues[victim];
+        pthread_mutex_lock(&queue->lock);
+        left = queue->tail - queue->head;
+        if (left > 0) {
+            tail = queue->tail;
+            head = tail - (left + 1) / 2;
+            queue->tail = head;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (left > 0) break;
+    }
+
+    pthread_mutex_lock(&own->lock);
+    own->head = head;
+    own->tail = tail;
+    pthread_mutex_unlock(&own->lock);
+    return 1;
+}
+
+static void BatchConvert(b2d_batch *batch, int idx)
+{
+    b2d_job *job = &batch->jobs[idx];
+    b2d_options opts;
+
+    if (job->opts != NULL) opts = *job->opts;
+    else if (batch->opts != NULL) {
+        opts = *batch->opts;
+        /* shared by every image */
+        opts.previewrgba = NULL;
+    }
+    else b2d_options_init(&opts);
+    if (job->name != NULL) opts.name = job->name;
+    opts.colortable = 1;
+    opts.threads = 0;
+
+    job->status = b2d_convert_rgb(job->rgb, job->w, job->h, job->stride, &opts, &job->result);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->done++;
+    if (job->status != 0) batch->failed++;
+    if (batch->progress != NULL)
+        batch->progress(batch->userdata, idx, job->status, batch->done, batch->count);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void *BatchWorker(void *arg)
+{
+    b2d_batchworker *worker = (b2d_batchworker *)arg;
+    b2d_batch *batch = worker->batch;
+    b2d_batchqueue *own = &batch->queues[worker->index];
+    int idx;
+
+    for (;;) {
+        idx = BatchTake(own);
+        if (idx < 0) {
+            if (BatchSteal(batch, worker->index) == 0) break;
+            continue;
+        }
+        BatchConvert(batch, idx);
+    }
+    return NULL;
+}
+
+int b2d_convert_batch(b2d_job *jobs, int count, const b2d_options *opts, int threads,
+                      b2d_progress progress, void *userdata)
+{
+    b2d_batch batch;
+    b2d_batchworker workers[MAXBATCHTHREADS];
+    pthread_t handles[MAXBATCHTHREADS];
+    int i, started = 0;
+
+    if (count < 0 || (jobs == NULL && count > 0)) {
+        fprintf(stderr, "❌ b2d_convert_batch: Invalid arguments\n");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        memset(&jobs[i].result, 0, sizeof(b2d_result));
+        jobs[i].status = -1;
+    }
+    if (count == 0) return 0;
+
+    memset(&batch, 0, sizeof(b2d_batch));
+    batch.jobs = jobs;
+    batch.count = count;
+    batch.opts = opts;
+    batch.progress = progress;
+    batch.userdata = userdata;
+    batch.threads = BatchThreads(threads, count);
+    pthread_mutex_init(&batch.lock, NULL);
+
+    for (i = 0; i < batch.threads; i++) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].head = (int)((long)count * i / batch.threads);
+        batch.queues[i].tail = (int)((long)count * (i + 1) / batch.threads);
+        workers[i].batch = &batch;
+        workers[i].index = i;
+    }
+
+    /* this thread is one of them - if a thread cannot be started the
+       others take its images */
+    for (i = 1; i < batch.threads; i++) {
+        if (pthread_create(&handles[started], NULL, BatchWorker, &workers[i]) != 0) break;
+        started++;
+    }
+    BatchWorker(&workers[0]);
+    for (i = 0; i < started; i++) pthread_join(handles[i], NULL);
+
+    for (i = 0; i < batch.threads; i++) pthread_mutex_destroy(&batch.queues[i].lock);
+    pthread_mutex_destroy(&batch.lock);
+    return batch.failed;
+}
@@ -0,0 +1,245 @@
+/*
+ * b2d_cache.c
+ * Stage results shared between conversions
+ *
+ * The app converts the same image again every time a setting changes.
+ * Most settings only affect the later stages, so with b2d_options.cache
+ * the results of two stages are kept here for the next conversion:
+ *
+ * - The input resampled to an Apple II size (ResampleBMP), which is most
+ *   of the time a large photo takes. It depends on the input pixels, the
+ *   mode and the fit size.
+ * - The DHGR buffer left by Convert() - the palette index of every pixel
+ *   once the image is matched and dithered. It also depends on the
+ *   palette, dithering, error diffusion and cross-hatching settings, but
+ *   not on the preview palette. The preview is drawn again from it in
+ *   the preview palette (PreviewScreen), and the native files are made
+ *   from it as usual, so the HGR palette bits are still worked out.
+ *
+ * b2d_convert_rgb() fills in ctx->inputkey and ctx->screenkey. The input
+ * pixels are only known by their hash, 128 bits (CacheHash), so nothing
+ * the size of the input is kept. The settings are compared as they are.
+ * If the resampled input is kept b2d_convert_rgb() takes a copy of it
+ * (CacheInput) and does not copy the pixels into the input BMP at all,
+ * which for a photo takes longer than the rest of the conversion.
+ *
+ * MAXCACHEDINPUTS and MAXCACHEDSCREENS limit what is kept - less than
+ * 1MB for each resampled input and 16K for each DHGR buffer. The least
+ * recently used is replaced. b2d_free_caches() frees all of them.
+ *
+ * The mono converter only uses the resampled input, and a mask file
+ * (option "O") turns the DHGR buffer cache off.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+#include <pthread.h>
+
+#define MAXCACHEDINPUTS 4
+#define MAXCACHEDSCREENS 8
+#define SCREENSIZE 16384
+
+typedef struct b2d_cachedinput
+{
+    b2d_cachekey key;
+    unsigned long lastused;
+    uchar *bmp;             /* the resampled BMP, NULL for an empty slot */
+    size_t size;
+} b2d_cachedinput;
+
+typedef struct b2d_cachedscreen
+{
+    b2d_cachekey key;
+    unsigned long lastused;
+    uchar *dhrbuf;          /* SCREENSIZE bytes, NULL for an empty slot */
+} b2d_cachedscreen;
+
+static b2d_cachedinput cachedinputs[MAXCACHEDINPUTS];
+static b2d_cachedscreen cachedscreens[MAXCACHEDSCREENS];
+static unsigned long cacheclock;
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+
+#define HASHPRIME1 0x9E3779B185EBCA87ULL
+#define HASHPRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASHROTATE(v, n) (((v) << (n)) | ((v) >> (64 - (n))))
+
+/* adds len bytes to a 128-bit hash - both words start at 0
+   16 bytes at a time, 8 into each word so the rounds run side by side */
+void CacheHash(uint64_t *hash, const void *data, size_t len)
+{
+    const uchar *src = (const uchar *)data;
+    uint64_t h0 = hash[0], h1 = hash[1], v0, v1;
+
+    for (; len >= 16; len -= 16, src += 16) {
+        memcpy(&v0, src, 8);
+        memcpy(&v1, &src[8], 8);
+        h0 += v0 * HASHPRIME2;
+        h1 += v1 * HASHPRIME1;
+        h0 = HASHROTATE(h0, 31) * HASHPRIME1;
+        h1 = HASHROTATE(h1, 29) * HASHPRIME2;
+    }
+
+    /* the rest and how long it was */
+    v0 = (uint64_t)len;
+    while (len > 0) v0 = (v0 << 8) | src[--len];
+    h0 ^= HASHROTATE(h1, 17);
+    h1 ^= v0 * HASHPRIME2;
+    h0 = HASHROTATE(h0, 27) * HASHPRIME1;
+    h1 = HASHROTATE(h1, 33) * HASHPRIME1;
+    hash[0] = h0;
+    hash[1] = h1;
+}
+
+/* copies the resampled input of an earlier conversion with ctx->inputkey
+   to ctx->cachedinput - it cannot be replaced before ResampleBMP() reads it
+   returns 0 if there is none */
+int CacheInput(b2d_context *ctx)
+{
+    int idx;
+
+    if (ctx->cache == 0) return 0;
+
+    pthread_mutex_lock(&cachelock);
+    for (idx = 0; idx < MAXCACHEDINPUTS; idx++) {
+        if (cachedinputs[idx].bmp != NULL &&
+            memcmp(&cachedinputs[idx].key, &ctx->inputkey, sizeof(b2d_cachekey)) == 0) {
+            free(ctx->cachedinput);
+            ctx->cachedinput = (uchar *)malloc(cachedinputs[idx].size);
+            if (ctx->cachedinput != NULL) {
+                memcpy(ctx->cachedinput, cachedinputs[idx].bmp, cachedinputs[idx].size);
+                ctx->cachedinputsize = cachedinputs[idx].size;
+                cachedinputs[idx].lastused = ++cacheclock;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cachelock);
+    return ctx->cachedinput != NULL;
+}
+
+/* ctx->cachedinput is read from now on, as ResampleBMP() would leave it
+   returns 0 if there is not enough memory */
+int CacheInputStage(b2d_context *ctx)
+{
+    memcpy(&ctx->mybmp, ctx->cachedinput, sizeof(BMPHEADER));
+    if (StageCreate(ctx) == 0) return 0;
+    StageWrite(ctx, &ctx->cachedinput[sizeof(BMPHEADER)], ctx->cachedinputsize - sizeof(BMPHEADER));
+    StageFinish(ctx, ctx->scaledfile);
+    free(ctx->cachedinput);
+    ctx->cachedinput = NULL;
+    return 1;
+}
+
+/* keeps the BMP ResampleBMP() just made */
+void CacheInputStore(b2d_context *ctx)
+{
+    b2d_cachedinput *slot = NULL;
+    uchar *bmp;
+    int idx;
+
+    if (ctx->cache == 0 || ctx->stage.image == NULL) return;
+
+    bmp = (uchar *)malloc(ctx->stage.size);
+    if (bmp == NULL) return;
+    memcpy(bmp, ctx->stage.image, ctx->stage.size);
+
+    pthread_mutex_lock(&cachelock);
+    /* the same key from another thread, an empty slot or the least recently used */
+    for (idx = 0; idx < MAXCACHEDINPUTS; idx++) {
+        if (cachedinputs[idx].bmp != NULL &&
+            memcmp(&cachedinputs[idx].key, &ctx->inputkey, sizeof(b2d_cachekey)) == 0) {
+            slot = &cachedinputs[idx];
+            break;
+        }
+    }
+    for (idx = 0; slot == NULL && idx < MAXCACHEDINPUTS; idx++) {
+        if (cachedinputs[idx].bmp == NULL) slot = &cachedinputs[idx];
+    }
+    if (slot == NULL) {
+        slot = &cachedinputs[0];
+        for (idx = 1; idx < MAXCACHEDINPUTS; idx++) {
+            if (cachedinputs[idx].lastused < slot->lastused) slot = &cachedinputs[idx];
+        }
+    }
+    free(slot->bmp);
+    memcpy(&slot->key, &ctx->inputkey, sizeof(b2d_cachekey));
+    slot->bmp = bmp;
+    slot->size = ctx->stage.size;
+    slot->lastused = ++cacheclock;
+    pthread_mutex_unlock(&cachelock);
+}
+
+/* the DHGR buffer of an earlier conversion with ctx->screenkey
+   returns 0 if there is none */
+int CacheScreen(b2d_context *ctx)
+{
+    int idx, found = 0;
+
+    if (ctx->cache == 0 || ctx->use_overlay != 0) return 0;
+
+    pthread_mutex_lock(&cachelock);
+    for (idx = 0; idx < MAXCACHEDSCREENS; idx++) {
+        if (cachedscreens[idx].dhrbuf != NULL &&
+            memcmp(&cachedscreens[idx].key, &ctx->screenkey, sizeof(b2d_cachekey)) == 0) {
+            memcpy(ctx->dhrbuf, cachedscreens[idx].dhrbuf, SCREENSIZE);
+            cachedscreens[idx].lastused = ++cacheclock;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cachelock);
+    return found;
+}
+
+/* keeps the DHGR buffer Convert() just made */
+void CacheScreenStore(b2d_context *ctx)
+{
+    b2d_cachedscreen *slot = NULL;
+    int idx;
+
+    if (ctx->cache == 0 || ctx->use_overlay != 0) return;
+
+    pthread_mutex_lock(&cachelock);
+    for (idx = 0; idx < MAXCACHEDSCREENS; idx++) {
+        if (cachedscreens[idx].dhrbuf != NULL &&
+            memcmp(&cachedscreens[idx].key, &ctx->screenkey, sizeof(b2d_cachekey)) == 0) {
+            slot = &cachedscreens[idx];
+            break;
+        }
+    }
+    for (idx = 0; slot == NULL && idx < MAXCACHEDSCREENS; idx++) {
+        if (cachedscreens[idx].dhrbuf == NULL) slot = &cachedscreens[idx];
+    }
+    if (slot == NULL) {
+        slot = &cachedscreens[0];
+        for (idx = 1; idx < MAXCACHEDSCREENS; idx++) {
+            if (cachedscreens[idx].lastused < slot->lastused) slot = &cachedscreens[idx];
+        }
+    }
+    if (slot->dhrbuf == NULL) slot->dhrbuf = (uchar *)malloc(SCREENSIZE);
+    if (slot->dhrbuf != NULL) {
+        memcpy(&slot->key, &ctx->screenkey, sizeof(b2d_cachekey));
+        memcpy(slot->dhrbuf, ctx->dhrbuf, SCREENSIZE);
+        slot->lastused = ++cacheclock;
+    }
+    pthread_mutex_unlock(&cachelock);
+}
+
+/* frees every kept stage result */
+void b2d_free_caches(void)
+{
+    int idx;
+
+    pthread_mutex_lock(&cachelock);
+    for (idx = 0; idx < MAXCACHEDINPUTS; idx++) {
+        free(cachedinputs[idx].bmp);
+        memset(&cachedinputs[idx], 0, sizeof(b2d_cachedinput));
+    }
+    for (idx = 0; idx < MAXCACHEDSCREENS; idx++) {
+        free(cachedscreens[idx].dhrbuf);
+        memset(&cachedscreens[idx], 0, sizeof(b2d_cachedscreen));
+    }
+    pthread_mutex_unlock(&cachelock);
+}
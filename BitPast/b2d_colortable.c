@@ -0,0 +1,145 @@
+/*
+ * b2d_colortable.c
+ * Closest color tables shared between conversions
+ *
+ * In color table mode GetDrawColor() looks each rgb value up in a table
+ * with an entry for every 24-bit color instead of searching the palette.
+ * Entries are filled the first time a color is seen, so the table only
+ * pays off when it is used again. Tables are kept here after a conversion
+ * ends and handed to the next conversion with the same palette settings,
+ * which is the usual case when an image is converted repeatedly while
+ * options like dithering are changed.
+ *
+ * The dithered scanlines are matched to the palette a second time when
+ * they are plotted. Those colors are always palette colors, so the
+ * NEARCOLOR table for that pass hits almost every time.
+ *
+ * The tables are 16MB each. Only the pages for colors that have been
+ * looked up are touched, but MAXCOLORTABLES limits the total.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+#include <pthread.h>
+
+#define MAXCOLORTABLES 4
+#define COLORTABLESIZE (1UL << 24)
+
+static b2d_colortable colortables[MAXCOLORTABLES];
+static unsigned long colortableclock;
+static pthread_mutex_t colortablelock = PTHREAD_MUTEX_INITIALIZER;
+
+/* everything GetPaletteColor() reads for this variant */
+static void ColorTableKey(b2d_context *ctx, sshort variant, sshort subset, b2d_colorkey *key)
+{
+    /* cleared so padding does not affect memcmp() */
+    memset(key, 0, sizeof(b2d_colorkey));
+
+    memcpy(key->apple, ctx->rgbAppleArray, sizeof(key->apple));
+    switch (variant) {
+        case LOWCOLOR:
+            memcpy(key->rgb, ctx->rgbDoubleDarken, sizeof(key->rgb));
+            memcpy(key->luma, ctx->rgbLumaDarken, sizeof(key->luma));
+            break;
+        case HIGHCOLOR:
+            memcpy(key->rgb, ctx->rgbDoubleBrighten, sizeof(key->rgb));
+            memcpy(key->luma, ctx->rgbLumaBrighten, sizeof(key->luma));
+            break;
+        default:
+            memcpy(key->rgb, ctx->rgbDouble, sizeof(key->rgb));
+            memcpy(key->luma, ctx->rgbLuma, sizeof(key->luma));
+            break;
+    }
+    key->lumaRED = ctx->lumaRED;
+    key->lumaGREEN = ctx->lumaGREEN;
+    key->lumaBLUE = ctx->lumaBLUE;
+    key->dlumaRED = ctx->dlumaRED;
+    key->dlumaGREEN = ctx->dlumaGREEN;
+    key->dlumaBLUE = ctx->dlumaBLUE;
+    key->variant = variant;
+    key->subset = subset;
+    key->fixedpoint = ctx->fixedpoint;
+}
+
+/* returns NULL if all tables are in use by other conversions
+   or there is no memory for a new one */
+b2d_colortable *ColorTableAcquire(b2d_context *ctx, sshort variant, sshort subset)
+{
+    b2d_colortable *table = NULL;
+    b2d_colorkey key;
+    int idx;
+
+    ColorTableKey(ctx, variant, subset, &key);
+
+    pthread_mutex_lock(&colortablelock);
+
+    for (idx = 0; idx < MAXCOLORTABLES; idx++) {
+        if (colortables[idx].map != NULL &&
+            memcmp(&colortables[idx].key, &key, sizeof(b2d_colorkey)) == 0) {
+            table = &colortables[idx];
+            break;
+        }
+    }
+
+    if (table == NULL) {
+        /* use an empty slot or replace the least recently used idle table */
+        for (idx = 0; idx < MAXCOLORTABLES; idx++) {
+            if (colortables[idx].map == NULL) {
+                table = &colortables[idx];
+                break;
+            }
+            if (colortables[idx].refcount == 0 &&
+                (table == NULL || colortables[idx].lastused < table->lastused))
+                table = &colortables[idx];
+        }
+
+        if (table != NULL) {
+            /* a fresh calloc is cheaper than clearing 16MB */
+            free(table->map);
+            table->map = (atomic_uchar *)calloc(COLORTABLESIZE, sizeof(atomic_uchar));
+            if (table->map == NULL) table = NULL;
+            else memcpy(&table->key, &key, sizeof(b2d_colorkey));
+        }
+    }
+
+    if (table != NULL) {
+        table->refcount++;
+        table->lastused = ++colortableclock;
+    }
+
+    pthread_mutex_unlock(&colortablelock);
+    return table;
+}
+
+void ColorTableRelease(b2d_context *ctx)
+{
+    int variant, subset;
+
+    pthread_mutex_lock(&colortablelock);
+    for (variant = 0; variant < 4; variant++) {
+        for (subset = 0; subset < 3; subset++) {
+            if (ctx->colortables[variant][subset] != NULL) {
+                ctx->colortables[variant][subset]->refcount--;
+                ctx->colortables[variant][subset] = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&colortablelock);
+}
+
+/* frees the tables that no conversion is using */
+void b2d_free_colortables(void)
+{
+    int idx;
+
+    pthread_mutex_lock(&colortablelock);
+    for (idx = 0; idx < MAXCOLORTABLES; idx++) {
+        if (colortables[idx].refcount == 0) {
+            free(colortables[idx].map);
+            memset(&colortables[idx], 0, sizeof(b2d_colortable));
+        }
+    }
+    pthread_mutex_unlock(&colortablelock);
+}
@@ -0,0 +1,827 @@
+/*
+ * b2d_dither.c
+ * Error diffusion kernels for FloydSteinberg()
+ *
+ * FloydSteinberg() calls one of these for each color channel of each pixel
+ * to spread the channel's error into the rest of the scanline (line) and
+ * the scanlines below it (seed and seed2). DitherKernel() picks the kernel
+ * once when dithering starts, so the pixel loop does not switch on the
+ * dither, and ctx->ditherline holds the settings each kernel needs.
+ *
+ * The error rows for each channel are a ring of ctx->ditherrows buffers.
+ * After each scanline DitherRowsNext() moves the pointers up one row and
+ * clears the row that was finished for reuse as the last one, so only
+ * one row per channel is touched no matter how tall the kernel is.
+ *
+ * For color HGR, HgrTrialPass() makes FloydSteinberg()'s two trial passes
+ * over each scanline, one per 4 color palette, side by side in one loop.
+ *
+ * With option "mt" Convert() and ConvertMono() read every scanline first
+ * and DitherImage() dithers them on several threads. Each thread takes
+ * the next scanline and follows the one above it a few pixels behind, far
+ * enough that every error from above has arrived before a pixel's input
+ * is added and it is matched to the palette. The additions to each pixel
+ * happen in the same order as scanline at a time dithering, so clipping
+ * gives the same result and the output is the same. A cancelled
+ * conversion stops taking scanlines.
+ *
+ * Each kernel is written once as an inline function and compiled twice:
+ * with the dither's own divisor as a constant, which is used unless color
+ * bleed (option R) changes it, and with the divisor from ctx->bleed. The
+ * constant divisions become multiplies and shifts.
+ *
+ * The weights and the order of the rounding are the same as the switch
+ * these replace, so the output is the same.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL static inline __attribute__((always_inline))
+#else
+#define KERNEL static inline
+#endif
+
+#define KERNELARGS const b2d_ditherline *dl, sshort *line, sshort *seed, sshort *seed2, int x, int error
+#define ROWARGS const b2d_ditherline *dl, sshort *const *rows, int x, int error
+
+/* AdjustShortPixel() for the current scanline - always clipped */
+KERNEL void DiffuseLine(sshort *buf, int value)
+{
+    sshort pixel = (sshort)(buf[0] + (sshort)value);
+
+    if (pixel < 0) pixel = 0;
+    else if (pixel > 255) pixel = 255;
+    buf[0] = pixel;
+}
+
+/* AdjustShortPixel() for the next scanlines - clipped unless threshold is 0 */
+KERNEL void DiffuseSeed(const b2d_ditherline *dl, sshort *buf, int value)
+{
+    sshort pixel = (sshort)(buf[0] + (sshort)value);
+
+    if (dl->seedclip != 0) {
+        if (pixel < 0) pixel = 0;
+        else if (pixel > 255) pixel = 255;
+    }
+    buf[0] = pixel;
+}
+
+/* F 1 */
+KERNEL void FloydSteinbergKernel(KERNELARGS, const int bleed)
+{
+    /*
+        *   7
+    3   5   1   (1/16)
+
+    Serpentine
+
+    7   *
+    1   5   3
+    */
+    int total_difference = 0;
+
+    (void)seed2;    /* only the next scanline */
+
+    /* if error summing is turned-on add the accumulated rounding error
+       to the next pixel */
+    if (dl->errorsum != 0) {
+        total_difference = (error * 16) / bleed -
+            ((error * 3) / bleed + (error * 5) / bleed + (error * 1) / bleed + (error * 7) / bleed);
+    }
+
+    /* for serpentine effect alternating scanlines run the error in reverse */
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (sshort)((error * 7) / bleed) + total_difference);
+        if (x > 0) DiffuseSeed(dl, &seed[x-1], (error * 1) / bleed);
+        DiffuseSeed(dl, &seed[x+1], (error * 3) / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (sshort)((error * 7) / bleed) + total_difference);
+
+        /* if making hgr passes 0 and 1 dither first line only */
+        if (dl->oneline != 0) return;
+
+        if (x > 0) DiffuseSeed(dl, &seed[x-1], (error * 3) / bleed);
+        DiffuseSeed(dl, &seed[x+1], (error * 1) / bleed);
+    }
+    DiffuseSeed(dl, &seed[x], (error * 5) / bleed);
+}
+
+/* J 2 */
+KERNEL void JarvisKernel(KERNELARGS, const int bleed)
+{
+    /*
+            *   7   5
+    3   5   7   5   3
+    1   3   5   3   1   (1/48)
+    */
+    DiffuseLine(&line[x+1], (error * 7) / bleed);
+    DiffuseLine(&line[x+2], (error * 5) / bleed);
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) {
+        DiffuseSeed(dl, &seed[x-1], (error * 5) / bleed);
+        DiffuseSeed(dl, &seed2[x-1], (error * 3) / bleed);
+    }
+    if (x > 1) {
+        DiffuseSeed(dl, &seed[x-2], (error * 3) / bleed);
+        DiffuseSeed(dl, &seed2[x-2], error / bleed);
+    }
+    DiffuseSeed(dl, &seed[x], (error * 7) / bleed);
+    DiffuseSeed(dl, &seed[x+1], (error * 5) / bleed);
+    DiffuseSeed(dl, &seed[x+2], (error * 3) / bleed);
+
+    DiffuseSeed(dl, &seed2[x], (error * 5) / bleed);
+    DiffuseSeed(dl, &seed2[x+1], (error * 3) / bleed);
+    DiffuseSeed(dl, &seed2[x+2], error / bleed);
+}
+
+/* S 3 */
+KERNEL void StuckiKernel(KERNELARGS, const int bleed)
+{
+    /*
+            *   8   4
+    2   4   8   4   2
+    1   2   4   2   1   (1/42)
+    */
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (error * 8) / bleed);
+        if (x > 1) DiffuseLine(&line[x-2], (error * 4) / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (error * 8) / bleed);
+        DiffuseLine(&line[x+2], (error * 4) / bleed);
+    }
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) {
+        DiffuseSeed(dl, &seed[x-1], (error * 4) / bleed);
+        DiffuseSeed(dl, &seed2[x-1], (error * 2) / bleed);
+    }
+    if (x > 1) {
+        DiffuseSeed(dl, &seed[x-2], (error * 2) / bleed);
+        DiffuseSeed(dl, &seed2[x-2], error / bleed);
+    }
+    DiffuseSeed(dl, &seed[x], (error * 8) / bleed);
+    DiffuseSeed(dl, &seed[x+1], (error * 4) / bleed);
+    DiffuseSeed(dl, &seed[x+2], (error * 2) / bleed);
+
+    DiffuseSeed(dl, &seed2[x], (error * 4) / bleed);
+    DiffuseSeed(dl, &seed2[x+1], (error * 2) / bleed);
+    DiffuseSeed(dl, &seed2[x+2], error / bleed);
+}
+
+/* A 4 */
+KERNEL void AtkinsonKernel(KERNELARGS, const int bleed)
+{
+    /*
+        *   1   1
+    1   1   1
+        1           (1/8)
+    */
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], error / bleed);
+        if (x > 1) DiffuseLine(&line[x-2], error / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], error / bleed);
+        DiffuseLine(&line[x+2], error / bleed);
+    }
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) DiffuseSeed(dl, &seed[x-1], error / bleed);
+    DiffuseSeed(dl, &seed[x], error / bleed);
+    DiffuseSeed(dl, &seed[x+1], error / bleed);
+
+    DiffuseSeed(dl, &seed2[x], error / bleed);
+}
+
+/* B 5 */
+KERNEL void BurkesKernel(KERNELARGS, const int bleed)
+{
+    /*
+            *   8   4
+    2   4   8   4   2   (1/32)
+    */
+    (void)seed2;    /* only the next scanline */
+
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (error * 8) / bleed);
+        if (x > 1) DiffuseLine(&line[x-2], (error * 4) / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (error * 8) / bleed);
+        DiffuseLine(&line[x+2], (error * 4) / bleed);
+    }
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) DiffuseSeed(dl, &seed[x-1], (error * 4) / bleed);
+    if (x > 1) DiffuseSeed(dl, &seed[x-2], (error * 2) / bleed);
+    DiffuseSeed(dl, &seed[x], (error * 8) / bleed);
+    DiffuseSeed(dl, &seed[x+1], (error * 4) / bleed);
+    DiffuseSeed(dl, &seed[x+2], (error * 2) / bleed);
+}
+
+/* SI 6 */
+KERNEL void SierraKernel(KERNELARGS, const int bleed)
+{
+    /*
+            *   5   3
+    2   4   5   4   2
+        2   3   2       (1/32)
+    */
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (error * 5) / bleed);
+        if (x > 1) DiffuseLine(&line[x-2], (error * 3) / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (error * 5) / bleed);
+        DiffuseLine(&line[x+2], (error * 3) / bleed);
+    }
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) {
+        DiffuseSeed(dl, &seed[x-1], (error * 4) / bleed);
+        DiffuseSeed(dl, &seed2[x-1], (error * 2) / bleed);
+    }
+    if (x > 1) DiffuseSeed(dl, &seed[x-2], (error * 2) / bleed);
+    DiffuseSeed(dl, &seed[x], (error * 5) / bleed);
+    DiffuseSeed(dl, &seed[x+1], (error * 4) / bleed);
+    DiffuseSeed(dl, &seed[x+2], (error * 2) / bleed);
+
+    DiffuseSeed(dl, &seed2[x], (error * 3) / bleed);
+    DiffuseSeed(dl, &seed2[x+1], (error * 2) / bleed);
+}
+
+/* S2 7 */
+KERNEL void SierraTwoKernel(KERNELARGS, const int bleed)
+{
+    /*
+            *   4   3
+    1   2   3   2   1   (1/16)
+    */
+    (void)seed2;    /* only the next scanline */
+
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (error * 4) / bleed);
+        if (x > 1) DiffuseLine(&line[x-2], (error * 3) / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (error * 4) / bleed);
+        DiffuseLine(&line[x+2], (error * 3) / bleed);
+    }
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) DiffuseSeed(dl, &seed[x-1], (error * 2) / bleed);
+    if (x > 1) DiffuseSeed(dl, &seed[x-2], error / bleed);
+    DiffuseSeed(dl, &seed[x], (error * 3) / bleed);
+    DiffuseSeed(dl, &seed[x+1], (error * 2) / bleed);
+    DiffuseSeed(dl, &seed[x+2], error / bleed);
+}
+
+/* SL 8 */
+KERNEL void SierraLiteKernel(KERNELARGS, const int bleed)
+{
+    /*
+        *   2
+    1   1       (1/4)
+    */
+    (void)seed2;    /* only the next scanline */
+
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (error * 2) / bleed);
+        DiffuseSeed(dl, &seed[x+1], error / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (error * 2) / bleed);
+
+        if (dl->oneline != 0) return;
+
+        if (x > 0) DiffuseSeed(dl, &seed[x-1], error / bleed);
+    }
+    DiffuseSeed(dl, &seed[x], error / bleed);
+}
+
+/* buckels dither - d9 */
+KERNEL void BuckelsKernel(KERNELARGS, const int bleed)
+{
+    /*
+      * 2 1
+    1 2 1
+      1          (1/8)
+
+    Serpentine
+
+  1 2 *
+    1 2 1
+      1
+    */
+    int total_difference = 0;
+
+    if (dl->errorsum != 0) {
+        total_difference = (error * 8) / bleed -
+            ((error * 2) / bleed + (error * 2) / bleed +
+             error / bleed + error / bleed + error / bleed + error / bleed);
+    }
+
+    if (dl->reverse != 0) {
+        if (x > 0) DiffuseLine(&line[x-1], (sshort)((error * 2) / bleed) + total_difference);
+        if (x > 1) DiffuseLine(&line[x-2], error / bleed);
+    }
+    else {
+        DiffuseLine(&line[x+1], (sshort)((error * 2) / bleed) + total_difference);
+        DiffuseLine(&line[x+2], error / bleed);
+    }
+
+    if (dl->oneline != 0) return;
+
+    if (x > 0) DiffuseSeed(dl, &seed[x-1], error / bleed);
+    DiffuseSeed(dl, &seed[x], (error * 2) / bleed);
+    DiffuseSeed(dl, &seed[x+1], error / bleed);
+
+    DiffuseSeed(dl, &seed2[x], error / bleed);
+}
+
+/* the kernel with its own divisor and with the color bleed divisor */
+#define DITHERKERNEL(name, divisor) \
+static void name(ROWARGS) \
+{ \
+    name##Kernel(dl, rows[0], rows[1], rows[2], x, error, divisor); \
+} \
+static void name##Bleed(ROWARGS) \
+{ \
+    name##Kernel(dl, rows[0], rows[1], rows[2], x, error, dl->bleed); \
+}
+
+DITHERKERNEL(FloydSteinberg, 16)
+DITHERKERNEL(Jarvis, 48)
+DITHERKERNEL(Stucki, 42)
+DITHERKERNEL(Atkinson, 8)
+DITHERKERNEL(Burkes, 32)
+DITHERKERNEL(Sierra, 32)
+DITHERKERNEL(SierraTwo, 16)
+DITHERKERNEL(SierraLite, 4)
+DITHERKERNEL(Buckels, 8)
+
+/* the pattern from ReadCustomDither() with the unused fields left out
+   dl->reverse is not used - custom patterns are applied as they are on
+   the reversed scanlines of the serpentine effect, as they always were */
+static void CustomKernel(ROWARGS)
+{
+    int i, pos;
+
+    for (i = 0; i < dl->customcount; i++) {
+        pos = x + dl->customoffset[i];
+        if (pos < 0) continue;
+
+        if (dl->customline[i] == 0) {
+            DiffuseLine(&rows[0][pos], (error * dl->custommult[i]) / dl->bleed);
+            continue;
+        }
+
+        /* if making hgr passes 0 and 1 dither first line only */
+        if (dl->oneline != 0) continue;
+
+        DiffuseSeed(dl, &rows[dl->customline[i]][pos], (error * dl->custommult[i]) / dl->bleed);
+    }
+}
+
+/* called when dithering starts after ctx->bleed is set */
+b2d_ditherkernel DitherKernel(b2d_context *ctx)
+{
+    b2d_ditherline *dl = &ctx->ditherline;
+    int i, j;
+
+    dl->bleed = ctx->bleed;
+    dl->errorsum = ctx->errorsum;
+    /* see AdjustShortPixel() */
+    dl->seedclip = (ctx->globalclip == 1 || ctx->threshold != 0);
+    dl->reverse = dl->oneline = 0;
+
+    switch (ctx->dither) {
+        case FLOYDSTEINBERG: return (ctx->bleed == 16 ? FloydSteinberg : FloydSteinbergBleed);
+        case JARVIS:         return (ctx->bleed == 48 ? Jarvis : JarvisBleed);
+        case STUCKI:         return (ctx->bleed == 42 ? Stucki : StuckiBleed);
+        case ATKINSON:       return (ctx->bleed == 8 ? Atkinson : AtkinsonBleed);
+        case BURKES:         return (ctx->bleed == 32 ? Burkes : BurkesBleed);
+        case SIERRA:         return (ctx->bleed == 32 ? Sierra : SierraBleed);
+        case SIERRATWO:      return (ctx->bleed == 16 ? SierraTwo : SierraTwoBleed);
+        case SIERRALITE:     return (ctx->bleed == 4 ? SierraLite : SierraLiteBleed);
+        case CUSTOM:
+            /* 0,0,0,0,0,0,0,*,0,0,0,0,0,0,0
+               0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+               ... up to DITHERROWS rows */
+            dl->customcount = 0;
+            for (j = 0; j < DITHERTAPS; j++) {
+                for (i = 0; i < DITHERROWS; i++) {
+                    if (ctx->customdither[i][j] < 1) continue;
+                    dl->customline[dl->customcount] = (sshort)i;
+                    dl->customoffset[dl->customcount] = (sshort)(j - DITHERCENTER);
+                    dl->custommult[dl->customcount] = ctx->customdither[i][j];
+                    dl->customcount++;
+                }
+            }
+            return CustomKernel;
+    }
+    return (ctx->bleed == 8 ? Buckels : BuckelsBleed);
+}
+
+
+/* how many error rows the selected dither writes to, the current
+   scanline included */
+static int DitherRowCount(b2d_context *ctx)
+{
+    int i, j, rows = 1;
+
+    switch (ctx->dither) {
+        case 0:              return 1;
+        case FLOYDSTEINBERG:
+        case BURKES:
+        case SIERRATWO:
+        case SIERRALITE:     return 2;
+        case CUSTOM:
+            for (i = 1; i < DITHERROWS; i++) {
+                for (j = 0; j < DITHERTAPS; j++) {
+                    if (ctx->customdither[i][j] > 0) rows = i + 1;
+                }
+            }
+            return rows;
+    }
+    /* Jarvis, Stucki, Atkinson, Sierra and Buckels */
+    return 3;
+}
+
+static void DitherRowPointers(b2d_context *ctx)
+{
+    ctx->redDither = ctx->ditherrow[RED][0];
+    ctx->greenDither = ctx->ditherrow[GREEN][0];
+    ctx->blueDither = ctx->ditherrow[BLUE][0];
+}
+
+/* clears the error rows before the first scanline
+   width is the number of values in each row the conversion uses */
+void DitherRowsInit(b2d_context *ctx, int width)
+{
+    int channel, i;
+
+    ctx->ditherrows = DitherRowCount(ctx);
+    ctx->ditherclear = width;
+    for (channel = 0; channel < 3; channel++) {
+        for (i = 0; i < DITHERROWS; i++) {
+            ctx->ditherrow[channel][i] = ctx->ditherbuf[channel][i];
+            memset(ctx->ditherrow[channel][i], 0, sizeof(sshort) * width);
+        }
+    }
+    DitherRowPointers(ctx);
+}
+
+/* called after each scanline is dithered - the row below becomes the
+   current scanline and the finished row is cleared and goes to the end */
+void DitherRowsNext(b2d_context *ctx)
+{
+    sshort *done;
+    int channel, i, last = ctx->ditherrows - 1;
+
+    for (channel = 0; channel < 3; channel++) {
+        done = ctx->ditherrow[channel][0];
+        for (i = 0; i < last; i++) ctx->ditherrow[channel][i] = ctx->ditherrow[channel][i+1];
+        memset(done, 0, sizeof(sshort) * ctx->ditherclear);
+        ctx->ditherrow[channel][last] = done;
+    }
+    DitherRowPointers(ctx);
+}
+
+/* ***************************************************************** */
+/* ===================== color HGR trial passes ==================== */
+/* ***************************************************************** */
+
+/* dithers pixel x of the current scanline to a dither7 subset and returns
+   its total error - the trial passes only diffuse within the scanline */
+static int HgrTrialPixel(b2d_context *ctx, sshort *rows[3][DITHERROWS], int x, int y, uchar dither7)
+{
+    sshort red, green, blue, red_error, green_error, blue_error;
+    uchar r, g, b, drawcolor;
+
+    red = rows[RED][0][x];
+    green = rows[GREEN][0][x];
+    blue = rows[BLUE][0][x];
+
+    ctx->dither7 = dither7;
+    drawcolor = GetDrawColor(ctx, (uchar)red, (uchar)green, (uchar)blue, x, y);
+
+    r = ctx->rgbArray[drawcolor][RED];
+    g = ctx->rgbArray[drawcolor][GREEN];
+    b = ctx->rgbArray[drawcolor][BLUE];
+
+    rows[RED][0][x] = (int)r;
+    rows[GREEN][0][x] = (int)g;
+    rows[BLUE][0][x] = (int)b;
+
+    red_error = red - r;
+    green_error = green - g;
+    blue_error = blue - b;
+
+    ctx->ditherkernel(&ctx->ditherline, rows[RED], x, red_error);
+    ctx->ditherkernel(&ctx->ditherline, rows[GREEN], x, green_error);
+    ctx->ditherkernel(&ctx->ditherline, rows[BLUE], x, blue_error);
+
+    return abs(red_error) + abs(green_error) + abs(blue_error);
+}
+
+/* the Orange-Blue and Green-Violet trial passes for scanline y
+
+   FloydSteinberg() saves the error rows before these and restores red and
+   green before its final pass, but blue is carried from one pass to the
+   next: the Green-Violet pass starts from the blue the Orange-Blue pass
+   left and the final pass from the blue the Green-Violet pass left. To
+   keep that, the Orange-Blue pass works on copies of the rows and the
+   Green-Violet pass on the rows themselves, following a few pixels
+   behind. Each of its blue values is replaced by the Orange-Blue one only
+   once the Orange-Blue pass can no longer change it, and before any
+   Green-Violet error reaches it.
+
+   Both passes match each pixel to only 4 colors, so interleaving them
+   keeps each pixel's input in the cache for the second pass and needs no
+   copy of the rows between the passes. The rows are left as after the
+   second of the passes made one after the other. */
+void HgrTrialPass(b2d_context *ctx, int y, int width)
+{
+    sshort *trial[3][DITHERROWS];
+    int channel, i, x, x1, ahead = 2, behind = 0, lag, admitted = 0;
+
+    for (channel = 0; channel < 3; channel++) {
+        for (i = 0; i < DITHERROWS; i++) trial[channel][i] = ctx->ditherrow[channel][i];
+    }
+    trial[RED][0] = ctx->redTrial;
+    trial[GREEN][0] = ctx->greenTrial;
+    trial[BLUE][0] = ctx->blueTrial;
+    memcpy(ctx->redTrial, ctx->redSave, sizeof(ctx->redTrial));
+    memcpy(ctx->greenTrial, ctx->greenSave, sizeof(ctx->greenTrial));
+    memcpy(ctx->blueTrial, ctx->blueSave, sizeof(ctx->blueTrial));
+
+    /* how far a pixel's error reaches along the scanline - only a custom
+       dither can reach back to the left */
+    if (ctx->dither == CUSTOM) {
+        ahead = 0;
+        for (i = 0; i < ctx->ditherline.customcount; i++) {
+            if (ctx->ditherline.customline[i] != 0) continue;
+            if (ctx->ditherline.customoffset[i] > ahead) ahead = ctx->ditherline.customoffset[i];
+            if (-ctx->ditherline.customoffset[i] > behind) behind = -ctx->ditherline.customoffset[i];
+        }
+    }
+    /* Orange-Blue pixel x is final once pixel x + behind is done and
+       Green-Violet pixel x1 reaches x1 + ahead */
+    lag = ahead + behind;
+
+    ctx->ditherline.oneline = 1;
+    for (x = 0; x < width + lag; x++) {
+        if (x < width) ctx->OrangeBlueError[x] = (sshort)HgrTrialPixel(ctx, trial, x, y, 'O');
+
+        x1 = x - lag;
+        if (x1 < 0) continue;
+        for (; admitted <= x1 + ahead && admitted < 320; admitted++)
+            ctx->blueDither[admitted] = ctx->blueTrial[admitted];
+        ctx->GreenVioletError[x1] = (sshort)HgrTrialPixel(ctx, ctx->ditherrow, x1, y, 'G');
+    }
+    for (; admitted < 320; admitted++) ctx->blueDither[admitted] = ctx->blueTrial[admitted];
+    memcpy(ctx->blueSave, ctx->blueTrial, sizeof(ctx->blueSave));
+}
+
+/* ***************************************************************** */
+/* ================ dithering on more than one thread ============== */
+/* ***************************************************************** */
+
+#define MAXDITHERTHREADS 16
+#define DITHERCHUNK 8       /* pixels finished between progress updates */
+
+/* pixels of a scanline finished - on its own cache line */
+typedef struct b2d_ditherprogress
+{
+    atomic_int done;
+    char pad[64 - sizeof(atomic_int)];
+} b2d_ditherprogress;
+
+typedef struct b2d_wavefront
+{
+    b2d_context *ctx;
+    int width, height;
+    int ahead;              /* pixels a new scanline reaches to the right */
+    int behind;             /* pixels the scanline above reaches back to the left */
+    atomic_int nextrow;
+    b2d_ditherprogress *progress;
+} b2d_wavefront;
+
+/* the clipped input for scanline y read by Convert() or ConvertMono() */
+static sshort *InputRow(b2d_context *ctx, int channel, int y)
+{
+    return &ctx->ditherimage[((long)channel * ctx->ditherheight + y) * DITHERWIDTH];
+}
+
+/* the error row for scanline y - DITHERROWS extra rows below the last
+   scanline take the errors diffused past the bottom */
+static sshort *ErrorRow(b2d_context *ctx, int channel, int y)
+{
+    long rows = ctx->ditherheight + DITHERROWS;
+
+    return &ctx->ditherimage[(3L * ctx->ditherheight + channel * rows + y) * DITHERWIDTH];
+}
+
+static int DitherThreads(b2d_context *ctx)
+{
+    long threads = ctx->ditherthreads;
+
+    if (threads < 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAXDITHERTHREADS) threads = MAXDITHERTHREADS;
+    return (threads < 1 ? 1 : (int)threads);
+}
+
+/* called when the dither buffers are cleared before the first scanline
+   the scanlines are read into ctx->ditherimage if they will be dithered
+   on more than one thread */
+void DitherImageInit(b2d_context *ctx, int height)
+{
+    free(ctx->ditherimage);
+    ctx->ditherimage = NULL;
+
+#ifdef B2D_VERIFY_FIXED
+    /* mismatches are reported in scanline order */
+    return;
+#endif
+
+    /* color hgr tries both palettes on each scanline before it diffuses
+       the error and serpentine scanlines depend on the whole line above */
+    if (DitherThreads(ctx) < 2 || ctx->hgrdither == 1 || ctx->serpentine == 1 || height < 2) return;
+
+    ctx->ditherheight = height;
+    ctx->ditherimage = (sshort *)calloc((size_t)(6 * height + 3 * DITHERROWS) * DITHERWIDTH, sizeof(sshort));
+    if (NULL == ctx->ditherimage) return;
+
+    ctx->dithery = 0;
+    ctx->redDither = InputRow(ctx, RED, 0);
+    ctx->greenDither = InputRow(ctx, GREEN, 0);
+    ctx->blueDither = InputRow(ctx, BLUE, 0);
+}
+
+/* the input for the next scanline goes in the next row */
+void DitherImageNext(b2d_context *ctx)
+{
+    ctx->dithery++;
+    if (ctx->dithery >= ctx->ditherheight) return;
+    ctx->redDither = InputRow(ctx, RED, ctx->dithery);
+    ctx->greenDither = InputRow(ctx, GREEN, ctx->dithery);
+    ctx->blueDither = InputRow(ctx, BLUE, ctx->dithery);
+}
+
+/* points redDither and friends at dithered scanline y for FloydSteinbergPlot() */
+void DitherImageRow(b2d_context *ctx, int y)
+{
+    ctx->redDither = ErrorRow(ctx, RED, y);
+    ctx->greenDither = ErrorRow(ctx, GREEN, y);
+    ctx->blueDither = ErrorRow(ctx, BLUE, y);
+}
+
+/* waits until scanline y has finished the given number of pixels */
+static int DitherWait(b2d_wavefront *wf, int y, int pixels, int done)
+{
+    int spins = 0;
+
+    while (done < pixels) {
+        done = atomic_load_explicit(&wf->progress[y].done, memory_order_acquire);
+        if (done >= pixels) break;
+        if (++spins == 64) {
+            spins = 0;
+            sched_yield();
+        }
+    }
+    return done;
+}
+
+/* FloydSteinberg() for one scanline without hgr color or serpentine */
+static void DitherRow(b2d_wavefront *wf, int y)
+{
+    b2d_context *ctx = wf->ctx;
+    sshort *rows[3][DITHERROWS], *input[3];
+    sshort red, green, blue, value;
+    int x, c, channel, added = 0, above = 0, last = wf->width - 1;
+    uchar drawcolor, r, g, b;
+
+    for (channel = 0; channel < 3; channel++) {
+        input[channel] = InputRow(ctx, channel, y);
+        for (c = 0; c < DITHERROWS; c++) rows[channel][c] = ErrorRow(ctx, channel, y + c);
+    }
+
+    for (x = 0; x < wf->width; x++) {
+
+        /* add the input to the pixels this pixel diffuses into first, once
+           the scanline above has finished every pixel that reaches them */
+        for (; added <= x + wf->ahead && added <= last; added++) {
+            if (y > 0 && NULL != wf->progress) {
+                c = added + wf->behind;
+                above = DitherWait(wf, y - 1, (c < last ? c : last) + 1, above);
+            }
+            /* AdjustShortPixel() with clipping */
+            for (channel = 0; channel < 3; channel++) {
+                value = (sshort)(rows[channel][0][added] + input[channel][added]);
+                if (value < 0) value = 0;
+                else if (value > 255) value = 255;
+                rows[channel][0][added] = value;
+            }
+        }
+
+        red   = rows[RED][0][x];
+        green = rows[GREEN][0][x];
+        blue  = rows[BLUE][0][x];
+
+        drawcolor = GetDrawColor(ctx, (uchar)red, (uchar)green, (uchar)blue, x, y);
+
+        r = ctx->rgbArray[drawcolor][RED];
+        g = ctx->rgbArray[drawcolor][GREEN];
+        b = ctx->rgbArray[drawcolor][BLUE];
+
+        rows[RED][0][x]   = (sshort)r;
+        rows[GREEN][0][x] = (sshort)g;
+        rows[BLUE][0][x]  = (sshort)b;
+
+        ctx->ditherkernel(&ctx->ditherline, rows[RED], x, (sshort)(red - r));
+        ctx->ditherkernel(&ctx->ditherline, rows[GREEN], x, (sshort)(green - g));
+        ctx->ditherkernel(&ctx->ditherline, rows[BLUE], x, (sshort)(blue - b));
+
+        if (NULL != wf->progress && (x + 1) % DITHERCHUNK == 0)
+            atomic_store_explicit(&wf->progress[y].done, x + 1, memory_order_release);
+    }
+    if (NULL != wf->progress)
+        atomic_store_explicit(&wf->progress[y].done, wf->width, memory_order_release);
+}
+
+static void *DitherWorker(void *arg)
+{
+    b2d_wavefront *wf = (b2d_wavefront *)arg;
+    int y;
+
+    /* scanlines are taken in order so the one above is always being
+       dithered or finished - once the conversion is cancelled no more
+       are taken (see b2d_progress.c) */
+    while (ProgressCancelled(wf->ctx) == 0 && (y = atomic_fetch_add(&wf->nextrow, 1)) < wf->height)
+        DitherRow(wf, y);
+    return NULL;
+}
+
+/* dithers the scanlines read since DitherImageInit() */
+void DitherImage(b2d_context *ctx, int width)
+{
+    b2d_wavefront wf;
+    pthread_t threads[MAXDITHERTHREADS];
+    int i, count, started = 0;
+
+    if (ctx->ditherstart == 0) DitherStart(ctx);
+    ctx->ditherline.reverse = 0;
+    ctx->ditherline.oneline = (ctx->ditheroneline == 1);
+
+    /* find the color tables GetDrawColor() uses now rather than on the threads */
+    ColorTablePreload(ctx);
+
+    wf.ctx = ctx;
+    wf.width = width;
+    wf.height = ctx->ditherheight;
+    wf.ahead = 2;
+    wf.behind = 2;
+    if (ctx->dither == CUSTOM) {
+        wf.ahead = wf.behind = 0;
+        for (i = 0; i < ctx->ditherline.customcount; i++) {
+            if (ctx->ditherline.customline[i] == 0) {
+                if (ctx->ditherline.customoffset[i] > wf.ahead) wf.ahead = ctx->ditherline.customoffset[i];
+            }
+            else if (-ctx->ditherline.customoffset[i] > wf.behind) wf.behind = -ctx->ditherline.customoffset[i];
+        }
+    }
+    atomic_init(&wf.nextrow, 0);
+
+    /* without the progress counters the scanlines are dithered in order
+       on this thread */
+    wf.progress = (b2d_ditherprogress *)calloc((size_t)wf.height, sizeof(b2d_ditherprogress));
+    count = (NULL == wf.progress ? 1 : DitherThreads(ctx));
+    if (count > wf.height) count = wf.height;
+
+    /* this thread is one of them */
+    for (i = 1; i < count; i++) {
+        if (pthread_create(&threads[started], NULL, DitherWorker, &wf) != 0) break;
+        started++;
+    }
+    DitherWorker(&wf);
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    free(wf.progress);
+}
@@ -1,6 +1,7 @@
 /*
  * b2d_globals.c
- * Definitions for all global variables declared in b2d.h
+ * Definitions for all global tables declared in b2d.h
+ * and the b2d_context constructor that sets conversion defaults
  * 
  * This file MUST be the only one that defines these variables.
  * We define B2D_IMPLEMENTATION to tell b2d.h we're creating the actual definitions here.
@@ -12,83 +13,7 @@
 /* That's it! b2d.h creates all the variable definitions when B2D_IMPLEMENTATION is defined. */
 /* All other .c files that include b2d.h will see them as extern declarations. */
 
-
-/* Output buffers */
-uchar *dhrbuf = NULL;
-uchar *hgrbuf = NULL;
-
-/* Static structures for processing */
-BITMAPFILEHEADER bfi;
-BITMAPINFOHEADER bmi;
-BMPHEADER mybmp, maskbmp;
-RGBQUAD sbmp[256], maskpalette[256];
-
-/* Overlay file for screen titling and framing */
-FILE *fpmask = NULL;
-unsigned char remap[256];
-
-/* File names */
-char bmpfile[MAXF], dibfile[MAXF], scaledfile[MAXF], previewfile[MAXF];
-char reformatfile[MAXF], maskfile[MAXF], fmask[MAXF];
-char spritefile[MAXF], mainfile[MAXF], auxfile[MAXF], a2fcfile[MAXF];
-char usertextfile[MAXF], vbmpfile[MAXF], fname[MAXF];
-char hgrcolor[MAXF], hgrmono[MAXF], hgrwork[MAXF];
-
-/* Flags and settings */
-int mono = 0, dosheader = 0, spritemask = 0, tags = 0;
-int backgroundcolor = 0, quietmode = 1, diffuse = 0, merge = 0, scale = 0, applesoft = 0, outputtype = BIN_OUTPUT;
-int reformat = 0, debug = 0;
-int preview = 0, vbmp = 0, hgroutput = 0;
-int use_overlay = 0, maskpixel = 0, overcolor = 0, clearcolor = 5;
-int xmatrix = 0, ymatrix = 0, threshold = 0;
-
-ushort bmpwidth = 0, bmpheight = 0, spritewidth = 0;
-
-sshort justify = 0, jxoffset = -1, jyoffset = -1;
-
-int doubleblack = 0, doublewhite = 0, doublecolors = 1, ditheroneline = 0;
-
-int globalclip = 0;
-int ditherstart = 0;
-int bleed = 16;
-int paletteclip = 0;
-
-sshort customdivisor;
-sshort customdither[3][11];
-
 unsigned char msk[] = {0x80, 0x40, 0x20, 0x10, 0x8, 0x4, 0x2, 0x1};
-int reverse = 0;
-
-/* Line buffers */
-uchar bmpscanline[1920];
-uchar bmpscanline2[1920];
-uchar dibscanline1[1920];
-uchar dibscanline2[1920];
-uchar dibscanline3[1920];
-uchar dibscanline4[1920];
-uchar previewline[1920];
-uchar maskline[560];
-
-/* Floyd-Steinberg Dithering */
-uchar dither = 0, errorsum = 0, serpentine = 0;
-
-sshort redDither[640], greenDither[640], blueDither[640];
-sshort redSeed[640], greenSeed[640], blueSeed[640];
-sshort redSeed2[640], greenSeed2[640], blueSeed2[640];
-sshort *colorptr, *seedptr, *seed2ptr, color_error;
-
-int colorbleed = 100;
-
-/* Color HGR dither routines */
-sshort redSave[320], greenSave[320], blueSave[320];
-sshort OrangeBlueError[320], GreenVioletError[320];
-uchar HgrPixelPalette[320];
-uchar dither7 = 0, hgrdither = 0;
-
-/* HGR output routines */
-unsigned char palettebits[40], hgrpaltype = 255;
-unsigned char hgrcolortype = 0;
-unsigned char work280[280], buf280[560];
 
 /* Built-in palette options */
 uchar kegs32colors[16][3] = {
@@ -119,6 +44,7 @@ uchar awinnewcolors[16][3] = {
     {56, 203, 0}, {213, 213, 26}, {98, 246, 153}, {255, 255, 255}
 };
 
+/* wikipedia, grpal and PseudoPalette are defaults - each context gets its own copy */
 uchar wikipedia[16][3] = {
     {0, 0, 0}, {114, 38, 64}, {64, 51, 127}, {228, 52, 254},
     {14, 89, 64}, {128, 128, 128}, {27, 154, 254}, {191, 179, 255},
@@ -161,10 +87,6 @@ uchar Cybernesto[16][3] = {
     {20, 245, 60}, {208, 221, 141}, {114, 255, 208}, {255, 255, 255}
 };
 
-sshort pseudocount = 0;
-sshort pseudolist[PSEUDOMAX];
-ushort pseudowork[16][3];
-
 uchar PseudoPalette[16][3] = {
     {0, 0, 0}, {184, 6, 88}, {16, 27, 182}, {204, 27, 238},
     {25, 115, 0}, {105, 105, 105}, {20, 101, 240}, {130, 171, 255},
@@ -178,14 +100,6 @@ uchar rgbXmpArray[16][3];
 uchar rgbVgaArray[16][3];
 uchar rgbPcxArray[16][3];
 
-uchar rgbArray[16][3], rgbAppleArray[16][3], rgbPreview[16][3], rgbUser[16][3];
-double rgbLuma[16], rgbDouble[16][3];
-double rgbOrangeDouble[3][3], rgbGreenDouble[3][3];
-double rgbOrangeLuma[3], rgbGreenLuma[3];
-
-double rgbLumaBrighten[16], rgbDoubleBrighten[16][3];
-double rgbLumaDarken[16], rgbDoubleDarken[16][3];
-
 unsigned HB[192] = {
     0x2000, 0x2400, 0x2800, 0x2C00, 0x3000, 0x3400, 0x3800, 0x3C00,
     0x2080, 0x2480, 0x2880, 0x2C80, 0x3080, 0x3480, 0x3880, 0x3C80,
@@ -224,7 +138,11 @@ uchar dhrbytes[16][4] = {
     {0x77, 0x6E, 0x5D, 0x3B}, {0x7F, 0x7F, 0x7F, 0x7F}
 };
 
-sshort lores = 0, loresoutput = 0, appletop = 0;
+/* the inverse of dhrbytes - the drawcolor of the 4 bits of a pixel, low bit
+   first, in any of the 7 pixel positions of a block (see dhrgetpixel) */
+uchar dhrnibble[16] = {
+    0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15
+};
 
 unsigned textbase[24] = {
     0x0400, 0x0480, 0x0500, 0x0580, 0x0600, 0x0680, 0x0700, 0x0780,
@@ -236,25 +154,11 @@ unsigned char dloauxcolor[16] = {
     0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15
 };
 
-uchar mix25to24[24][2] = {
-    {24, 1}, {23, 2}, {22, 3}, {21, 4}, {20, 5}, {19, 6},
-    {18, 7}, {17, 8}, {16, 9}, {15, 10}, {14, 11}, {13, 12},
-    {12, 13}, {11, 14}, {10, 15}, {9, 16}, {8, 17}, {7, 18},
-    {6, 19}, {5, 20}, {4, 21}, {3, 22}, {2, 23}, {1, 24}
-};
-
 uchar pixel320to280[7][4] = {
     {7, 1, 0, 1}, {6, 2, 1, 2}, {5, 3, 2, 3}, {4, 4, 3, 4},
     {3, 5, 4, 5}, {2, 6, 5, 6}, {1, 7, 6, 7}
 };
 
-uchar rgbVBMP[16][3] = {
-    {0, 0, 0}, {114, 38, 64}, {64, 51, 127}, {228, 52, 254},
-    {14, 89, 64}, {128, 128, 128}, {27, 154, 254}, {191, 179, 255},
-    {64, 76, 0}, {228, 101, 1}, {128, 128, 128}, {241, 166, 191},
-    {27, 203, 1}, {191, 204, 128}, {141, 217, 191}, {255, 255, 255}
-};
-
 unsigned char RemapLoToHi[16] = {
     LOBLACK, LORED, LOBROWN, LOORANGE, LODKGREEN, LOGRAY, LOLTGREEN, LOYELLOW,
     LODKBLUE, LOPURPLE, LOGREY, LOPINK, LOMEDBLUE, LOLTBLUE, LOAQUA, LOWHITE
@@ -287,5 +191,66 @@ uchar dhgr2hgr[16] = {
     HBLACK, HORANGE, HBLACK, HBLACK, HGREEN, HBLACK, HBLACK, HWHITE
 };
 /* TomThumb font data - stub implementation */
-unsigned char tomthumb[256] = {0};
-
+/* sized for all 96 characters (18 bytes each) so titling never reads past the end */
+unsigned char tomthumb[96 * 18] = {0};
+
+/* Conversion context */
+
+/* set every field of a context to the values a fresh conversion starts with */
+void b2d_context_init(b2d_context *ctx)
+{
+    memset(ctx, 0, sizeof(b2d_context));
+
+    ctx->quietmode = 1;
+    ctx->outputtype = BIN_OUTPUT;
+    ctx->clearcolor = 5;
+    ctx->jxoffset = ctx->jyoffset = -1;
+    ctx->doublecolors = 1;
+    ctx->bleed = 16;
+    ctx->colorbleed = 100;
+    ctx->hgrpaltype = 255;
+
+    ctx->lumaREQ = 601;
+    ctx->lumaRED = 299;
+    ctx->lumaGREEN = 587;
+    ctx->lumaBLUE = 114;
+    ctx->dlumaRED = 0.299;
+    ctx->dlumaGREEN = 0.587;
+    ctx->dlumaBLUE = 0.114;
+
+#ifdef B2D_VERIFY_FIXED
+    /* check the integer distances against every double precision search */
+    ctx->fixedpoint = 1;
+#endif
+
+    memcpy(ctx->wikipedia, wikipedia, sizeof(ctx->wikipedia));
+    memcpy(ctx->grpal, grpal, sizeof(ctx->grpal));
+    memcpy(ctx->PseudoPalette, PseudoPalette, sizeof(ctx->PseudoPalette));
+
+    /* redDither and friends point into the error rows */
+    DitherRowsInit(ctx, DITHERWIDTH);
+}
+
+b2d_context *b2d_context_new(void)
+{
+    b2d_context *ctx = (b2d_context *)malloc(sizeof(b2d_context));
+
+    if (NULL != ctx) b2d_context_init(ctx);
+    return ctx;
+}
+
+/* release a context and anything a conversion left open */
+void b2d_context_free(b2d_context *ctx)
+{
+    if (NULL == ctx) return;
+    if (NULL != ctx->fpmask) fclose(ctx->fpmask);
+    StageClose(ctx);
+    free(ctx->previewbmp);
+    ColorTableRelease(ctx);
+    free(ctx->ditherimage);
+    free(ctx->cachedinput);
+    free(ctx->dhrbuf);
+    free(ctx->hgrbuf);
+    b2d_memfile_clear(ctx);
+    free(ctx);
+}
@@ -0,0 +1,375 @@
+/*
+ * b2d_memio.c
+ * Named in-memory files for b2d conversions
+ *
+ * b2d.c opens every input, temporary and output file through b2d_fopen()
+ * and deletes them through b2d_remove(). For a normal command line style
+ * conversion these are fopen() and remove() in the current directory.
+ * When ctx->memio is set the same names are looked up in ctx->memfiles
+ * instead and a stdio stream is opened on the memory, so the engine can
+ * run without touching the file system at all.
+ *
+ * Files opened for reading ("rb") are read whole when they are opened,
+ * and the stream reads from memory. Convert() and ConvertMono() read the
+ * input bottom-up one scanline at a time, which as fseek() and fread() on
+ * a file costs a system call or two per scanline. b2d_fread_at() copies a
+ * scanline straight from memory instead.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1   /* fopencookie */
+#endif
+
+#include "b2d.h"
+
+#include <errno.h>
+#include <sys/types.h>
+
+typedef struct memstream
+{
+    b2d_memfile *mf;
+    size_t pos;
+    b2d_input *input;   /* "rb" - read from input->data instead of mf */
+    uchar *buffer;      /* a file read whole from the file system */
+} memstream;
+
+b2d_memfile *b2d_memfile_find(b2d_context *ctx, const char *name)
+{
+    int idx;
+
+    for (idx = 0; idx < ctx->memfilecount; idx++) {
+        if (strcmp(ctx->memfiles[idx].name, name) == 0) return &ctx->memfiles[idx];
+    }
+    return NULL;
+}
+
+/* creates an empty file or truncates an existing one
+   removed files leave empty slots that are reused when the table is full */
+b2d_memfile *b2d_memfile_create(b2d_context *ctx, const char *name, size_t capacity)
+{
+    b2d_memfile *mf = b2d_memfile_find(ctx, name);
+
+    if (mf == NULL) {
+        if (name[0] == 0 || strlen(name) >= MAXF) return NULL;
+        if (ctx->memfilecount < MAXMEMFILES) mf = &ctx->memfiles[ctx->memfilecount++];
+        else mf = b2d_memfile_find(ctx, "");
+        if (mf == NULL) return NULL;
+        memset(mf, 0, sizeof(b2d_memfile));
+        strcpy(mf->name, name);
+    }
+    mf->size = 0;
+    if (capacity > mf->capacity) {
+        uchar *data = (uchar *)realloc(mf->data, capacity);
+        if (data == NULL) return NULL;
+        mf->data = data;
+        mf->capacity = capacity;
+    }
+    return mf;
+}
+
+void b2d_memfile_clear(b2d_context *ctx)
+{
+    int idx;
+
+    for (idx = 0; idx < ctx->memfilecount; idx++) free(ctx->memfiles[idx].data);
+    memset(ctx->memfiles, 0, sizeof(ctx->memfiles));
+    ctx->memfilecount = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* stream callbacks                                                    */
+/* ------------------------------------------------------------------ */
+
+static size_t memstream_size(memstream *ms)
+{
+    return (ms->input != NULL ? ms->input->size : ms->mf->size);
+}
+
+static long memstream_read(memstream *ms, char *buf, size_t len)
+{
+    const uchar *data = (ms->input != NULL ? ms->input->data : ms->mf->data);
+    size_t size = memstream_size(ms);
+
+    if (ms->pos >= size) return 0;
+    if (len > size - ms->pos) len = size - ms->pos;
+    memcpy(buf, data + ms->pos, len);
+    ms->pos += len;
+    return (long)len;
+}
+
+static long memstream_write(memstream *ms, const char *buf, size_t len)
+{
+    b2d_memfile *mf = ms->mf;
+    size_t end = ms->pos + len;
+
+    if (end > mf->capacity) {
+        size_t capacity = mf->capacity < 4096 ? 4096 : mf->capacity;
+        uchar *data;
+
+        while (capacity < end) capacity *= 2;
+        data = (uchar *)realloc(mf->data, capacity);
+        if (data == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        mf->data = data;
+        mf->capacity = capacity;
+    }
+    /* a seek past the end leaves a gap of zeros like a file would */
+    if (ms->pos > mf->size) memset(mf->data + mf->size, 0, ms->pos - mf->size);
+    memcpy(mf->data + ms->pos, buf, len);
+    ms->pos = end;
+    if (end > mf->size) mf->size = end;
+    return (long)len;
+}
+
+static long memstream_seek(memstream *ms, long offset, int whence)
+{
+    long base;
+
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (long)ms->pos; break;
+        case SEEK_END: base = (long)memstream_size(ms); break;
+        default: errno = EINVAL; return -1;
+    }
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ms->pos = (size_t)(base + offset);
+    return (long)ms->pos;
+}
+
+static void memstream_close(memstream *ms)
+{
+    if (ms->input != NULL) memset(ms->input, 0, sizeof(b2d_input));
+    free(ms->buffer);
+    free(ms);
+}
+
+#ifdef __APPLE__
+
+static int memstream_readfn(void *cookie, char *buf, int len)
+{
+    return (int)memstream_read((memstream *)cookie, buf, (size_t)len);
+}
+
+static int memstream_writefn(void *cookie, const char *buf, int len)
+{
+    return (int)memstream_write((memstream *)cookie, buf, (size_t)len);
+}
+
+static fpos_t memstream_seekfn(void *cookie, fpos_t offset, int whence)
+{
+    return (fpos_t)memstream_seek((memstream *)cookie, (long)offset, whence);
+}
+
+static int memstream_closefn(void *cookie)
+{
+    memstream_close((memstream *)cookie);
+    return 0;
+}
+
+static FILE *memstream_open(memstream *ms, const char *mode, int readable, int writable)
+{
+    return funopen(ms, readable ? memstream_readfn : NULL,
+                   writable ? memstream_writefn : NULL,
+                   memstream_seekfn, memstream_closefn);
+}
+
+#else
+
+static ssize_t memstream_readfn(void *cookie, char *buf, size_t len)
+{
+    return (ssize_t)memstream_read((memstream *)cookie, buf, len);
+}
+
+static ssize_t memstream_writefn(void *cookie, const char *buf, size_t len)
+{
+    /* fopencookie treats a short count as an error */
+    return memstream_write((memstream *)cookie, buf, len) < 0 ? 0 : (ssize_t)len;
+}
+
+static int memstream_seekfn(void *cookie, off64_t *offset, int whence)
+{
+    long pos = memstream_seek((memstream *)cookie, (long)*offset, whence);
+
+    if (pos < 0) return -1;
+    *offset = (off64_t)pos;
+    return 0;
+}
+
+static int memstream_closefn(void *cookie)
+{
+    memstream_close((memstream *)cookie);
+    return 0;
+}
+
+static FILE *memstream_open(memstream *ms, const char *mode, int readable, int writable)
+{
+    cookie_io_functions_t io;
+
+    io.read = readable ? memstream_readfn : NULL;
+    io.write = writable ? memstream_writefn : NULL;
+    io.seek = memstream_seekfn;
+    io.close = memstream_closefn;
+    return fopencookie(ms, mode, io);
+}
+
+#endif
+
+/* ------------------------------------------------------------------ */
+/* fopen() and remove() for the engine                                 */
+/* ------------------------------------------------------------------ */
+
+static FILE *memfile_open(b2d_context *ctx, const char *name, const char *mode)
+{
+    b2d_memfile *mf;
+    memstream *ms;
+    FILE *fp;
+    int readable, writable;
+
+    /* "r", "rb", "w", "wb" and "wb+" are the only modes b2d.c uses */
+    readable = (mode[0] == 'r' || strchr(mode, '+') != NULL);
+    writable = (mode[0] == 'w' || strchr(mode, '+') != NULL);
+
+    if (mode[0] == 'w') mf = b2d_memfile_create(ctx, name, 0);
+    else mf = b2d_memfile_find(ctx, name);
+
+    if (mf == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    ms = (memstream *)calloc(1, sizeof(memstream));
+    if (ms == NULL) return NULL;
+    ms->mf = mf;
+
+    fp = memstream_open(ms, mode, readable, writable);
+    if (fp == NULL) free(ms);
+    return fp;
+}
+
+/* NULL if the file cannot be read whole */
+static uchar *read_whole_file(const char *name, size_t *size)
+{
+    FILE *fp = fopen(name, "rb");
+    uchar *data = NULL;
+    long length;
+
+    if (fp == NULL) return NULL;
+    if (fseek(fp, 0L, SEEK_END) == 0 && (length = ftell(fp)) >= 0) {
+        rewind(fp);
+        /* a byte more so an empty file is not NULL */
+        data = (uchar *)malloc((size_t)length + 1);
+        if (data != NULL && fread(data, 1, (size_t)length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = (size_t)length;
+    }
+    fclose(fp);
+    return data;
+}
+
+/* "rb" - a stream on the whole file in memory */
+static FILE *input_open(b2d_context *ctx, const char *name)
+{
+    b2d_input *input = NULL;
+    b2d_memfile *mf = NULL;
+    memstream *ms;
+    uchar *buffer = NULL;
+    const uchar *data;
+    size_t size = 0;
+    FILE *fp;
+    int idx;
+
+    for (idx = 0; idx < MAXINPUTS && input == NULL; idx++) {
+        if (ctx->inputs[idx].fp == NULL) input = &ctx->inputs[idx];
+    }
+    /* too many open - b2d_fread_at() uses fseek() and fread() on these */
+    if (input == NULL) return (ctx->memio == 0 ? fopen(name, "rb") : memfile_open(ctx, name, "rb"));
+
+    if (ctx->memio == 0) {
+        buffer = read_whole_file(name, &size);
+        /* not a regular file - read it as a stream */
+        if (buffer == NULL) return fopen(name, "rb");
+        data = buffer;
+    }
+    else {
+        mf = b2d_memfile_find(ctx, name);
+        if (mf == NULL) {
+            errno = ENOENT;
+            return NULL;
+        }
+        data = mf->data;
+        size = mf->size;
+    }
+
+    ms = (memstream *)calloc(1, sizeof(memstream));
+    if (ms == NULL) {
+        free(buffer);
+        return NULL;
+    }
+    ms->mf = mf;
+    ms->input = input;
+    ms->buffer = buffer;
+
+    fp = memstream_open(ms, "rb", 1, 0);
+    if (fp == NULL) {
+        free(buffer);
+        free(ms);
+        return NULL;
+    }
+    input->fp = fp;
+    input->data = data;
+    input->size = size;
+    return fp;
+}
+
+FILE *b2d_fopen(b2d_context *ctx, const char *name, const char *mode)
+{
+    if (strcmp(mode, "rb") == 0) return input_open(ctx, name);
+    if (ctx->memio == 0) return fopen(name, mode);
+    return memfile_open(ctx, name, mode);
+}
+
+/* fseek() to pos and fread() len bytes, for a file opened "rb"
+   the bytes are copied from memory and the stream is not moved */
+size_t b2d_fread_at(b2d_context *ctx, FILE *fp, long pos, void *buf, size_t len)
+{
+    b2d_input *input;
+    int idx;
+
+    for (idx = 0; idx < MAXINPUTS; idx++) {
+        input = &ctx->inputs[idx];
+        if (input->fp != fp) continue;
+
+        if (pos < 0 || (size_t)pos >= input->size) return 0;
+        if (len > input->size - (size_t)pos) len = input->size - (size_t)pos;
+        memcpy(buf, input->data + pos, len);
+        return len;
+    }
+
+    if (fseek(fp, pos, SEEK_SET) != 0) return 0;
+    return fread(buf, 1, len, fp);
+}
+
+int b2d_remove(b2d_context *ctx, const char *name)
+{
+    b2d_memfile *mf;
+
+    if (ctx->memio == 0) return remove(name);
+
+    mf = b2d_memfile_find(ctx, name);
+    if (mf == NULL) return -1;
+
+    /* the slot is left empty rather than moved so the remaining
+       files stay in the order they were written */
+    free(mf->data);
+    memset(mf, 0, sizeof(b2d_memfile));
+    return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * b2d_nearest.c
+ * Closest color search for GetMedColor(), GetHighColor() and GetLowColor()
+ *
+ * These functions score all 16 palette entries for every pixel.
+ * InitDoubleArrays() copies each variant's palette into one array per
+ * channel with NearestInit(), in double precision and in fixed point.
+ * The 4 colors of each dither7 subset used for color HGR are copied into
+ * tables of their own, so those pixels only score 4 entries.
+ *
+ * NearestColor() scores the double precision entries several at a time:
+ * 4 with AVX2 when the processor has it, 2 with SSE2 or NEON otherwise.
+ * Builds without any of these (or with B2D_NO_SIMD defined) use the scalar
+ * loops in b2d.c. The distance is computed with the same operations in the
+ * same order as the scalar loops, and ties go to the lowest palette index,
+ * so the closest color is the same.
+ *
+ * NearestFixed() is used instead when ctx->fixedpoint is set (option
+ * "fixed"). It compares the same distances exactly with 64-bit integers,
+ * so it needs no floating point and no divisions. The double precision
+ * search rounds, so when two entries are equally or all but equally
+ * close the rounding decides which is closest. Then NearestFixed()
+ * compares them in double precision as well, and it always returns the
+ * double precision distance, so "fixed" never changes the output. Build
+ * with B2D_VERIFY_FIXED to check that - see NearestFixed().
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+/* distances are scaled by this to make them whole numbers - see NearestFixed() */
+#define FIXEDSCALE 1.0404e16
+
+/* palette channels are in 1/FIXEDUNIT and at most 255 * FIXEDUNIT */
+#define FIXEDUNIT 200
+
+/* larger than any distance */
+#define FIXEDOFF (1LL << 60)
+
+/* integer distances closer than this are compared in double precision
+   too - 1e-12, far more than the rounding errors of the double search */
+#define FIXEDNEAR ((long long)(FIXEDSCALE * 1e-12))
+
+/* palette entries in the dither7 subsets in ascending order, so ties
+   still go to the lowest palette index */
+static const uchar subsetcolors[2][4] = {
+    /* 'O' - orange-blue palette: black, medium blue, orange, white */
+    {0, 6, 9, 15},
+    /* 'G' - green-violet palette: black, purple, light green, white */
+    {0, 3, 12, 15}};
+
+/* the dlumaRED and dlumaGREEN distance weights times 3000000
+   the weights are 1/1000ths, 1/10000ths or 1/1000000ths for the luma
+   settings in setluma() so the results are whole numbers
+   dlumaGREEN is used for blue as in the scalar loops in b2d.c */
+static int FixedWeights(b2d_context *ctx, long long *weight)
+{
+    static const long long scales[3] = {1000, 10000, 1000000};
+    double dluma[3];
+    long long w;
+    int idx, c;
+
+    dluma[0] = ctx->dlumaRED;
+    dluma[1] = dluma[2] = ctx->dlumaGREEN;
+
+    for (idx = 0; idx < 3; idx++) {
+        for (c = 0; c < 3; c++) {
+            w = (long long)(dluma[c] * (double)scales[idx] + 0.5);
+            if ((double)w / (double)scales[idx] != dluma[c]) break;
+            weight[c] = w * (3000000 / scales[idx]);
+        }
+        if (c == 3) return 1;
+    }
+    return 0;
+}
+
+/* scale is the cross-hatch threshold in 1/FIXEDUNIT - FIXEDUNIT for none */
+static void NearestCopy(b2d_context *ctx, b2d_nearest *pal, double rgb[16][3], double *luma,
+                        long long *weight, sshort scale)
+{
+    long long fixed[3], fixluma;
+    int i, c;
+
+    for (i = 0; i < 16; i++) {
+        pal->red[i] = rgb[i][0];
+        pal->green[i] = rgb[i][1];
+        pal->blue[i] = rgb[i][2];
+        pal->luma[i] = luma[i];
+
+        /* darker colors are clipped at 255 as in InitDoubleArrays() */
+        for (c = 0; c < 3; c++) {
+            fixed[c] = (long long)ctx->rgbArray[i][c] * scale;
+            if (fixed[c] > 255 * FIXEDUNIT) fixed[c] = 255 * FIXEDUNIT;
+        }
+        fixluma = fixed[0]*ctx->lumaRED + fixed[1]*ctx->lumaGREEN + fixed[2]*ctx->lumaBLUE;
+
+        /* the terms of the distance that depend on the palette entry - see NearestFixed() */
+        pal->fixbase[i] = weight[0]*fixed[0]*fixed[0] + weight[1]*fixed[1]*fixed[1]
+            + weight[2]*fixed[2]*fixed[2] + 4*fixluma*fixluma;
+        pal->fixred[i] = 2*FIXEDUNIT * (weight[0]*fixed[0] + 4*fixluma*ctx->lumaRED);
+        pal->fixgreen[i] = 2*FIXEDUNIT * (weight[1]*fixed[1] + 4*fixluma*ctx->lumaGREEN);
+        pal->fixblue[i] = 2*FIXEDUNIT * (weight[2]*fixed[2] + 4*fixluma*ctx->lumaBLUE);
+    }
+}
+
+/* the first 4 entries of sub are a dither7 subset of pal */
+static void NearestSubset(b2d_nearest *sub, const b2d_nearest *pal, const uchar *colors)
+{
+    int i, idx;
+
+    for (i = 0; i < 4; i++) {
+        idx = colors[i];
+        sub->red[i] = pal->red[idx];
+        sub->green[i] = pal->green[idx];
+        sub->blue[i] = pal->blue[idx];
+        sub->luma[i] = pal->luma[idx];
+        sub->fixbase[i] = pal->fixbase[idx];
+        sub->fixred[i] = pal->fixred[idx];
+        sub->fixgreen[i] = pal->fixgreen[idx];
+        sub->fixblue[i] = pal->fixblue[idx];
+    }
+}
+
+/* takes entries that are the same as an earlier one out of the integer
+   search - the lower index is closest in both searches, and without them
+   NearestFixed() does not take every color near the two grays for a tie */
+static void NearestDuplicates(b2d_nearest *pal, int count)
+{
+    int i, j;
+
+    for (i = count - 1; i > 0; i--) {
+        for (j = 0; j < i; j++) {
+            if (pal->fixbase[j] == pal->fixbase[i] && pal->fixred[j] == pal->fixred[i] &&
+                pal->fixgreen[j] == pal->fixgreen[i] && pal->fixblue[j] == pal->fixblue[i]) {
+                pal->fixbase[i] = FIXEDOFF;
+                pal->fixred[i] = pal->fixgreen[i] = pal->fixblue[i] = 0;
+                break;
+            }
+        }
+    }
+}
+
+/* the palette to search for the current dither7 subset
+   colors maps its entries back to the palette and is NULL for all 16 */
+static const b2d_nearest *NearestPalette(b2d_context *ctx, sshort variant, int *count, const uchar **colors)
+{
+    int subset;
+
+    /* dither7 is set in FloydSteinberg() function */
+    if (ctx->dither7 == (uchar)0) {
+        *count = 16;
+        *colors = NULL;
+        return &ctx->nearest[variant];
+    }
+    subset = (ctx->dither7 == 'O' ? 0 : 1);
+    *count = 4;
+    *colors = subsetcolors[subset];
+    return &ctx->nearestsubset[variant][subset];
+}
+
+/* brighten and darken are the cross-hatch thresholds in 1/FIXEDUNIT */
+void NearestInit(b2d_context *ctx, sshort brighten, sshort darken)
+{
+    long long weight[3];
+    int variant, subset;
+
+    /* every luma setting has exact weights - this is in case one is added that does not */
+    if (FixedWeights(ctx, weight) == 0) ctx->fixedpoint = 0;
+
+    NearestCopy(ctx, &ctx->nearest[MEDCOLOR], ctx->rgbDouble, ctx->rgbLuma, weight, FIXEDUNIT);
+    NearestCopy(ctx, &ctx->nearest[HIGHCOLOR], ctx->rgbDoubleBrighten, ctx->rgbLumaBrighten, weight, brighten);
+    NearestCopy(ctx, &ctx->nearest[LOWCOLOR], ctx->rgbDoubleDarken, ctx->rgbLumaDarken, weight, darken);
+
+    for (variant = 0; variant < 3; variant++) {
+        for (subset = 0; subset < 2; subset++) {
+            NearestSubset(&ctx->nearestsubset[variant][subset], &ctx->nearest[variant], subsetcolors[subset]);
+            NearestDuplicates(&ctx->nearestsubset[variant][subset], 4);
+        }
+        NearestDuplicates(&ctx->nearest[variant], 16);
+    }
+}
+
+/* the double precision distance to palette entry i as NearestColor() and
+   the scalar loops in b2d.c compute it - the same operations in the same
+   order, one at a time so they are not fused into multiply-adds */
+static double NearestDistance(const b2d_nearest *pal, int i, double dr, double dg, double db,
+                              double luma, double wr, double wg)
+{
+    double diffR, diffG, diffB, lumadiff, d, t;
+
+    lumadiff = pal->luma[i] - luma;
+    diffR = (pal->red[i] - dr) / 255.0;
+    diffG = (pal->green[i] - dg) / 255.0;
+    diffB = (pal->blue[i] - db) / 255.0;
+    d = diffR * diffR;
+    d = d * wr;
+    t = diffG * diffG;
+    t = t * wg;
+    d = d + t;
+    t = diffB * diffB;
+    t = t * wg;
+    d = d + t;
+    d = d * 0.75;
+    t = lumadiff * lumadiff;
+    return d + t;
+}
+
+/* closest color with integer distances
+
+   The double precision distance for palette entry i is
+
+       0.75 * (dR*(diffR/255)^2 + dG*(diffG/255)^2 + dG*(diffB/255)^2)
+            + (lumadiff/255000)^2
+
+   Multiplied by FIXEDSCALE with the channels in 1/FIXEDUNIT this becomes
+
+       weight[0]*diffR^2 + weight[1]*diffG^2 + weight[2]*diffB^2 + 4*lumadiff^2
+
+   which is at most about 3e16 and fits in 64 bits. Multiplying out the
+   squares leaves fixbase[i] - fixred[i]*r - fixgreen[i]*g - fixblue[i]*b
+   plus terms that depend only on r, g and b. Those are the same for every
+   palette entry so they are left out of the comparison.
+
+   The double precision search picks the entry whose rounded distance is
+   smallest. When the two closest exact distances are within FIXEDNEAR
+   rounding can put either first - or put a later index first on a tie -
+   so those colors are searched in double precision as well. */
+uchar NearestFixed(b2d_context *ctx, sshort variant, uchar r, uchar g, uchar b, double *paldistance)
+{
+    const uchar *colors;
+    long long fr = (long long)r, fg = (long long)g, fb = (long long)b;
+    long long distance, larger, prevdistance = FIXEDOFF, nextdistance = FIXEDOFF;
+    double dr = (double)r, dg = (double)g, db = (double)b, luma, closest, dbldistance;
+    uchar drawcolor = 0;
+    int i, count;
+    const b2d_nearest *pal = NearestPalette(ctx, variant, &count, &colors);
+
+    for (i = 0; i < count; i++) {
+        distance = pal->fixbase[i] - pal->fixred[i]*fr - pal->fixgreen[i]*fg - pal->fixblue[i]*fb;
+
+        /* the second smallest as well
+           written without a branch since which is smaller is hard to predict */
+        larger = (distance < prevdistance) ? prevdistance : distance;
+        nextdistance = (larger < nextdistance) ? larger : nextdistance;
+        drawcolor = (distance < prevdistance) ? (uchar)i : drawcolor;
+        prevdistance = (distance < prevdistance) ? distance : prevdistance;
+    }
+
+    if (nextdistance - prevdistance <= FIXEDNEAR) {
+        /* too close to call - the first smallest rounded distance as the double search finds it */
+        luma = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
+        drawcolor = 0;
+        closest = NearestDistance(pal, 0, dr, dg, db, luma, ctx->dlumaRED, ctx->dlumaGREEN);
+        for (i = 1; i < count; i++) {
+            dbldistance = NearestDistance(pal, i, dr, dg, db, luma, ctx->dlumaRED, ctx->dlumaGREEN);
+            if (dbldistance < closest) {
+                closest = dbldistance;
+                drawcolor = (uchar)i;
+            }
+        }
+        if (paldistance != NULL) paldistance[0] = closest;
+    }
+    else if (paldistance != NULL) {
+        luma = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
+        paldistance[0] = NearestDistance(pal, drawcolor, dr, dg, db, luma, ctx->dlumaRED, ctx->dlumaGREEN);
+    }
+    if (colors != NULL) drawcolor = colors[drawcolor];
+
+#ifdef B2D_VERIFY_FIXED
+    {
+        double expecteddistance;
+        uchar expected;
+
+        ctx->fixedpoint = 0;
+        switch (variant) {
+            case HIGHCOLOR: expected = GetHighColor(ctx, r,g,b,&expecteddistance); break;
+            case LOWCOLOR:  expected = GetLowColor(ctx, r,g,b,&expecteddistance); break;
+            default:        expected = GetMedColor(ctx, r,g,b,&expecteddistance); break;
+        }
+        ctx->fixedpoint = 1;
+
+        if (expected != drawcolor || (paldistance != NULL && expecteddistance != paldistance[0])) {
+            ctx->fixedmismatches++;
+            fprintf(stderr, "fixed point mismatch %ld: variant %d dither7 %d rgb %d,%d,%d double %d %.17g fixed %d %.17g\n",
+                    ctx->fixedmismatches, variant, ctx->dither7, r, g, b, expected, expecteddistance,
+                    drawcolor, paldistance != NULL ? paldistance[0] : expecteddistance);
+        }
+        /* the double precision color keeps the output the same so every difference is reported */
+        if (paldistance != NULL) paldistance[0] = expecteddistance;
+        return expected;
+    }
+#else
+    return drawcolor;
+#endif
+}
+
+#ifdef B2D_SIMD
+
+#include <math.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#else
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define NEAREST_AVX2 1
+#endif
+#endif
+
+#define OFF INFINITY
+
+/* lowest palette index with the smallest distance */
+static uchar NearestFirst(const double *distance, double closest)
+{
+    int i;
+
+    for (i = 0; distance[i] != closest; i++);
+    return (uchar)i;
+}
+
+#if defined(__aarch64__)
+
+static uchar NearestNEON(const b2d_nearest *pal, int count, double dr, double dg, double db,
+                         double luma, double wr, double wg, double *paldistance)
+{
+    float64x2_t vr = vdupq_n_f64(dr), vg = vdupq_n_f64(dg), vb = vdupq_n_f64(db);
+    float64x2_t vl = vdupq_n_f64(luma), vwr = vdupq_n_f64(wr), vwg = vdupq_n_f64(wg);
+    float64x2_t v255 = vdupq_n_f64(255.0), v075 = vdupq_n_f64(0.75);
+    float64x2_t diffR, diffG, diffB, lumadiff, d, closest = vdupq_n_f64(OFF);
+    double distance[16];
+    int i;
+
+    /* vmulq and vaddq are kept separate - a fused multiply-add rounds differently */
+    for (i = 0; i < count; i += 2) {
+        lumadiff = vsubq_f64(vld1q_f64(pal->luma + i), vl);
+        diffR = vdivq_f64(vsubq_f64(vld1q_f64(pal->red + i), vr), v255);
+        diffG = vdivq_f64(vsubq_f64(vld1q_f64(pal->green + i), vg), v255);
+        diffB = vdivq_f64(vsubq_f64(vld1q_f64(pal->blue + i), vb), v255);
+        d = vaddq_f64(vmulq_f64(vmulq_f64(diffR, diffR), vwr), vmulq_f64(vmulq_f64(diffG, diffG), vwg));
+        d = vaddq_f64(d, vmulq_f64(vmulq_f64(diffB, diffB), vwg));
+        d = vaddq_f64(vmulq_f64(d, v075), vmulq_f64(lumadiff, lumadiff));
+        vst1q_f64(distance + i, d);
+        closest = vminq_f64(closest, d);
+    }
+    paldistance[0] = vminvq_f64(closest);
+    return NearestFirst(distance, paldistance[0]);
+}
+
+#else
+
+static uchar NearestSSE2(const b2d_nearest *pal, int count, double dr, double dg, double db,
+                         double luma, double wr, double wg, double *paldistance)
+{
+    __m128d vr = _mm_set1_pd(dr), vg = _mm_set1_pd(dg), vb = _mm_set1_pd(db);
+    __m128d vl = _mm_set1_pd(luma), vwr = _mm_set1_pd(wr), vwg = _mm_set1_pd(wg);
+    __m128d v255 = _mm_set1_pd(255.0), v075 = _mm_set1_pd(0.75);
+    __m128d diffR, diffG, diffB, lumadiff, d, closest = _mm_set1_pd(OFF);
+    double distance[16];
+    int i;
+
+    for (i = 0; i < count; i += 2) {
+        lumadiff = _mm_sub_pd(_mm_loadu_pd(pal->luma + i), vl);
+        diffR = _mm_div_pd(_mm_sub_pd(_mm_loadu_pd(pal->red + i), vr), v255);
+        diffG = _mm_div_pd(_mm_sub_pd(_mm_loadu_pd(pal->green + i), vg), v255);
+        diffB = _mm_div_pd(_mm_sub_pd(_mm_loadu_pd(pal->blue + i), vb), v255);
+        d = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(diffR, diffR), vwr), _mm_mul_pd(_mm_mul_pd(diffG, diffG), vwg));
+        d = _mm_add_pd(d, _mm_mul_pd(_mm_mul_pd(diffB, diffB), vwg));
+        d = _mm_add_pd(_mm_mul_pd(d, v075), _mm_mul_pd(lumadiff, lumadiff));
+        _mm_storeu_pd(distance + i, d);
+        closest = _mm_min_pd(closest, d);
+    }
+    closest = _mm_min_sd(closest, _mm_unpackhi_pd(closest, closest));
+    paldistance[0] = _mm_cvtsd_f64(closest);
+    return NearestFirst(distance, paldistance[0]);
+}
+
+#ifdef NEAREST_AVX2
+
+/* only "avx2" and not "fma" so the compiler cannot fuse the multiply-adds */
+__attribute__((target("avx2")))
+static uchar NearestAVX2(const b2d_nearest *pal, int count, double dr, double dg, double db,
+                         double luma, double wr, double wg, double *paldistance)
+{
+    __m256d vr = _mm256_set1_pd(dr), vg = _mm256_set1_pd(dg), vb = _mm256_set1_pd(db);
+    __m256d vl = _mm256_set1_pd(luma), vwr = _mm256_set1_pd(wr), vwg = _mm256_set1_pd(wg);
+    __m256d v255 = _mm256_set1_pd(255.0), v075 = _mm256_set1_pd(0.75);
+    __m256d diffR, diffG, diffB, lumadiff, d, closest = _mm256_set1_pd(OFF);
+    __m128d half;
+    double distance[16];
+    int i;
+
+    for (i = 0; i < count; i += 4) {
+        lumadiff = _mm256_sub_pd(_mm256_loadu_pd(pal->luma + i), vl);
+        diffR = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(pal->red + i), vr), v255);
+        diffG = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(pal->green + i), vg), v255);
+        diffB = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(pal->blue + i), vb), v255);
+        d = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(diffR, diffR), vwr),
+                          _mm256_mul_pd(_mm256_mul_pd(diffG, diffG), vwg));
+        d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_mul_pd(diffB, diffB), vwg));
+        d = _mm256_add_pd(_mm256_mul_pd(d, v075), _mm256_mul_pd(lumadiff, lumadiff));
+        _mm256_storeu_pd(distance + i, d);
+        closest = _mm256_min_pd(closest, d);
+    }
+    half = _mm_min_pd(_mm256_castpd256_pd128(closest), _mm256_extractf128_pd(closest, 1));
+    half = _mm_min_sd(half, _mm_unpackhi_pd(half, half));
+    paldistance[0] = _mm_cvtsd_f64(half);
+    return NearestFirst(distance, paldistance[0]);
+}
+
+#endif /* NEAREST_AVX2 */
+
+#endif
+
+/* closest color in the palette for a GetDrawColor() variant */
+uchar NearestColor(b2d_context *ctx, sshort variant, uchar r, uchar g, uchar b, double *paldistance)
+{
+    const uchar *colors;
+    double dr = (double)r, dg = (double)g, db = (double)b, luma, closest;
+    uchar drawcolor;
+    int count;
+    const b2d_nearest *pal = NearestPalette(ctx, variant, &count, &colors);
+
+    luma = (dr*ctx->lumaRED + dg*ctx->lumaGREEN + db*ctx->lumaBLUE) / (255.0*1000);
+
+    /* the blue difference is weighted by dlumaGREEN as in the scalar loops */
+#if defined(__aarch64__)
+    drawcolor = NearestNEON(pal, count, dr, dg, db, luma, ctx->dlumaRED, ctx->dlumaGREEN, &closest);
+#else
+#ifdef NEAREST_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        drawcolor = NearestAVX2(pal, count, dr, dg, db, luma, ctx->dlumaRED, ctx->dlumaGREEN, &closest);
+    else
+#endif
+    drawcolor = NearestSSE2(pal, count, dr, dg, db, luma, ctx->dlumaRED, ctx->dlumaGREEN, &closest);
+#endif
+    if (paldistance != NULL) paldistance[0] = closest;
+    return (colors != NULL ? colors[drawcolor] : drawcolor);
+}
+
+#endif /* B2D_SIMD */
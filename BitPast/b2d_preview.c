@@ -0,0 +1,149 @@
+/*
+ * b2d_preview.c
+ * The preview image
+ *
+ * Convert() and ConvertMono() build the preview one scanline at a time in
+ * ctx->previewline, top scanline first, as 24-bit BGR. PreviewLine() takes
+ * each finished scanline.
+ *
+ * For the command line the scanlines are collected in a BMP in memory,
+ * bottom-up as BMPs are stored, and PreviewClose() writes the preview
+ * file with one fwrite(). There is no need to pad the file first and
+ * seek back to each scanline.
+ *
+ * b2d_convert_rgb() can pass an RGBA8 surface instead (ctx->previewrgba).
+ * The scanlines are then written straight into it, top scanline first,
+ * so the app can draw it without decoding a BMP. With ctx->previewscale
+ * 2 each preview pixel is drawn 2 x 2.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+/* draws the preview again from the DHGR buffer in the preview palette,
+   as Convert() draws it - dwidth colors across, each 2 pixels wide but
+   in DLGR */
+void PreviewScreen(b2d_context *ctx, ushort width, ushort dwidth)
+{
+    uchar line[140];
+    int x, x1, y, idx, i, pixels;
+
+    if (PreviewOpen(ctx, width, ctx->bmpheight) == INVALID) return;
+
+    pixels = (ctx->loresoutput == 1 && ctx->lores == 0) ? 1 : 2;
+    memset(&ctx->previewline[0], 0, sizeof(ctx->previewline));
+    for (y = 0; y < ctx->bmpheight; y++) {
+        dhrgetline(ctx, y, line);
+        for (x = 0, x1 = 0; x < dwidth; x++) {
+            idx = line[x];
+            for (i = 0; i < pixels; i++) {
+                ctx->previewline[x1++] = ctx->rgbPreview[idx][BLUE];
+                ctx->previewline[x1++] = ctx->rgbPreview[idx][GREEN];
+                ctx->previewline[x1++] = ctx->rgbPreview[idx][RED];
+            }
+        }
+        PreviewLine(ctx);
+    }
+    PreviewClose(ctx);
+}
+
+/* starts a width x height preview
+   turns the preview off and returns INVALID if it cannot be made */
+sshort PreviewOpen(b2d_context *ctx, ushort width, ushort height)
+{
+    size_t need;
+    int scale;
+
+    if (ctx->previewscale != 2) ctx->previewscale = 1;
+    scale = ctx->previewscale;
+
+    free(ctx->previewbmp);
+    ctx->previewbmp = NULL;
+    ctx->previewwidth = width;
+    ctx->previewheight = height;
+    ctx->previewrow = 0;
+
+    if (ctx->previewrgba != NULL) {
+        need = (size_t)width * scale * (size_t)height * scale * 4;
+        if (need > ctx->previewsize) {
+            printf("Preview surface is too small for %d x %d!\n", width * scale, height * scale);
+            ctx->preview = 0;
+            return INVALID;
+        }
+        return SUCCESS;
+    }
+
+    ctx->previewpacket = SetDIBHeader(ctx, width, height);
+    ctx->previewbmp = (uchar *)calloc(1, ctx->mybmp.bfi.bfSize);
+    if (ctx->previewbmp == NULL) {
+        printf("Error creating %s!\n", ctx->previewfile);
+        ctx->preview = 0;
+        return INVALID;
+    }
+    memcpy(ctx->previewbmp, &ctx->mybmp, sizeof(BMPHEADER));
+    return SUCCESS;
+}
+
+/* the next scanline of the preview from ctx->previewline */
+void PreviewLine(b2d_context *ctx)
+{
+    int scale = ctx->previewscale, x, i, stage;
+    size_t stride;
+    uchar *src = ctx->previewline, *dest;
+
+    if (ctx->previewrow >= ctx->previewheight) return;
+    stage = StatsStage(ctx, B2D_STAGE_PREVIEW);
+
+    if (ctx->previewrgba != NULL) {
+        stride = (size_t)ctx->previewwidth * scale * 4;
+        dest = ctx->previewrgba + stride * ((size_t)ctx->previewrow * scale);
+        for (x = 0; x < ctx->previewwidth; x++, src += 3) {
+            for (i = 0; i < scale; i++, dest += 4) {
+                dest[0] = src[2];
+                dest[1] = src[1];
+                dest[2] = src[0];
+                dest[3] = 255;
+            }
+        }
+        /* the same scanline again for 2 x 2 */
+        for (i = 1; i < scale; i++) {
+            memcpy(dest, dest - stride, stride);
+            dest += stride;
+        }
+    }
+    else if (ctx->previewbmp != NULL) {
+        dest = ctx->previewbmp + sizeof(BMPHEADER) +
+               (size_t)(ctx->previewheight - 1 - ctx->previewrow) * ctx->previewpacket;
+        memcpy(dest, src, ctx->previewpacket);
+    }
+    ctx->previewrow++;
+    StatsStage(ctx, stage);
+}
+
+/* writes the preview file - nothing to do for a surface */
+void PreviewClose(b2d_context *ctx)
+{
+    FILE *fp;
+    BMPHEADER *header = (BMPHEADER *)ctx->previewbmp;
+    int stage;
+
+    if (ctx->previewbmp == NULL) return;
+    stage = StatsStage(ctx, B2D_STAGE_PREVIEW);
+
+    fp = b2d_fopen(ctx, ctx->previewfile, "wb");
+    if (fp == NULL) {
+        printf("Error opening %s for writing!\n", ctx->previewfile);
+        ctx->preview = 0;
+    }
+    else {
+        if (fwrite(ctx->previewbmp, header->bfi.bfSize, 1, fp) != 1) {
+            printf("Error writing %s!\n", ctx->previewfile);
+            ctx->preview = 0;
+        }
+        fclose(fp);
+    }
+    free(ctx->previewbmp);
+    ctx->previewbmp = NULL;
+    StatsStage(ctx, stage);
+}
@@ -0,0 +1,77 @@
+/*
+ * b2d_progress.c
+ * Cancelling a conversion and reporting how far it is
+ *
+ * b2d_convert_rgb() can be given a flag that cancels the conversion and
+ * a callback for its progress (b2d_options.cancel and scanline). The flag
+ * is set on another thread with b2d_cancel(). Convert() and ConvertMono()
+ * call ProgressLine() after each scanline they match to the palette and
+ * dither. It reports the scanline and returns non-zero once the flag is
+ * set, and the converter stops there. ProgressAbort()
+ * drops what was made so far, nothing is saved, and ConvertImage()
+ * returns INVALID with ctx->cancelled set.
+ *
+ * With option "mt" every scanline is read before they are dithered on
+ * several threads (see b2d_dither.c), then each is plotted, so each
+ * scanline counts twice. The dithering threads only look at the flag,
+ * with ProgressCancelled(), before they take the next scanline. One that
+ * is taken is finished - the scanline below it waits for it.
+ *
+ * The command line does not use either.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+/* starts counting the scanlines */
+void ProgressBegin(b2d_context *ctx, int scanlines)
+{
+    ctx->scanlinesdone = 0;
+    ctx->scanlines = scanlines;
+}
+
+/* whether the conversion is cancelled - the flag is set on another
+   thread, and this is safe to call on the dithering threads */
+int ProgressCancelled(b2d_context *ctx)
+{
+    if (ctx->cancelled != 0) return 1;
+    if (ctx->cancel == NULL) return 0;
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED) != 0;
+#else
+    return *ctx->cancel != 0;
+#endif
+}
+
+/* sets the flag on another thread - see b2d_api.h */
+void b2d_cancel(volatile int *cancel)
+{
+    if (cancel == NULL) return;
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(cancel, 1, __ATOMIC_RELAXED);
+#else
+    *cancel = 1;
+#endif
+}
+
+/* one more scanline is done
+   returns non-zero if the conversion is cancelled */
+int ProgressLine(b2d_context *ctx)
+{
+    if (ctx->scanlinesdone < ctx->scanlines) ctx->scanlinesdone++;
+    if (ctx->scanline != NULL) ctx->scanline(ctx->scanlinedata, ctx->scanlinesdone, ctx->scanlines);
+    if (ProgressCancelled(ctx)) ctx->cancelled = 1;
+    return ctx->cancelled;
+}
+
+/* frees what a cancelled conversion made so far */
+void ProgressAbort(b2d_context *ctx)
+{
+    StageClose(ctx);
+    free(ctx->previewbmp);
+    ctx->previewbmp = NULL;
+    ctx->previewrow = 0;
+    free(ctx->ditherimage);
+    ctx->ditherimage = NULL;
+}
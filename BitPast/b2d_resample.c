@@ -0,0 +1,403 @@
+/*
+ * b2d_resample.c
+ * Input of any size, and resizing it to an Apple II size
+ *
+ * The converters only take a few input sizes - the Apple II screen
+ * sizes, fragments up to 280 x 192 and the "classic" sizes ResizeBMP()
+ * merges down (320 x 200, 640 x 400, 640 x 480 and 560 x 384). Color
+ * input of any other size is resampled to one they take before it is
+ * resized and converted:
+ *
+ *   DHGR and HGR   140 x 192, the full screen
+ *   mono           560 x 384, or 280 x 192 for HGR
+ *   LGR and DLGR   40 x 48 and 80 x 48
+ *
+ * Option "fit" (b2d_options.fitwidth and fitheight) resamples everything
+ * that is not already that size to the size given instead, so a photo
+ * can be fitted to 640 x 480 and then go through the classic 640 x 480
+ * merge like any other.
+ *
+ * ResampleRows() does both, and the classic merges in ResizeBMP() too.
+ * Each pixel it makes is the average of the area it covers, each input
+ * pixel weighted by how much of it is inside - across first, then down.
+ * The weights are whole numbers: from 640 pixels to 140 each input pixel
+ * is 7 parts and each new pixel 32 of them. They are worked out once for
+ * each axis, and dividing by the total is a multiply and shift.
+ *
+ * The classic merges were written as expanding each pixel 7 times and
+ * averaging groups of them, 25 lines to 24 from a table and so on, which
+ * is the same thing rounded down on each axis, so rounded down they give
+ * the pixels they always gave. 640 x 400 is still halved down before 25
+ * lines go to 24, as a second pass down. Resampling rounds to nearest.
+ *
+ * The input is read one scanline at a time and only the scanlines each
+ * pass down still needs are kept, so the memory used depends on the
+ * width and not the size of the input. Reductions of many times - a
+ * camera photo to 140 x 192 - use every input pixel once and do not ring
+ * the way a windowed filter can.
+ *
+ * Monochrome bitmaps are not resampled, they are only taken verbatim.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+#ifdef B2D_SIMD
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
+/* dividing by multiplying with 2^AXISSHIFT / divisor rounded up is exact
+   for sums below 256 times any divisor a ushort size can have */
+#define AXISSHIFT 48
+
+/* the weights of one axis, size input pixels (or scanlines) to outputs -
+   output n is the sum of taps[n] input values from first[n] on, each
+   times its weight from start[n] on, divided by divisor */
+typedef struct b2d_axis
+{
+    ulong size, outputs, divisor, bias, maxtaps;
+    uint64_t reciprocal;
+    ulong *first, *taps, *start;
+    ushort *weight;
+} b2d_axis;
+
+/* level 0 is the input scanlines resampled across, and level n is level
+   n - 1 resampled down by down[n - 1] */
+#define MAXLEVELS 3
+
+typedef struct b2d_resampler
+{
+    b2d_context *ctx;
+    ulong pos, packet, width, samples;
+    b2d_axis across, down[MAXLEVELS - 1];
+    int passes;
+    uchar *in;
+
+    /* the last scanlines of each level, as many as the next pass takes */
+    uchar *ring[MAXLEVELS];
+    ulong ringsize[MAXLEVELS];
+    long have[MAXLEVELS];
+    uint32_t *sum;
+} b2d_resampler;
+
+/* whether the converters take the input as it is */
+static int ResampleSupported(b2d_context *ctx)
+{
+    ushort width = ctx->bmpwidth, height = ctx->bmpheight;
+    sshort lores, justify, jxoffset, jyoffset, appletop, status;
+
+    if (ctx->mono == 1) return (width == 560 && height == 384) || (width == 280 && height == 192);
+
+    if (ctx->loresoutput == 1) {
+        /* ValidLoResSizeRange() also sets up the windowbox for the size it
+           checks, which is done again for the size that is converted */
+        lores = ctx->lores;
+        justify = ctx->justify;
+        jxoffset = ctx->jxoffset;
+        jyoffset = ctx->jyoffset;
+        appletop = ctx->appletop;
+        status = ValidLoResSizeRange(ctx);
+        ctx->lores = lores;
+        ctx->justify = justify;
+        ctx->jxoffset = jxoffset;
+        ctx->jyoffset = jyoffset;
+        ctx->appletop = appletop;
+        return status == SUCCESS;
+    }
+
+    if (width <= 280 && height <= 192) return 1;
+    return (width == 320 && height == 200) || (width == 640 && (height == 400 || height == 480)) ||
+           (width == 560 && height == 384);
+}
+
+/* option "fit" - only sizes up to 640 x 480 are converted */
+void ResampleFit(b2d_context *ctx, int width, int height)
+{
+    if (width < 1 || width > 640 || height < 1 || height > 480) width = height = 0;
+    ctx->fitwidth = (ushort)width;
+    ctx->fitheight = (ushort)height;
+}
+
+/* the size of ctx->bmpwidth x ctx->bmpheight input once it is resampled
+   returns 0 if it is converted as it is */
+int ResampleSize(b2d_context *ctx, ushort *width, ushort *height)
+{
+    if (ctx->bmi.biBitCount == 1 || ctx->bmpwidth == 0 || ctx->bmpheight == 0) return 0;
+
+    if (ctx->fitwidth != 0 && ctx->fitheight != 0) {
+        *width = ctx->fitwidth;
+        *height = ctx->fitheight;
+    }
+    else {
+        if (ResampleSupported(ctx)) return 0;
+        if (ctx->mono == 1) {
+            *width = (ctx->hgroutput == 1 ? 280 : 560);
+            *height = (ctx->hgroutput == 1 ? 192 : 384);
+        }
+        else if (ctx->loresoutput == 1) {
+            *width = (ctx->lores == 1 ? 40 : 80);
+            *height = 48;
+        }
+        else {
+            *width = 140;
+            *height = 192;
+        }
+    }
+    return (*width != ctx->bmpwidth || *height != ctx->bmpheight);
+}
+
+static void AxisFree(b2d_axis *axis)
+{
+    free(axis->first);
+    free(axis->taps);
+    free(axis->start);
+    free(axis->weight);
+    memset(axis, 0, sizeof(b2d_axis));
+}
+
+/* the weights for size to outputs, rounded to nearest or down
+   returns 0 if there is not enough memory */
+static int AxisInit(b2d_axis *axis, ulong size, ulong outputs, int rounded)
+{
+    ulong a = size, b = outputs, t, unit, span, n, i, left, right, lo, hi, count = 0;
+
+    memset(axis, 0, sizeof(b2d_axis));
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    /* input pixel i covers i * unit to (i + 1) * unit and output n covers
+       n * span to (n + 1) * span */
+    unit = outputs / a;
+    span = size / a;
+
+    axis->size = size;
+    axis->outputs = outputs;
+    axis->divisor = span;
+    axis->bias = (rounded != 0 ? span / 2 : 0);
+    axis->reciprocal = (((uint64_t)1 << AXISSHIFT) + span - 1) / span;
+    axis->first = (ulong *)malloc(outputs * sizeof(ulong));
+    axis->taps = (ulong *)malloc(outputs * sizeof(ulong));
+    axis->start = (ulong *)malloc(outputs * sizeof(ulong));
+    axis->weight = (ushort *)malloc((size + outputs) * sizeof(ushort));
+    if (axis->first == NULL || axis->taps == NULL || axis->start == NULL || axis->weight == NULL) {
+        AxisFree(axis);
+        return 0;
+    }
+
+    for (n = 0, left = 0; n < outputs; n++, left = right) {
+        right = left + span;
+        axis->first[n] = left / unit;
+        axis->start[n] = count;
+        for (i = left / unit; i * unit < right; i++) {
+            lo = (i * unit > left ? i * unit : left);
+            hi = ((i + 1) * unit < right ? (i + 1) * unit : right);
+            axis->weight[count++] = (ushort)(hi - lo);
+        }
+        axis->taps[n] = count - axis->start[n];
+        if (axis->taps[n] > axis->maxtaps) axis->maxtaps = axis->taps[n];
+    }
+    return 1;
+}
+
+static uchar AxisDivide(const b2d_axis *axis, ulong sum)
+{
+    return (uchar)(((uint64_t)(sum + axis->bias) * axis->reciprocal) >> AXISSHIFT);
+}
+
+/* one scanline across - the taps are different for each pixel */
+static void AxisAcross(const b2d_axis *axis, const uchar *src, uchar *dest)
+{
+    const ushort *weight = axis->weight;
+    const uchar *ptr;
+    ulong n, t, b, g, r;
+
+    for (n = 0; n < axis->outputs; n++) {
+        ptr = &src[axis->first[n] * 3];
+        b = g = r = 0;
+        for (t = 0; t < axis->taps[n]; t++, ptr += 3, weight++) {
+            b += (ulong)weight[0] * ptr[0];
+            g += (ulong)weight[0] * ptr[1];
+            r += (ulong)weight[0] * ptr[2];
+        }
+        *dest++ = AxisDivide(axis, b);
+        *dest++ = AxisDivide(axis, g);
+        *dest++ = AxisDivide(axis, r);
+    }
+}
+
+/* sum[x] += weight * row[x] - down, every sample in a scanline has the
+   same weight */
+static void AxisAccumulate(uint32_t *sum, const uchar *row, ushort weight, ulong count)
+{
+    ulong x = 0;
+
+#ifdef B2D_SIMD
+#if defined(__aarch64__)
+    uint8x16_t v;
+    uint16x8_t lo, hi;
+
+    for (; x + 16 <= count; x += 16) {
+        v = vld1q_u8(row + x);
+        lo = vmovl_u8(vget_low_u8(v));
+        hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(sum + x, vmlal_n_u16(vld1q_u32(sum + x), vget_low_u16(lo), weight));
+        vst1q_u32(sum + x + 4, vmlal_n_u16(vld1q_u32(sum + x + 4), vget_high_u16(lo), weight));
+        vst1q_u32(sum + x + 8, vmlal_n_u16(vld1q_u32(sum + x + 8), vget_low_u16(hi), weight));
+        vst1q_u32(sum + x + 12, vmlal_n_u16(vld1q_u32(sum + x + 12), vget_high_u16(hi), weight));
+    }
+#else
+    __m128i zero = _mm_setzero_si128(), w = _mm_set1_epi16((short)weight);
+    __m128i v, half, plo, phi;
+    __m128i *ptr;
+    int i;
+
+    /* SSE2 has no 32 bit multiply - the products are put together from
+       their low and high 16 bits */
+    for (; x + 16 <= count; x += 16) {
+        v = _mm_loadu_si128((const __m128i *)(row + x));
+        for (i = 0; i < 2; i++) {
+            half = (i == 0 ? _mm_unpacklo_epi8(v, zero) : _mm_unpackhi_epi8(v, zero));
+            plo = _mm_mullo_epi16(half, w);
+            phi = _mm_mulhi_epu16(half, w);
+            ptr = (__m128i *)(sum + x + i * 8);
+            _mm_storeu_si128(ptr, _mm_add_epi32(_mm_loadu_si128(ptr), _mm_unpacklo_epi16(plo, phi)));
+            _mm_storeu_si128(ptr + 1, _mm_add_epi32(_mm_loadu_si128(ptr + 1), _mm_unpackhi_epi16(plo, phi)));
+        }
+    }
+#endif
+#endif
+
+    for (; x < count; x++) sum[x] += (uint32_t)weight * row[x];
+}
+
+/* scanline row of a level - they are asked for in order, and the last
+   ones are still there for the next scanline down that takes them */
+static const uchar *ResamplerRow(b2d_resampler *rs, int level, long row)
+{
+    uchar *dest = &rs->ring[level][(ulong)row % rs->ringsize[level] * rs->samples];
+    b2d_axis *axis;
+    ulong t, x;
+
+    if (row <= rs->have[level]) return dest;
+
+    if (level == 0) {
+        StageReadAt(rs->ctx, (long)(rs->pos + (ulong)row * rs->packet), rs->in, rs->width * 3);
+        AxisAcross(&rs->across, rs->in, dest);
+    }
+    else {
+        /* the scanlines above are made first, so the sums can be shared */
+        axis = &rs->down[level - 1];
+        for (t = 0; t < axis->taps[row]; t++) ResamplerRow(rs, level - 1, (long)(axis->first[row] + t));
+        memset(rs->sum, 0, rs->samples * sizeof(uint32_t));
+        for (t = 0; t < axis->taps[row]; t++) {
+            AxisAccumulate(rs->sum, ResamplerRow(rs, level - 1, (long)(axis->first[row] + t)),
+                           axis->weight[axis->start[row] + t], rs->samples);
+        }
+        for (x = 0; x < rs->samples; x++) dest[x] = AxisDivide(axis, rs->sum[x]);
+    }
+    rs->have[level] = row;
+    return dest;
+}
+
+static void ResamplerFree(b2d_resampler *rs)
+{
+    int i;
+
+    AxisFree(&rs->across);
+    for (i = 0; i < MAXLEVELS; i++) {
+        if (i < MAXLEVELS - 1) AxisFree(&rs->down[i]);
+        free(rs->ring[i]);
+    }
+    free(rs->sum);
+    free(rs->in);
+}
+
+/* resamples width x rows pixels of the BMP left by the last stage, from
+   offset bytes into its pixels, to outwidth x outheight and writes them
+   to the next stage - see StageCreate()
+   midheight is 0, or a height the rows go down to first
+   rounded is 0 to round down on each axis as the classic merges do
+   returns 0 if there is not enough memory */
+int ResampleRows(b2d_context *ctx, ulong offset, ulong width, ulong rows,
+                 ushort outwidth, ushort midheight, ushort outheight, int rounded)
+{
+    b2d_resampler rs;
+    ulong outpacket = (ulong)outwidth * 3, y;
+    uchar *out;
+    int i, status = 1;
+
+    memset(&rs, 0, sizeof(b2d_resampler));
+    rs.ctx = ctx;
+    rs.pos = ctx->bfi.bfOffBits + offset;
+    rs.packet = (ulong)ctx->bmi.biWidth * 3;
+    while (rs.packet % 4 != 0) rs.packet++;
+    rs.width = width;
+    rs.samples = (ulong)outwidth * 3;
+    while (outpacket % 4 != 0) outpacket++;
+
+    if (midheight != 0) {
+        status &= AxisInit(&rs.down[rs.passes++], rows, midheight, rounded);
+        rows = midheight;
+    }
+    status &= AxisInit(&rs.down[rs.passes++], rows, outheight, rounded);
+    status &= AxisInit(&rs.across, width, outwidth, rounded);
+
+    rs.in = (uchar *)malloc(width * 3);
+    rs.sum = (uint32_t *)malloc(rs.samples * sizeof(uint32_t));
+    if (rs.in == NULL || rs.sum == NULL) status = 0;
+    for (i = 0; i <= rs.passes && status != 0; i++) {
+        /* the last level is written out, padding and all */
+        rs.ringsize[i] = (i < rs.passes ? rs.down[i].maxtaps : 1);
+        rs.ring[i] = (uchar *)calloc(rs.ringsize[i], (i < rs.passes ? rs.samples : outpacket));
+        rs.have[i] = -1;
+        if (rs.ring[i] == NULL) status = 0;
+    }
+
+    for (y = 0; y < outheight && status != 0; y++) {
+        out = (uchar *)ResamplerRow(&rs, rs.passes, (long)y);
+        StageWrite(ctx, out, outpacket);
+    }
+
+    ResamplerFree(&rs);
+    return status;
+}
+
+/* resamples the 24-bit BMP left by the last stage to width x height
+   returns NULL if there is not enough memory */
+FILE *ResampleBMP(b2d_context *ctx, FILE *fp, ushort width, ushort height)
+{
+    ulong srcwidth = (ulong)ctx->bmi.biWidth, srcheight = (ulong)ctx->bmi.biHeight;
+
+    /* option S is for input that is already an Apple II size - what is
+       resampled is single scaled up to 140 wide, as a classic merge leaves
+       it, and Convert() takes anything wider as double scaled */
+    ctx->scale = 0;
+
+    /* the same input was resampled before and its pixels were not
+       copied (see b2d_cache.c) */
+    if (ctx->cachedinput != NULL) {
+        if (CacheInputStage(ctx) == 0) {
+            StageClose(ctx);
+            printf("Error creating %s!\n", ctx->scaledfile);
+            return NULL;
+        }
+        return fp;
+    }
+
+    SetDIBHeader(ctx, width, height);
+    if (StageCreate(ctx) == 0 || ResampleRows(ctx, 0, srcwidth, srcheight, width, 0, height, 1) == 0) {
+        StageClose(ctx);
+        printf("Error creating %s!\n", ctx->scaledfile);
+        return NULL;
+    }
+    StageFinish(ctx, ctx->scaledfile);
+    CacheInputStore(ctx);
+    return fp;
+}
@@ -0,0 +1,214 @@
+/*
+ * b2d_stage.c
+ * The scanline stages between the input BMP and the converters
+ *
+ * Before Convert() and ConvertMono() read the input one scanline at a
+ * time it may be reformatted to 24-bit (ReformatBMP), resized to an Apple
+ * II size (ResizeBMP) and error diffused (ReadDIBFile). Each of these used
+ * to write a new BMP file that the next one opened and read back. They
+ * now hand scanlines to each other in memory:
+ *
+ * - 1, 4 and 8 bit scanlines are expanded to 24-bit when the next stage
+ *   reads them, one at a time, so a reformatted image is never stored.
+ * - Resampling, resizing and error diffusion write their scanlines to a
+ *   BMP kept in memory, which the next stage reads instead of a file.
+ *   Error diffusion runs from the bottom of the image up and the
+ *   converters from the top down, so the image is kept whole in between.
+ *   It is small - at most 640 x 480, and 280 x 192 once resized.
+ *
+ * Each stage reads the BMP left by the one before it as if it was still a
+ * file, so positions and scanline arithmetic are the same as before. With
+ * option "debug" the BMP left by each stage is also written out under the
+ * old temporary file name.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+/* reading the input as is */
+void StageOpen(b2d_context *ctx, FILE *fp)
+{
+    b2d_stage *st = &ctx->stage;
+
+    StageClose(ctx);
+    st->fp = fp;
+    st->offbits = ctx->bfi.bfOffBits;
+    st->row = -1;
+}
+
+/* expands a 24-bit scanline from the input into st->line */
+static void StageReformatRow(b2d_context *ctx, long row)
+{
+    b2d_stage *st = &ctx->stage;
+    long src = row;
+
+    /* DHGR monochrome lines are doubled */
+    if (st->bitcount == 1 && st->width == 560) src = row / 2;
+
+    b2d_fread_at(ctx, st->fp, (long)(st->offbits + (ulong)src * st->packet), st->in, st->packet);
+    memset(st->line, 0, st->outpacket);
+    if (st->bitcount == 1) ReformatMonoLine(ctx, st->in, st->line, st->width);
+    else ReformatVGALine(ctx, st->in, st->line, st->width, st->bitcount);
+    st->row = row;
+}
+
+/* writes the BMP left by a stage to a file - option "debug" */
+static void StageDump(b2d_context *ctx, const char *name)
+{
+    FILE *fp;
+    uchar buf[1920];
+    ulong pos, end;
+    size_t len;
+
+    if ((fp = b2d_fopen(ctx, name, "wb")) == NULL) return;
+    fwrite((char *)&ctx->bfi.bfType[0], sizeof(BITMAPFILEHEADER), 1, fp);
+    fwrite((char *)&ctx->bmi.biSize, sizeof(BITMAPINFOHEADER), 1, fp);
+    end = ctx->bfi.bfOffBits + ctx->bmi.biSizeImage;
+    for (pos = ctx->bfi.bfOffBits; pos < end; pos += len) {
+        len = StageReadAt(ctx, (long)pos, buf, sizeof(buf));
+        if (len == 0) break;
+        fwrite(buf, 1, len, fp);
+    }
+    fclose(fp);
+}
+
+/* reading 1, 4 or 8 bit input as 24-bit - the palette is in ctx->sbmp
+   and the 24-bit header in ctx->mybmp
+   returns 0 if there is not enough memory */
+int StageReformat(b2d_context *ctx, ushort packet, ushort rows)
+{
+    b2d_stage *st = &ctx->stage;
+
+    st->reformat = 1;
+    st->width = ctx->bmpwidth;
+    st->bitcount = ctx->bmi.biBitCount;
+    st->packet = packet;
+    st->outpacket = ctx->mybmp.bmi.biSizeImage / ctx->mybmp.bmi.biHeight;
+    st->rows = rows;
+    st->row = -1;
+
+    /* the input can be any width (see b2d_resample.c) */
+    free(st->in);
+    free(st->line);
+    st->in = (uchar *)malloc(st->packet);
+    st->line = (uchar *)malloc(st->outpacket);
+    if (st->in == NULL || st->line == NULL) return 0;
+
+    ctx->bfi = ctx->mybmp.bfi;
+    ctx->bmi = ctx->mybmp.bmi;
+
+    if (ctx->debug != 0) StageDump(ctx, ctx->reformatfile);
+    return 1;
+}
+
+/* the same as fseek() and fread() on the BMP left by the last stage
+   returns the bytes read, fewer at the end of the file */
+size_t StageReadAt(b2d_context *ctx, long pos, void *buf, size_t len)
+{
+    b2d_stage *st = &ctx->stage;
+    uchar *dest = (uchar *)buf;
+    size_t done = 0, n;
+    ulong off, col;
+    long row;
+
+    if (pos < 0) return 0;
+
+    if (st->image != NULL) {
+        if ((size_t)pos >= st->size) return 0;
+        if (len > st->size - (size_t)pos) len = st->size - (size_t)pos;
+        memcpy(buf, &st->image[pos], len);
+        return len;
+    }
+
+    if (st->reformat == 0) return b2d_fread_at(ctx, st->fp, pos, buf, len);
+
+    if ((ulong)pos < ctx->bfi.bfOffBits) return 0;
+    off = (ulong)pos - ctx->bfi.bfOffBits;
+    while (done < len) {
+        row = (long)(off / st->outpacket);
+        col = off % st->outpacket;
+        if ((ulong)row >= st->rows) break;
+        if (row != st->row) StageReformatRow(ctx, row);
+        n = st->outpacket - col;
+        if (n > len - done) n = len - done;
+        memcpy(&dest[done], &st->line[col], n);
+        done += n;
+        off += n;
+    }
+    return done;
+}
+
+void StageSeek(b2d_context *ctx, long pos)
+{
+    ctx->stage.pos = pos;
+}
+
+/* reads on from the last StageSeek() */
+size_t StageRead(b2d_context *ctx, void *buf, size_t len)
+{
+    size_t n = StageReadAt(ctx, ctx->stage.pos, buf, len);
+
+    ctx->stage.pos += (long)n;
+    return n;
+}
+
+/* starts the BMP for the next stage with the header in ctx->mybmp
+   returns 0 if there is not enough memory */
+int StageCreate(b2d_context *ctx)
+{
+    b2d_stage *st = &ctx->stage;
+
+    free(st->next);
+    st->next = (uchar *)malloc(ctx->mybmp.bfi.bfSize);
+    if (st->next == NULL) return 0;
+    memcpy(st->next, &ctx->mybmp, sizeof(BMPHEADER));
+    st->nextsize = sizeof(BMPHEADER);
+    return 1;
+}
+
+void StageWrite(b2d_context *ctx, const void *buf, size_t len)
+{
+    b2d_stage *st = &ctx->stage;
+
+    if (st->next == NULL) return;
+    if (len > ctx->mybmp.bfi.bfSize - st->nextsize) len = ctx->mybmp.bfi.bfSize - st->nextsize;
+    memcpy(&st->next[st->nextsize], buf, len);
+    st->nextsize += len;
+}
+
+/* the BMP written since StageCreate() is read from now on */
+void StageFinish(b2d_context *ctx, const char *name)
+{
+    b2d_stage *st = &ctx->stage;
+
+    free(st->image);
+    st->image = st->next;
+    st->size = st->nextsize;
+    st->next = NULL;
+    st->reformat = 0;
+    st->row = -1;
+
+    /* read the header stuff into the appropriate structures */
+    memcpy(&ctx->bfi, st->image, sizeof(BITMAPFILEHEADER));
+    memcpy(&ctx->bmi, &st->image[sizeof(BITMAPFILEHEADER)], sizeof(BITMAPINFOHEADER));
+
+    if (ctx->debug != 0) StageDump(ctx, name);
+}
+
+void StageClose(b2d_context *ctx)
+{
+    b2d_stage *st = &ctx->stage;
+
+    if (st->fp != NULL) fclose(st->fp);
+    free(st->image);
+    free(st->next);
+    free(st->in);
+    free(st->line);
+    st->fp = NULL;
+    st->image = st->next = NULL;
+    st->in = st->line = NULL;
+    st->size = st->nextsize = 0;
+    st->reformat = 0;
+    st->row = -1;
+}
@@ -0,0 +1,106 @@
+/*
+ * b2d_stats.c
+ * Where a conversion spends its time
+ *
+ * With option "stats" (b2d_options.stats) ConvertImage() times each stage
+ * of the conversion and counts the colors matched to the palette. The
+ * converters call StatsStage() as they go from one stage to the next, so
+ * the time between two calls goes to the stage that was current. A stage
+ * inside another one - a preview scanline written while dithering -
+ * switches back to the outer stage when it is done, and its time is not
+ * counted twice.
+ *
+ * Without the option nothing is timed or counted: StatsStage() returns
+ * at once and the counters are not touched. The counters are atomic
+ * because the colors can be matched on several threads (option "mt").
+ *
+ * The command line prints the stats as JSON after the conversion.
+ *
+ * DO NOT define B2D_IMPLEMENTATION here
+ */
+
+#include "b2d.h"
+
+#include <time.h>
+
+static const char *stagenames[B2D_STAGES] = {
+    "header", "reformat", "resize", "diffuse", "dither",
+    "hgrpalette", "encode", "save", "preview"
+};
+
+static double StatsNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* starts timing in the header stage */
+void StatsBegin(b2d_context *ctx)
+{
+    if (ctx->stats == 0) return;
+    memset(&ctx->statsdata, 0, sizeof(b2d_stats));
+    atomic_store(&ctx->drawcolors, 0);
+    atomic_store(&ctx->exactmatches, 0);
+    ctx->statsstart = ctx->statsmark = StatsNow();
+    ctx->statsstage = B2D_STAGE_HEADER;
+}
+
+/* the time since the last call goes to the current stage
+   returns the stage that was current, for going back to it */
+int StatsStage(b2d_context *ctx, int stage)
+{
+    int last = ctx->statsstage;
+    double now;
+
+    if (ctx->stats == 0) return last;
+    now = StatsNow();
+    if (last >= 0 && last < B2D_STAGES) ctx->statsdata.seconds[last] += now - ctx->statsmark;
+    ctx->statsmark = now;
+    ctx->statsstage = stage;
+    return last;
+}
+
+/* closes the current stage and fills in the totals */
+void StatsEnd(b2d_context *ctx)
+{
+    if (ctx->stats == 0) return;
+    StatsStage(ctx, -1);
+    ctx->statsdata.total = ctx->statsmark - ctx->statsstart;
+    ctx->statsdata.drawcolors = (uint64_t)atomic_load(&ctx->drawcolors);
+    ctx->statsdata.exactmatches = (uint64_t)atomic_load(&ctx->exactmatches);
+}
+
+const char *b2d_stage_name(int stage)
+{
+    if (stage < 0 || stage >= B2D_STAGES) return NULL;
+    return stagenames[stage];
+}
+
+int b2d_stats_json(const b2d_stats *stats, char *buf, size_t size)
+{
+    char dummy[1];
+    size_t len = 0;
+    int i, n;
+
+    if (buf == NULL || size == 0) {
+        buf = dummy;
+        size = 1;
+    }
+
+    /* the length so far even if the buffer is full */
+#define STATSJSON(...) \
+    n = snprintf(buf + (len < size ? len : size - 1), len < size ? size - len : 1, __VA_ARGS__); \
+    if (n > 0) len += (size_t)n
+
+    STATSJSON("{\"total_ms\":%.3f,\"stages_ms\":{", stats->total * 1000);
+    for (i = 0; i < B2D_STAGES; i++) {
+        STATSJSON("%s\"%s\":%.3f", i ? "," : "", stagenames[i], stats->seconds[i] * 1000);
+    }
+    STATSJSON("},\"drawcolors\":%llu,\"exactmatches\":%llu}",
+              (unsigned long long)stats->drawcolors, (unsigned long long)stats->exactmatches);
+#undef STATSJSON
+
+    return (int)len;
+}
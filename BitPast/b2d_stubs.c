@@ -13,7 +13,7 @@
  * Stub for GetUserTextFile
  * TODO: Implement actual functionality
  */
-sshort GetUserTextFile(void) {
+sshort GetUserTextFile(b2d_context *ctx) {
     // Return error code for now
     return -1;  // ALWAYS RETURN A VALUE
 }
@@ -22,7 +22,7 @@ sshort GetUserTextFile(void) {
  * Stub for dhrgetpixel
  * TODO: Implement actual functionality
  */
-int dhrgetpixel(int x, int y) {
+int dhrgetpixel(b2d_context *ctx, int x, int y) {
     // Return default pixel value for now
     return 0;  // ALWAYS RETURN A VALUE
 }
@@ -1,184 +1,502 @@
 /*
  * b2d_wrapper.c
- * Wrapper function to call b2d conversion from Swift
+ * Wrapper functions to call b2d conversion from Swift
  * DO NOT define B2D_IMPLEMENTATION here
  */
 
 #include "b2d.h"
-#include <string.h>  // For memset
 
 /**
  * Wrapper function that can be called from Swift
  * This ensures all code paths return a value
  */
 int b2d_main_wrapper(int argc, char** argv) {
-    // ========================================================================
-    // CRITICAL: Reset ALL global variables before each conversion
-    // This fixes the bug where mode settings persist between conversions
-    // Variables are declared in b2d.h as extern and defined in b2d_globals.c
-    // ========================================================================
-
-    // NOTE: Do NOT free dhrbuf/hgrbuf here!
-    // b2d.c already frees them at the end of each call (lines 6371-6372).
-    // We just need to ensure the pointers are NULL so b2d allocates fresh buffers.
-    // The pointers may contain stale addresses from the previous free() in b2d.
-    dhrbuf = NULL;
-    hgrbuf = NULL;
-
-    // Reset mode flags (these are the ACTUAL variable names from b2d_globals.c)
-    hgroutput = 0;        // HGR mode output flag
-    mono = 0;             // Monochrome mode flag
-    lores = 0;            // Lo-res mode flag
-    loresoutput = 0;      // Lo-res output flag
-    appletop = 0;         // Apple top flag
-
-    // Reset dither settings
-    dither = 0;           // Reset dither to default (none)
-    hgrdither = 0;        // Reset HGR dither
-    dither7 = 0;          // Reset 7-bit dither
-    errorsum = 0;         // Error sum flag
-    serpentine = 0;       // Serpentine dither flag
-    ditheroneline = 0;    // Single line dither flag
-    ditherstart = 0;      // Dither start position
-
-    // Reset palette settings
-    hgrpaltype = 255;     // Reset to default (255 = auto-select)
-    hgrcolortype = 0;     // Reset HGR color type
-
-    // Reset other important flags that affect output
-    preview = 0;          // Preview mode
-    vbmp = 0;             // VBMP output mode
-    dosheader = 0;        // DOS header flag
-    spritemask = 0;       // Sprite mask flag
-    tags = 0;             // Tags flag
-    debug = 0;            // Debug flag
-    quietmode = 1;        // Quiet mode (default is 1)
-    outputtype = BIN_OUTPUT;  // Reset output type to default
-
-    // Reset processing flags
-    diffuse = 0;          // Diffusion flag
-    merge = 0;            // Merge flag
-    scale = 0;            // Scale flag
-    reformat = 0;         // Reformat flag
-    applesoft = 0;        // Applesoft flag
-    reverse = 0;          // Reverse flag
-
-    // Reset color/clipping settings
-    paletteclip = 0;      // Palette clipping
-    globalclip = 0;       // Global clipping
-    colorbleed = 100;     // Color bleed (default is 100)
-    bleed = 16;           // Bleed value (default is 16)
-    backgroundcolor = 0;  // Background color
-    clearcolor = 5;       // Clear color (default is 5)
-
-    // Reset overlay settings
-    use_overlay = 0;      // Overlay usage flag
-    maskpixel = 0;        // Mask pixel
-    overcolor = 0;        // Overlay color
-
-    // Close and reset file pointers if open
-    if (fpmask != NULL) {
-        fclose(fpmask);
-        fpmask = NULL;
-    }
-
-    // Reset justification
-    justify = 0;
-    jxoffset = -1;
-    jyoffset = -1;
-
-    // Reset double color settings
-    doubleblack = 0;
-    doublewhite = 0;
-    doublecolors = 1;     // Default is 1
-
-    // Reset cross-hatch settings
-    xmatrix = 0;
-    ymatrix = 0;
-    threshold = 0;
-
-    // Reset image dimensions
-    bmpwidth = 0;
-    bmpheight = 0;
-    spritewidth = 0;
-
-    // Reset pseudo palette
-    pseudocount = 0;
-
-    // Clear dither buffers to prevent color bleeding from previous conversions
-    memset(redDither, 0, sizeof(redDither));
-    memset(greenDither, 0, sizeof(greenDither));
-    memset(blueDither, 0, sizeof(blueDither));
-    memset(redSeed, 0, sizeof(redSeed));
-    memset(greenSeed, 0, sizeof(greenSeed));
-    memset(blueSeed, 0, sizeof(blueSeed));
-    memset(redSeed2, 0, sizeof(redSeed2));
-    memset(greenSeed2, 0, sizeof(greenSeed2));
-    memset(blueSeed2, 0, sizeof(blueSeed2));
-
-    // Clear HGR-specific buffers
-    memset(redSave, 0, sizeof(redSave));
-    memset(greenSave, 0, sizeof(greenSave));
-    memset(blueSave, 0, sizeof(blueSave));
-    memset(OrangeBlueError, 0, sizeof(OrangeBlueError));
-    memset(GreenVioletError, 0, sizeof(GreenVioletError));
-    memset(HgrPixelPalette, 0, sizeof(HgrPixelPalette));
-    memset(palettebits, 0, sizeof(palettebits));
-    memset(work280, 0, sizeof(work280));
-    memset(buf280, 0, sizeof(buf280));
-
-    // Clear scanline buffers
-    memset(bmpscanline, 0, sizeof(bmpscanline));
-    memset(bmpscanline2, 0, sizeof(bmpscanline2));
-    memset(dibscanline1, 0, sizeof(dibscanline1));
-    memset(dibscanline2, 0, sizeof(dibscanline2));
-    memset(dibscanline3, 0, sizeof(dibscanline3));
-    memset(dibscanline4, 0, sizeof(dibscanline4));
-    memset(previewline, 0, sizeof(previewline));
-    memset(maskline, 0, sizeof(maskline));
-
-    // Clear filename buffers
-    memset(bmpfile, 0, sizeof(bmpfile));
-    memset(dibfile, 0, sizeof(dibfile));
-    memset(previewfile, 0, sizeof(previewfile));
-    memset(mainfile, 0, sizeof(mainfile));
-    memset(auxfile, 0, sizeof(auxfile));
-    memset(hgrcolor, 0, sizeof(hgrcolor));
-    memset(hgrmono, 0, sizeof(hgrmono));
-    memset(hgrwork, 0, sizeof(hgrwork));
-
-    // CRITICAL: Reset color palette arrays that get modified by HGR mode
-    // When hgroutput==1, b2d.c modifies rgbArray and rgbPreview (line 849-856)
-    // setting some colors to black. These must be reset for DHGR to work properly.
-    memset(rgbArray, 0, sizeof(rgbArray));
-    memset(rgbPreview, 0, sizeof(rgbPreview));
-    memset(rgbAppleArray, 0, sizeof(rgbAppleArray));
-    memset(rgbVBMP, 0, sizeof(rgbVBMP));
-    memset(rgbDouble, 0, sizeof(rgbDouble));
-    memset(rgbLuma, 0, sizeof(rgbLuma));
-    memset(rgbDoubleBrighten, 0, sizeof(rgbDoubleBrighten));
-    memset(rgbLumaBrighten, 0, sizeof(rgbLumaBrighten));
-    memset(rgbDoubleDarken, 0, sizeof(rgbDoubleDarken));
-    memset(rgbLumaDarken, 0, sizeof(rgbLumaDarken));
-
-    // CRITICAL: Restore grpal to original values!
-    // HGR mode permanently modifies grpal (lines 5942-5951 in b2d.c)
-    // setting 10 of 16 colors to black. This breaks subsequent DHGR conversions.
-    // Original values from b2d_globals.c:
-    static const uchar grpal_original[16][3] = {
-        {0, 0, 0}, {148, 12, 125}, {32, 54, 212}, {188, 55, 255},
-        {51, 111, 0}, {126, 126, 126}, {7, 168, 225}, {158, 172, 255},
-        {99, 77, 0}, {249, 86, 29}, {126, 126, 126}, {255, 129, 236},
-        {67, 200, 0}, {221, 206, 23}, {93, 248, 133}, {255, 255, 255}
-    };
-    memcpy(grpal, grpal_original, sizeof(grpal));
+    b2d_context *ctx;
+    int status;
 
     // Validate input
     if (argc < 1 || argv == NULL) {
         fprintf(stderr, "❌ b2d_main_wrapper: Invalid arguments\n");
         return -1;
     }
-    
+
+    // Each call gets a fresh context, so no settings, buffers or palette
+    // changes (HGR mode zeroes entries in grpal, mono clears wikipedia)
+    // carry over from a previous conversion.
+    ctx = b2d_context_new();
+    if (ctx == NULL) {
+        fprintf(stderr, "❌ b2d_main_wrapper: No memory for conversion context\n");
+        return -1;
+    }
+
     // Call the actual b2d conversion function
-    return b2d_actual_main(argc, argv);
+    status = b2d_actual_main(ctx, argc, argv);
+
+    b2d_context_free(ctx);
+    return status;
+}
+
+/**
+ * Defaults are the same as running b2d with no options:
+ * DHGR output, palette 5 for conversion and preview, no dithering
+ */
+void b2d_options_init(b2d_options *opts) {
+    memset(opts, 0, sizeof(b2d_options));
+    opts->mode = B2D_MODE_DHGR;
+    opts->palette = 5;
+    opts->previewpalette = 5;
+    opts->preview = 1;
+}
+
+static int valid_palette(int palette) {
+    // 6 is a user palette file and 15 is a pseudo-palette, neither is
+    // available without the command line options that load them
+    return palette >= 0 && palette <= 16 && palette != 6 && palette != 15;
+}
+
+/**
+ * Sets the context up the same way b2d_actual_main() does for the
+ * matching command line options
+ */
+static void apply_options(b2d_context *ctx, const b2d_options *opts, char *hgroptions) {
+    switch (opts->mode) {
+        case B2D_MODE_HGR:
+            ctx->hgroutput = 1;
+            strcpy(hgroptions, "C");
+            ctx->clearcolor = 3;
+            ctx->hgrcolortype = 'B';
+            SetHgrPalette(ctx);
+            break;
+        case B2D_MODE_MONO:
+            ctx->mono = 1;
+            ctx->dither = FLOYDSTEINBERG;
+            break;
+        case B2D_MODE_LGR:
+            ctx->lores = ctx->loresoutput = 1;
+            break;
+        case B2D_MODE_DLGR:
+            ctx->loresoutput = 1;
+            break;
+    }
+
+    if (opts->dither > 0 && opts->dither < 10) ctx->dither = (uchar)opts->dither;
+    if (opts->serpentine != 0) ctx->serpentine = 1;
+    if (opts->errorsum != 0) ctx->errorsum = 1;
+    if (opts->diffuse != 0) ctx->diffuse = (opts->diffuse == 4) ? 4 : 2;
+
+    // X and Z each turn on cross-hatching with the other's default
+    if (opts->xmatrix > 0 || opts->threshold > 0) {
+        ctx->xmatrix = (opts->xmatrix == 1 || opts->xmatrix == 3) ? opts->xmatrix : 2;
+        ctx->threshold = (opts->threshold > 0 && opts->threshold < 51) ? opts->threshold : 25;
+    }
+    if (opts->ymatrix > 0) ctx->ymatrix = (opts->ymatrix == 2 || opts->ymatrix == 3) ? opts->ymatrix : 1;
+    if (opts->colorbleed != 0 && opts->colorbleed > -101 && opts->colorbleed < 101)
+        ctx->colorbleed = 100 + opts->colorbleed;
+
+    ctx->preview = (opts->preview != 0);
+    ctx->previewrgba = opts->previewrgba;
+    ctx->previewsize = opts->previewsize;
+    ctx->previewscale = opts->previewscale;
+    ctx->colortable = (opts->colortable != 0);
+    ctx->cache = (opts->cache != 0);
+    if (opts->fixedpoint != 0) ctx->fixedpoint = 1;
+    ctx->ditherthreads = opts->threads;
+    ctx->stats = (opts->stats != 0);
+    ctx->cancel = opts->cancel;
+    ctx->scanline = opts->scanline;
+    ctx->scanlinedata = opts->scanlinedata;
+    ResampleFit(ctx, opts->fitwidth, opts->fitheight);
+
+    CheckOptions(ctx, 0);
+}
+
+/**
+ * Stores the RGB pixels as the 24-bit BMP input file b2d expects
+ * Only the header is stored if the input is already resampled (ctx->cachedinput),
+ * the pixels are never read
+ */
+static int write_input_bmp(b2d_context *ctx, const uint8_t *rgb, int w, int h, int stride) {
+    b2d_memfile *mf;
+    BMPHEADER header;
+    size_t packet = ((size_t)w * 3 + 3) & ~(size_t)3;
+    size_t offset = sizeof(BMPHEADER);
+    const uint8_t *src;
+    uchar *dest;
+    int x, y;
+
+    mf = b2d_memfile_create(ctx, ctx->bmpfile, ctx->cachedinput != NULL ? offset : offset + packet * (size_t)h);
+    if (mf == NULL) return INVALID;
+
+    memset(&header, 0, sizeof(BMPHEADER));
+    header.bfi.bfType[0] = 'B';
+    header.bfi.bfType[1] = 'M';
+    header.bfi.bfSize = (unsigned int)(offset + packet * (size_t)h);
+    header.bfi.bfOffBits = (unsigned int)offset;
+    header.bmi.biSize = sizeof(BITMAPINFOHEADER);
+    header.bmi.biWidth = (unsigned int)w;
+    header.bmi.biHeight = (unsigned int)h;
+    header.bmi.biPlanes = 1;
+    header.bmi.biBitCount = 24;
+    header.bmi.biCompression = BI_RGB;
+    header.bmi.biSizeImage = (unsigned int)(packet * (size_t)h);
+    memcpy(mf->data, &header, offset);
+    mf->size = offset;
+    if (ctx->cachedinput != NULL) return SUCCESS;
+
+    // BMP scanlines are stored bottom-up in BGR order
+    for (y = 0; y < h; y++) {
+        src = rgb + (size_t)y * (size_t)stride;
+        dest = mf->data + offset + (size_t)(h - 1 - y) * packet;
+        for (x = 0; x < w; x++, src += 3, dest += 3) {
+            dest[0] = src[2];
+            dest[1] = src[1];
+            dest[2] = src[0];
+        }
+        for (x = w * 3; x < (int)packet; x++) *dest++ = 0;
+    }
+    mf->size = offset + packet * (size_t)h;
+    return SUCCESS;
+}
+
+/**
+ * Unpacks the 24-bit preview BMP into top-down RGB
+ */
+static int read_preview_bmp(b2d_memfile *mf, b2d_result *result) {
+    BMPHEADER header;
+    size_t packet, row;
+    const uchar *src;
+    uint8_t *dest;
+    int x, y, w, h;
+
+    if (mf->size < sizeof(BMPHEADER)) return INVALID;
+    memcpy(&header, mf->data, sizeof(BMPHEADER));
+    if (header.bfi.bfType[0] != 'B' || header.bfi.bfType[1] != 'M' ||
+        header.bmi.biBitCount != 24) return INVALID;
+
+    w = (int)header.bmi.biWidth;
+    h = (int)header.bmi.biHeight;
+    packet = ((size_t)w * 3 + 3) & ~(size_t)3;
+    if (w < 1 || h < 1 || header.bfi.bfOffBits + packet * (size_t)h > mf->size) return INVALID;
+
+    result->preview = (uint8_t *)malloc((size_t)w * (size_t)h * 3);
+    if (result->preview == NULL) return INVALID;
+
+    dest = result->preview;
+    for (y = 0; y < h; y++) {
+        row = header.bfi.bfOffBits + (size_t)(h - 1 - y) * packet;
+        src = mf->data + row;
+        for (x = 0; x < w; x++, src += 3, dest += 3) {
+            dest[0] = src[2];
+            dest[1] = src[1];
+            dest[2] = src[0];
+        }
+    }
+    result->previewwidth = w;
+    result->previewheight = h;
+    return SUCCESS;
+}
+
+/**
+ * Hands one output file to a B2D_SINK_FILES or B2D_SINK_WRITE sink
+ * Returns 0 if the sink took it
+ */
+static int sink_output(const b2d_options *opts, const b2d_memfile *mf) {
+    char path[4096];
+    size_t len;
+    FILE *fp;
+    int status;
+
+    if (opts->sink == B2D_SINK_WRITE) return opts->write(opts->writedata, mf->name, mf->data, mf->size);
+
+    len = strlen(opts->directory);
+    if (snprintf(path, sizeof(path), "%s%s%s", opts->directory,
+                 (len > 0 && opts->directory[len - 1] != '/') ? "/" : "", mf->name) >= (int)sizeof(path))
+        return -1;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+    status = (fwrite(mf->data, 1, mf->size, fp) == mf->size) ? 0 : -1;
+    if (fclose(fp) != 0) status = -1;
+    return status;
+}
+
+/**
+ * Moves the output files out of the context and into the result,
+ * or hands them to the sink
+ */
+static int collect_output(b2d_context *ctx, const b2d_options *opts, b2d_result *result) {
+    b2d_memfile *mf;
+    b2d_file *file;
+    int idx;
+
+    result->files = (b2d_file *)calloc(MAXMEMFILES, sizeof(b2d_file));
+    if (result->files == NULL) return INVALID;
+
+    for (idx = 0; idx < ctx->memfilecount; idx++) {
+        mf = &ctx->memfiles[idx];
+        // skip removed files and the input
+        if (mf->name[0] == 0 || strcmp(mf->name, ctx->bmpfile) == 0) continue;
+
+        if (strcmp(mf->name, ctx->previewfile) == 0) {
+            if (read_preview_bmp(mf, result) != SUCCESS) return INVALID;
+            continue;
+        }
+
+        file = &result->files[result->filecount];
+        file->name = strdup(mf->name);
+        if (file->name == NULL) return INVALID;
+        file->size = mf->size;
+        result->filecount++;
+
+        // written in the order the engine wrote them
+        if (opts->sink != B2D_SINK_MEMORY) {
+            if (sink_output(opts, mf) != 0) return INVALID;
+            continue;
+        }
+        file->data = mf->data;
+        mf->data = NULL;
+    }
+
+    // the preview went straight to the caller's surface
+    if (ctx->previewrgba != NULL && ctx->preview != 0 && ctx->previewrow > 0) {
+        result->previewrgba = ctx->previewrgba;
+        result->previewwidth = ctx->previewwidth * ctx->previewscale;
+        result->previewheight = ctx->previewheight * ctx->previewscale;
+    }
+    return SUCCESS;
+}
+
+/**
+ * What the cached stages depend on besides the input pixels (see b2d_cache.c)
+ * The preview palette and everything that does not change the colors is left out
+ */
+static void cache_keys(b2d_context *ctx, const b2d_options *opts, int w, int h) {
+    b2d_cachekey *key = &ctx->inputkey;
+
+    key->width = w;
+    key->height = h;
+    key->settings[0] = opts->mode;
+    key->settings[1] = ctx->fitwidth;
+    key->settings[2] = ctx->fitheight;
+
+    ctx->screenkey = *key;
+    key = &ctx->screenkey;
+    key->settings[3] = opts->palette;
+    key->settings[4] = ctx->dither;
+    key->settings[5] = ctx->serpentine;
+    key->settings[6] = ctx->errorsum;
+    key->settings[7] = ctx->diffuse;
+    key->settings[8] = ctx->xmatrix;
+    key->settings[9] = ctx->threshold;
+    key->settings[10] = ctx->ymatrix;
+    key->settings[11] = ctx->colorbleed;
+    key->settings[12] = ctx->colortable;
+    key->settings[13] = ctx->fixedpoint;
+}
+
+/**
+ * Point samples the input to width x height for a draft
+ */
+static uint8_t *sample_input(const uint8_t *rgb, int w, int h, int stride, int width, int height) {
+    uint8_t *sampled, *dest;
+    const uint8_t *src, *row;
+    int x, y;
+
+    sampled = (uint8_t *)malloc((size_t)width * (size_t)height * 3);
+    if (sampled == NULL) return NULL;
+
+    dest = sampled;
+    for (y = 0; y < height; y++) {
+        // the input pixel at the middle of each output pixel
+        row = rgb + (size_t)(((2L * y + 1) * h) / (2L * height)) * (size_t)stride;
+        for (x = 0; x < width; x++, dest += 3) {
+            src = row + (size_t)(((2L * x + 1) * w) / (2L * width)) * 3;
+            dest[0] = src[0];
+            dest[1] = src[1];
+            dest[2] = src[2];
+        }
+    }
+    return sampled;
+}
+
+/**
+ * A context with the settings applied and the input in memory, ready
+ * for ConvertImage() - NULL if there is not enough memory
+ */
+static b2d_context *open_context(const uint8_t *rgb, int w, int h, int stride,
+                                 const b2d_options *opts, int draft) {
+    b2d_context *ctx;
+    char name[MAXF], hgroptions[20];
+    uint8_t *sampled = NULL;
+    ushort width, height;
+    int status, y;
+
+    ctx = b2d_context_new();
+    if (ctx == NULL) {
+        fprintf(stderr, "❌ b2d_convert_rgb: No memory for conversion context\n");
+        return NULL;
+    }
+    ctx->memio = 1;
+
+    hgroptions[0] = 0;
+    apply_options(ctx, opts, hgroptions);
+    ctx->draft = draft;
+
+    // the names are only used to look up the in-memory files
+    // and to name the output the same way the command line does
+    strncpy(name, opts->name != NULL ? opts->name : "B2D", MAXF - 1);
+    name[MAXF - 1] = 0;
+    SetFileNames(ctx, name, 0, 0, hgroptions);
+
+    // a draft point samples the input to the size it would be
+    // resampled to, which takes next to no time
+    if (draft != 0) {
+        ctx->bmpwidth = (ushort)w;
+        ctx->bmpheight = (ushort)h;
+        ctx->bmi.biBitCount = 24;
+        if (ResampleSize(ctx, &width, &height) != 0) {
+            sampled = sample_input(rgb, w, h, stride, width, height);
+            if (sampled == NULL) {
+                b2d_context_free(ctx);
+                return NULL;
+            }
+            rgb = sampled;
+            w = width;
+            h = height;
+            stride = w * 3;
+        }
+        ctx->bmpwidth = ctx->bmpheight = 0;
+        ctx->bmi.biBitCount = 0;
+    }
+
+    // the hash of the pixels finds the input resampled before
+    if (ctx->cache != 0) {
+        for (y = 0; y < h; y++) CacheHash(ctx->inputkey.pixels, rgb + (size_t)y * (size_t)stride, (size_t)w * 3);
+        cache_keys(ctx, opts, w, h);
+        CacheInput(ctx);
+    }
+
+    status = write_input_bmp(ctx, rgb, w, h, stride);
+    free(sampled);
+    if (status != SUCCESS || AllocScreenBuffers(ctx) != SUCCESS) {
+        b2d_context_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/**
+ * The quick draft for b2d_options.draft
+ * Returns 0 to go on to the full conversion
+ */
+static int convert_draft(const uint8_t *rgb, int w, int h, int stride, const b2d_options *opts) {
+    b2d_context *ctx;
+    b2d_options draft = *opts;
+    uint8_t *surface = NULL;
+    int status;
+
+    // nearest colors only, from the color tables
+    draft.dither = 0;
+    draft.serpentine = 0;
+    draft.errorsum = 0;
+    draft.diffuse = 0;
+    draft.xmatrix = 0;
+    draft.threshold = 0;
+    draft.colortable = 1;
+    draft.threads = 0;
+    draft.stats = 0;
+    draft.cache = 0;
+    draft.scanline = NULL;
+    draft.preview = 1;
+
+    if (draft.previewrgba == NULL) {
+        draft.previewscale = 1;
+        draft.previewsize = (size_t)B2D_PREVIEW_MAXWIDTH * B2D_PREVIEW_MAXHEIGHT * 4;
+        surface = (uint8_t *)malloc(draft.previewsize);
+        if (surface == NULL) return -1;
+        draft.previewrgba = surface;
+    }
+
+    ctx = open_context(rgb, w, h, stride, &draft, opts->drafthalf != 0 ? 2 : 1);
+    if (ctx == NULL) {
+        free(surface);
+        return -1;
+    }
+
+    status = 1;
+    if (ConvertImage(ctx, (sshort)opts->palette, (sshort)opts->previewpalette, 0) != INVALID) {
+        status = 0;
+        if (ctx->previewrow > 0 &&
+            opts->draft(opts->draftdata, draft.previewrgba, ctx->previewwidth * ctx->previewscale,
+                        ctx->previewheight * ctx->previewscale) != 0) status = B2D_CANCELLED;
+    }
+    else if (ctx->cancelled != 0) status = B2D_CANCELLED;
+
+    b2d_context_free(ctx);
+    free(surface);
+    return status;
+}
+
+/**
+ * In-memory entry point for Swift
+ * Nothing is read from or written to the file system but the native
+ * files of a B2D_SINK_FILES sink
+ */
+int b2d_convert_rgb(const uint8_t *rgb, int w, int h, int stride,
+                    const b2d_options *opts, b2d_result *result) {
+    b2d_context *ctx;
+    b2d_options defaults;
+    int status;
+
+    if (result == NULL) return -1;
+    memset(result, 0, sizeof(b2d_result));
+
+    if (opts == NULL) {
+        b2d_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    // Validate input
+    if (rgb == NULL || w < 1 || h < 1 || w > 0x7fff || h > 0x7fff || stride < w * 3 ||
+        opts->mode < B2D_MODE_DHGR || opts->mode > B2D_MODE_DLGR ||
+        !valid_palette(opts->palette) || !valid_palette(opts->previewpalette) ||
+        opts->sink < B2D_SINK_MEMORY || opts->sink > B2D_SINK_WRITE ||
+        (opts->sink == B2D_SINK_FILES && opts->directory == NULL) ||
+        (opts->sink == B2D_SINK_WRITE && opts->write == NULL)) {
+        fprintf(stderr, "❌ b2d_convert_rgb: Invalid arguments\n");
+        return -1;
+    }
+
+    // the quick preview first
+    if (opts->draft != NULL && opts->mode != B2D_MODE_MONO) {
+        status = convert_draft(rgb, w, h, stride, opts);
+        if (status != 0) return status;
+    }
+
+    ctx = open_context(rgb, w, h, stride, opts, 0);
+    if (ctx == NULL) return -1;
+
+    status = 1;
+    if (ConvertImage(ctx, (sshort)opts->palette, (sshort)opts->previewpalette, 0) != INVALID) {
+        status = (collect_output(ctx, opts, result) == SUCCESS) ? 0 : -1;
+        if (status != 0) b2d_result_free(result);
+        else result->stats = ctx->statsdata;
+    }
+    else if (ctx->cancelled != 0) status = B2D_CANCELLED;
+
+    b2d_context_free(ctx);
+    return status;
+}
+
+void b2d_result_free(b2d_result *result) {
+    int idx;
+
+    if (result == NULL) return;
+    for (idx = 0; idx < result->filecount; idx++) {
+        free(result->files[idx].name);
+        free(result->files[idx].data);
+    }
+    free(result->files);
+    free(result->preview);
+    memset(result, 0, sizeof(b2d_result));
 }
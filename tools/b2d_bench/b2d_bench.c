@@ -0,0 +1,1362 @@
+/*
+ * b2d_bench.c
+ * Timing the b2d conversion engine
+ *
+ * Converts a synthetic corpus through b2d_convert_rgb() - the same entry
+ * point the app uses - and reports the time per image and megapixels of
+ * input per second for each case. Nothing is read from or written to disk.
+ *
+ * The corpus is the same on every run: a gradient, photo-like noise and
+ * line art at 140 x 192, 280 x 192, 320 x 200, 560 x 384, 640 x 400 and
+ * 640 x 480. The cases are grouped in suites:
+ *
+ *   modes     DHGR, HGR, mono, LGR and DLGR, not dithered and dithered
+ *   dithers   DHGR with no dither and each of the 9 dithers (D1-D9)
+ *   xhatch    DHGR cross-hatching (X1-X3) and thresholds (Z)
+ *   palettes  DHGR with each built-in palette (P)
+ *
+ * Sizes a mode does not take are reported as skipped. Each case is run
+ * -r times and the fastest run is kept. With -p the engine times each
+ * stage of the conversion (b2d_options.stats) and the stage times of the
+ * fastest run are shown as well.
+ *
+ * Golden hashes
+ *
+ * b2d_bench -v golden.txt checks that the engine still makes exactly the
+ * same output. Every case of every suite, some more option combinations
+ * (diffusion, serpentine, color table mode, threads...), the command
+ * line only outputs (sprites, sprite masks and VBMP) and option S in
+ * each mode and with option fit are run on the corpus, and each output
+ * file and the preview are hashed. Any hash that is not the one in
+ * golden.txt is reported and b2d_bench exits with 1.
+ * b2d_bench -g golden.txt writes the file again - only do that for a
+ * change that is meant to change the output.
+ *
+ * b2d_bench -v then checks the API settings that do not change the
+ * output against a plain conversion of the same image, in each mode:
+ *
+ *   - B2D_SINK_FILES and B2D_SINK_WRITE get the same files as
+ *     B2D_SINK_MEMORY.
+ *   - The scanline callback counts up to its total, with and without
+ *     threads, and setting *cancel partway through, on the converting
+ *     thread or another one, returns B2D_CANCELLED with no files.
+ *   - A draft, full or half height, does not change the conversion, a
+ *     half height draft repeats every other scanline of the full one,
+ *     and a draft callback that returns non-zero stops the conversion.
+ *   - Converting with the stage cache gives the same output as without,
+ *     as the dither, the palette and the preview palette change.
+ *   - The stage cache finds the matched screen again when only the
+ *     preview palette, threads or name change, and drops the oldest
+ *     screen once it has more than it keeps.
+ *   - Each image of a batch is the same as it is converted on its own
+ *     in color table mode.
+ *   - The preview drawn in an RGBA surface, at previewscale 1 and 2, is
+ *     the packed RGB preview with alpha 255.
+ *   - Integer color distances (fixed) give the same output for colors
+ *     that are as close to two palette entries.
+ *   - Dithering on several threads counts as many matched colors (stats)
+ *     as one thread, with and without color tables.
+ *
+ * Each check that fails is reported and counts as a case that differs.
+ *
+ * See the Makefile in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "b2d_api.h"
+
+#define MAXSIZES 6
+#define MAXIMAGES 3
+#define MAXCASES 128
+#define MAXLINE 1024
+
+typedef struct bench_image
+{
+    const char *kind;
+    int w, h;
+    uint8_t *rgb;
+} bench_image;
+
+typedef struct bench_case
+{
+    const char *suite;
+    char label[32];
+    b2d_options opts;
+    const char *cli[4];     /* command line options instead of opts */
+} bench_case;
+
+static const int sizes[MAXSIZES][2] = {
+    {140, 192}, {280, 192}, {320, 200}, {560, 384}, {640, 400}, {640, 480}
+};
+
+static const char *kinds[MAXIMAGES] = {"gradient", "photo", "lineart"};
+
+static const char *modenames[] = {"DHGR", "HGR", "mono", "LGR", "DLGR"};
+
+/* the engine reports each file it saves on stdout - the results go here */
+static FILE *out;
+
+/* settings from the command line */
+static int repeats = 3, split = 0, colortable = 0, fixedpoint = 0, threads = 0;
+static const char *suitelist = NULL, *sizelist = NULL;
+static const char *goldenfile = NULL;
+static int generate = 0;
+
+static unsigned long seed;
+
+/* the same numbers on every run */
+static unsigned Random(void)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (unsigned)((seed >> 16) & 0x7fff);
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint8_t Clip(int value)
+{
+    if (value < 0) return 0;
+    if (value > 255) return 255;
+    return (uint8_t)value;
+}
+
+static void MakeGradient(bench_image *img)
+{
+    int x, y;
+    uint8_t *p = img->rgb;
+
+    for (y = 0; y < img->h; y++) {
+        for (x = 0; x < img->w; x++, p += 3) {
+            p[0] = (uint8_t)(x * 255 / (img->w - 1));
+            p[1] = (uint8_t)(y * 255 / (img->h - 1));
+            p[2] = (uint8_t)((x + y) * 255 / (img->w + img->h - 2));
+        }
+    }
+}
+
+/* smooth noise on a coarse grid with fine grain on top - soft edges and
+   slow color changes like a photo */
+static void MakePhoto(bench_image *img)
+{
+    enum { GRID = 9 };
+    int lattice[GRID][GRID][3];
+    int x, y, c, gx, gy, fx, fy, cw, ch, top, bottom;
+    uint8_t *p = img->rgb;
+
+    for (gy = 0; gy < GRID; gy++)
+        for (gx = 0; gx < GRID; gx++)
+            for (c = 0; c < 3; c++) lattice[gy][gx][c] = (int)(Random() % 256);
+
+    cw = (img->w + GRID - 2) / (GRID - 1);
+    ch = (img->h + GRID - 2) / (GRID - 1);
+    for (y = 0; y < img->h; y++) {
+        gy = y / ch;
+        fy = y % ch;
+        for (x = 0; x < img->w; x++, p += 3) {
+            gx = x / cw;
+            fx = x % cw;
+            for (c = 0; c < 3; c++) {
+                top = lattice[gy][gx][c] * (cw - fx) + lattice[gy][gx + 1][c] * fx;
+                bottom = lattice[gy + 1][gx][c] * (cw - fx) + lattice[gy + 1][gx + 1][c] * fx;
+                p[c] = Clip((top * (ch - fy) + bottom * fy) / (cw * ch) + (int)(Random() % 33) - 16);
+            }
+        }
+    }
+}
+
+/* flat colors and hard edges - a grid, diagonals and filled boxes */
+static void MakeLineArt(bench_image *img)
+{
+    static const uint8_t colors[6][3] = {
+        {255, 0, 0}, {0, 160, 0}, {0, 0, 255}, {255, 200, 0}, {160, 0, 200}, {0, 200, 200}
+    };
+    int x, y, i, x0, y0, x1, y1;
+    uint8_t *p;
+
+    memset(img->rgb, 255, (size_t)img->w * img->h * 3);
+    for (i = 0; i < 12; i++) {
+        x0 = (int)(Random() % img->w);
+        y0 = (int)(Random() % img->h);
+        x1 = x0 + (int)(Random() % (img->w / 4 + 1));
+        y1 = y0 + (int)(Random() % (img->h / 4 + 1));
+        if (x1 > img->w) x1 = img->w;
+        if (y1 > img->h) y1 = img->h;
+        for (y = y0; y < y1; y++) {
+            p = img->rgb + ((size_t)y * img->w + x0) * 3;
+            for (x = x0; x < x1; x++, p += 3) memcpy(p, colors[i % 6], 3);
+        }
+    }
+    for (y = 0; y < img->h; y++) {
+        p = img->rgb + (size_t)y * img->w * 3;
+        for (x = 0; x < img->w; x++, p += 3) {
+            if (x % 16 == 0 || y % 16 == 0 || x == y || x == img->w - 1 - y) p[0] = p[1] = p[2] = 0;
+        }
+    }
+}
+
+static int MakeImage(bench_image *img, int kind, int w, int h)
+{
+    img->kind = kinds[kind];
+    img->w = w;
+    img->h = h;
+    img->rgb = (uint8_t *)malloc((size_t)w * h * 3);
+    if (img->rgb == NULL) return 0;
+
+    seed = (unsigned long)(w * 1000 + h) * 3 + (unsigned long)kind;
+    if (kind == 0) MakeGradient(img);
+    else if (kind == 1) MakePhoto(img);
+    else MakeLineArt(img);
+    return 1;
+}
+
+/* is name in the comma separated list - everything is in an empty list */
+static int InList(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+
+    if (list == NULL) return 1;
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == list || p[-1] == ',') && (p[len] == 0 || p[len] == ',')) return 1;
+        p += len;
+    }
+    return 0;
+}
+
+static void CaseOptions(b2d_options *opts, int mode, int dither)
+{
+    b2d_options_init(opts);
+    opts->mode = mode;
+    opts->dither = dither;
+    opts->colortable = colortable;
+    opts->fixedpoint = fixedpoint;
+    opts->threads = threads;
+}
+
+/* the cases of every suite asked for - returns how many */
+static int MakeCases(bench_case *cases)
+{
+    int count = 0, i;
+
+    if (InList(suitelist, "modes")) {
+        for (i = 0; i < 10; i++) {
+            cases[count].suite = "modes";
+            CaseOptions(&cases[count].opts, i / 2, (i % 2) ? 1 : 0);
+            /* mono is always dithered */
+            if (i / 2 == B2D_MODE_MONO && i % 2 == 0) continue;
+            sprintf(cases[count].label, "%s%s", modenames[i / 2], (i % 2) ? " D1" : "");
+            count++;
+        }
+    }
+    if (InList(suitelist, "dithers")) {
+        for (i = 0; i < 10; i++) {
+            cases[count].suite = "dithers";
+            CaseOptions(&cases[count].opts, B2D_MODE_DHGR, i);
+            sprintf(cases[count].label, "DHGR D%d", i);
+            count++;
+        }
+    }
+    if (InList(suitelist, "xhatch")) {
+        for (i = 1; i < 4; i++) {
+            cases[count].suite = "xhatch";
+            CaseOptions(&cases[count].opts, B2D_MODE_DHGR, 0);
+            cases[count].opts.xmatrix = i;
+            sprintf(cases[count].label, "DHGR X%d", i);
+            count++;
+        }
+        for (i = 10; i <= 50; i += 20) {
+            cases[count].suite = "xhatch";
+            CaseOptions(&cases[count].opts, B2D_MODE_DHGR, 0);
+            cases[count].opts.threshold = i;
+            sprintf(cases[count].label, "DHGR Z%d", i);
+            count++;
+        }
+    }
+    if (InList(suitelist, "palettes")) {
+        for (i = 0; i < 17; i++) {
+            /* 6 is a user palette file and 15 a pseudo-palette */
+            if (i == 6 || i == 15) continue;
+            cases[count].suite = "palettes";
+            CaseOptions(&cases[count].opts, B2D_MODE_DHGR, 0);
+            cases[count].opts.palette = i;
+            sprintf(cases[count].label, "DHGR P%d", i);
+            count++;
+        }
+    }
+    return count;
+}
+
+/* the command line options of a case, one after the other */
+static void CLILabel(bench_case *bc)
+{
+    int i;
+
+    bc->label[0] = 0;
+    for (i = 0; i < 4 && bc->cli[i] != NULL; i++) {
+        if (i > 0) strcat(bc->label, " ");
+        strcat(bc->label, bc->cli[i]);
+    }
+}
+
+/* option combinations the suites do not time, for the golden hashes */
+static int MakeGoldenCases(bench_case *cases)
+{
+    static const struct {
+        const char *label;
+        int mode, dither, serpentine, errorsum, diffuse, ymatrix, colorbleed;
+        int previewpalette, colortable, fixedpoint, threads;
+    } extras[] = {
+        {"DHGR D1 DX",    0, 1, 1, 0, 0, 0,   0, 5, 0, 0,  0},
+        {"DHGR D1 sum",   0, 1, 0, 1, 0, 0,   0, 5, 0, 0,  0},
+        {"DHGR E2",       0, 0, 0, 0, 2, 0,   0, 5, 0, 0,  0},
+        {"DHGR D1 E4",    0, 1, 0, 0, 4, 0,   0, 5, 0, 0,  0},
+        {"DHGR Y1",       0, 0, 0, 0, 0, 1,   0, 5, 0, 0,  0},
+        {"DHGR Y3",       0, 0, 0, 0, 0, 3,   0, 5, 0, 0,  0},
+        {"DHGR R-30",     0, 0, 0, 0, 0, 0, -30, 5, 0, 0,  0},
+        {"DHGR D2 R30",   0, 2, 0, 0, 0, 0,  30, 5, 0, 0,  0},
+        {"DHGR V2",       0, 0, 0, 0, 0, 0,   0, 2, 0, 0,  0},
+        {"DHGR D1 lut",   0, 1, 0, 0, 0, 0,   0, 5, 1, 0,  0},
+        {"DHGR D1 fixed", 0, 1, 0, 0, 0, 0,   0, 5, 0, 1,  0},
+        {"DHGR D1 mt",    0, 1, 0, 0, 0, 0,   0, 5, 0, 0, -1},
+        {"HGR D5 E2",     1, 5, 0, 0, 2, 0,   0, 5, 0, 0,  0},
+        {"HGR D1 mt",     1, 1, 0, 0, 0, 0,   0, 5, 0, 0, -1},
+        {"mono D9",       2, 9, 0, 0, 0, 0,   0, 5, 0, 0,  0},
+        {"LGR D3 lut",    3, 3, 0, 0, 0, 0,   0, 5, 1, 0,  0},
+        {"DLGR D9 mt",    4, 9, 0, 0, 0, 0,   0, 5, 0, 0, -1}
+    };
+    static const char *cli[][4] = {
+        {"F", NULL}, {"FM", NULL}, {"F", "D1", NULL}, {"vbmp", NULL},
+        {"D1", "vbmp", NULL}, {"H", "vbmp", NULL}, {"H", "F", NULL}
+    };
+    /* option S on every size in each mode, DHGR first - the classic sizes
+       are merged to 140 wide whatever it asks for */
+    static const char *scalemodes[] = {NULL, "H", "L", "DL", "mono", "F", "FM", "A", "vbmp"};
+    /* and with input resampled to fit - 140 wide is single scaled */
+    static const char *fit[][4] = {
+        {"fit140x192", "S1", NULL}, {"fit140x192", "S2", NULL}, {"H", "fit140x192", "S2", NULL},
+        {"F", "fit140x192", "S2", NULL}, {"A", "fit140x192", "S2", NULL},
+        {"fit280x192", "S2", NULL}, {"fit640x480", "S2", NULL}
+    };
+    int count, i, j, n;
+
+    colortable = fixedpoint = threads = 0;
+    suitelist = NULL;
+    count = MakeCases(cases);
+
+    for (i = 0; i < (int)(sizeof(extras) / sizeof(extras[0])); i++, count++) {
+        cases[count].suite = "options";
+        strcpy(cases[count].label, extras[i].label);
+        CaseOptions(&cases[count].opts, extras[i].mode, extras[i].dither);
+        cases[count].opts.serpentine = extras[i].serpentine;
+        cases[count].opts.errorsum = extras[i].errorsum;
+        cases[count].opts.diffuse = extras[i].diffuse;
+        cases[count].opts.ymatrix = extras[i].ymatrix;
+        cases[count].opts.colorbleed = extras[i].colorbleed;
+        cases[count].opts.previewpalette = extras[i].previewpalette;
+        cases[count].opts.colortable = extras[i].colortable;
+        cases[count].opts.fixedpoint = extras[i].fixedpoint;
+        cases[count].opts.threads = extras[i].threads;
+    }
+    for (i = 0; i < (int)(sizeof(cli) / sizeof(cli[0])); i++, count++) {
+        cases[count].suite = "cli";
+        memcpy(cases[count].cli, cli[i], sizeof(cli[i]));
+        CLILabel(&cases[count]);
+    }
+    for (i = 0; i < (int)(sizeof(scalemodes) / sizeof(scalemodes[0])); i++) {
+        for (j = 1; j <= 2; j++, count++) {
+            cases[count].suite = "scale";
+            n = 0;
+            if (scalemodes[i] != NULL) cases[count].cli[n++] = scalemodes[i];
+            cases[count].cli[n] = (j == 1) ? "S1" : "S2";
+            CLILabel(&cases[count]);
+        }
+    }
+    for (i = 0; i < (int)(sizeof(fit) / sizeof(fit[0])); i++, count++) {
+        cases[count].suite = "scale";
+        memcpy(cases[count].cli, fit[i], sizeof(fit[i]));
+        CLILabel(&cases[count]);
+    }
+    return count;
+}
+
+/* 64-bit FNV-1a */
+static unsigned long long Hash(const uint8_t *data, size_t size)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void AddHash(char *line, const char *name, const uint8_t *data, size_t size)
+{
+    size_t len = strlen(line);
+
+    snprintf(line + len, MAXLINE - len, " %s=%016llx", name, Hash(data, size));
+}
+
+/* a 24-bit BMP of the image for the command line */
+static int WriteBMP(const bench_image *img, const char *name)
+{
+    uint8_t header[54], *row;
+    int packet = (img->w * 3 + 3) & ~3, x, y;
+    unsigned size = 54 + (unsigned)packet * img->h;
+    FILE *fp;
+
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    for (x = 0; x < 4; x++) {
+        header[2 + x] = (uint8_t)(size >> (x * 8));
+        header[18 + x] = (uint8_t)((unsigned)img->w >> (x * 8));
+        header[22 + x] = (uint8_t)((unsigned)img->h >> (x * 8));
+        header[34 + x] = (uint8_t)((size - 54) >> (x * 8));
+    }
+    header[10] = 54;
+    header[14] = 40;
+    header[26] = 1;
+    header[28] = 24;
+
+    if ((fp = fopen(name, "wb")) == NULL) return 0;
+    row = (uint8_t *)calloc(1, (size_t)packet);
+    if (row == NULL) {
+        fclose(fp);
+        return 0;
+    }
+    fwrite(header, 1, sizeof(header), fp);
+    for (y = img->h - 1; y >= 0; y--) {
+        for (x = 0; x < img->w; x++) {
+            row[x * 3] = img->rgb[((size_t)y * img->w + x) * 3 + 2];
+            row[x * 3 + 1] = img->rgb[((size_t)y * img->w + x) * 3 + 1];
+            row[x * 3 + 2] = img->rgb[((size_t)y * img->w + x) * 3];
+        }
+        fwrite(row, 1, (size_t)packet, fp);
+    }
+    free(row);
+    fclose(fp);
+    return 1;
+}
+
+static int CompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* runs the command line version in an empty directory and hashes the
+   files it makes - returns 0 if it made none */
+static int HashCLI(const bench_case *bc, const bench_image *img, char *line)
+{
+    char dir[] = "/tmp/b2d_bench.XXXXXX", cwd[1024], *argv[8], *names[32];
+    char args[6][16];
+    int argc = 0, count = 0, i;
+    DIR *dp;
+    struct dirent *entry;
+    struct stat st;
+    uint8_t *data;
+    FILE *fp;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(dir) == NULL) return 0;
+    if (chdir(dir) != 0) return 0;
+
+    if (WriteBMP(img, "bench.bmp")) {
+        /* the command line changes its options as it reads them */
+        strcpy(args[0], "b2d");
+        strcpy(args[1], "bench.bmp");
+        for (i = 0; i < 4 && bc->cli[i] != NULL; i++) strcpy(args[i + 2], bc->cli[i]);
+        for (argc = 0; argc < i + 2; argc++) argv[argc] = args[argc];
+        argv[argc] = NULL;
+        b2d_main_wrapper(argc, argv);
+    }
+    remove("bench.bmp");
+
+    if ((dp = opendir(".")) != NULL) {
+        while ((entry = readdir(dp)) != NULL && count < 32) {
+            if (entry->d_name[0] == '.') continue;
+            names[count++] = strdup(entry->d_name);
+        }
+        closedir(dp);
+    }
+    qsort(names, (size_t)count, sizeof(char *), CompareNames);
+
+    for (i = 0; i < count; i++) {
+        if (stat(names[i], &st) == 0 && (data = (uint8_t *)malloc((size_t)st.st_size + 1)) != NULL) {
+            if ((fp = fopen(names[i], "rb")) != NULL) {
+                if (fread(data, 1, (size_t)st.st_size, fp) == (size_t)st.st_size)
+                    AddHash(line, names[i], data, (size_t)st.st_size);
+                fclose(fp);
+            }
+            free(data);
+        }
+        remove(names[i]);
+        free(names[i]);
+    }
+    if (chdir(cwd) != 0) count = 0;
+    rmdir(dir);
+    return count;
+}
+
+/* one line with the hash of every output of a case */
+static void HashCase(const bench_case *bc, const bench_image *img, char *line)
+{
+    b2d_result result;
+    int i;
+
+    snprintf(line, MAXLINE, "%s|%s|%s|%dx%d", bc->suite, bc->label, img->kind, img->w, img->h);
+    if (bc->cli[0] != NULL) {
+        if (HashCLI(bc, img, line) == 0) strcat(line, " skipped");
+        return;
+    }
+    if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &bc->opts, &result) != 0) {
+        strcat(line, " skipped");
+        return;
+    }
+    for (i = 0; i < result.filecount; i++)
+        AddHash(line, result.files[i].name, result.files[i].data, result.files[i].size);
+    if (result.preview != NULL)
+        AddHash(line, "preview", result.preview,
+                (size_t)result.previewwidth * result.previewheight * 3);
+    b2d_result_free(&result);
+}
+
+/* writes or checks the golden hashes - returns the cases that differ */
+static int Golden(const bench_image *images, int imagecount)
+{
+    bench_case *cases;
+    char line[MAXLINE], expected[MAXLINE], *nl;
+    FILE *fp;
+    int count, i, j, cases_run = 0, bad = 0;
+
+    cases = (bench_case *)calloc(MAXCASES, sizeof(bench_case));
+    if (cases == NULL) return 1;
+    count = MakeGoldenCases(cases);
+
+    fp = fopen(goldenfile, generate ? "w" : "r");
+    if (fp == NULL) {
+        fprintf(stderr, "b2d_bench: cannot open %s\n", goldenfile);
+        free(cases);
+        return 1;
+    }
+    if (generate) fprintf(fp, "# b2d_bench golden hashes - suite|case|image|size file=fnv1a64 ...\n");
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < imagecount; j++) {
+            /* the command line cases only for full screen sizes, and
+               option S for every size */
+            if (strcmp(cases[i].suite, "cli") == 0 && images[j].w > 280) continue;
+            HashCase(&cases[i], &images[j], line);
+            cases_run++;
+            if (generate) {
+                fprintf(fp, "%s\n", line);
+                continue;
+            }
+            do {
+                if (fgets(expected, sizeof(expected), fp) == NULL) {
+                    expected[0] = 0;
+                    break;
+                }
+            } while (expected[0] == '#');
+            if ((nl = strchr(expected, '\n')) != NULL) *nl = 0;
+            if (strcmp(line, expected) != 0) {
+                fprintf(out, "differs: %s\n expected: %s\n", line, expected);
+                bad++;
+            }
+        }
+    }
+    if (generate) fprintf(out, "%d cases written to %s\n", cases_run, goldenfile);
+    else fprintf(out, "%d cases, %d differ\n", cases_run, bad);
+
+    fclose(fp);
+    free(cases);
+    return bad;
+}
+
+/* API checks - b2d_convert_rgb() settings that the golden hashes do not
+   cover, checked against a plain conversion of the same image */
+
+static int checks, failed;
+
+static void Check(int ok, const char *what, int mode, const bench_image *img)
+{
+    checks++;
+    if (ok) return;
+    fprintf(out, "failed: %s %s %s %dx%d\n", what, modenames[mode], img->kind, img->w, img->h);
+    failed++;
+}
+
+/* the image of the corpus with kind and size, NULL if there is none */
+static const bench_image *FindImage(const bench_image *images, int imagecount,
+                                    const char *kind, int w, int h)
+{
+    int i;
+
+    for (i = 0; i < imagecount; i++) {
+        if (strcmp(images[i].kind, kind) == 0 && images[i].w == w && images[i].h == h)
+            return &images[i];
+    }
+    return NULL;
+}
+
+/* a whole file, NULL if it cannot be read */
+static uint8_t *ReadFile(const char *name, size_t *size)
+{
+    struct stat st;
+    uint8_t *data;
+    FILE *fp;
+
+    if (stat(name, &st) != 0 || (data = (uint8_t *)malloc((size_t)st.st_size + 1)) == NULL) return NULL;
+    if ((fp = fopen(name, "rb")) == NULL) {
+        free(data);
+        return NULL;
+    }
+    *size = fread(data, 1, (size_t)st.st_size, fp);
+    fclose(fp);
+    if (*size != (size_t)st.st_size) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/* removes every file in a directory - returns how many there were */
+static int EmptyDir(const char *dir)
+{
+    char path[1024];
+    DIR *dp;
+    struct dirent *entry;
+    int count = 0;
+
+    if ((dp = opendir(dir)) == NULL) return 0;
+    while ((entry = readdir(dp)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        remove(path);
+        count++;
+    }
+    closedir(dp);
+    return count;
+}
+
+/* whether two results have the same files, in the same order, and the
+   same preview - the data of files that went to a sink is not compared */
+static int SameResult(const b2d_result *a, const b2d_result *b)
+{
+    int i;
+
+    if (a->filecount != b->filecount) return 0;
+    for (i = 0; i < a->filecount; i++) {
+        if (strcmp(a->files[i].name, b->files[i].name) != 0 || a->files[i].size != b->files[i].size)
+            return 0;
+        if (a->files[i].data != NULL && b->files[i].data != NULL &&
+            memcmp(a->files[i].data, b->files[i].data, a->files[i].size) != 0) return 0;
+    }
+    if ((a->preview == NULL) != (b->preview == NULL)) return 0;
+    if (a->preview == NULL) return 1;
+    return a->previewwidth == b->previewwidth && a->previewheight == b->previewheight &&
+           memcmp(a->preview, b->preview, (size_t)a->previewwidth * a->previewheight * 3) == 0;
+}
+
+#define MAXSINKFILES 16
+
+/* what a B2D_SINK_WRITE sink was handed */
+typedef struct bench_sink
+{
+    int count;
+    char *names[MAXSINKFILES];
+    uint8_t *data[MAXSINKFILES];
+    size_t sizes[MAXSINKFILES];
+} bench_sink;
+
+static int SinkWrite(void *userdata, const char *name, const uint8_t *data, size_t size)
+{
+    bench_sink *sink = (bench_sink *)userdata;
+
+    if (sink->count == MAXSINKFILES || (sink->data[sink->count] = (uint8_t *)malloc(size + 1)) == NULL)
+        return -1;
+    memcpy(sink->data[sink->count], data, size);
+    sink->names[sink->count] = strdup(name);
+    sink->sizes[sink->count] = size;
+    sink->count++;
+    return 0;
+}
+
+static void SinkFree(bench_sink *sink)
+{
+    int i;
+
+    for (i = 0; i < sink->count; i++) {
+        free(sink->names[i]);
+        free(sink->data[i]);
+    }
+    memset(sink, 0, sizeof(bench_sink));
+}
+
+/* B2D_SINK_FILES and B2D_SINK_WRITE get the same files as B2D_SINK_MEMORY */
+static void CheckSinks(const bench_image *img, int mode)
+{
+    char dir[] = "/tmp/b2d_bench.XXXXXX", path[1024];
+    b2d_options opts;
+    b2d_result memory, result;
+    bench_sink sink;
+    uint8_t *data;
+    size_t size;
+    int status, ok, i;
+
+    CaseOptions(&opts, mode, 1);
+    opts.preview = 1;
+    if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &memory) != 0) return;
+
+    if (mkdtemp(dir) != NULL) {
+        opts.sink = B2D_SINK_FILES;
+        opts.directory = dir;
+        status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+        ok = (status == 0 && SameResult(&memory, &result));
+        for (i = 0; ok && i < result.filecount; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, result.files[i].name);
+            data = ReadFile(path, &size);
+            ok = (data != NULL && result.files[i].data == NULL && size == memory.files[i].size &&
+                  memcmp(data, memory.files[i].data, size) == 0);
+            free(data);
+        }
+        if (status == 0) b2d_result_free(&result);
+        /* and nothing else */
+        Check(EmptyDir(dir) == memory.filecount && ok, "sink files", mode, img);
+        rmdir(dir);
+    }
+
+    memset(&sink, 0, sizeof(sink));
+    opts.sink = B2D_SINK_WRITE;
+    opts.directory = NULL;
+    opts.write = SinkWrite;
+    opts.writedata = &sink;
+    status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+    ok = (status == 0 && SameResult(&memory, &result) && sink.count == memory.filecount);
+    for (i = 0; ok && i < sink.count; i++) {
+        ok = (strcmp(sink.names[i], memory.files[i].name) == 0 && sink.sizes[i] == memory.files[i].size &&
+              memcmp(sink.data[i], memory.files[i].data, sink.sizes[i]) == 0);
+    }
+    if (status == 0) b2d_result_free(&result);
+    Check(ok, "sink write", mode, img);
+    SinkFree(&sink);
+
+    b2d_result_free(&memory);
+}
+
+/* what a scanline callback saw */
+typedef struct bench_progress
+{
+    int calls, done, total, backwards;
+    int cancelat;           /* sets cancel once done gets here, 0 for never */
+    int waitat;             /* waits there for CancelThread() instead */
+    volatile int cancel;
+} bench_progress;
+
+static void ProgressScanline(void *userdata, int done, int total)
+{
+    bench_progress *progress = (bench_progress *)userdata;
+
+    if (done < progress->done || (progress->calls > 0 && total != progress->total)) progress->backwards++;
+    progress->calls++;
+    __atomic_store_n(&progress->done, done, __ATOMIC_RELEASE);
+    progress->total = total;
+    if (progress->cancelat > 0 && done >= progress->cancelat) progress->cancel = 1;
+    /* a conversion that is partway through when the other thread cancels */
+    if (progress->waitat > 0 && done == progress->waitat) {
+        while (__atomic_load_n(&progress->cancel, __ATOMIC_RELAXED) == 0) sched_yield();
+    }
+}
+
+/* cancels the conversion from another thread once it is at waitat */
+static void *CancelThread(void *userdata)
+{
+    bench_progress *progress = (bench_progress *)userdata;
+
+    while (__atomic_load_n(&progress->done, __ATOMIC_ACQUIRE) < progress->waitat) sched_yield();
+    b2d_cancel(&progress->cancel);
+    return NULL;
+}
+
+/* the scanline callback counts up to its total, on one thread and on
+   several, and setting *cancel halfway leaves no files - from the
+   converting thread and from another one, with and without threads */
+static void CheckProgress(const bench_image *img, int mode)
+{
+    char dir[] = "/tmp/b2d_bench.XXXXXX";
+    b2d_options opts;
+    b2d_result result;
+    bench_progress progress;
+    pthread_t thread;
+    int status, total = 0, done, i;
+
+    CaseOptions(&opts, mode, 1);
+    opts.preview = 1;
+    opts.scanline = ProgressScanline;
+    opts.scanlinedata = &progress;
+    for (i = 0; i < 2; i++) {
+        memset(&progress, 0, sizeof(progress));
+        opts.threads = i * 2;
+        opts.cancel = &progress.cancel;
+        if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result) != 0) return;
+        b2d_result_free(&result);
+        Check(progress.calls > 0 && progress.backwards == 0 && progress.done == progress.total,
+              i ? "scanlines mt" : "scanlines", mode, img);
+        if (i == 0) total = progress.total;
+    }
+
+    if (mkdtemp(dir) == NULL) return;
+    memset(&progress, 0, sizeof(progress));
+    progress.cancelat = total / 2;
+    opts.threads = 0;
+    opts.sink = B2D_SINK_FILES;
+    opts.directory = dir;
+    status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+    Check(status == B2D_CANCELLED && result.filecount == 0 && result.preview == NULL &&
+          progress.done < total && EmptyDir(dir) == 0, "cancel", mode, img);
+    if (status == 0) b2d_result_free(&result);
+
+    for (i = 0; i < 2; i++) {
+        memset(&progress, 0, sizeof(progress));
+        progress.waitat = total / 4;
+        opts.threads = i * 2;
+        if (pthread_create(&thread, NULL, CancelThread, &progress) != 0) break;
+        status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+        done = progress.done;
+        /* lets the thread go if the conversion never got to waitat */
+        __atomic_store_n(&progress.done, total, __ATOMIC_RELEASE);
+        pthread_join(thread, NULL);
+        Check(status == B2D_CANCELLED && result.filecount == 0 && result.preview == NULL &&
+              done == progress.waitat && EmptyDir(dir) == 0, i ? "cancel thread mt" : "cancel thread", mode, img);
+        if (status == 0) b2d_result_free(&result);
+    }
+    rmdir(dir);
+}
+
+/* what a draft callback saw */
+typedef struct bench_draft
+{
+    int calls, width, height;
+    uint8_t *rgba;          /* a copy of the last draft */
+    int stop;               /* what the callback returns */
+} bench_draft;
+
+static int DraftCallback(void *userdata, const uint8_t *rgba, int width, int height)
+{
+    bench_draft *draft = (bench_draft *)userdata;
+
+    draft->calls++;
+    draft->width = (rgba != NULL) ? width : 0;
+    draft->height = height;
+    free(draft->rgba);
+    draft->rgba = NULL;
+    if (rgba != NULL && (draft->rgba = (uint8_t *)malloc((size_t)width * height * 4)) != NULL)
+        memcpy(draft->rgba, rgba, (size_t)width * height * 4);
+    return draft->stop;
+}
+
+/* whether a half height draft has the scanlines of the full draft, each
+   twice - the draft has a row for each scanline */
+static int HalfDraft(const bench_draft *full, const bench_draft *half)
+{
+    size_t row = (size_t)full->width * 4;
+    int y;
+
+    if (full->rgba == NULL || half->rgba == NULL || half->width != full->width || half->height != full->height)
+        return 0;
+    for (y = 0; y < half->height; y++) {
+        if (memcmp(half->rgba + y * row, full->rgba + (y & ~1) * row, row) != 0) return 0;
+    }
+    /* and not every scanline of the full draft */
+    for (y = 1; y < full->height; y += 2) {
+        if (memcmp(full->rgba + y * row, full->rgba + (y - 1) * row, row) != 0) return 1;
+    }
+    return 0;
+}
+
+/* a draft does not change the conversion, a half height draft repeats
+   every other scanline of the full one, and one the callback returns
+   non-zero for stops the conversion - mono has no draft */
+static void CheckDraft(const bench_image *img, int mode)
+{
+    b2d_options opts;
+    b2d_result plain, result;
+    bench_draft draft, full;
+    int status, calls = (mode == B2D_MODE_MONO) ? 0 : 1, i;
+
+    CaseOptions(&opts, mode, 1);
+    opts.preview = 1;
+    if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &plain) != 0) return;
+
+    opts.draft = DraftCallback;
+    opts.draftdata = &draft;
+    memset(&full, 0, sizeof(full));
+    for (i = 0; i < 2; i++) {
+        memset(&draft, 0, sizeof(draft));
+        opts.drafthalf = i;
+        status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+        Check(status == 0 && SameResult(&plain, &result) && draft.calls == calls &&
+              (calls == 0 || (draft.width > 0 && draft.height > 0)), i ? "draft half" : "draft", mode, img);
+        if (status == 0) b2d_result_free(&result);
+        if (i == 0) full = draft;
+    }
+    if (calls != 0) Check(HalfDraft(&full, &draft), "draft half rows", mode, img);
+    free(full.rgba);
+    free(draft.rgba);
+
+    memset(&draft, 0, sizeof(draft));
+    draft.stop = 1;
+    opts.drafthalf = 0;
+    status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+    if (calls == 0) Check(status == 0 && SameResult(&plain, &result) && draft.calls == 0, "draft stop", mode, img);
+    else Check(status == B2D_CANCELLED && result.filecount == 0 && result.preview == NULL && draft.calls == 1,
+               "draft stop", mode, img);
+    if (status == 0) b2d_result_free(&result);
+    free(draft.rgba);
+
+    b2d_result_free(&plain);
+}
+
+/* converting again with the stage cache (b2d_options.cache) gives what a
+   conversion without it does, as the dither, the palette and the preview
+   palette change and then go back - fit is 0 x 0 for the size as it is */
+static void CheckCache(const bench_image *img, int mode, int fitwidth, int fitheight)
+{
+    static const struct {
+        int dither, palette, previewpalette;    /* -1 for the default */
+    } steps[] = {{0, -1, -1}, {1, -1, -1}, {1, 2, -1}, {1, 2, 3}, {0, -1, -1}, {1, 2, 3}};
+    b2d_options opts;
+    b2d_result cold, warm;
+    int status, i;
+
+    b2d_free_caches();
+    for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])); i++) {
+        CaseOptions(&opts, mode, steps[i].dither);
+        opts.preview = 1;
+        opts.fitwidth = fitwidth;
+        opts.fitheight = fitheight;
+        if (steps[i].palette >= 0) opts.palette = steps[i].palette;
+        if (steps[i].previewpalette >= 0) opts.previewpalette = steps[i].previewpalette;
+        if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &cold) != 0) break;
+
+        opts.cache = 1;
+        status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &warm);
+        Check(status == 0 && SameResult(&cold, &warm), fitwidth ? "cache fit" : "cache", mode, img);
+        if (status == 0) b2d_result_free(&warm);
+        b2d_result_free(&cold);
+    }
+    b2d_free_caches();
+}
+
+/* colors matched to the palette (stats) by one conversion with the stage
+   cache, -1 if it could not convert - none when the screen is found */
+static int64_t CachedMatches(const bench_image *img, const b2d_options *opts)
+{
+    b2d_result result;
+    int64_t drawcolors;
+
+    if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, opts, &result) != 0) return -1;
+    drawcolors = (int64_t)result.stats.drawcolors;
+    b2d_result_free(&result);
+    return drawcolors;
+}
+
+/* the screen is found again when only settings it does not depend on
+   change - the preview palette, threads and name - and the oldest screen
+   is dropped once more are kept than b2d_cache.c has room for - mono only
+   keeps the resampled input */
+static void CheckCacheKey(const bench_image *img, int mode)
+{
+    b2d_options opts, other;
+    int64_t first, again;
+    int i;
+
+    if (mode == B2D_MODE_MONO) return;
+    b2d_free_caches();
+    CaseOptions(&opts, mode, 1);
+    opts.preview = 1;
+    opts.cache = 1;
+    opts.stats = 1;
+    first = CachedMatches(img, &opts);
+    other = opts;
+    other.previewpalette = 3;
+    other.threads = 2;
+    other.name = "KEY";
+    again = CachedMatches(img, &other);
+    Check(first > 0 && again == 0, "cache key", mode, img);
+
+    /* 16 other screens, each matched again */
+    for (i = 1, again = 1; i <= 16 && again > 0; i++) {
+        other = opts;
+        other.colorbleed = i;
+        again = CachedMatches(img, &other);
+    }
+    Check(again > 0 && CachedMatches(img, &other) == 0 && CachedMatches(img, &opts) > 0,
+          "cache evict", mode, img);
+    b2d_free_caches();
+}
+
+/* the preview drawn in an RGBA surface, at previewscale 1 and 2, is the
+   packed RGB preview with alpha 255 and each pixel scale x scale */
+static void CheckPreviewRGBA(const bench_image *img, int mode)
+{
+    b2d_options opts;
+    b2d_result packed, result;
+    uint8_t *surface, *dest;
+    const uint8_t *src;
+    size_t size = (size_t)B2D_PREVIEW_MAXWIDTH * B2D_PREVIEW_MAXHEIGHT * 4 * 4;
+    int status, ok, scale, x, y;
+
+    CaseOptions(&opts, mode, 1);
+    opts.preview = 1;
+    if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &packed) != 0) return;
+    if ((surface = (uint8_t *)malloc(size)) == NULL) {
+        b2d_result_free(&packed);
+        return;
+    }
+
+    for (scale = 1; scale <= 2; scale++) {
+        memset(surface, 0, size);
+        opts.previewrgba = surface;
+        opts.previewsize = size;
+        opts.previewscale = scale;
+        status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result);
+        ok = (status == 0 && packed.preview != NULL && result.preview == NULL && result.previewrgba == surface &&
+              result.previewwidth == packed.previewwidth * scale &&
+              result.previewheight == packed.previewheight * scale);
+        for (y = 0; ok && y < result.previewheight; y++) {
+            dest = surface + (size_t)y * result.previewwidth * 4;
+            for (x = 0; ok && x < result.previewwidth; x++, dest += 4) {
+                src = packed.preview + ((size_t)(y / scale) * packed.previewwidth + x / scale) * 3;
+                ok = (dest[0] == src[0] && dest[1] == src[1] && dest[2] == src[2] && dest[3] == 255);
+            }
+        }
+        /* the files are the same whatever the preview is drawn in */
+        if (ok) {
+            result.preview = packed.preview;
+            result.previewwidth = packed.previewwidth;
+            result.previewheight = packed.previewheight;
+            ok = SameResult(&packed, &result);
+            result.preview = NULL;
+        }
+        Check(ok, scale == 1 ? "previewrgba" : "previewrgba 2x", mode, img);
+        if (status == 0) b2d_result_free(&result);
+    }
+    free(surface);
+    b2d_result_free(&packed);
+}
+
+#define MAXJOBS 18
+
+/* each image of a batch comes out as it does converted on its own in
+   color table mode - one in each mode, and one with the batch settings
+   and a name of its own */
+static void CheckBatch(const bench_image **imgs, int imgcount)
+{
+    b2d_job *jobs;
+    b2d_options batch, opts[MAXJOBS], single;
+    b2d_result result;
+    const bench_image *jobimages[MAXJOBS];
+    int count = 0, status, i, mode;
+
+    jobs = (b2d_job *)calloc(MAXJOBS, sizeof(b2d_job));
+    if (jobs == NULL) return;
+    CaseOptions(&batch, B2D_MODE_DHGR, 1);
+    batch.preview = 1;
+
+    for (i = 0; i < imgcount && count + 6 <= MAXJOBS; i++) {
+        for (mode = B2D_MODE_DHGR; mode <= B2D_MODE_DLGR; mode++, count++) {
+            CaseOptions(&opts[count], mode, mode % 2);
+            opts[count].preview = 1;
+            jobs[count].opts = &opts[count];
+            jobimages[count] = imgs[i];
+        }
+        jobs[count].name = "JOB";
+        jobimages[count++] = imgs[i];
+    }
+    for (i = 0; i < count; i++) {
+        jobs[i].rgb = jobimages[i]->rgb;
+        jobs[i].w = jobimages[i]->w;
+        jobs[i].h = jobimages[i]->h;
+        jobs[i].stride = jobimages[i]->w * 3;
+    }
+    b2d_convert_batch(jobs, count, &batch, 4, NULL, NULL);
+
+    for (i = 0; i < count; i++) {
+        single = (jobs[i].opts != NULL) ? *jobs[i].opts : batch;
+        single.colortable = 1;
+        if (jobs[i].name != NULL) single.name = jobs[i].name;
+        status = b2d_convert_rgb(jobs[i].rgb, jobs[i].w, jobs[i].h, jobs[i].stride, &single, &result);
+        Check(status == jobs[i].status && (status != 0 || SameResult(&result, &jobs[i].result)),
+              jobs[i].name != NULL ? "batch named" : "batch", single.mode, jobimages[i]);
+        if (status == 0) b2d_result_free(&result);
+        if (jobs[i].status == 0) b2d_result_free(&jobs[i].result);
+    }
+    free(jobs);
+}
+
+/* colors that are as close to two palette entries, in the palette that
+   has them - the double precision search picks one by how it rounds */
+static const uint8_t tiecolors[][3] = {
+    {13, 163, 48}, {255, 204, 68}, {136, 238, 0}, {168, 40, 24}, {168, 64, 88},
+    {48, 30, 48}, {48, 48, 96}, {48, 96, 48}, {80, 50, 80}, {80, 160, 80},
+    {121, 47, 51}, {223, 217, 255}, {75, 94, 0}, {245, 115, 255}
+};
+
+/* integer color distances (fixed) make the same output as double precision
+   for colors that tie, with each built-in palette the ties were found in
+   and with the low and high color variants (Y1, Y3) */
+static void CheckFixed(void)
+{
+    bench_image ties;
+    b2d_options opts;
+    b2d_result plain, result;
+    int count = (int)(sizeof(tiecolors) / sizeof(tiecolors[0])), status, palette, y, i;
+
+    ties.kind = "ties";
+    ties.w = 140;
+    ties.h = 192;
+    ties.rgb = (uint8_t *)malloc((size_t)ties.w * ties.h * 3);
+    if (ties.rgb == NULL) return;
+    /* a band of each color, at least 2 x 2 for the cross-hatch patterns */
+    for (y = 0; y < ties.h; y++) {
+        for (i = 0; i < ties.w; i++) memcpy(&ties.rgb[((size_t)y * ties.w + i) * 3], tiecolors[y * count / ties.h], 3);
+    }
+
+    for (palette = 0; palette < 6; palette++) {
+        for (i = 0; i < 3; i++) {
+            CaseOptions(&opts, B2D_MODE_DHGR, 0);
+            opts.preview = 1;
+            opts.palette = palette;
+            opts.ymatrix = i * 3 / 2;
+            if (b2d_convert_rgb(ties.rgb, ties.w, ties.h, ties.w * 3, &opts, &plain) != 0) continue;
+            opts.fixedpoint = 1;
+            status = b2d_convert_rgb(ties.rgb, ties.w, ties.h, ties.w * 3, &opts, &result);
+            Check(status == 0 && SameResult(&plain, &result), "fixed", B2D_MODE_DHGR, &ties);
+            if (status == 0) b2d_result_free(&result);
+            b2d_result_free(&plain);
+        }
+    }
+    free(ties.rgb);
+}
+
+/* dithering on several threads counts the colors it matches (stats) as
+   one thread does, in color table mode as well */
+static void CheckStats(const bench_image *img)
+{
+    b2d_options opts;
+    b2d_result result;
+    uint64_t drawcolors[2];
+    int table, i;
+
+    for (table = 0; table < 2; table++) {
+        for (i = 0; i < 2; i++) {
+            CaseOptions(&opts, B2D_MODE_DHGR, 1);
+            opts.colortable = table;
+            opts.threads = i * 2;
+            opts.stats = 1;
+            drawcolors[i] = 0;
+            if (b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, &opts, &result) != 0) return;
+            drawcolors[i] = result.stats.drawcolors;
+            b2d_result_free(&result);
+        }
+        Check(drawcolors[0] > 0 && drawcolors[0] == drawcolors[1], table ? "stats mt lut" : "stats mt",
+              B2D_MODE_DHGR, img);
+    }
+}
+
+/* runs the API checks on some of the corpus - returns how many failed */
+static int CheckAPI(const bench_image *images, int imagecount)
+{
+    static const struct {
+        const char *kind;
+        int w, h;
+    } picks[] = {{"photo", 280, 192}, {"lineart", 560, 384}, {"photo", 640, 480}};
+    static const int fits[5][2] = {{140, 192}, {140, 192}, {560, 384}, {40, 48}, {80, 48}};
+    const bench_image *img, *imgs[3];
+    int imgcount = 0, i, mode;
+
+    for (i = 0; i < (int)(sizeof(picks) / sizeof(picks[0])); i++) {
+        img = FindImage(images, imagecount, picks[i].kind, picks[i].w, picks[i].h);
+        if (img == NULL) continue;
+        imgs[imgcount++] = img;
+        for (mode = B2D_MODE_DHGR; mode <= B2D_MODE_DLGR; mode++) {
+            CheckSinks(img, mode);
+            CheckProgress(img, mode);
+            CheckDraft(img, mode);
+            CheckCache(img, mode, 0, 0);
+            CheckCacheKey(img, mode);
+            CheckPreviewRGBA(img, mode);
+        }
+        CheckStats(img);
+    }
+    /* resampled to each mode's size, which is cached as well */
+    if ((img = FindImage(images, imagecount, "photo", 640, 480)) != NULL) {
+        for (mode = B2D_MODE_DHGR; mode <= B2D_MODE_DLGR; mode++)
+            CheckCache(img, mode, fits[mode][0], fits[mode][1]);
+    }
+    CheckBatch(imgs, imgcount);
+    CheckFixed();
+    fprintf(out, "%d api checks, %d failed\n", checks, failed);
+    return failed;
+}
+
+/* the fastest of repeats conversions in seconds
+   returns -1 if the image cannot be converted in this mode */
+static double TimeCase(const bench_image *img, const b2d_options *opts, b2d_stats *stats)
+{
+    b2d_result result;
+    double best = -1, start, elapsed;
+    int i, status;
+
+    for (i = 0; i < repeats; i++) {
+        start = Now();
+        status = b2d_convert_rgb(img->rgb, img->w, img->h, img->w * 3, opts, &result);
+        elapsed = Now() - start;
+        if (status != 0) return -1;
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+            *stats = result.stats;
+        }
+        b2d_result_free(&result);
+    }
+    return best;
+}
+
+static void RunCase(const bench_case *bc, const bench_image *img, double *total, double *pixels)
+{
+    b2d_options opts = bc->opts;
+    b2d_stats stats;
+    double full, mp;
+    int i;
+
+    opts.stats = split;
+    fprintf(out, "%-9s %-10s %-8s %3dx%-3d ", bc->suite, bc->label, img->kind, img->w, img->h);
+    full = TimeCase(img, &opts, &stats);
+    if (full < 0) {
+        fprintf(out, "%9s\n", "skipped");
+        return;
+    }
+    mp = (double)img->w * img->h / 1e6;
+    fprintf(out, "%9.3f %8.2f", full * 1000, mp / full);
+    *total += full;
+    *pixels += mp;
+
+    if (split) {
+        for (i = 0; i < B2D_STAGES; i++) fprintf(out, " %10.3f", stats.seconds[i] * 1000);
+    }
+    fprintf(out, "\n");
+}
+
+static void Usage(void)
+{
+    fprintf(stderr,
+            "usage: b2d_bench [-s suites] [-z sizes] [-r repeats] [-p] [-l] [-f] [-t threads]\n"
+            "       b2d_bench -v golden.txt | -g golden.txt\n"
+            "  -s  comma separated suites: modes,dithers,xhatch,palettes (default all)\n"
+            "  -z  comma separated sizes, e.g. 280x192,640x480 (default all)\n"
+            "  -r  runs of each case, the fastest is kept (default 3)\n"
+            "  -p  the time of each stage in ms (stats)\n"
+            "  -l  color table mode (lut)\n"
+            "  -f  integer color distances (fixed)\n"
+            "  -t  dithering threads, -1 for one per processor (mt)\n"
+            "  -v  check the output against golden hashes, and the API checks\n"
+            "  -g  write golden hashes\n");
+}
+
+int main(int argc, char **argv)
+{
+    bench_image images[MAXSIZES * MAXIMAGES];
+    bench_case *cases;
+    char name[16];
+    int count, imagecount = 0, i, j, opt, bad;
+    double total = 0, pixels = 0, start;
+
+    while ((opt = getopt(argc, argv, "s:z:r:plft:v:g:h")) != -1) {
+        switch (opt) {
+            case 's': suitelist = optarg; break;
+            case 'z': sizelist = optarg; break;
+            case 'r': repeats = atoi(optarg); break;
+            case 'p': split = 1; break;
+            case 'l': colortable = 1; break;
+            case 'f': fixedpoint = 1; break;
+            case 't': threads = atoi(optarg); break;
+            case 'g': generate = 1; /* fall through */
+            case 'v': goldenfile = optarg; break;
+            default: Usage(); return 1;
+        }
+    }
+    if (repeats < 1) repeats = 1;
+
+    /* keep the engine's messages out of the results */
+    out = fdopen(dup(fileno(stdout)), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "b2d_bench: cannot redirect stdout\n");
+        return 1;
+    }
+
+    cases = (bench_case *)calloc(MAXCASES, sizeof(bench_case));
+    if (cases == NULL) return 1;
+    count = MakeCases(cases);
+
+    for (i = 0; i < MAXSIZES; i++) {
+        sprintf(name, "%dx%d", sizes[i][0], sizes[i][1]);
+        /* the golden hashes are for the whole corpus */
+        if (goldenfile == NULL && !InList(sizelist, name)) continue;
+        for (j = 0; j < MAXIMAGES; j++) {
+            if (!MakeImage(&images[imagecount], j, sizes[i][0], sizes[i][1])) return 1;
+            imagecount++;
+        }
+    }
+    if (goldenfile != NULL) {
+        bad = Golden(images, imagecount);
+        if (!generate) bad += CheckAPI(images, imagecount);
+        for (i = 0; i < imagecount; i++) free(images[i].rgb);
+        free(cases);
+        b2d_free_colortables();
+        fclose(out);
+        return bad != 0;
+    }
+
+    if (count == 0 || imagecount == 0) {
+        Usage();
+        return 1;
+    }
+
+    fprintf(out, "%-9s %-10s %-8s %-7s %9s %8s", "suite", "case", "image", "size", "ms", "MP/s");
+    if (split) {
+        for (i = 0; i < B2D_STAGES; i++) fprintf(out, " %10s", b2d_stage_name(i));
+    }
+    fprintf(out, "\n");
+
+    start = Now();
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < imagecount; j++) RunCase(&cases[i], &images[j], &total, &pixels);
+        fflush(out);
+    }
+    fprintf(out, "\n%.2f MP converted in %.3f s of conversion, %.2f MP/s (%.1f s wall)\n",
+            pixels, total, total > 0 ? pixels / total : 0, Now() - start);
+
+    for (i = 0; i < imagecount; i++) free(images[i].rgb);
+    free(cases);
+    b2d_free_colortables();
+    fclose(out);
+    return 0;
+}